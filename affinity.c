@@ -0,0 +1,288 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "utils.h"
+#include "affinity.h"
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+affinity_config(struct aajson *a, aajson_val *value,
+	struct affinity_conf *c)
+{
+	struct affinity_cpus *cpus = NULL;
+
+	if (STRCMP(a, 2, "capture") == 0) {
+		cpus = &c->capture;
+	} else if (STRCMP(a, 2, "workers") == 0) {
+		cpus = &c->workers;
+	} else if (STRCMP(a, 2, "helpers") == 0) {
+		cpus = &c->helpers;
+	} else if (STRCMP(a, 2, "numa-local") == 0) {
+		c->numa_local = (value->type == AAJSON_VALUE_TRUE);
+		return 1;
+	} else {
+		return 1;
+	}
+
+	if (!affinity_parse_cpus(value->str, cpus)) {
+		LOG("cpu-affinity: incorrect list of CPUs '%s'", value->str);
+		return 0;
+	}
+
+	return 1;
+}
+#undef STRCMP
+
+static int
+parse_cpu_num(const char **s, int *cpu)
+{
+	char *end;
+	long n;
+
+	while (isspace((unsigned char)**s)) {
+		(*s)++;
+	}
+
+	errno = 0;
+	n = strtol(*s, &end, 10);
+	if ((end == *s) || errno || (n < 0) || (n >= CPU_SETSIZE)) {
+		return 0;
+	}
+
+	*s = end;
+	while (isspace((unsigned char)**s)) {
+		(*s)++;
+	}
+
+	*cpu = (int)n;
+	return 1;
+}
+
+int
+affinity_parse_cpus(const char *s, struct affinity_cpus *cpus)
+{
+	cpus->n = 0;
+
+	while (*s) {
+		int first, last, i;
+
+		if (!parse_cpu_num(&s, &first)) {
+			return 0;
+		}
+		last = first;
+
+		if (*s == '-') {
+			s++;
+			if (!parse_cpu_num(&s, &last) || (last < first)) {
+				return 0;
+			}
+		}
+
+		for (i=first; i<=last; i++) {
+			if (cpus->n >= AFFINITY_MAX_CPUS) {
+				return 0;
+			}
+			cpus->cpus[cpus->n] = i;
+			cpus->n++;
+		}
+
+		if (*s == ',') {
+			s++;
+		} else if (*s != '\0') {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int
+affinity_cpu_node(int cpu)
+{
+	char path[PATH_MAX];
+	DIR *d;
+	struct dirent *dent;
+	int node = 0;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+	d = opendir(path);
+	if (!d) {
+		return 0;
+	}
+
+	while ((dent = readdir(d))) {
+		if ((strncmp(dent->d_name, "node", 4) == 0)
+			&& isdigit((unsigned char)dent->d_name[4])) {
+
+			node = atoi(dent->d_name + 4);
+			break;
+		}
+	}
+
+	closedir(d);
+	return node;
+}
+
+static struct affinity_cpus *
+class_cpus(struct affinity_conf *c, enum AFFINITY_CLASS cls)
+{
+	switch (cls) {
+		case AFFINITY_CAPTURE:
+			return &c->capture;
+		case AFFINITY_WORKER:
+			return &c->workers;
+		case AFFINITY_HELPER:
+			return &c->helpers;
+	}
+
+	return NULL;
+}
+
+static int
+node_mask(int node, unsigned long *mask)
+{
+	if ((node < 0) || (node >= (int)(sizeof(unsigned long) * 8))) {
+		return 0;
+	}
+
+	*mask = 1UL << node;
+	return 1;
+}
+
+int
+affinity_thread(struct affinity_conf *c, enum AFFINITY_CLASS cls,
+	size_t idx)
+{
+	struct affinity_cpus *cpus = class_cpus(c, cls);
+	cpu_set_t set;
+	unsigned long mask;
+	int err, cpu = -1;
+	size_t i;
+
+	if (!cpus || (cpus->n == 0)) {
+		/* not configured */
+		return 1;
+	}
+
+	CPU_ZERO(&set);
+	if (cls == AFFINITY_HELPER) {
+		for (i=0; i<cpus->n; i++) {
+			CPU_SET(cpus->cpus[i], &set);
+		}
+	} else {
+		cpu = cpus->cpus[idx % cpus->n];
+		CPU_SET(cpu, &set);
+	}
+
+	err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+	if (err) {
+		LOG("Can't set CPU affinity: %s", strerror(err));
+		return 0;
+	}
+
+	if ((cpu < 0) || !c->numa_local) {
+		return 1;
+	}
+
+	if (!node_mask(affinity_cpu_node(cpu), &mask)) {
+		return 1;
+	}
+
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+		sizeof(mask) * 8) != 0) {
+
+		LOG("set_mempolicy() failed: %s", strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+affinity_mempolicy(struct affinity_conf *c, enum AFFINITY_CLASS cls,
+	long idx)
+{
+	struct affinity_cpus *cpus = class_cpus(c, cls);
+	unsigned long mask;
+
+	if (!c->numa_local || !cpus || (cpus->n == 0)
+		|| (cls == AFFINITY_HELPER)) {
+
+		return 1;
+	}
+
+	if (idx < 0) {
+		if (syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0) != 0) {
+			LOG("set_mempolicy() failed: %s", strerror(errno));
+			return 0;
+		}
+		return 1;
+	}
+
+	if (!node_mask(affinity_cpu_node(cpus->cpus[idx % cpus->n]), &mask)) {
+		return 1;
+	}
+
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+		sizeof(mask) * 8) != 0) {
+
+		LOG("set_mempolicy() failed: %s", strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+affinity_mbind(struct affinity_conf *c, enum AFFINITY_CLASS cls,
+	size_t idx, void *addr, size_t len)
+{
+	struct affinity_cpus *cpus = class_cpus(c, cls);
+	unsigned long mask;
+
+	if (!c->numa_local || !cpus || (cpus->n == 0)
+		|| (cls == AFFINITY_HELPER)) {
+
+		return 1;
+	}
+
+	if (!node_mask(affinity_cpu_node(cpus->cpus[idx % cpus->n]), &mask)) {
+		return 1;
+	}
+
+	if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask,
+		sizeof(mask) * 8, 0) != 0) {
+
+		LOG("mbind() failed: %s", strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
@@ -0,0 +1,75 @@
+#ifndef affinity_h_included
+#define affinity_h_included
+
+#include <stddef.h>
+
+#include "utils.h"
+#include "aajson/aajson.h"
+
+/*
+ * CPU affinity of threads and NUMA-local memory
+ *
+ * Capture and worker threads are pinned to one CPU each: thread N gets
+ * N-th CPU from the list (modulo list size). Helper threads (background
+ * threads of monitoring objects, notifications, reload threads) inherit
+ * mask from the main thread, main thread is pinned to the whole helpers
+ * list before other threads are started.
+ *
+ * With "numa-local" each capture/worker thread sets preferred memory
+ * policy to the node of its CPU. Per-thread tkvdb arenas, fwm banks and
+ * mavg databases are created (and restored from snapshot) before threads
+ * are started, main thread takes policy of the owner thread for that time,
+ * so pages are allocated on the owner's node. tkvdb doesn't give addresses
+ * of its arenas, so they can't be passed to mbind().
+ */
+
+#define AFFINITY_MAX_CPUS 1024
+
+enum AFFINITY_CLASS
+{
+	AFFINITY_CAPTURE,
+	AFFINITY_WORKER,
+	AFFINITY_HELPER
+};
+
+struct affinity_cpus
+{
+	size_t n;
+	int cpus[AFFINITY_MAX_CPUS];
+};
+
+struct affinity_conf
+{
+	struct affinity_cpus capture;
+	struct affinity_cpus workers;
+	struct affinity_cpus helpers;
+
+	int numa_local;
+};
+
+int affinity_config(struct aajson *a, aajson_val *value,
+	struct affinity_conf *c);
+
+/* parse list like "0-3,8,10-11", returns 0 on error */
+int affinity_parse_cpus(const char *s, struct affinity_cpus *cpus);
+
+/* NUMA node of CPU, 0 if unknown */
+int affinity_cpu_node(int cpu);
+
+/* pin calling thread, idx is thread index in class */
+int affinity_thread(struct affinity_conf *c, enum AFFINITY_CLASS cls,
+	size_t idx);
+
+/*
+ * memory touched by calling thread goes to node of thread idx, negative idx
+ * restores default policy
+ */
+int affinity_mempolicy(struct affinity_conf *c, enum AFFINITY_CLASS cls,
+	long idx);
+
+/* place memory of thread idx on its node, addr must be page-aligned */
+int affinity_mbind(struct affinity_conf *c, enum AFFINITY_CLASS cls,
+	size_t idx, void *addr, size_t len);
+
+#endif
+
@@ -68,17 +68,17 @@ classification_fields_init(size_t nthreads, struct mo_classification *clsf)
 	}
 
 	clsf->thread_data =
-		calloc(nthreads, sizeof(struct classification_thread_data));
+		calloc_cl(nthreads, sizeof(struct classification_thread_data));
 	if (!clsf->thread_data) {
-		LOG("calloc() failed");
+		LOG("calloc_cl() failed");
 		return 0;
 	}
 
 	for (i=0; i<nthreads; i++) {
 		clsf->thread_data[i].keysize = keysize;
-		clsf->thread_data[i].key = malloc(keysize);
+		clsf->thread_data[i].key = malloc_cl(keysize);
 		if (!clsf->thread_data[i].key) {
-			LOG("malloc() failed");
+			LOG("malloc_cl() failed");
 			return 0;
 		}
 
@@ -872,7 +872,8 @@ classification_bg_thread(void *arg)
 
 static int
 classification_process_nf_class(struct monit_object *mo, size_t thread_id,
-	struct flow_info *flow, uint8_t *flow_class, int class_id)
+	struct flow_info *flow, uint8_t *flow_class, int class_id,
+	struct metrics_prof *prof)
 {
 	size_t i;
 	struct mo_classification *clsf = &mo->classifications[class_id];
@@ -888,15 +889,19 @@ classification_process_nf_class(struct monit_object *mo, size_t thread_id,
 	tkvdb_tr *clsf_db;
 	tkvdb_datum dtkey, dtval;
 	TKVDB_RES rc;
+	struct mo_thread_metrics *m = &mo->metrics[thread_id];
+	uint64_t t;
 
 	key = cdata->key;
 
+	t = prof_start(prof);
 	for (i=0; i<clsf->nfields; i++) {
 		struct field *fld = &clsf->fields[i];
 
 		monit_object_key_add_fld(fld, key, flow);
 		key += fld->size;
 	}
+	t = mo_cost_lap(m, MO_COST_KEY, t);
 
 	tr_idx = atomic_load_explicit(&cdata->tr_idx, memory_order_relaxed)
 		% 2;
@@ -954,13 +959,14 @@ classification_process_nf_class(struct monit_object *mo, size_t thread_id,
 	} else {
 		flow_class[0] = '\0';
 	}
+	mo_cost_lap(m, MO_COST_DB, t);
 
 	return 1;
 }
 
 int
 classification_process_nf(struct monit_object *mo, size_t thread_id,
-	struct flow_info *flow)
+	struct flow_info *flow, struct metrics_prof *prof)
 {
 	int i;
 
@@ -977,7 +983,7 @@ FOR_LIST_OF_CLASSES
 			memset(flow->CLASS, 0, CLASS_NAME_MAX);             \
 			flow->has_##CLASS = 1;                              \
 			classification_process_nf_class(mo, thread_id, flow,\
-				flow->CLASS, i);
+				flow->CLASS, i, prof);
 FOR_LIST_OF_CLASSES
 #undef DO
 		}
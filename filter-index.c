@@ -0,0 +1,556 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "filter.h"
+#include "filter-index.h"
+#include "flow-info.h"
+#include "utils.h"
+
+/* subexpression can't be bounded by prefixes */
+#define GUARD_NONE 0
+#define GUARD_OK   1
+/* broken expression */
+#define GUARD_ERR -1
+
+static int
+filter_index_literal(struct filter_basic *fb)
+{
+	int max_mask;
+	size_t i;
+
+	if (fb->is_func || (fb->n == 0)) {
+		return 0;
+	}
+
+	/* only fields with flow addresses, not device or next hop */
+	switch (fb->name) {
+		case FILTER_BASIC_NAME_HOST:
+		case FILTER_BASIC_NAME_NET:
+			max_mask = 32;
+			break;
+		case FILTER_BASIC_NAME_HOST6:
+		case FILTER_BASIC_NAME_NET6:
+			max_mask = 16 * 8;
+			break;
+		default:
+			return 0;
+	}
+
+	if ((fb->direction != FILTER_BASIC_DIR_SRC)
+		&& (fb->direction != FILTER_BASIC_DIR_DST)
+		&& (fb->direction != FILTER_BASIC_DIR_BOTH)) {
+
+		return 0;
+	}
+
+	for (i=0; i<fb->n; i++) {
+		struct filter_basic_data *d = &fb->data[i];
+
+		/* IP lists may be changed, masks out of range are matched
+		   in a special way */
+		if (d->is_list || (d->data.ip.mask_len < 0)
+			|| (d->data.ip.mask_len > max_mask)) {
+
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Walk subexpression ending at *pos (RPN) from the end, *pos is set to the
+ * position before subexpression. Basic filters which bound subexpression
+ * are appended to fbs
+ */
+static int
+filter_index_guard(struct filter_expr *e, size_t *pos,
+	struct filter_basic **fbs, size_t *nfbs)
+{
+	struct filter_op *op;
+	size_t n0 = *nfbs, n1;
+	int r1, r2;
+
+	if (*pos == 0) {
+		return GUARD_ERR;
+	}
+	(*pos)--;
+	op = &e->filter[*pos];
+
+	switch (op->op) {
+		case FILTER_OP_BASIC:
+			if (!filter_index_literal(op->arg)) {
+				return GUARD_NONE;
+			}
+			fbs[(*nfbs)++] = op->arg;
+			return GUARD_OK;
+
+		case FILTER_OP_NOT:
+			r1 = filter_index_guard(e, pos, fbs, nfbs);
+			*nfbs = n0;
+			return (r1 == GUARD_ERR) ? GUARD_ERR : GUARD_NONE;
+
+		case FILTER_OP_AND:
+		case FILTER_OP_OR:
+			/* right operand first */
+			r2 = filter_index_guard(e, pos, fbs, nfbs);
+			n1 = *nfbs;
+			r1 = filter_index_guard(e, pos, fbs, nfbs);
+			if ((r1 == GUARD_ERR) || (r2 == GUARD_ERR)) {
+				return GUARD_ERR;
+			}
+			break;
+
+		default:
+			return GUARD_ERR;
+	}
+
+	if (op->op == FILTER_OP_OR) {
+		/* both operands are needed */
+		if ((r1 == GUARD_OK) && (r2 == GUARD_OK)) {
+			return GUARD_OK;
+		}
+		*nfbs = n0;
+		return GUARD_NONE;
+	}
+
+	/* AND: one operand is enough, left one is preferred */
+	if (r1 == GUARD_OK) {
+		memmove(&fbs[n0], &fbs[n1], (*nfbs - n1) * sizeof(fbs[0]));
+		*nfbs = n0 + (*nfbs - n1);
+		return GUARD_OK;
+	}
+	if (r2 == GUARD_OK) {
+		*nfbs = n1;
+		return GUARD_OK;
+	}
+	*nfbs = n0;
+	return GUARD_NONE;
+}
+
+static int
+filter_index_has_side_effects(struct filter_expr *e)
+{
+	size_t i;
+
+	for (i=0; i<e->n; i++) {
+		struct filter_basic *fb = e->filter[i].arg;
+
+		/* mfreq() counts values of each matched flow */
+		if (fb && fb->is_func && (fb->name == FILTER_BASIC_NAME_MFREQ)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+trie_add(struct filter_index_trie *t, uint8_t *addr, int mask, uint32_t id)
+{
+	struct filter_index_node *node;
+	uint32_t *tmp;
+	size_t cur = 0;
+	int i;
+
+	if (t->nnodes == 0) {
+		t->nodes = calloc(1, sizeof(struct filter_index_node));
+		if (!t->nodes) {
+			return 0;
+		}
+		t->nnodes = 1;
+	}
+
+	for (i=0; i<mask; i++) {
+		struct filter_index_node *nodes;
+		int bit = (addr[i / 8] >> (7 - (i % 8))) & 1;
+
+		if (t->nodes[cur].next[bit]) {
+			cur = t->nodes[cur].next[bit];
+			continue;
+		}
+
+		nodes = realloc(t->nodes,
+			(t->nnodes + 1) * sizeof(struct filter_index_node));
+		if (!nodes) {
+			return 0;
+		}
+		t->nodes = nodes;
+		memset(&t->nodes[t->nnodes], 0, sizeof(struct filter_index_node));
+		t->nodes[cur].next[bit] = t->nnodes;
+		cur = t->nnodes;
+		t->nnodes++;
+	}
+
+	node = &t->nodes[cur];
+	if (node->nids && (node->ids[node->nids - 1] == id)) {
+		/* the same prefix twice in one filter */
+		return 1;
+	}
+
+	tmp = realloc(node->ids, (node->nids + 1) * sizeof(uint32_t));
+	if (!tmp) {
+		return 0;
+	}
+	node->ids = tmp;
+	node->ids[node->nids++] = id;
+
+	return 1;
+}
+
+static void
+trie_lookup(struct filter_index_trie *t, const uint8_t *addr, int bits,
+	uint64_t *bm, uint64_t *rowmasks, uint64_t row)
+{
+	size_t cur = 0;
+	int i;
+
+	if (t->nnodes == 0) {
+		return;
+	}
+
+	/* all prefixes on the path cover address */
+	for (i=0; ; i++) {
+		struct filter_index_node *node = &t->nodes[cur];
+		uint32_t j;
+		int bit;
+
+		for (j=0; j<node->nids; j++) {
+			FILTER_BITMAP_SET(bm, node->ids[j]);
+			if (rowmasks) {
+				rowmasks[node->ids[j]] |= row;
+			}
+		}
+
+		if (i == bits) {
+			break;
+		}
+
+		bit = (addr[i / 8] >> (7 - (i % 8))) & 1;
+		cur = node->next[bit];
+		if (!cur) {
+			break;
+		}
+	}
+}
+
+static int
+filter_index_add(struct filter_index *idx, struct filter_basic *fb,
+	uint32_t id)
+{
+	size_t i;
+	int v6 = (fb->type == FILTER_BASIC_ADDR6);
+
+	for (i=0; i<fb->n; i++) {
+		struct ip_addr_and_mask *ip = &fb->data[i].data.ip;
+		uint8_t *addr;
+
+		addr = v6 ? (uint8_t *)&ip->ip.v6.addr
+			: (uint8_t *)&ip->ip.v4.addr;
+
+		if (fb->direction & FILTER_BASIC_DIR_SRC) {
+			if (!trie_add(&idx->tries[v6 ? FILTER_INDEX_SRC6
+				: FILTER_INDEX_SRC4], addr, ip->mask_len, id)) {
+
+				return 0;
+			}
+		}
+		if (fb->direction & FILTER_BASIC_DIR_DST) {
+			if (!trie_add(&idx->tries[v6 ? FILTER_INDEX_DST6
+				: FILTER_INDEX_DST4], addr, ip->mask_len, id)) {
+
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+struct filter_index *
+filter_index_new(struct filter_expr **exprs, size_t n, size_t nthreads)
+{
+	struct filter_index *idx;
+	struct filter_basic **fbs = NULL;
+	size_t i, maxfbs = 0;
+
+	idx = calloc(1, sizeof(struct filter_index));
+	if (!idx) {
+		LOG("Not enough memory");
+		goto fail_idx;
+	}
+	idx->n = n;
+	idx->nthreads = nthreads;
+	idx->nwords = (n + 63) / 64;
+	if (idx->nwords == 0) {
+		idx->nwords = 1;
+	}
+	idx->stride = CACHE_LINE_ROUND(idx->nwords * sizeof(uint64_t))
+		/ sizeof(uint64_t);
+
+	idx->rstride = CACHE_LINE_ROUND(idx->nwords * 64 * sizeof(uint64_t))
+		/ sizeof(uint64_t);
+
+	idx->fallback = calloc(idx->nwords, sizeof(uint64_t));
+	idx->candidates = calloc_cl(nthreads * idx->stride, sizeof(uint64_t));
+	idx->rowmasks = calloc_cl(nthreads * idx->rstride, sizeof(uint64_t));
+	if (!idx->fallback || !idx->candidates || !idx->rowmasks) {
+		LOG("Not enough memory");
+		goto fail_bitmaps;
+	}
+
+	for (i=0; i<n; i++) {
+		if (exprs[i] && (exprs[i]->n > maxfbs)) {
+			maxfbs = exprs[i]->n;
+		}
+	}
+	fbs = malloc((maxfbs + 1) * sizeof(struct filter_basic *));
+	if (!fbs) {
+		LOG("Not enough memory");
+		goto fail_bitmaps;
+	}
+
+	for (i=0; i<n; i++) {
+		struct filter_expr *e = exprs[i];
+		size_t pos, nfbs = 0, j;
+
+		if (!e || (e->n == 0) || filter_index_has_side_effects(e)) {
+			FILTER_BITMAP_SET(idx->fallback, i);
+			continue;
+		}
+
+		pos = e->n;
+		if ((filter_index_guard(e, &pos, fbs, &nfbs) != GUARD_OK)
+			|| (pos != 0)) {
+
+			FILTER_BITMAP_SET(idx->fallback, i);
+			continue;
+		}
+
+		for (j=0; j<nfbs; j++) {
+			if (!filter_index_add(idx, fbs[j], i)) {
+				LOG("Not enough memory");
+				goto fail_add;
+			}
+		}
+		idx->nindexed++;
+	}
+
+	free(fbs);
+	return idx;
+
+fail_add:
+	free(fbs);
+fail_bitmaps:
+	filter_index_free(idx);
+fail_idx:
+	return NULL;
+}
+
+void
+filter_index_free(struct filter_index *idx)
+{
+	size_t i, j;
+
+	if (!idx) {
+		return;
+	}
+
+	for (i=0; i<FILTER_INDEX_NTRIES; i++) {
+		struct filter_index_trie *t = &idx->tries[i];
+
+		for (j=0; j<t->nnodes; j++) {
+			free(t->nodes[j].ids);
+		}
+		free(t->nodes);
+	}
+	free(idx->fallback);
+	free(idx->candidates);
+	free(idx->rowmasks);
+	free(idx);
+}
+
+static void
+filter_index_lookup(struct filter_index *idx, struct flow_info *flow,
+	uint64_t *bm, uint64_t *rowmasks, uint64_t row)
+{
+	if (flow->has_ip4_src_addr) {
+		trie_lookup(&idx->tries[FILTER_INDEX_SRC4], flow->ip4_src_addr,
+			32, bm, rowmasks, row);
+	}
+	if (flow->has_ip4_dst_addr) {
+		trie_lookup(&idx->tries[FILTER_INDEX_DST4], flow->ip4_dst_addr,
+			32, bm, rowmasks, row);
+	}
+	if (flow->has_ip6_src_addr) {
+		trie_lookup(&idx->tries[FILTER_INDEX_SRC6], flow->ip6_src_addr,
+			16 * 8, bm, rowmasks, row);
+	}
+	if (flow->has_ip6_dst_addr) {
+		trie_lookup(&idx->tries[FILTER_INDEX_DST6], flow->ip6_dst_addr,
+			16 * 8, bm, rowmasks, row);
+	}
+}
+
+size_t
+filter_index_first(struct filter_index *idx, size_t thread_id,
+	struct flow_info *flow)
+{
+	uint64_t *bm;
+
+	if (!idx) {
+		return 0;
+	}
+
+	bm = idx->candidates + thread_id * idx->stride;
+	memcpy(bm, idx->fallback, idx->nwords * sizeof(uint64_t));
+	filter_index_lookup(idx, flow, bm, NULL, 0);
+
+	if (bm[0] & 1) {
+		return 0;
+	}
+	return filter_index_next(idx, thread_id, 0);
+}
+
+/* rows with the same address share one walk of trie */
+static void
+trie_lookup_rows(struct filter_index_trie *t, const uint8_t *addrs,
+	size_t size, uint64_t rows, uint64_t *bm, uint64_t *rowmasks)
+{
+	while (rows) {
+		const uint8_t *addr = addrs + __builtin_ctzll(rows) * size;
+		uint64_t same = 0, m;
+
+		for (m=rows; m; m&=m-1) {
+			int r = __builtin_ctzll(m);
+
+			if (memcmp(addrs + r * size, addr, size) == 0) {
+				same |= 1ULL << r;
+			}
+		}
+
+		trie_lookup(t, addr, size * 8, bm, rowmasks, same);
+		rows &= ~same;
+	}
+}
+
+/*
+ * addresses of rows from column of "host" or "net" filters, or copied from
+ * flow records if filters don't reference them
+ */
+static uint64_t
+block_addrs(struct filter_block *b, int name, int name2, int dst,
+	size_t fld_off, size_t has_off, size_t size, uint8_t *tmp,
+	const uint8_t **addrs)
+{
+	struct filter_column *c;
+	uint64_t has = 0;
+	size_t r;
+
+	c = filter_block_column(b, name * 2 + dst);
+	if (!c) {
+		c = filter_block_column(b, name2 * 2 + dst);
+	}
+	if (c) {
+		*addrs = (const uint8_t *)&c->v;
+		return c->has;
+	}
+
+	for (r=0; r<b->n; r++) {
+		uint8_t *flow = (uint8_t *)b->flows[r];
+		int h;
+
+		memcpy(&h, flow + has_off, sizeof(int));
+		if (h) {
+			memcpy(tmp + r * size, flow + fld_off, size);
+			has |= 1ULL << r;
+		}
+	}
+	*addrs = tmp;
+
+	return has;
+}
+
+#define BLOCK_ADDRS(B, V, DIR, FLD, TMP, ADDRS)                               \
+	block_addrs(B, FILTER_BASIC_NAME_HOST##V, FILTER_BASIC_NAME_NET##V,   \
+		DIR, offsetof(struct flow_info, FLD),                         \
+		offsetof(struct flow_info, has_##FLD),                        \
+		sizeof(((struct flow_info *)0)->FLD), TMP, ADDRS)
+
+/*
+ * candidates of block are union of candidates of rows, for each candidate
+ * mask of rows is kept (filter_index_rows())
+ */
+size_t
+filter_index_first_batch(struct filter_index *idx, size_t thread_id,
+	struct filter_block *b, uint64_t rows)
+{
+	uint64_t *bm, *rowmasks, has;
+	const uint8_t *addrs;
+	xe_ip tmp[FILTER_BATCH_MAX];
+	size_t w;
+
+	if (!idx) {
+		return 0;
+	}
+
+	bm = idx->candidates + thread_id * idx->stride;
+	rowmasks = idx->rowmasks + thread_id * idx->rstride;
+
+	/* masks of previous candidates */
+	for (w=0; w<idx->nwords; w++) {
+		uint64_t word = bm[w];
+
+		while (word) {
+			rowmasks[w * 64 + __builtin_ctzll(word)] = 0;
+			word &= word - 1;
+		}
+	}
+
+	memcpy(bm, idx->fallback, idx->nwords * sizeof(uint64_t));
+
+	if (idx->tries[FILTER_INDEX_SRC4].nnodes) {
+		has = BLOCK_ADDRS(b, , 0, ip4_src_addr, (uint8_t *)tmp, &addrs);
+		trie_lookup_rows(&idx->tries[FILTER_INDEX_SRC4], addrs,
+			sizeof(uint32_t), rows & has, bm, rowmasks);
+	}
+	if (idx->tries[FILTER_INDEX_DST4].nnodes) {
+		has = BLOCK_ADDRS(b, , 1, ip4_dst_addr, (uint8_t *)tmp, &addrs);
+		trie_lookup_rows(&idx->tries[FILTER_INDEX_DST4], addrs,
+			sizeof(uint32_t), rows & has, bm, rowmasks);
+	}
+	if (idx->tries[FILTER_INDEX_SRC6].nnodes) {
+		has = BLOCK_ADDRS(b, 6, 0, ip6_src_addr, (uint8_t *)tmp, &addrs);
+		trie_lookup_rows(&idx->tries[FILTER_INDEX_SRC6], addrs,
+			sizeof(xe_ip), rows & has, bm, rowmasks);
+	}
+	if (idx->tries[FILTER_INDEX_DST6].nnodes) {
+		has = BLOCK_ADDRS(b, 6, 1, ip6_dst_addr, (uint8_t *)tmp, &addrs);
+		trie_lookup_rows(&idx->tries[FILTER_INDEX_DST6], addrs,
+			sizeof(xe_ip), rows & has, bm, rowmasks);
+	}
+
+	if (bm[0] & 1) {
+		return 0;
+	}
+	return filter_index_next(idx, thread_id, 0);
+}
@@ -0,0 +1,126 @@
+#ifndef filter_index_h_included
+#define filter_index_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Index of many filters by source and destination address prefixes
+ *
+ * For each filter we find a set of "host/net" literals, such that filter
+ * can't match if none of them matches. For "dst net A or B" this is A and B,
+ * for "a and b" - set of a or set of b, for "a or b" - both sets (if both
+ * exist). Literals go to prefix tries (IPv4/IPv6, source/destination) with
+ * ids of filters in nodes. Filters without such set (negations, functions,
+ * IP lists, mfreq() that counts every flow, etc.) are in fallback bitmap.
+ *
+ * For flow we walk tries by flow addresses and collect ids of filters with
+ * all covering prefixes in per-thread bitmap, only these filters (and
+ * fallback ones) are matched, in the same order as before.
+ */
+
+/* build index for lists with at least this number of objects */
+#define FILTER_INDEX_MIN 16
+
+struct filter_expr;
+struct flow_info;
+struct filter_block;
+
+enum FILTER_INDEX_TRIE
+{
+	FILTER_INDEX_SRC4,
+	FILTER_INDEX_DST4,
+	FILTER_INDEX_SRC6,
+	FILTER_INDEX_DST6,
+
+	FILTER_INDEX_NTRIES
+};
+
+struct filter_index_node
+{
+	uint32_t next[2];
+
+	uint32_t nids;
+	uint32_t *ids;
+};
+
+struct filter_index_trie
+{
+	size_t nnodes;
+	struct filter_index_node *nodes;
+};
+
+struct filter_index
+{
+	size_t n;
+	/* number of filters in tries */
+	size_t nindexed;
+
+	struct filter_index_trie tries[FILTER_INDEX_NTRIES];
+
+	size_t nwords;
+	uint64_t *fallback;
+
+	/* per-thread bitmaps of candidates, each on own cache line */
+	size_t nthreads;
+	size_t stride;
+	uint64_t *candidates;
+
+	/* per-thread masks of rows of block for each filter */
+	size_t rstride;
+	uint64_t *rowmasks;
+};
+
+struct filter_index *filter_index_new(struct filter_expr **exprs, size_t n,
+	size_t nthreads);
+void filter_index_free(struct filter_index *idx);
+
+/* both return index of next candidate or idx->n, all filters if idx is NULL */
+size_t filter_index_first(struct filter_index *idx, size_t thread_id,
+	struct flow_info *flow);
+size_t filter_index_first_batch(struct filter_index *idx, size_t thread_id,
+	struct filter_block *b, uint64_t rows);
+
+static inline size_t
+filter_index_next(struct filter_index *idx, size_t thread_id, size_t i)
+{
+	uint64_t *bm, word;
+	size_t w;
+
+	i++;
+	if (!idx) {
+		return i;
+	}
+
+	w = i / 64;
+	if (w >= idx->nwords) {
+		return idx->n;
+	}
+
+	bm = idx->candidates + thread_id * idx->stride;
+	word = bm[w] & (~0ULL << (i % 64));
+	while (!word) {
+		w++;
+		if (w >= idx->nwords) {
+			return idx->n;
+		}
+		word = bm[w];
+	}
+
+	return w * 64 + __builtin_ctzll(word);
+}
+
+/* rows of block which may match candidate i */
+static inline uint64_t
+filter_index_rows(struct filter_index *idx, size_t thread_id, size_t i,
+	uint64_t rows)
+{
+	if (!idx || ((idx->fallback[i / 64] >> (i % 64)) & 1)) {
+		return rows;
+	}
+
+	return idx->rowmasks[thread_id * idx->rstride + i] & rows;
+}
+
+#endif
+
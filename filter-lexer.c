@@ -193,6 +193,8 @@ FOR_LIST_OF_GEOIP_FIELDS
 		*id = ASN;
 	}  else if (MATCH("asd")) {
 		*id = ASD;
+	}  else if (MATCH("pfx")) {
+		*id = PFX;
 
 #define FIELD(NAME, STR, FLD, SCALE)                  \
 	} else if (MATCH(STR)) {                      \
@@ -324,9 +324,9 @@ function_mfreq_parse(struct filter_input *in, struct function_mfreq *mfreq)
 	}
 
 	/* init freqmap */
-	mfreq->freqmap = calloc(UINT16_MAX + 1, sizeof(uint64_t));
+	mfreq->freqmap = freqmap_new();
 	if (!mfreq->freqmap) {
-		LOG("calloc() failed");
+		LOG("Can't allocate frequency map");
 		return 0;
 	}
 
@@ -523,6 +523,372 @@ function_as(struct filter_input *in, struct filter_expr *e)
 	}
 }
 
+/* pfx */
+int
+function_pfx_parse(struct filter_input *in, struct function_pfx *pfx)
+{
+	memset(pfx, 0, sizeof(struct function_pfx));
+
+	if (!accept_(in, PFX)) {
+		return 0;
+	}
+
+	if (!accept_(in, LPAREN)) {
+		mkerror(in, "Expected '(' after 'pfx'");
+		return 0;
+	}
+
+	/* arg */
+	if (!parse_nonaggr_field(in, &pfx->ip_off, &pfx->ip_size)) {
+		mkerror(in, "Incorrect field name");
+		return 0;
+	}
+	if ((pfx->ip_size != sizeof(uint32_t))
+		&& (pfx->ip_size != sizeof(xe_ip))) {
+
+		mkerror(in, "Expected IPv4 or IPv6 address field");
+		return 0;
+	}
+
+	if (!accept_(in, RPAREN)) {
+		mkerror(in, "Expected ')'");
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+function_pfx(struct filter_input *in, struct filter_expr *e)
+{
+	struct function_pfx pfx;
+	struct filter_basic *fb;
+
+	if (!function_pfx_parse(in, &pfx)) {
+		return 0;
+	}
+
+	if (!filter_add_basic_filter(e, FILTER_BASIC_STRING,
+			FILTER_BASIC_NAME_PFX, FILTER_BASIC_DIR_NONE)) {
+		return 0;
+	}
+
+	fb = e->filter[e->n - 1].arg;
+	fb->func_data.pfx = malloc(sizeof(struct function_pfx));
+	if (!fb->func_data.pfx) {
+		return 0;
+	}
+
+	*fb->func_data.pfx = pfx;
+
+	fb->is_func = 1;
+
+	return id(in, e, FILTER_BASIC_STRING);
+}
+
+/*
+ * net(field, len[, len6])
+ * IPv4 address is masked to 'len' bits, IPv6 to 'len6' (or 'len' if there is
+ * only one length)
+ */
+int
+function_net_parse(struct filter_input *in, struct function_net *net)
+{
+	const char *p;
+	uint64_t len4, len6;
+
+	memset(net, 0, sizeof(struct function_net));
+
+	if (in->current_token.id != NET) {
+		return 0;
+	}
+
+	/* 'net' without parenthesis is a field */
+	for (p=in->s; (*p == ' ') || (*p == '\t'); p++);
+	if (*p != '(') {
+		return 0;
+	}
+
+	accept_(in, NET);
+	if (!accept_(in, LPAREN)) {
+		mkerror(in, "Expected '(' after 'net'");
+		return 0;
+	}
+
+	/* arg */
+	if (!parse_nonaggr_field(in, &net->ip_off, &net->ip_size)) {
+		mkerror(in, "Incorrect field name");
+		return 0;
+	}
+	if ((net->ip_size != sizeof(uint32_t))
+		&& (net->ip_size != sizeof(xe_ip))) {
+
+		mkerror(in, "Expected IPv4 or IPv6 address field");
+		return 0;
+	}
+
+	if (!accept_(in, COMMA)) {
+		mkerror(in, "Expected ',' after field name");
+		return 0;
+	}
+
+	len4 = len6 = in->current_token.data.range.low;
+	if (!accept_(in, INT_RANGE)) {
+		mkerror(in, "Expected prefix length");
+		return 0;
+	}
+
+	if (accept_(in, COMMA)) {
+		len6 = in->current_token.data.range.low;
+		if (!accept_(in, INT_RANGE)) {
+			mkerror(in, "Expected IPv6 prefix length");
+			return 0;
+		}
+	}
+
+	if (!accept_(in, RPAREN)) {
+		mkerror(in, "Expected ')'");
+		return 0;
+	}
+
+	if ((net->ip_size == sizeof(uint32_t)) && (len4 > 32)) {
+		mkerror(in, "IPv4 prefix length should be in range 0-32");
+		return 0;
+	}
+	if ((net->ip_size == sizeof(xe_ip)) && (len6 > 128)) {
+		mkerror(in, "IPv6 prefix length should be in range 0-128");
+		return 0;
+	}
+	net->mask4 = len4;
+	net->mask6 = len6;
+
+	return 1;
+}
+
+static void
+tfstr_compile(struct filter_basic *fb)
+{
+	struct function_tfstr *tfstr = fb->func_data.tfstr;
+	unsigned int tf;
+	size_t i;
+
+	for (tf=0; tf<=UINT8_MAX; tf++) {
+		char *flg = tcp_flags_to_str(tf);
+
+		for (i=0; i<fb->n; i++) {
+			if (strcasecmp(fb->data[i].data.str, flg) == 0) {
+				FILTER_BITMAP_SET(tfstr->bitmap, tf);
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * port number from "53", "domain (53)" or "domain(53)", string for this port
+ * is checked by caller
+ */
+static int
+str_to_port(const char *s, size_t len, uint16_t *port)
+{
+	char num[8];
+	const char *p;
+	size_t nlen;
+	char *end;
+	unsigned long v;
+
+	if ((len > 0) && (s[len - 1] == ')')) {
+		for (p=s+len-1; (p > s) && (*p != '('); p--)
+			;
+		if (*p != '(') {
+			return 0;
+		}
+		p++;
+		nlen = s + len - 1 - p;
+	} else {
+		p = s;
+		nlen = len;
+	}
+
+	if ((nlen == 0) || (nlen >= sizeof(num))) {
+		return 0;
+	}
+	memcpy(num, p, nlen);
+	num[nlen] = '\0';
+
+	v = strtoul(num, &end, 10);
+	if ((*end != '\0') || (v > UINT16_MAX)) {
+		return 0;
+	}
+
+	*port = v;
+	return 1;
+}
+
+static int
+portstr_compile(struct filter_basic *fb)
+{
+	struct function_portstr *portstr = fb->func_data.portstr;
+	size_t i;
+
+	portstr->bitmap = calloc((UINT16_MAX + 1) / 64, sizeof(uint64_t));
+	if (!portstr->bitmap) {
+		return 0;
+	}
+
+	for (i=0; i<fb->n; i++) {
+		char *lit = fb->data[i].data.str;
+		char p[32];
+		uint16_t port;
+
+		if (!str_to_port(lit, strlen(lit), &port)) {
+			continue;
+		}
+
+		port_to_str(p, port);
+		if (strcasecmp(lit, p) == 0) {
+			FILTER_BITMAP_SET(portstr->bitmap, port);
+		}
+	}
+
+	return 1;
+}
+
+static uint64_t *
+ppstr_rule_bitmap(struct function_ppstr *ppstr, enum PPSTR_SIDE side,
+	uint16_t port)
+{
+	struct ppstr_rule *tmp;
+	size_t i;
+
+	for (i=0; i<ppstr->nrules; i++) {
+		if ((ppstr->rules[i].side == side)
+			&& (ppstr->rules[i].port == port)) {
+
+			return ppstr->rules[i].bitmap;
+		}
+	}
+
+	tmp = realloc(ppstr->rules,
+		(ppstr->nrules + 1) * sizeof(struct ppstr_rule));
+	if (!tmp) {
+		return NULL;
+	}
+	ppstr->rules = tmp;
+
+	tmp = &ppstr->rules[ppstr->nrules];
+	tmp->side = side;
+	tmp->port = port;
+	tmp->bitmap = calloc((UINT16_MAX + 1) / 64, sizeof(uint64_t));
+	if (!tmp->bitmap) {
+		return NULL;
+	}
+	ppstr->nrules++;
+
+	return tmp->bitmap;
+}
+
+/*
+ * "port1 -> port2", "port1 ->" or "-> port2" (see ports_pair_to_str()).
+ * Port from each non-empty side is fixed, if the other side is empty all
+ * its values are checked
+ */
+static int
+ppstr_compile_literal(struct function_ppstr *ppstr, const char *lit)
+{
+	const char *arrow, *l, *r;
+	size_t llen, rlen;
+	uint16_t port1 = 0, port2 = 0;
+	int has1, has2;
+	uint64_t *bitmap;
+	uint32_t v;
+	char pp[64];
+
+	arrow = strstr(lit, "->");
+	if (!arrow) {
+		return 1;
+	}
+
+	/* trim spaces around sides */
+	for (l=lit; (l < arrow) && isspace(*l); l++)
+		;
+	for (llen=arrow-l; (llen > 0) && isspace(l[llen - 1]); llen--)
+		;
+	for (r=arrow+2; *r && isspace(*r); r++)
+		;
+	for (rlen=strlen(r); (rlen > 0) && isspace(r[rlen - 1]); rlen--)
+		;
+
+	has1 = llen && str_to_port(l, llen, &port1);
+	has2 = rlen && str_to_port(r, rlen, &port2);
+
+	if ((llen && !has1) || (rlen && !has2)) {
+		return 1;
+	}
+
+	if (has1 && has2) {
+		ports_pair_to_str(pp, port1, port2);
+		if (strcasecmp(lit, pp) != 0) {
+			return 1;
+		}
+		bitmap = ppstr_rule_bitmap(ppstr, PPSTR_PORT1, port1);
+		if (!bitmap) {
+			return 0;
+		}
+		FILTER_BITMAP_SET(bitmap, port2);
+	} else if (has1) {
+		bitmap = NULL;
+		for (v=0; v<=UINT16_MAX; v++) {
+			ports_pair_to_str(pp, port1, v);
+			if (strcasecmp(lit, pp) != 0) {
+				continue;
+			}
+			if (!bitmap) {
+				bitmap = ppstr_rule_bitmap(ppstr, PPSTR_PORT1,
+					port1);
+				if (!bitmap) {
+					return 0;
+				}
+			}
+			FILTER_BITMAP_SET(bitmap, v);
+		}
+	} else if (has2) {
+		bitmap = NULL;
+		for (v=0; v<=UINT16_MAX; v++) {
+			ports_pair_to_str(pp, v, port2);
+			if (strcasecmp(lit, pp) != 0) {
+				continue;
+			}
+			if (!bitmap) {
+				bitmap = ppstr_rule_bitmap(ppstr, PPSTR_PORT2,
+					port2);
+				if (!bitmap) {
+					return 0;
+				}
+			}
+			FILTER_BITMAP_SET(bitmap, v);
+		}
+	}
+
+	return 1;
+}
+
+static int
+ppstr_compile(struct filter_basic *fb)
+{
+	size_t i;
+
+	for (i=0; i<fb->n; i++) {
+		if (!ppstr_compile_literal(fb->func_data.ppstr,
+			fb->data[i].data.str)) {
+
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 int
 function_tfstr_parse(struct filter_input *in, struct function_tfstr *tfstr)
 {
@@ -556,6 +922,7 @@ function_tfstr(struct filter_input *in, struct filter_expr *e)
 	struct function_tfstr tfstr;
 	struct filter_basic *fb;
 
+	memset(&tfstr, 0, sizeof(struct function_tfstr));
 	if (!function_tfstr_parse(in, &tfstr)) {
 		return 0;
 	}
@@ -576,7 +943,13 @@ function_tfstr(struct filter_input *in, struct filter_expr *e)
 
 	fb->is_func = 1;
 
-	return id(in, e, FILTER_BASIC_STRING);
+	if (!id(in, e, FILTER_BASIC_STRING)) {
+		return 0;
+	}
+
+	tfstr_compile(fb);
+
+	return 1;
 }
 
 int
@@ -613,6 +986,7 @@ function_portstr(struct filter_input *in, struct filter_expr *e)
 	struct function_portstr portstr;
 	struct filter_basic *fb;
 
+	memset(&portstr, 0, sizeof(struct function_portstr));
 	if (!function_portstr_parse(in, &portstr)) {
 		return 0;
 	}
@@ -633,7 +1007,16 @@ function_portstr(struct filter_input *in, struct filter_expr *e)
 
 	fb->is_func = 1;
 
-	return id(in, e, FILTER_BASIC_STRING);
+	if (!id(in, e, FILTER_BASIC_STRING)) {
+		return 0;
+	}
+
+	if (!portstr_compile(fb)) {
+		mkerror(in, "Can't allocate memory for 'portstr'");
+		return 0;
+	}
+
+	return 1;
 }
 
 int
@@ -680,6 +1063,7 @@ function_ppstr(struct filter_input *in, struct filter_expr *e)
 	struct function_ppstr ppstr;
 	struct filter_basic *fb;
 
+	memset(&ppstr, 0, sizeof(struct function_ppstr));
 	if (!function_ppstr_parse(in, &ppstr)) {
 		return 0;
 	}
@@ -701,5 +1085,14 @@ function_ppstr(struct filter_input *in, struct filter_expr *e)
 
 	fb->is_func = 1;
 
-	return id(in, e, FILTER_BASIC_STRING);
+	if (!id(in, e, FILTER_BASIC_STRING)) {
+		return 0;
+	}
+
+	if (!ppstr_compile(fb)) {
+		mkerror(in, "Can't allocate memory for 'ppstr'");
+		return 0;
+	}
+
+	return 1;
 }
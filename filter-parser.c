@@ -141,6 +141,10 @@ rule(struct filter_input *q, struct filter_expr *e)
 		return 1;
 	}
 
+	if (function_pfx(q, e)) {
+		return 1;
+	}
+
 	/* simple rules */
 	if (rule_without_direction(q, e, FILTER_BASIC_DIR_BOTH)) {
 		return 1;
@@ -251,6 +255,10 @@ parse_filter(struct filter_input *f)
 		mkerror(f, err);
 	}
 
+	if (!f->error) {
+		filter_compile(e);
+	}
+
 	return e;
 }
 
@@ -266,6 +274,11 @@ field_map_flow_info(struct field *fld, const char *name)
 		return 1;
 #include "netflow.def"
 
+	} else if (strcmp("tenant", name) == 0) {
+		/* virtual field, set for family of monitoring objects */
+		fld->nf_offset = offsetof(struct flow_info, tenant);
+		fld->size = sizeof(uint32_t);
+		return 1;
 	}
 
 	return 0;
@@ -456,6 +469,24 @@ parse_field(char *s, struct field *fld, char *err)
 			fld->type = FILTER_BASIC_STRING;
 			fld->size = sizeof(((struct as_info *)0)->asd);
 		}
+	} else if (function_pfx_parse(&in, &fld->func_data.pfx)) {
+		fld->is_func = 1;
+		fld->id = PFX;
+		fld->type = FILTER_BASIC_STRING;
+		fld->size = RIB_PFX_SIZE;
+	} else if (function_net_parse(&in, &fld->func_data.net)) {
+		fld->is_func = 1;
+		fld->id = NET;
+		if (fld->func_data.net.ip_size == sizeof(uint32_t)) {
+			fld->type = FILTER_BASIC_ADDR4;
+		} else {
+			fld->type = FILTER_BASIC_ADDR6;
+		}
+		fld->size = fld->func_data.net.ip_size;
+	} else if (in.error) {
+		/* function with incorrect arguments */
+		strcpy(err, in.errmsg);
+		return 0;
 	} else {
 		/* parse field without ASC/DESC suffix */
 		if (!field_without_order(&in, fld, err)) {
@@ -0,0 +1,439 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "filter-preds.h"
+#include "utils.h"
+
+#define PREDS_INITIAL_SLOTS 64
+
+static int
+filter_preds_shareable(struct filter_basic *fb)
+{
+	if (!fb) {
+		return 0;
+	}
+
+	switch (fb->name) {
+		/* set while flow is dispatched, differ between objects */
+		case FILTER_BASIC_NAME_TENANT:
+		case FILTER_BASIC_NAME_CLASS0:
+		case FILTER_BASIC_NAME_CLASS1:
+		case FILTER_BASIC_NAME_CLASS2:
+		case FILTER_BASIC_NAME_CLASS3:
+		case FILTER_BASIC_NAME_CLASS4:
+		/* payload of sFlow sample is parsed by objects which need it */
+		case FILTER_BASIC_NAME_DNS_NAME:
+		case FILTER_BASIC_NAME_DNS_IPS:
+		case FILTER_BASIC_NAME_SNI:
+			return 0;
+		default:
+			break;
+	}
+
+	if (!fb->is_func) {
+		return 1;
+	}
+
+	switch (fb->name) {
+		case FILTER_BASIC_NAME_DIV:
+		case FILTER_BASIC_NAME_DIV_R:
+		case FILTER_BASIC_NAME_DIV_L:
+		case FILTER_BASIC_NAME_MIN:
+		case FILTER_BASIC_NAME_ASN:
+		case FILTER_BASIC_NAME_ASD:
+		case FILTER_BASIC_NAME_PFX:
+/* geoip */
+#define DO(FIELD, SIZE) case FILTER_BASIC_NAME_##FIELD:
+FOR_LIST_OF_GEOIP_FIELDS
+#undef DO
+			return 1;
+
+		/* mfreq() updates own frequency map on each call, string
+		   functions are already a single bitmap lookup */
+		default:
+			return 0;
+	}
+}
+
+static uint64_t
+hash_mix(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	size_t i;
+
+	/* FNV-1a */
+	for (i=0; i<size; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static uint64_t
+filter_basic_hash(struct filter_basic *fb)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	h = hash_mix(h, &fb->type, sizeof(fb->type));
+	h = hash_mix(h, &fb->name, sizeof(fb->name));
+	h = hash_mix(h, &fb->direction, sizeof(fb->direction));
+	h = hash_mix(h, &fb->n, sizeof(fb->n));
+
+	for (i=0; i<fb->n; i++) {
+		struct filter_basic_data *d = &fb->data[i];
+
+		if (d->is_list) {
+			h = hash_mix(h, &d->data.addr_list,
+				sizeof(d->data.addr_list));
+			continue;
+		}
+
+		switch (fb->type) {
+			case FILTER_BASIC_ADDR4:
+				h = hash_mix(h, &d->data.ip.ip.v4.addr,
+					sizeof(d->data.ip.ip.v4.addr));
+				h = hash_mix(h, &d->data.ip.mask_len,
+					sizeof(d->data.ip.mask_len));
+				break;
+			case FILTER_BASIC_ADDR6:
+				h = hash_mix(h, &d->data.ip.ip.v6.addr,
+					sizeof(d->data.ip.ip.v6.addr));
+				h = hash_mix(h, &d->data.ip.mask_len,
+					sizeof(d->data.ip.mask_len));
+				break;
+			case FILTER_BASIC_RANGE:
+				h = hash_mix(h, &d->data.range,
+					sizeof(d->data.range));
+				break;
+			case FILTER_BASIC_MAC:
+				h = hash_mix(h, &d->data.mac,
+					sizeof(d->data.mac));
+				break;
+			case FILTER_BASIC_STRING:
+				h = hash_mix(h, d->data.str,
+					strlen(d->data.str));
+				break;
+			default:
+				break;
+		}
+	}
+
+	return h;
+}
+
+static int
+filter_basic_data_equal(enum FILTER_BASIC_TYPE type,
+	struct filter_basic_data *a, struct filter_basic_data *b)
+{
+	struct ip_addr_and_mask *ia = &a->data.ip, *ib = &b->data.ip;
+
+	if (a->is_list || b->is_list) {
+		return a->is_list && b->is_list
+			&& (a->data.addr_list == b->data.addr_list);
+	}
+
+	switch (type) {
+		case FILTER_BASIC_ADDR4:
+			return (ia->version == ib->version)
+				&& (ia->mask_len == ib->mask_len)
+				&& (ia->ip.v4.addr == ib->ip.v4.addr)
+				&& (ia->ip.v4.mask == ib->ip.v4.mask);
+		case FILTER_BASIC_ADDR6:
+			return (ia->version == ib->version)
+				&& (ia->mask_len == ib->mask_len)
+				&& (memcmp(&ia->ip.v6.addr, &ib->ip.v6.addr,
+					sizeof(xe_ip)) == 0)
+				&& (memcmp(&ia->ip.v6.mask, &ib->ip.v6.mask,
+					sizeof(xe_ip)) == 0);
+		case FILTER_BASIC_RANGE:
+			return (a->data.range.low == b->data.range.low)
+				&& (a->data.range.high == b->data.range.high);
+		case FILTER_BASIC_MAC:
+			return memcmp(&a->data.mac, &b->data.mac,
+				sizeof(struct mac_addr)) == 0;
+		case FILTER_BASIC_STRING:
+			return strcmp(a->data.str, b->data.str) == 0;
+		default:
+			return 0;
+	}
+}
+
+static int
+filter_func_equal(struct filter_basic *a, struct filter_basic *b)
+{
+	union filter_func_data *fa = &a->func_data, *fb = &b->func_data;
+
+	switch (a->name) {
+		case FILTER_BASIC_NAME_DIV:
+		case FILTER_BASIC_NAME_DIV_R:
+		case FILTER_BASIC_NAME_DIV_L:
+			return (fa->div->dividend_off
+					== fb->div->dividend_off)
+				&& (fa->div->dividend_size
+					== fb->div->dividend_size)
+				&& (fa->div->divisor_off
+					== fb->div->divisor_off)
+				&& (fa->div->divisor_size
+					== fb->div->divisor_size)
+				&& (fa->div->is_log == fb->div->is_log)
+				&& (fa->div->k == fb->div->k);
+		case FILTER_BASIC_NAME_MIN:
+			return (fa->min->arg1_off == fb->min->arg1_off)
+				&& (fa->min->arg1_size == fb->min->arg1_size)
+				&& (fa->min->arg2_off == fb->min->arg2_off)
+				&& (fa->min->arg2_size == fb->min->arg2_size);
+		case FILTER_BASIC_NAME_ASN:
+		case FILTER_BASIC_NAME_ASD:
+			return (fa->as->ip_off == fb->as->ip_off)
+				&& (fa->as->ip_size == fb->as->ip_size)
+				&& (fa->as->num == fb->as->num);
+		case FILTER_BASIC_NAME_PFX:
+			return (fa->pfx->ip_off == fb->pfx->ip_off)
+				&& (fa->pfx->ip_size == fb->pfx->ip_size);
+/* geoip */
+#define DO(FIELD, SIZE) case FILTER_BASIC_NAME_##FIELD:
+FOR_LIST_OF_GEOIP_FIELDS
+#undef DO
+			return (fa->geoip->ip_off == fb->geoip->ip_off)
+				&& (fa->geoip->ip_size == fb->geoip->ip_size)
+				&& (fa->geoip->field == fb->geoip->field);
+		default:
+			return 0;
+	}
+}
+
+static int
+filter_basic_equal(struct filter_basic *a, struct filter_basic *b)
+{
+	size_t i;
+
+	if ((a->type != b->type) || (a->name != b->name)
+		|| (a->direction != b->direction) || (a->n != b->n)
+		|| (a->is_func != b->is_func)) {
+
+		return 0;
+	}
+
+	if (a->is_func && !filter_func_equal(a, b)) {
+		return 0;
+	}
+
+	/* the same literals in the same order */
+	for (i=0; i<a->n; i++) {
+		if (!filter_basic_data_equal(a->type, &a->data[i],
+			&b->data[i])) {
+
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+struct filter_preds *
+filter_preds_new(void)
+{
+	struct filter_preds *p;
+
+	p = calloc(1, sizeof(struct filter_preds));
+	if (!p) {
+		LOG("Not enough memory");
+		goto fail_preds;
+	}
+
+	p->nslots = PREDS_INITIAL_SLOTS;
+	p->slots = calloc(p->nslots, sizeof(struct filter_basic *));
+	p->ids = calloc(p->nslots, sizeof(uint32_t));
+	p->columns = calloc((FILTER_NCOLUMNS + 63) / 64, sizeof(uint64_t));
+	if (!p->slots || !p->ids || !p->columns) {
+		LOG("Not enough memory");
+		goto fail_slots;
+	}
+
+	return p;
+
+fail_slots:
+	filter_preds_free(p);
+fail_preds:
+	return NULL;
+}
+
+void
+filter_preds_free(struct filter_preds *p)
+{
+	if (!p) {
+		return;
+	}
+
+	free(p->slots);
+	free(p->ids);
+	free(p->columns);
+	free(p->bits);
+	free(p->memo);
+	free(p);
+}
+
+static int
+filter_preds_grow(struct filter_preds *p)
+{
+	struct filter_basic **slots;
+	uint32_t *ids;
+	size_t i, nslots = p->nslots * 2;
+
+	slots = calloc(nslots, sizeof(struct filter_basic *));
+	ids = calloc(nslots, sizeof(uint32_t));
+	if (!slots || !ids) {
+		free(slots);
+		free(ids);
+		return 0;
+	}
+
+	for (i=0; i<p->nslots; i++) {
+		size_t s;
+
+		if (!p->slots[i]) {
+			continue;
+		}
+		s = filter_basic_hash(p->slots[i]) & (nslots - 1);
+		while (slots[s]) {
+			s = (s + 1) & (nslots - 1);
+		}
+		slots[s] = p->slots[i];
+		ids[s] = p->ids[i];
+	}
+
+	free(p->slots);
+	free(p->ids);
+	p->slots = slots;
+	p->ids = ids;
+	p->nslots = nslots;
+
+	return 1;
+}
+
+static void
+filter_preds_columns_add(struct filter_preds *p, struct filter_basic *fb)
+{
+	int id;
+
+	if (fb->direction & FILTER_BASIC_DIR_SRC) {
+		id = filter_column_id(fb, FILTER_BASIC_DIR_SRC);
+		if (id >= 0) {
+			FILTER_BITMAP_SET(p->columns, id);
+		}
+	}
+	if (fb->direction & FILTER_BASIC_DIR_DST) {
+		id = filter_column_id(fb, FILTER_BASIC_DIR_DST);
+		if (id >= 0) {
+			FILTER_BITMAP_SET(p->columns, id);
+		}
+	}
+}
+
+int
+filter_preds_add(struct filter_preds *p, struct filter_expr *e)
+{
+	size_t i;
+
+	if (!e) {
+		return 1;
+	}
+
+	for (i=0; i<e->n; i++) {
+		struct filter_op *op = &e->filter[i];
+		size_t s;
+
+		if (op->op != FILTER_OP_BASIC) {
+			continue;
+		}
+		p->nleaves++;
+		if (!filter_preds_shareable(op->arg)) {
+			continue;
+		}
+
+		/* load factor is less than 1/2 */
+		if ((p->n + 1) * 2 > p->nslots) {
+			if (!filter_preds_grow(p)) {
+				LOG("Not enough memory");
+				return 0;
+			}
+		}
+
+		s = filter_basic_hash(op->arg) & (p->nslots - 1);
+		while (p->slots[s]) {
+			if (filter_basic_equal(p->slots[s], op->arg)) {
+				break;
+			}
+			s = (s + 1) & (p->nslots - 1);
+		}
+
+		if (!p->slots[s]) {
+			p->slots[s] = op->arg;
+			p->ids[s] = p->n;
+			p->n++;
+			filter_preds_columns_add(p, op->arg);
+		}
+		op->pred = p->ids[s] + 1;
+	}
+
+	return 1;
+}
+
+int
+filter_preds_memo_init(struct filter_preds *p, size_t nthreads)
+{
+	size_t i, nwords, stride;
+
+	nwords = (p->n + 63) / 64;
+	if (nwords == 0) {
+		nwords = 1;
+	}
+	/* bitmaps and masks of rows of thread on own cache lines */
+	stride = CACHE_LINE_ROUND((nwords + p->n) * 2 * sizeof(uint64_t))
+		/ sizeof(uint64_t);
+
+	p->bits = calloc_cl(nthreads * stride, sizeof(uint64_t));
+	p->memo = calloc_cl(nthreads, sizeof(struct filter_memo));
+	if (!p->bits || !p->memo) {
+		LOG("Not enough memory");
+		free(p->bits);
+		free(p->memo);
+		p->bits = NULL;
+		p->memo = NULL;
+		return 0;
+	}
+
+	p->nthreads = nthreads;
+	for (i=0; i<nthreads; i++) {
+		p->memo[i].evaluated = p->bits + i * stride;
+		p->memo[i].value = p->memo[i].evaluated + nwords;
+		p->memo[i].nwords = nwords;
+		p->memo[i].rows_done = p->memo[i].value + nwords;
+		p->memo[i].rows_value = p->memo[i].rows_done + p->n;
+		p->memo[i].npreds = p->n;
+	}
+
+	return 1;
+}
+
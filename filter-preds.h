@@ -0,0 +1,113 @@
+#ifndef filter_preds_h_included
+#define filter_preds_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utils.h"
+
+/*
+ * Predicates shared by filters of all monitoring objects
+ *
+ * Sibling and nested objects often have the same basic filters ("proto 17",
+ * "dst net @mynet" of parent repeated in children). Equal basic filters
+ * (leaves) of the whole tree get one predicate id, stored in filter_op.
+ * Each thread has a memo: two bitmaps over predicate ids, "evaluated" and
+ * "value". Memo is cleared before each flow, so each distinct leaf is
+ * evaluated at most once per flow. For block of flows (filter_match_batch())
+ * memo keeps masks of rows for each predicate instead of bits, fields of
+ * shared leaves are copied to columns of block.
+ *
+ * Leaves which depend on the object (tenant of family, class names set by
+ * classification, DNS and SNI from payload parsed by object) or have side
+ * effects (mfreq()) are not shared and evaluated every time
+ */
+
+struct filter_expr;
+struct filter_basic;
+
+struct filter_memo
+{
+	_Alignas(CACHE_LINE_SIZE) uint64_t *evaluated;
+	uint64_t *value;
+	size_t nwords;
+
+	/* block of flows: per predicate masks of evaluated rows and values */
+	uint64_t *rows_done;
+	uint64_t *rows_value;
+	size_t npreds;
+
+	/* leaves of matched filters and leaves really evaluated */
+	uint64_t nleaves;
+	uint64_t nevals;
+};
+
+struct filter_preds
+{
+	/* number of distinct predicates */
+	size_t n;
+
+	/* hash table of representative leaves, open addressing */
+	size_t nslots;
+	struct filter_basic **slots;
+	uint32_t *ids;
+
+	/* all leaves, including duplicates */
+	size_t nleaves;
+
+	/* bitmap of columns of blocks used by shared leaves */
+	uint64_t *columns;
+
+	size_t nthreads;
+	uint64_t *bits;
+	struct filter_memo *memo;
+};
+
+struct filter_preds *filter_preds_new(void);
+void filter_preds_free(struct filter_preds *p);
+
+/* set predicate ids of leaves in expression */
+int filter_preds_add(struct filter_preds *p, struct filter_expr *e);
+
+/* allocate per-thread memo after all expressions are added */
+int filter_preds_memo_init(struct filter_preds *p, size_t nthreads);
+
+static inline struct filter_memo *
+filter_preds_memo(struct filter_preds *p, size_t thread_id)
+{
+	if (!p || !p->memo) {
+		return NULL;
+	}
+
+	return &p->memo[thread_id];
+}
+
+/* before each flow */
+static inline void
+filter_memo_reset(struct filter_memo *m)
+{
+	if (!m) {
+		return;
+	}
+
+	memset(m->evaluated, 0, m->nwords * sizeof(uint64_t));
+	m->nleaves = 0;
+	m->nevals = 0;
+}
+
+/* before each block of flows */
+static inline void
+filter_memo_reset_batch(struct filter_memo *m)
+{
+	if (!m) {
+		return;
+	}
+
+	memset(m->rows_done, 0, m->npreds * sizeof(uint64_t));
+	m->nleaves = 0;
+	m->nevals = 0;
+}
+
+#endif
+
@@ -16,11 +16,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "filter.h"
+#include "filter-preds.h"
 #include "netflow.h"
 #include "utils.h"
 #include "flow-info.h"
@@ -34,7 +36,8 @@ enum FIELDS_SIZEMAX {
 
 	FIELD_SIZEMAX_dev_ip6 = 16,
 	FIELD_SIZEMAX_dev_id = 4,
-	FIELD_SIZEMAX_dev_mark = 4
+	FIELD_SIZEMAX_dev_mark = 4,
+	FIELD_SIZEMAX_tenant = 4
 };
 
 void
@@ -60,6 +63,7 @@ filter_add_basic_filter(struct filter_expr *e, enum FILTER_BASIC_TYPE type,
 	fb->n = 0;
 	fb->data = NULL;
 	fb->direction = dir;
+	memset(&fb->set, 0, sizeof(struct filter_set));
 
 	fb->is_func = 0;
 
@@ -72,6 +76,7 @@ filter_add_basic_filter(struct filter_expr *e, enum FILTER_BASIC_TYPE type,
 
 	e->filter[e->n].op = FILTER_OP_BASIC;
 	e->filter[e->n].arg = fb;
+	e->filter[e->n].pred = 0;
 	e->n++;
 
 	return 1;
@@ -244,6 +249,7 @@ filter_add_op(struct filter_expr *e, enum FILTER_OP op)
 
 	e->filter[e->n].op = op;
 	e->filter[e->n].arg = NULL;
+	e->filter[e->n].pred = 0;
 	e->n++;
 
 	return 1;
@@ -252,6 +258,84 @@ fail_realloc:
 	return 0;
 }
 
+/* compiled sets of literals */
+static int
+filter_set_match_int(struct filter_set *set, int r)
+{
+	size_t lo, hi;
+
+	if (set->type == FILTER_SET_BITMAP) {
+		if ((r < 0) || (r > UINT16_MAX)) {
+			return 0;
+		}
+		return FILTER_BITMAP_TEST(set->bitmap, r);
+	}
+
+	/* last range with low <= r */
+	lo = 0;
+	hi = set->nranges;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (set->ranges[mid].low <= r) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return (lo > 0) && (r <= set->ranges[lo - 1].high);
+}
+
+static int
+filter_set_match_addr4(struct filter_set *set, uint32_t *addr,
+	uint32_t *addr2)
+{
+	size_t i;
+
+	if (addr && iplist_match4(set->trie, *addr)) {
+		return 1;
+	}
+	if (addr2 && iplist_match4(set->trie, *addr2)) {
+		return 1;
+	}
+
+	for (i=0; i<set->nlists; i++) {
+		if (addr && iplist_match4(set->lists[i], *addr)) {
+			return 1;
+		}
+		if (addr2 && iplist_match4(set->lists[i], *addr2)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+filter_set_match_addr6(struct filter_set *set, xe_ip *addr, xe_ip *addr2)
+{
+	size_t i;
+
+	if (addr && iplist_match6(set->trie, addr)) {
+		return 1;
+	}
+	if (addr2 && iplist_match6(set->trie, addr2)) {
+		return 1;
+	}
+
+	for (i=0; i<set->nlists; i++) {
+		if (addr && iplist_match6(set->lists[i], addr)) {
+			return 1;
+		}
+		if (addr2 && iplist_match6(set->lists[i], addr2)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
 static int
 filter_basic_match_single_addr4(int direction, struct filter_basic_data *fbd,
 	uint32_t *addr, uint32_t *addr2)
@@ -345,6 +429,10 @@ filter_basic_match_addr4(struct filter_basic *fb, struct flow_info *flow)
 		return 0;
 	}
 
+	if (fb->set.type == FILTER_SET_TRIE) {
+		return filter_set_match_addr4(&fb->set, addr4, addr4_second);
+	}
+
 	for (i=0; i<fb->n; i++) {
 		if (filter_basic_match_single_addr4(fb->direction,
 			&(fb->data[i]), addr4, addr4_second)) {
@@ -454,6 +542,10 @@ filter_basic_match_addr6(struct filter_basic *fb, struct flow_info *flow)
 		return 0;
 	}
 
+	if (fb->set.type == FILTER_SET_TRIE) {
+		return filter_set_match_addr6(&fb->set, addr6, addr6_second);
+	}
+
 	for (i=0; i<fb->n; i++) {
 		if (filter_basic_match_single_addr6(fb->direction,
 			&(fb->data[i]), addr6, addr6_second)) {
@@ -528,6 +620,18 @@ filter_basic_match_range(struct filter_basic *fb, struct flow_info *flow)
 			return 0;
 	}
 
+	if (fb->set.type != FILTER_SET_NONE) {
+		if (filter_set_match_int(&fb->set, r1)) {
+			return 1;
+		}
+		if ((fb->direction == FILTER_BASIC_DIR_BOTH)
+			&& filter_set_match_int(&fb->set, r2)) {
+
+			return 1;
+		}
+		return 0;
+	}
+
 	for (i=0; i<fb->n; i++) {
 		if (fb->direction != FILTER_BASIC_DIR_BOTH) {
 			if ((r1 >= fb->data[i].data.range.low)
@@ -722,8 +826,8 @@ filter_function_mfreq(struct filter_basic *fb, struct flow_info *flow)
 	arg2 = get_nf_val((uintptr_t)flow + mfreq->arg2_off,
 		mfreq->arg2_size);
 
-	freq1 = mfreq->freqmap[arg1];
-	freq2 = mfreq->freqmap[arg2];
+	freq1 = freqmap_get(mfreq->freqmap, arg1);
+	freq2 = freqmap_get(mfreq->freqmap, arg2);
 
 	if (freq1 != freq2) {
 		res = (freq1 > freq2) ? arg1 : arg2;
@@ -733,11 +837,8 @@ filter_function_mfreq(struct filter_basic *fb, struct flow_info *flow)
 	}
 
 	/* update freqmap */
-	atomic_fetch_add_explicit(&mfreq->freqmap[arg1], 1,
-		memory_order_relaxed);
-	atomic_fetch_add_explicit(&mfreq->freqmap[arg1], 1,
-		memory_order_relaxed);
-
+	freqmap_add(mfreq->freqmap, arg1);
+	freqmap_add(mfreq->freqmap, arg2);
 
 	for (i=0; i<fb->n; i++) {
 		if ((res >= fb->data[i].data.range.low)
@@ -834,22 +935,30 @@ filter_function_as(struct filter_basic *fb, struct flow_info *flow)
 }
 
 static int
-filter_function_tfstr(struct filter_basic *fb, struct flow_info *flow)
+filter_function_pfx(struct filter_basic *fb, struct flow_info *flow)
 {
 	size_t i;
-	struct function_tfstr *tfstr = fb->func_data.tfstr;
-	uint8_t tf;
-	if (tfstr->tf_size == 2) {
-		/* FIXME: add AE (Accurate ECN) */
-		tf = *((uint8_t *)((uintptr_t)flow + tfstr->tf_off + 1));
+	struct function_pfx *pfx = fb->func_data.pfx;
+	char *res = NULL;
+
+	if (pfx->ip_size == sizeof(uint32_t)) {
+		uint32_t addr = *((uint32_t *)
+			((uintptr_t)flow + pfx->ip_off));
+
+		if (!rib_lookup4(addr, &res)) {
+			return 0;
+		}
 	} else {
-		tf = *((uint8_t *)((uintptr_t)flow + tfstr->tf_off));
+		xe_ip addr = *((xe_ip *)
+			((uintptr_t)flow + pfx->ip_off));
+
+		if (!rib_lookup6(&addr, &res)) {
+			return 0;
+		}
 	}
 
 	for (i=0; i<fb->n; i++) {
-		char *flg = tcp_flags_to_str(tf);
-
-		if (strcasecmp(fb->data[i].data.str, flg) == 0) {
+		if (strcmp(fb->data[i].data.str, res) == 0) {
 			return 1;
 		}
 	}
@@ -857,26 +966,31 @@ filter_function_tfstr(struct filter_basic *fb, struct flow_info *flow)
 	return 0;
 }
 
+static int
+filter_function_tfstr(struct filter_basic *fb, struct flow_info *flow)
+{
+	struct function_tfstr *tfstr = fb->func_data.tfstr;
+	uint8_t tf;
+	if (tfstr->tf_size == 2) {
+		/* FIXME: add AE (Accurate ECN) */
+		tf = *((uint8_t *)((uintptr_t)flow + tfstr->tf_off + 1));
+	} else {
+		tf = *((uint8_t *)((uintptr_t)flow + tfstr->tf_off));
+	}
+
+	return FILTER_BITMAP_TEST(tfstr->bitmap, tf);
+}
+
 static int
 filter_function_portstr(struct filter_basic *fb, struct flow_info *flow)
 {
-	size_t i;
 	struct function_portstr *portstr = fb->func_data.portstr;
 	uint16_t port;
 
 	port = get_nf_val((uintptr_t)flow + portstr->port_off,
 		portstr->port_size);
 
-	for (i=0; i<fb->n; i++) {
-		char p[32];
-		port_to_str(p, port);
-
-		if (strcasecmp(fb->data[i].data.str, p) == 0) {
-			return 1;
-		}
-	}
-
-	return 0;
+	return FILTER_BITMAP_TEST(portstr->bitmap, port);
 }
 
 static int
@@ -891,12 +1005,21 @@ filter_function_ppstr(struct filter_basic *fb, struct flow_info *flow)
 	port2 = get_nf_val((uintptr_t)flow + ppstr->arg2_off,
 		ppstr->arg2_size);
 
-	for (i=0; i<fb->n; i++) {
-		char pp[64];
-		ports_pair_to_str(pp, port1, port2);
+	for (i=0; i<ppstr->nrules; i++) {
+		struct ppstr_rule *r = &ppstr->rules[i];
 
-		if (strcasecmp(fb->data[i].data.str, pp) == 0) {
-			return 1;
+		if (r->side == PPSTR_PORT1) {
+			if ((r->port == port1)
+				&& FILTER_BITMAP_TEST(r->bitmap, port2)) {
+
+				return 1;
+			}
+		} else {
+			if ((r->port == port2)
+				&& FILTER_BITMAP_TEST(r->bitmap, port1)) {
+
+				return 1;
+			}
 		}
 	}
 
@@ -928,6 +1051,8 @@ FOR_LIST_OF_GEOIP_FIELDS
 			case FILTER_BASIC_NAME_ASN:
 			case FILTER_BASIC_NAME_ASD:
 				return filter_function_as(fb, flow);
+			case FILTER_BASIC_NAME_PFX:
+				return filter_function_pfx(fb, flow);
 			case FILTER_BASIC_NAME_TFSTR:
 				return filter_function_tfstr(fb, flow);
 			case FILTER_BASIC_NAME_PORTSTR:
@@ -957,8 +1082,483 @@ FOR_LIST_OF_GEOIP_FIELDS
 	return ret;
 }
 
+static inline int
+filter_leaf_match(struct filter_op *op, struct flow_info *flow,
+	struct filter_memo *memo)
+{
+	size_t id;
+	int ret;
+
+	if (!memo) {
+		return filter_basic_match(op->arg, flow);
+	}
+
+	memo->nleaves++;
+	if (!op->pred) {
+		memo->nevals++;
+		return filter_basic_match(op->arg, flow);
+	}
+
+	id = op->pred - 1;
+	if (FILTER_BITMAP_TEST(memo->evaluated, id)) {
+		return FILTER_BITMAP_TEST(memo->value, id);
+	}
+
+	memo->nevals++;
+	ret = filter_basic_match(op->arg, flow);
+	FILTER_BITMAP_SET(memo->evaluated, id);
+	if (ret) {
+		FILTER_BITMAP_SET(memo->value, id);
+	} else {
+		FILTER_BITMAP_CLEAR(memo->value, id);
+	}
+
+	return ret;
+}
+
+/* fields of filter.def in struct flow_info, for columns of blocks */
+struct filter_column_def
+{
+	enum FILTER_BASIC_TYPE type;
+	unsigned int off;
+	unsigned int size;
+	unsigned int has_off;
+};
+
+static const struct filter_column_def column_defs[FILTER_NCOLUMNS] = {
+#define FIELD(NAME, STR, TYPE, SRC, DST)                                     \
+	[FILTER_BASIC_NAME_##NAME * 2] = {FILTER_BASIC_##TYPE,               \
+		offsetof(struct flow_info, SRC), FIELD_SIZEMAX_##SRC,        \
+		offsetof(struct flow_info, has_##SRC)},                      \
+	[FILTER_BASIC_NAME_##NAME * 2 + 1] = {FILTER_BASIC_##TYPE,           \
+		offsetof(struct flow_info, DST), FIELD_SIZEMAX_##DST,        \
+		offsetof(struct flow_info, has_##DST)},
+#include "filter.def"
+};
+
 int
-filter_match(struct filter_expr *expr, struct flow_info *flow)
+filter_column_id(struct filter_basic *fb, int dir)
+{
+	int id;
+
+	if (fb->is_func || (fb->name == FILTER_BASIC_NAME_NONE)
+		|| (fb->name >= FILTER_BASIC_NAME_DIV)) {
+
+		return -1;
+	}
+
+	id = fb->name * 2;
+	/* "proto", "tcp-flags" etc. have one field for both directions */
+	if ((dir == FILTER_BASIC_DIR_DST)
+		&& (column_defs[id + 1].off != column_defs[id].off)) {
+
+		id++;
+	}
+
+	switch (column_defs[id].type) {
+		case FILTER_BASIC_ADDR4:
+		case FILTER_BASIC_ADDR6:
+			break;
+		case FILTER_BASIC_RANGE:
+			/* the same conversion as in filter_basic_match_range() */
+			if (column_defs[id].size > sizeof(uint32_t)) {
+				return -1;
+			}
+			break;
+		default:
+			return -1;
+	}
+
+	return id;
+}
+
+struct filter_block *
+filter_block_new(const uint64_t *columns)
+{
+	struct filter_block *b;
+	size_t i, ncols = 0;
+
+	b = calloc(1, sizeof(struct filter_block));
+	if (!b) {
+		LOG("Not enough memory");
+		goto fail_block;
+	}
+
+	for (i=0; columns && (i<FILTER_NCOLUMNS); i++) {
+		ncols += FILTER_BITMAP_TEST(columns, i);
+	}
+
+	if (ncols) {
+		b->data = calloc_cl(ncols, sizeof(struct filter_column));
+		if (!b->data) {
+			LOG("Not enough memory");
+			goto fail_data;
+		}
+	}
+
+	ncols = 0;
+	for (i=0; columns && (i<FILTER_NCOLUMNS); i++) {
+		if (FILTER_BITMAP_TEST(columns, i)) {
+			b->cols[i] = &b->data[ncols];
+			ncols++;
+		}
+	}
+
+	/* columns are filled for next generation */
+	b->gen = 1;
+
+	return b;
+
+fail_data:
+	free(b);
+fail_block:
+	return NULL;
+}
+
+void
+filter_block_free(struct filter_block *b)
+{
+	if (!b) {
+		return;
+	}
+
+	free(b->data);
+	free(b);
+}
+
+struct filter_column *
+filter_block_column(struct filter_block *b, int id)
+{
+	struct filter_column *c = b->cols[id];
+	const struct filter_column_def *def = &column_defs[id];
+	size_t r;
+
+	if (!c || ((c->gen == b->gen) && (c->n == b->n))) {
+		return c;
+	}
+
+	/* copy field of all rows */
+	c->has = 0;
+	for (r=0; r<b->n; r++) {
+		uint8_t *flow = (uint8_t *)b->flows[r];
+		int has;
+
+		memcpy(&has, flow + def->has_off, sizeof(int));
+		c->has |= (uint64_t)(has != 0) << r;
+	}
+
+	switch (def->type) {
+		case FILTER_BASIC_ADDR4:
+			for (r=0; r<b->n; r++) {
+				memcpy(&c->v.addr4[r],
+					(uint8_t *)b->flows[r] + def->off,
+					sizeof(uint32_t));
+			}
+			break;
+		case FILTER_BASIC_ADDR6:
+			for (r=0; r<b->n; r++) {
+				memcpy(&c->v.addr6[r],
+					(uint8_t *)b->flows[r] + def->off,
+					sizeof(xe_ip));
+			}
+			break;
+		default:
+			for (r=0; r<b->n; r++) {
+				uint8_t *ptr = (uint8_t *)b->flows[r] + def->off;
+				uint16_t v16;
+				uint32_t v32;
+
+				if (def->size == 1) {
+					c->v.num[r] = *ptr;
+				} else if (def->size == 2) {
+					memcpy(&v16, ptr, sizeof(uint16_t));
+					c->v.num[r] = be16toh(v16);
+				} else {
+					memcpy(&v32, ptr, sizeof(uint32_t));
+					c->v.num[r] = be32toh(v32);
+				}
+			}
+			break;
+	}
+
+	c->gen = b->gen;
+	c->n = b->n;
+
+	return c;
+}
+
+static inline uint64_t
+filter_basic_match_rows(struct filter_basic *fb, struct flow_info **flows,
+	uint64_t rows)
+{
+	uint64_t res = 0;
+
+	while (rows) {
+		int r = __builtin_ctzll(rows);
+
+		rows &= rows - 1;
+		if (filter_basic_match(fb, flows[r])) {
+			res |= 1ULL << r;
+		}
+	}
+
+	return res;
+}
+
+static uint64_t
+filter_column_match_num(struct filter_basic *fb, struct filter_column *c,
+	size_t n)
+{
+	uint64_t res = 0;
+	size_t i, r;
+
+	if (fb->set.type != FILTER_SET_NONE) {
+		for (r=0; r<n; r++) {
+			res |= (uint64_t)filter_set_match_int(&fb->set,
+				c->v.num[r]) << r;
+		}
+		return res;
+	}
+
+	for (i=0; i<fb->n; i++) {
+		int low = fb->data[i].data.range.low;
+		int high = fb->data[i].data.range.high;
+
+		for (r=0; r<n; r++) {
+			int v = c->v.num[r];
+
+			res |= (uint64_t)((v >= low) & (v <= high)) << r;
+		}
+	}
+
+	return res;
+}
+
+/* rows without address don't match */
+static uint64_t
+filter_column_match_addr4(struct filter_basic *fb, struct filter_column *c,
+	size_t n)
+{
+	uint64_t res = 0;
+	size_t i, r;
+
+	if (fb->set.type == FILTER_SET_TRIE) {
+		for (r=0; r<n; r++) {
+			res |= (uint64_t)filter_set_match_addr4(&fb->set,
+				&c->v.addr4[r], NULL) << r;
+		}
+		return res & c->has;
+	}
+
+	for (i=0; i<fb->n; i++) {
+		struct filter_basic_data *d = &fb->data[i];
+		uint32_t addr = d->data.ip.ip.v4.addr;
+		uint32_t mask = d->data.ip.ip.v4.mask;
+
+		if (d->is_list) {
+			for (r=0; r<n; r++) {
+				res |= (uint64_t)iplist_match4(d->data.addr_list,
+					c->v.addr4[r]) << r;
+			}
+			continue;
+		}
+
+		for (r=0; r<n; r++) {
+			res |= (uint64_t)((c->v.addr4[r] & mask) == addr) << r;
+		}
+	}
+
+	return res & c->has;
+}
+
+static uint64_t
+filter_column_match_addr6(struct filter_basic *fb, struct filter_column *c,
+	size_t n)
+{
+	uint64_t res = 0;
+	size_t i, r;
+
+	if (fb->set.type == FILTER_SET_TRIE) {
+		for (r=0; r<n; r++) {
+			res |= (uint64_t)filter_set_match_addr6(&fb->set,
+				&c->v.addr6[r], NULL) << r;
+		}
+		return res & c->has;
+	}
+
+	for (i=0; i<fb->n; i++) {
+		struct filter_basic_data *d = &fb->data[i];
+		xe_ip addr = d->data.ip.ip.v6.addr;
+		xe_ip mask = d->data.ip.ip.v6.mask;
+
+		if (d->is_list) {
+			for (r=0; r<n; r++) {
+				res |= (uint64_t)iplist_match6(d->data.addr_list,
+					&c->v.addr6[r]) << r;
+			}
+			continue;
+		}
+
+		for (r=0; r<n; r++) {
+			res |= (uint64_t)((c->v.addr6[r] & mask) == addr) << r;
+		}
+	}
+
+	return res & c->has;
+}
+
+static uint64_t
+filter_column_match(struct filter_basic *fb, struct filter_column *c,
+	size_t n)
+{
+	switch (fb->type) {
+		case FILTER_BASIC_ADDR4:
+			return filter_column_match_addr4(fb, c, n);
+		case FILTER_BASIC_ADDR6:
+			return filter_column_match_addr6(fb, c, n);
+		default:
+			return filter_column_match_num(fb, c, n);
+	}
+}
+
+/*
+ * All rows of block from columns of field, 0 if some column of basic filter
+ * isn't in block
+ */
+static int
+filter_basic_match_columns(struct filter_basic *fb, struct filter_block *b,
+	uint64_t *res)
+{
+	struct filter_column *src = NULL, *dst = NULL;
+	int id;
+
+	if (fb->direction & FILTER_BASIC_DIR_SRC) {
+		id = filter_column_id(fb, FILTER_BASIC_DIR_SRC);
+		if ((id < 0) || !(src = filter_block_column(b, id))) {
+			return 0;
+		}
+	}
+	if (fb->direction & FILTER_BASIC_DIR_DST) {
+		id = filter_column_id(fb, FILTER_BASIC_DIR_DST);
+		if ((id < 0) || !(dst = filter_block_column(b, id))) {
+			return 0;
+		}
+	}
+	if (!src && !dst) {
+		return 0;
+	}
+
+	*res = 0;
+	if (src) {
+		*res |= filter_column_match(fb, src, b->n);
+	}
+	if (dst && (dst != src)) {
+		*res |= filter_column_match(fb, dst, b->n);
+	}
+
+	return 1;
+}
+
+static inline uint64_t
+filter_leaf_match_batch(struct filter_op *op, struct filter_block *b,
+	uint64_t rows, struct filter_memo *memo)
+{
+	size_t id;
+	uint64_t todo, res;
+
+	if (!memo) {
+		return filter_basic_match_rows(op->arg, b->flows, rows);
+	}
+
+	memo->nleaves += __builtin_popcountll(rows);
+	if (!op->pred) {
+		memo->nevals += __builtin_popcountll(rows);
+		return filter_basic_match_rows(op->arg, b->flows, rows);
+	}
+
+	/* rows of parent object may be already evaluated */
+	id = op->pred - 1;
+	todo = rows & ~memo->rows_done[id];
+	if (!todo) {
+		return memo->rows_value[id] & rows;
+	}
+
+	/* shared leaf over columns, once for all rows of block */
+	if (filter_basic_match_columns(op->arg, b, &res)) {
+		memo->nevals += b->n;
+		memo->rows_value[id] = res;
+		memo->rows_done[id] = filter_block_rows(b);
+		return res & rows;
+	}
+
+	memo->nevals += __builtin_popcountll(todo);
+	res = filter_basic_match_rows(op->arg, b->flows, todo);
+	memo->rows_value[id] = (memo->rows_value[id] & ~todo) | res;
+	memo->rows_done[id] |= todo;
+
+	return memo->rows_value[id] & rows;
+}
+
+/*
+ * Filter for block of up to 64 flows: each basic filter is evaluated for all
+ * selected rows, then operators work with masks of rows
+ */
+uint64_t
+filter_match_batch(struct filter_expr *expr, struct filter_block *b,
+	uint64_t rows, struct filter_memo *memo)
+{
+	size_t i;
+	uint64_t *stack = alloca(expr->n * sizeof(uint64_t));
+	size_t sp = 0;
+
+	if (expr->n == 0) {
+		/* empty filter, match all */
+		return rows;
+	}
+
+	for (i=0; i<expr->n; i++) {
+		struct filter_op *op = &expr->filter[i];
+		switch (op->op) {
+			case FILTER_OP_BASIC:
+				stack[sp] = filter_leaf_match_batch(op, b,
+					rows, memo);
+				sp++;
+				break;
+			case FILTER_OP_NOT:
+				if (sp < 1) {
+					return 0;
+				}
+				stack[sp - 1] = ~stack[sp - 1] & rows;
+				break;
+			case FILTER_OP_AND:
+				if (sp < 2) {
+					return 0;
+				}
+				stack[sp - 2] &= stack[sp - 1];
+				sp--;
+				break;
+			case FILTER_OP_OR:
+				if (sp < 2) {
+					return 0;
+				}
+				stack[sp - 2] |= stack[sp - 1];
+				sp--;
+				break;
+			default:
+				return 0;
+		}
+	}
+
+	if (sp != 1) {
+		return 0;
+	}
+
+	return stack[0];
+}
+
+int
+filter_match_memo(struct filter_expr *expr, struct flow_info *flow,
+	struct filter_memo *memo)
 {
 	size_t i;
 	int ret;
@@ -974,7 +1574,7 @@ filter_match(struct filter_expr *expr, struct flow_info *flow)
 		struct filter_op *op = &expr->filter[i];
 		switch (op->op) {
 			case FILTER_OP_BASIC:
-				stack[sp] = filter_basic_match(op->arg, flow);
+				stack[sp] = filter_leaf_match(op, flow, memo);
 				sp++;
 				break;
 			case FILTER_OP_NOT:
@@ -1011,6 +1611,215 @@ filter_match(struct filter_expr *expr, struct flow_info *flow)
 	return ret;
 }
 
+int
+filter_match(struct filter_expr *expr, struct flow_info *flow)
+{
+	return filter_match_memo(expr, flow, NULL);
+}
+
+static void
+filter_set_free(struct filter_set *set)
+{
+	free(set->bitmap);
+	free(set->ranges);
+	iplist_free(set->trie);
+	free(set->lists);
+	memset(set, 0, sizeof(struct filter_set));
+}
+
+/* max size of field in flow, bytes */
+static int
+filter_basic_field_size(struct filter_basic *fb)
+{
+	switch (fb->name) {
+#define FIELD(NAME, STR, TYPE, SRC, DST)                                     \
+		case FILTER_BASIC_NAME_##NAME:                               \
+			return (FIELD_SIZEMAX_##SRC > FIELD_SIZEMAX_##DST)   \
+				? FIELD_SIZEMAX_##SRC : FIELD_SIZEMAX_##DST;
+#include "filter.def"
+		default:
+			break;
+	}
+
+	return 0;
+}
+
+static int
+range_cmp(const void *a, const void *b)
+{
+	const struct int_range *r1 = a, *r2 = b;
+
+	if (r1->low != r2->low) {
+		return (r1->low < r2->low) ? -1 : 1;
+	}
+	return (r1->high < r2->high) ? -1 : (r1->high > r2->high);
+}
+
+static int
+filter_set_compile_ranges(struct filter_basic *fb)
+{
+	struct filter_set *set = &fb->set;
+	size_t i, n = 0;
+
+	if (filter_basic_field_size(fb) <= (int)sizeof(uint16_t)) {
+		set->bitmap = calloc((UINT16_MAX + 1) / 64, sizeof(uint64_t));
+		if (!set->bitmap) {
+			return 0;
+		}
+
+		for (i=0; i<fb->n; i++) {
+			int v, low, high;
+
+			low = fb->data[i].data.range.low;
+			high = fb->data[i].data.range.high;
+			if (low < 0) {
+				low = 0;
+			}
+			if (high > UINT16_MAX) {
+				high = UINT16_MAX;
+			}
+			for (v=low; v<=high; v++) {
+				FILTER_BITMAP_SET(set->bitmap, v);
+			}
+		}
+
+		set->type = FILTER_SET_BITMAP;
+		return 1;
+	}
+
+	set->ranges = malloc(fb->n * sizeof(struct int_range));
+	if (!set->ranges) {
+		return 0;
+	}
+
+	for (i=0; i<fb->n; i++) {
+		if (fb->data[i].data.range.low <= fb->data[i].data.range.high) {
+			set->ranges[n++] = fb->data[i].data.range;
+		}
+	}
+	qsort(set->ranges, n, sizeof(struct int_range), &range_cmp);
+
+	/* merge overlapping and adjacent ranges */
+	set->nranges = 0;
+	for (i=0; i<n; i++) {
+		struct int_range *last;
+
+		if (set->nranges == 0) {
+			set->ranges[set->nranges++] = set->ranges[i];
+			continue;
+		}
+
+		last = &set->ranges[set->nranges - 1];
+		if ((long long)set->ranges[i].low <= (long long)last->high + 1) {
+			if (set->ranges[i].high > last->high) {
+				last->high = set->ranges[i].high;
+			}
+			continue;
+		}
+		set->ranges[set->nranges++] = set->ranges[i];
+	}
+
+	set->type = FILTER_SET_RANGES;
+	return 1;
+}
+
+static int
+filter_set_compile_addrs(struct filter_basic *fb)
+{
+	struct filter_set *set = &fb->set;
+	int max_mask = (fb->type == FILTER_BASIC_ADDR4) ? 32 : 16 * 8;
+	size_t i;
+
+	/* out of range masks are matched as before */
+	for (i=0; i<fb->n; i++) {
+		struct filter_basic_data *d = &fb->data[i];
+
+		if (!d->is_list && ((d->data.ip.mask_len < 0)
+			|| (d->data.ip.mask_len > max_mask))) {
+
+			return 1;
+		}
+	}
+
+	set->trie = iplist_new();
+	if (!set->trie) {
+		return 0;
+	}
+
+	for (i=0; i<fb->n; i++) {
+		struct filter_basic_data *d = &fb->data[i];
+		int ok;
+
+		if (d->is_list) {
+			struct iplist **tmp;
+
+			tmp = realloc(set->lists,
+				(set->nlists + 1) * sizeof(struct iplist *));
+			if (!tmp) {
+				return 0;
+			}
+			set->lists = tmp;
+			set->lists[set->nlists++] = d->data.addr_list;
+			continue;
+		}
+
+		if (fb->type == FILTER_BASIC_ADDR4) {
+			ok = iplist_add4(set->trie, d->data.ip.ip.v4.addr,
+				d->data.ip.mask_len);
+		} else {
+			ok = iplist_add6(set->trie, &d->data.ip.ip.v6.addr,
+				d->data.ip.mask_len);
+		}
+		if (!ok) {
+			return 0;
+		}
+	}
+
+	set->type = FILTER_SET_TRIE;
+	return 1;
+}
+
+void
+filter_compile(struct filter_expr *e)
+{
+	size_t i;
+
+	for (i=0; i<e->n; i++) {
+		struct filter_basic *fb = e->filter[i].arg;
+		int ok = 1;
+
+		if (!fb || fb->is_func || (fb->n < FILTER_SET_MIN_LITERALS)) {
+			continue;
+		}
+
+		if (fb->type == FILTER_BASIC_RANGE) {
+			ok = filter_set_compile_ranges(fb);
+		} else if ((fb->type == FILTER_BASIC_ADDR4)
+			|| (fb->type == FILTER_BASIC_ADDR6)) {
+
+			ok = filter_set_compile_addrs(fb);
+		}
+
+		if (!ok) {
+			/* not enough memory, literals are scanned */
+			LOG("Can't compile filter, not enough memory");
+			filter_set_free(&fb->set);
+		}
+	}
+}
+
+static void
+ppstr_free(struct function_ppstr *ppstr)
+{
+	size_t i;
+
+	for (i=0; i<ppstr->nrules; i++) {
+		free(ppstr->rules[i].bitmap);
+	}
+	free(ppstr->rules);
+	free(ppstr);
+}
+
 void
 filter_free(struct filter_expr *e)
 {
@@ -1020,6 +1829,7 @@ filter_free(struct filter_expr *e)
 	for (i=0; i<e->n; i++) {
 		fb = e->filter[i].arg;
 		if (fb) {
+			filter_set_free(&fb->set);
 			free(fb->data);
 			fb->data = NULL;
 			if (fb->is_func) {
@@ -1035,7 +1845,7 @@ filter_free(struct filter_expr *e)
 						fb->func_data.min = NULL;
 						break;
 					case FILTER_BASIC_NAME_MFREQ:
-						free(fb->func_data.mfreq
+						freqmap_free(fb->func_data.mfreq
 							->freqmap);
 						free(fb->func_data.mfreq);
 						fb->func_data.mfreq = NULL;
@@ -1052,6 +1862,24 @@ FOR_LIST_OF_GEOIP_FIELDS
 						free(fb->func_data.as);
 						fb->func_data.as = NULL;
 						break;
+					case FILTER_BASIC_NAME_PFX:
+						free(fb->func_data.pfx);
+						fb->func_data.pfx = NULL;
+						break;
+					case FILTER_BASIC_NAME_TFSTR:
+						free(fb->func_data.tfstr);
+						fb->func_data.tfstr = NULL;
+						break;
+					case FILTER_BASIC_NAME_PORTSTR:
+						free(fb->func_data.portstr
+							->bitmap);
+						free(fb->func_data.portstr);
+						fb->func_data.portstr = NULL;
+						break;
+					case FILTER_BASIC_NAME_PPSTR:
+						ppstr_free(fb->func_data.ppstr);
+						fb->func_data.ppstr = NULL;
+						break;
 					default:
 						break;
 				}
@@ -1165,6 +1993,11 @@ FOR_LIST_OF_GEOIP_FIELDS
 				(int)fb->func_data.as->ip_off,
 				(int)fb->func_data.as->ip_size);
 			break;
+		case FILTER_BASIC_NAME_PFX:
+			fprintf(f, "PFX ([offset %d]/[size %d])",
+				(int)fb->func_data.pfx->ip_off,
+				(int)fb->func_data.pfx->ip_size);
+			break;
 
 		default:
 			fprintf(f, "<Unknown name %d> ", fb->name);
@@ -6,6 +6,8 @@
 #include "xenoeye.h"
 #include "iplist.h"
 #include "geoip.h"
+#include "rib.h"
+#include "freqmap.h"
 
 #define ERR_MSG_LEN     1024
 
@@ -82,6 +84,7 @@ FOR_LIST_OF_GEOIP_FIELDS
 #undef DO
 	ASN,
 	ASD,
+	PFX,
 	TFSTR,
 	PORTSTR,
 	PPSTR,
@@ -145,6 +148,7 @@ FOR_LIST_OF_GEOIP_FIELDS
 #undef DO
 	FILTER_BASIC_NAME_ASN,
 	FILTER_BASIC_NAME_ASD,
+	FILTER_BASIC_NAME_PFX,
 	FILTER_BASIC_NAME_TFSTR,
 	FILTER_BASIC_NAME_PORTSTR,
 	FILTER_BASIC_NAME_PPSTR
@@ -182,7 +186,7 @@ struct function_mfreq
 	unsigned int arg2_off;
 	unsigned int arg2_size;
 
-	_Atomic uint64_t *freqmap;
+	struct freqmap *freqmap;
 };
 
 struct function_geoip
@@ -205,11 +209,42 @@ struct function_as
 	int num;
 };
 
+/* announced prefix from routing table */
+struct function_pfx
+{
+	/* offset and size in struct flow_info */
+	unsigned int ip_off;
+	unsigned int ip_size;
+};
+
+/* address masked to prefix length, IPv4 and IPv6 lengths may differ */
+struct function_net
+{
+	/* offset and size in struct flow_info */
+	unsigned int ip_off;
+	unsigned int ip_size;
+
+	int mask4;
+	int mask6;
+};
+
+/*
+ * String functions in filters (tfstr, portstr, ppstr) are compiled into
+ * bitmaps over numeric values of fields at parse time, so matching doesn't
+ * format strings. Bit is set if string for this value equals (ignoring case)
+ * one of the literals
+ */
+#define FILTER_BITMAP_TEST(B, V) (((B)[(V) >> 6] >> ((V) & 63)) & 1)
+#define FILTER_BITMAP_SET(B, V) ((B)[(V) >> 6] |= 1ULL << ((V) & 63))
+#define FILTER_BITMAP_CLEAR(B, V) ((B)[(V) >> 6] &= ~(1ULL << ((V) & 63)))
+
 struct function_tfstr
 {
 	/* offset in struct flow_info */
 	unsigned int tf_off;
 	unsigned int tf_size;
+
+	uint64_t bitmap[(UINT8_MAX + 1) / 64];
 };
 
 struct function_portstr
@@ -217,6 +252,22 @@ struct function_portstr
 	/* offset in struct flow_info */
 	unsigned int port_off;
 	unsigned int port_size;
+
+	uint64_t *bitmap;
+};
+
+enum PPSTR_SIDE
+{
+	PPSTR_PORT1,
+	PPSTR_PORT2
+};
+
+/* pairs with fixed port1 (or port2), other port is in bitmap */
+struct ppstr_rule
+{
+	enum PPSTR_SIDE side;
+	uint16_t port;
+	uint64_t *bitmap;
 };
 
 struct function_ppstr
@@ -228,7 +279,39 @@ struct function_ppstr
 	unsigned int arg2_off;
 	unsigned int arg2_size;
 
-	_Atomic uint64_t *freqmap;
+	size_t nrules;
+	struct ppstr_rule *rules;
+};
+
+/*
+ * Basic filter with many literals ("port 22 or 23 or ...", "net 10.1.0.0/24
+ * 10.2.0.0/24 ...") is compiled after parsing: ranges of fields up to 16
+ * bits go to bitmap, ranges of wider fields are sorted, merged and searched
+ * with binary search, addresses with masks go to prefix trie (IP lists are
+ * checked as before). Literals in fb->data are kept for dump
+ */
+#define FILTER_SET_MIN_LITERALS 8
+
+enum FILTER_SET_TYPE
+{
+	FILTER_SET_NONE,
+	FILTER_SET_BITMAP,
+	FILTER_SET_RANGES,
+	FILTER_SET_TRIE
+};
+
+struct filter_set
+{
+	enum FILTER_SET_TYPE type;
+
+	uint64_t *bitmap;
+
+	size_t nranges;
+	struct int_range *ranges;
+
+	struct iplist *trie;
+	size_t nlists;
+	struct iplist **lists;
 };
 
 struct filter_basic
@@ -240,6 +323,8 @@ struct filter_basic
 	size_t n;
 	struct filter_basic_data *data;
 
+	struct filter_set set;
+
 	int is_func;
 	union filter_func_data {
 		struct function_div *div;
@@ -247,6 +332,7 @@ struct filter_basic
 		struct function_mfreq *mfreq;
 		struct function_geoip *geoip;
 		struct function_as *as;
+		struct function_pfx *pfx;
 		struct function_tfstr *tfstr;
 		struct function_portstr *portstr;
 		struct function_ppstr *ppstr;
@@ -266,6 +352,9 @@ struct filter_op
 {
 	enum FILTER_OP op;
 	struct filter_basic *arg;
+
+	/* id of shared predicate + 1, 0 if leaf is always evaluated */
+	size_t pred;
 };
 
 struct filter_expr
@@ -308,13 +397,16 @@ struct field
 		struct function_mfreq mfreq;
 		struct function_geoip geoip;
 		struct function_as as;
+		struct function_pfx pfx;
 		struct function_tfstr tfstr;
 		struct function_portstr portstr;
 		struct function_ppstr ppstr;
+		struct function_net net;
 	} func_data;
 };
 
 struct filter_expr *parse_filter(struct filter_input *f);
+void filter_compile(struct filter_expr *e);
 int parse_field(char *s, struct field *f, char *err);
 void mkerror(struct filter_input *f, char *msg);
 
@@ -330,6 +422,85 @@ int filter_add_op(struct filter_expr *e, enum FILTER_OP op);
 
 int filter_match(struct filter_expr *expr, struct flow_info *flow);
 
+/* shared leaves are evaluated once per flow, see filter-preds.h */
+struct filter_memo;
+int filter_match_memo(struct filter_expr *expr, struct flow_info *flow,
+	struct filter_memo *memo);
+
+/*
+ * Block of up to 64 flows, bit N of masks of rows is flows[N]
+ *
+ * Fields of filter.def referenced by shared basic filters are also kept in
+ * columns (struct-of-arrays), one column per field. Column is filled from
+ * rows when the first filter of block needs it, numbers are kept as
+ * filter_basic_match() reads them, addresses as in flow records. Basic filter
+ * over columns is evaluated for all rows of block in one loop
+ */
+#define FILTER_BATCH_MAX 64
+
+/* source and destination field of each name of filter.def */
+#define FILTER_NCOLUMNS (FILTER_BASIC_NAME_DIV * 2)
+
+struct filter_column
+{
+	/* rows of block in column */
+	uint64_t gen;
+	size_t n;
+
+	/* rows with field in flow record */
+	uint64_t has;
+	union filter_column_data {
+		int num[FILTER_BATCH_MAX];
+		uint32_t addr4[FILTER_BATCH_MAX];
+		xe_ip addr6[FILTER_BATCH_MAX];
+	} v;
+};
+
+struct filter_block
+{
+	size_t n;
+	struct flow_info *flows[FILTER_BATCH_MAX];
+	uint64_t gen;
+
+	/* NULL if field isn't referenced */
+	struct filter_column *cols[FILTER_NCOLUMNS];
+	struct filter_column *data;
+};
+
+/* column of field in direction FILTER_BASIC_DIR_SRC/DST or -1 */
+int filter_column_id(struct filter_basic *fb, int dir);
+
+/* columns is bitmap over column ids, NULL - rows only */
+struct filter_block *filter_block_new(const uint64_t *columns);
+void filter_block_free(struct filter_block *b);
+
+static inline void
+filter_block_reset(struct filter_block *b)
+{
+	b->n = 0;
+	b->gen++;
+}
+
+/* flow should stay valid until block is reset */
+static inline void
+filter_block_add(struct filter_block *b, struct flow_info *flow)
+{
+	b->flows[b->n] = flow;
+	b->n++;
+}
+
+static inline uint64_t
+filter_block_rows(struct filter_block *b)
+{
+	return (b->n == FILTER_BATCH_MAX) ? ~0ULL : (1ULL << b->n) - 1;
+}
+
+/* filled column or NULL */
+struct filter_column *filter_block_column(struct filter_block *b, int id);
+
+uint64_t filter_match_batch(struct filter_expr *expr, struct filter_block *b,
+	uint64_t rows, struct filter_memo *memo);
+
 void filter_dump(struct filter_expr *e, FILE *f);
 void filter_free(struct filter_expr *e);
 
@@ -357,6 +528,9 @@ int function_as_parse(struct filter_input *in, struct function_as *as,
 	enum TOKEN_ID *tok);
 int function_as(struct filter_input *in, struct filter_expr *e);
 
+int function_pfx_parse(struct filter_input *in, struct function_pfx *pfx);
+int function_pfx(struct filter_input *in, struct filter_expr *e);
+
 int function_tfstr_parse(struct filter_input *in, struct function_tfstr *tfstr);
 int function_tfstr(struct filter_input *in, struct filter_expr *e);
 
@@ -367,6 +541,8 @@ int function_portstr(struct filter_input *in, struct filter_expr *e);
 int function_ppstr_parse(struct filter_input *in, struct function_ppstr *ppstr);
 int function_ppstr(struct filter_input *in, struct filter_expr *e);
 
+int function_net_parse(struct filter_input *in, struct function_net *net);
+
 static inline uint64_t
 get_nf_val(uintptr_t ptr, unsigned int size)
 {
@@ -19,5 +19,14 @@ void flow_print_str(struct xe_debug *debug, struct flow_info *fi,
 
 void sflow_debug_print(struct flow_info *fi, char *str);
 
+/* binary records of flows in shared memory, see flow-tap.h */
+int flow_tap_config(struct aajson *a, aajson_val *value,
+	struct flow_tap_conf *c);
+
+int flow_tap_init(struct xe_data *data);
+
+void flow_tap_write(size_t thread_id, struct flow_info *flow,
+	uint64_t time_ns);
+
 #endif
 
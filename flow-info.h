@@ -29,12 +29,18 @@ struct flow_info
 	int dev_mark_size;
 	int has_dev_mark;
 
+	/* tenant in family of monitoring objects */
+	uint8_t tenant[4];
+	int tenant_size;
+	int has_tenant;
+
 	uint32_t sampling_rate;
 };
 
 struct flow_packet_info
 {
-	struct sockaddr src_addr;
+	/* IPv4 or IPv6 exporter */
+	struct sockaddr_storage src_addr;
 	uint32_t src_addr_ipv4;
 
 	uint32_t source_id;
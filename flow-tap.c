@@ -0,0 +1,298 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "xenoeye.h"
+#include "filter.h"
+#include "flow-info.h"
+#include "flow-debug.h"
+#include "flow-tap.h"
+#include "monit-objects.h"
+
+static const char *default_fields[] = {
+	"dev-ip", "src host", "dst host", "proto", "src port", "dst port",
+	"tcp-flags", "octets", "packets"
+};
+
+static struct flow_tap_header *hdr = NULL;
+static struct flow_tap_ring **rings = NULL;
+static struct field tap_fields[FLOW_TAP_MAX_FIELDS];
+static size_t ntap_fields = 0;
+static struct filter_expr *tap_expr = NULL;
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+flow_tap_config(struct aajson *a, aajson_val *value, struct flow_tap_conf *c)
+{
+	c->enabled = 1;
+
+	if (STRCMP(a, 2, "shm") == 0) {
+		if ((value->str[0] != '/') || (strchr(value->str + 1, '/'))
+			|| (strlen(value->str) >= sizeof(c->shm))) {
+
+			LOG("flow-tap: incorrect shared memory name '%s'",
+				value->str);
+			return 0;
+		}
+		strcpy(c->shm, value->str);
+	} else if (STRCMP(a, 2, "size-m") == 0) {
+		c->size_m = atoi(value->str);
+		if (c->size_m == 0) {
+			LOG("flow-tap: incorrect size '%s'", value->str);
+			return 0;
+		}
+	} else if (STRCMP(a, 2, "filter") == 0) {
+		free(c->filter);
+		c->filter = strdup(value->str);
+		if (!c->filter) {
+			LOG("strdup() failed");
+			return 0;
+		}
+	} else if (STRCMP(a, 2, "fields") == 0) {
+		if (c->nfields >= FLOW_TAP_MAX_FIELDS) {
+			LOG("flow-tap: too many fields, max %d",
+				FLOW_TAP_MAX_FIELDS);
+			return 0;
+		}
+		if (strlen(value->str) >= FLOW_TAP_NAME_MAX) {
+			LOG("flow-tap: field name '%s' is too long",
+				value->str);
+			return 0;
+		}
+		strcpy(c->fields[c->nfields], value->str);
+		c->nfields++;
+	}
+
+	return 1;
+}
+#undef STRCMP
+
+static enum FLOW_TAP_FIELD_TYPE
+field_type(struct field *fld)
+{
+	switch (fld->type) {
+		case FILTER_BASIC_ADDR4:
+			/* dev-ip6 */
+			return fld->size == sizeof(uint32_t)
+				? FLOW_TAP_ADDR4 : FLOW_TAP_ADDR6;
+		case FILTER_BASIC_ADDR6:
+			return FLOW_TAP_ADDR6;
+		case FILTER_BASIC_MAC:
+			return FLOW_TAP_MAC;
+		case FILTER_BASIC_STRING:
+			return FLOW_TAP_STRING;
+		default:
+			break;
+	}
+
+	return FLOW_TAP_INT;
+}
+
+static int
+fields_init(struct flow_tap_conf *c)
+{
+	size_t i, n;
+
+	n = c->nfields ? c->nfields
+		: sizeof(default_fields) / sizeof(default_fields[0]);
+
+	for (i=0; i<n; i++) {
+		char name[FLOW_TAP_NAME_MAX], err[ERR_MSG_LEN];
+		struct field *fld = &tap_fields[i];
+
+		strcpy(name, c->nfields ? c->fields[i] : default_fields[i]);
+		if (!parse_field(name, fld, err)) {
+			LOG("flow-tap: can't parse field '%s': %s",
+				c->nfields ? c->fields[i] : default_fields[i],
+				err);
+			return 0;
+		}
+
+		strcpy(hdr->fields[i].name,
+			c->nfields ? c->fields[i] : default_fields[i]);
+		hdr->fields[i].type = field_type(fld);
+		hdr->fields[i].size = fld->size;
+		hdr->rec_size += fld->size;
+	}
+
+	ntap_fields = n;
+	hdr->nfields = n;
+
+	return 1;
+}
+
+int
+flow_tap_init(struct xe_data *data)
+{
+	struct flow_tap_conf *c = &data->tap;
+	struct flow_tap_header h;
+	size_t size, ring_bytes, i;
+	int fd;
+
+	if (!c->enabled) {
+		return 1;
+	}
+
+	if (!*c->shm) {
+		strcpy(c->shm, FLOW_TAP_DEFAULT_SHM);
+	}
+	if (c->size_m == 0) {
+		c->size_m = FLOW_TAP_DEFAULT_SIZE_M;
+	}
+
+	if (c->filter && *c->filter) {
+		struct filter_input q;
+
+		memset(&q, 0, sizeof(struct filter_input));
+		q.s = c->filter;
+		tap_expr = parse_filter(&q);
+		if (!tap_expr) {
+			LOG("flow-tap: can't allocate filter");
+			goto fail_filter;
+		}
+		if (q.error) {
+			LOG("flow-tap: can't parse filter '%s': %s",
+				c->filter, q.errmsg);
+			goto fail_filter;
+		}
+	}
+
+	/* record size and ring layout */
+	memset(&h, 0, sizeof(h));
+	hdr = &h;
+	h.rec_size = sizeof(uint64_t);
+	if (!fields_init(c)) {
+		goto fail_fields;
+	}
+	h.rec_size = (h.rec_size + 7) & ~7ULL;
+
+	size = c->size_m * 1024 * 1024;
+	ring_bytes = (size - FLOW_TAP_HEADER_SIZE) / data->nthreads;
+	h.nslots = 1;
+	while ((sizeof(struct flow_tap_ring) + h.nslots * 2 * h.rec_size)
+		<= ring_bytes) {
+
+		h.nslots *= 2;
+	}
+	if (h.nslots < 2) {
+		LOG("flow-tap: %lu MB is not enough for %lu rings",
+			(unsigned long)c->size_m,
+			(unsigned long)data->nthreads);
+		goto fail_fields;
+	}
+	h.ring_size = (sizeof(struct flow_tap_ring) + h.nslots * h.rec_size
+		+ FLOW_TAP_ALIGN - 1) & ~((uint64_t)FLOW_TAP_ALIGN - 1);
+	h.nrings = data->nthreads;
+	h.version = FLOW_TAP_VERSION;
+	size = FLOW_TAP_HEADER_SIZE + h.nrings * h.ring_size;
+
+	fd = shm_open(c->shm, O_CREAT | O_RDWR, 0600);
+	if (fd < 0) {
+		LOG("flow-tap: shm_open('%s') failed: %s", c->shm,
+			strerror(errno));
+		goto fail_fields;
+	}
+	if (ftruncate(fd, size) != 0) {
+		LOG("flow-tap: ftruncate('%s') failed: %s", c->shm,
+			strerror(errno));
+		close(fd);
+		goto fail_fields;
+	}
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		LOG("flow-tap: mmap() failed: %s", strerror(errno));
+		goto fail_fields;
+	}
+
+	rings = calloc(h.nrings, sizeof(struct flow_tap_ring *));
+	if (!rings) {
+		LOG("calloc() failed");
+		goto fail_rings;
+	}
+
+	/* readers check magic, so it is written last */
+	memset(hdr, 0, size);
+	memcpy(hdr, &h, sizeof(h));
+	for (i=0; i<h.nrings; i++) {
+		rings[i] = FLOW_TAP_RING(hdr, i);
+	}
+	atomic_thread_fence(memory_order_release);
+	hdr->magic = FLOW_TAP_MAGIC;
+
+	LOG("flow-tap: '%s', %lu rings of %lu records, %lu bytes each",
+		c->shm, (unsigned long)h.nrings, (unsigned long)h.nslots,
+		(unsigned long)h.rec_size);
+
+	return 1;
+
+fail_rings:
+	munmap(hdr, size);
+fail_fields:
+fail_filter:
+	if (tap_expr) {
+		filter_free(tap_expr);
+		tap_expr = NULL;
+	}
+	hdr = NULL;
+	c->enabled = 0;
+	return 0;
+}
+
+void
+flow_tap_write(size_t thread_id, struct flow_info *flow, uint64_t time_ns)
+{
+	struct flow_tap_ring *r = rings[thread_id];
+	uint64_t head, tail;
+	uint8_t *rec;
+	size_t i;
+
+	if (tap_expr && !filter_match(tap_expr, flow)) {
+		return;
+	}
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	if ((head - tail) >= hdr->nslots) {
+		atomic_store_explicit(&r->drops,
+			atomic_load_explicit(&r->drops, memory_order_relaxed)
+			+ 1, memory_order_relaxed);
+		return;
+	}
+
+	rec = r->data + (head & (hdr->nslots - 1)) * hdr->rec_size;
+	memcpy(rec, &time_ns, sizeof(uint64_t));
+	rec += sizeof(uint64_t);
+	for (i=0; i<ntap_fields; i++) {
+		monit_object_key_add_fld(&tap_fields[i], rec, flow);
+		rec += tap_fields[i].size;
+	}
+
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
@@ -0,0 +1,98 @@
+#ifndef flow_tap_h_included
+#define flow_tap_h_included
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+/*
+ * Flow tap: binary records of selected fields in shared memory
+ *
+ * Shared memory object contains header with description of fields and
+ * one ring per processing thread. Each ring has one writer (processing
+ * thread) and one reader (xetap). Record is capture time in nanoseconds
+ * followed by values of fields in the same format as in keys of monitoring
+ * objects (network byte order). Writer never waits: if ring is full
+ * record is dropped and counted.
+ *
+ * Formatting is done by reader, so cost of tap for collector is filter
+ * (optional) and copy of fields.
+ */
+
+#define FLOW_TAP_MAGIC 0x5845544150303031ULL /* "XETAP001" */
+#define FLOW_TAP_VERSION 1
+
+#define FLOW_TAP_DEFAULT_SHM "/xenoeye-tap"
+#define FLOW_TAP_DEFAULT_SIZE_M 16
+
+#define FLOW_TAP_MAX_FIELDS 32
+#define FLOW_TAP_NAME_MAX 64
+
+/* header takes one page, rings are cache line aligned */
+#define FLOW_TAP_HEADER_SIZE 4096
+#define FLOW_TAP_ALIGN 64
+
+enum FLOW_TAP_FIELD_TYPE
+{
+	FLOW_TAP_INT,
+	FLOW_TAP_ADDR4,
+	FLOW_TAP_ADDR6,
+	FLOW_TAP_MAC,
+	FLOW_TAP_STRING
+};
+
+struct flow_tap_field
+{
+	char name[FLOW_TAP_NAME_MAX];
+	uint32_t type;
+	uint32_t size;
+};
+
+struct flow_tap_header
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t nrings;
+
+	/* slots in ring, power of two */
+	uint64_t nslots;
+	/* bytes, multiple of 8 */
+	uint64_t rec_size;
+	/* distance between rings, bytes */
+	uint64_t ring_size;
+
+	uint32_t nfields;
+	struct flow_tap_field fields[FLOW_TAP_MAX_FIELDS];
+};
+
+struct flow_tap_ring
+{
+	/* written by collector */
+	_Alignas(FLOW_TAP_ALIGN) _Atomic uint64_t head;
+	_Atomic uint64_t drops;
+
+	/* written by reader */
+	_Alignas(FLOW_TAP_ALIGN) _Atomic uint64_t tail;
+
+	_Alignas(FLOW_TAP_ALIGN) uint8_t data[];
+};
+
+struct flow_tap_conf
+{
+	int enabled;
+
+	char shm[NAME_MAX];
+	size_t size_m;
+
+	/* empty - all flows */
+	char *filter;
+
+	char fields[FLOW_TAP_MAX_FIELDS][FLOW_TAP_NAME_MAX];
+	size_t nfields;
+};
+
+#define FLOW_TAP_RING(H, I) ((struct flow_tap_ring *)                         \
+	((uint8_t *)(H) + FLOW_TAP_HEADER_SIZE + (I) * (H)->ring_size))
+
+#endif
+
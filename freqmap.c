@@ -0,0 +1,213 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "freqmap.h"
+
+/* shard index of thread, the same for all maps */
+static atomic_int nshard_ids = 0;
+static _Thread_local int shard_id = -1;
+
+/* maps are created and freed on (re)load while housekeeping merges them */
+static pthread_mutex_t maps_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct freqmap *maps = NULL;
+
+struct freqmap *
+freqmap_new(void)
+{
+	struct freqmap *fm;
+	struct freqmap_shard *shared;
+
+	fm = calloc(1, sizeof(struct freqmap));
+	if (!fm) {
+		goto fail_map;
+	}
+
+	shared = calloc(1, sizeof(struct freqmap_shard));
+	if (!shared) {
+		goto fail_shard;
+	}
+
+	atomic_store(&fm->shards[FREQMAP_MAX_SHARDS], shared);
+
+	pthread_mutex_lock(&maps_mtx);
+	fm->next = maps;
+	if (maps) {
+		maps->prev = fm;
+	}
+	maps = fm;
+	pthread_mutex_unlock(&maps_mtx);
+
+	return fm;
+
+fail_shard:
+	free(fm);
+fail_map:
+	return NULL;
+}
+
+void
+freqmap_free(struct freqmap *fm)
+{
+	size_t i;
+
+	if (!fm) {
+		return;
+	}
+
+	pthread_mutex_lock(&maps_mtx);
+	if (fm->prev) {
+		fm->prev->next = fm->next;
+	} else {
+		maps = fm->next;
+	}
+	if (fm->next) {
+		fm->next->prev = fm->prev;
+	}
+	pthread_mutex_unlock(&maps_mtx);
+
+	for (i=0; i<=FREQMAP_MAX_SHARDS; i++) {
+		free(atomic_load(&fm->shards[i]));
+	}
+	free(fm);
+}
+
+void
+freqmap_merge(struct freqmap *fm)
+{
+	struct freqmap_shard *shards[FREQMAP_MAX_SHARDS + 1];
+	size_t i, n = 0;
+	uint32_t v;
+
+	for (i=0; i<=FREQMAP_MAX_SHARDS; i++) {
+		shards[n] = atomic_load_explicit(&fm->shards[i],
+			memory_order_acquire);
+		if (shards[n]) {
+			n++;
+		}
+	}
+
+	for (v=0; v<FREQMAP_SIZE; v++) {
+		uint64_t sum = 0;
+
+		for (i=0; i<n; i++) {
+			sum += atomic_load_explicit(&shards[i]->cnt[v],
+				memory_order_relaxed);
+		}
+		atomic_store_explicit(&fm->snapshot[v], sum,
+			memory_order_relaxed);
+	}
+}
+
+/* sum of update counters of shards */
+static uint64_t
+updates(struct freqmap *fm)
+{
+	size_t i;
+	uint64_t n = 0;
+
+	for (i=0; i<=FREQMAP_MAX_SHARDS; i++) {
+		struct freqmap_shard *s;
+
+		s = atomic_load_explicit(&fm->shards[i], memory_order_acquire);
+		if (s) {
+			n += atomic_load_explicit(&s->nupdates,
+				memory_order_relaxed);
+		}
+	}
+
+	return n;
+}
+
+void
+freqmap_merge_all(void)
+{
+	struct freqmap *fm;
+
+	pthread_mutex_lock(&maps_mtx);
+	for (fm=maps; fm; fm=fm->next) {
+		uint64_t n = updates(fm);
+
+		if (n == fm->merged_updates) {
+			/* nothing changed */
+			continue;
+		}
+
+		freqmap_merge(fm);
+		fm->merged_updates = n;
+	}
+	pthread_mutex_unlock(&maps_mtx);
+}
+
+static struct freqmap_shard *
+own_shard(struct freqmap *fm)
+{
+	struct freqmap_shard *s;
+
+	if (shard_id < 0) {
+		shard_id = atomic_fetch_add(&nshard_ids, 1);
+		if (shard_id > FREQMAP_MAX_SHARDS) {
+			shard_id = FREQMAP_MAX_SHARDS;
+		}
+	}
+
+	if (shard_id == FREQMAP_MAX_SHARDS) {
+		return NULL;
+	}
+
+	s = atomic_load_explicit(&fm->shards[shard_id], memory_order_relaxed);
+	if (!s) {
+		/* first update from this thread */
+		s = calloc(1, sizeof(struct freqmap_shard));
+		if (!s) {
+			return NULL;
+		}
+		atomic_store_explicit(&fm->shards[shard_id], s,
+			memory_order_release);
+	}
+
+	return s;
+}
+
+void
+freqmap_add(struct freqmap *fm, uint16_t val)
+{
+	struct freqmap_shard *s = own_shard(fm);
+
+	if (s) {
+		/* the only writer of shard */
+		atomic_store_explicit(&s->cnt[val],
+			atomic_load_explicit(&s->cnt[val], memory_order_relaxed)
+			+ 1, memory_order_relaxed);
+
+		atomic_store_explicit(&s->nupdates,
+			atomic_load_explicit(&s->nupdates, memory_order_relaxed)
+			+ 1, memory_order_relaxed);
+	} else {
+		s = atomic_load_explicit(&fm->shards[FREQMAP_MAX_SHARDS],
+			memory_order_relaxed);
+
+		atomic_fetch_add_explicit(&s->cnt[val], 1,
+			memory_order_relaxed);
+		atomic_fetch_add_explicit(&s->nupdates, 1,
+			memory_order_relaxed);
+	}
+}
+
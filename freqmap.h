@@ -0,0 +1,63 @@
+#ifndef freqmap_h_included
+#define freqmap_h_included
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Frequency map of 16-bit values for mfreq() function
+ *
+ * Each thread counts values in its own shard, increments are plain loads
+ * and stores, without locked instructions and without sharing of cache
+ * lines between threads. Values are compared by snapshot: sum of all shards.
+ * Snapshots of all maps are rebuilt by housekeeping thread (fwm thread each
+ * second, replay loop each second of capture), maps without updates since
+ * previous merge are skipped. Frequencies lag a bit behind, this is fine for
+ * choosing the more popular port.
+ *
+ * Threads above FREQMAP_MAX_SHARDS (or if shard can't be allocated) share
+ * one more shard with atomic increments.
+ */
+
+#define FREQMAP_SIZE (UINT16_MAX + 1)
+#define FREQMAP_MAX_SHARDS 64
+
+struct freqmap_shard
+{
+	_Atomic uint64_t nupdates;
+	_Atomic uint64_t cnt[FREQMAP_SIZE];
+};
+
+struct freqmap
+{
+	_Atomic uint64_t snapshot[FREQMAP_SIZE];
+
+	/* sum of updates of shards at last merge */
+	uint64_t merged_updates;
+
+	/* list of all maps, under registry lock */
+	struct freqmap *prev, *next;
+
+	/* per-thread shards, the last one is shared */
+	struct freqmap_shard *_Atomic shards[FREQMAP_MAX_SHARDS + 1];
+};
+
+struct freqmap *freqmap_new(void);
+void freqmap_free(struct freqmap *fm);
+
+void freqmap_add(struct freqmap *fm, uint16_t val);
+
+/* rebuild snapshot now */
+void freqmap_merge(struct freqmap *fm);
+
+/* rebuild snapshots of maps with updates, called by housekeeping thread */
+void freqmap_merge_all(void);
+
+static inline uint64_t
+freqmap_get(struct freqmap *fm, uint16_t val)
+{
+	return atomic_load_explicit(&fm->snapshot[val], memory_order_relaxed);
+}
+
+#endif
+
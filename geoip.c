@@ -14,6 +14,7 @@
 
 #include "xenoeye.h"
 #include "geoip.h"
+#include "rib.h"
 #include "ip-btrie.h"
 
 /* geo */
@@ -126,7 +127,7 @@ fail_mmap:
 	return addr;
 }
 
-static void
+void
 geoip_reload(struct xe_data *data)
 {
 	struct btrie_node_geo *geo4, *geo6;
@@ -200,8 +201,16 @@ geoip_thread(void *arg)
 			LOG("Reloading geo/as databases");
 			geoip_reload(data);
 			LOG("geo/as databases reloaded");
+
+			/* routing table for pfx() */
+			if (*data->rib_file) {
+				rib_load(data->rib_file);
+			}
 		}
 
+		/* table replaced by previous reload */
+		rib_free_old();
+
 		usleep(10000);
 	}
 
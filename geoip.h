@@ -61,7 +61,10 @@ int geoip_lookup6(xe_ip *addr, struct geoip_info **g);
 int as_lookup4(uint32_t addr, struct as_info **a);
 int as_lookup6(xe_ip *addr, struct as_info **a);
 
+struct xe_data;
+
 void *geoip_thread(void *arg);
+void geoip_reload(struct xe_data *data);
 
 static inline
 char *geoip_get_field(struct geoip_info *g, enum GEOIP_FIELD f)
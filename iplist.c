@@ -49,7 +49,25 @@ iplist_name(struct iplist *l)
 	return l->name;
 }
 
-static int
+struct iplist *
+iplist_new(void)
+{
+	return calloc(1, sizeof(struct iplist));
+}
+
+void
+iplist_free(struct iplist *l)
+{
+	if (!l) {
+		return;
+	}
+
+	free(l->nodes4);
+	free(l->nodes6);
+	free(l);
+}
+
+int
 iplist_add4(struct iplist *l, uint32_t addr, int mask)
 {
 	int i;
@@ -103,7 +121,7 @@ iplist_add4(struct iplist *l, uint32_t addr, int mask)
 	return 1;
 }
 
-static int
+int
 iplist_add6(struct iplist *l, xe_ip *addr, int mask)
 {
 	int i;
@@ -172,6 +190,11 @@ iplist_match4(struct iplist *l, uint32_t addr)
 		int bit, bit_n;
 		uint8_t byte;
 
+		/* shorter prefix covers address */
+		if (l->nodes4[node].is_leaf) {
+			return 1;
+		}
+
 		byte = addr_ptr[i / 8];
 		bit_n = 7 - (i % 8);
 		bit = !!(byte & (1 << bit_n));
@@ -201,6 +224,10 @@ iplist_match6(struct iplist *l, xe_ip *addr)
 		int bit, bit_n;
 		uint8_t byte;
 
+		if (l->nodes6[node].is_leaf) {
+			return 1;
+		}
+
 		byte = addr_ptr[i / 8];
 		bit_n = 7 - (i % 8);
 		bit = !!(byte & (1 << bit_n));
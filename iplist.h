@@ -15,6 +15,12 @@ struct iplist *iplist_get_by_name(const char *name);
 int iplist_match4(struct iplist *l, uint32_t addr);
 int iplist_match6(struct iplist *l, xe_ip *addr);
 
+/* unnamed list, e.g. for addresses from filter, addr in network order */
+struct iplist *iplist_new(void);
+int iplist_add4(struct iplist *l, uint32_t addr, int mask);
+int iplist_add6(struct iplist *l, xe_ip *addr, int mask);
+void iplist_free(struct iplist *l);
+
 /* for dump */
 char *iplist_name(struct iplist *l);
 
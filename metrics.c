@@ -0,0 +1,1045 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "utils.h"
+#include "xenoeye.h"
+#include "metrics.h"
+#include "workers.h"
+#include "monit-objects.h"
+
+/* metrics of monitoring objects */
+enum MO_METRIC
+{
+	MO_FLOWS,
+	FWM_KEYS,
+	FWM_MEM,
+	FWM_EXPORTS,
+	FWM_EXPORT_SECONDS,
+	FWM_LAST_EXPORT_SECONDS,
+	FWM_EXPORT_BYTES,
+	MAVG_KEYS,
+	MAVG_MEM,
+	MAVG_MEM_LIMIT,
+	MO_COST,
+	FWM_LIVE_MEM,
+	CLSF_MEM
+};
+
+struct mo_metric_desc
+{
+	enum MO_METRIC id;
+	const char *name;
+	const char *type;
+	const char *help;
+};
+
+static struct mo_metric_desc mo_metrics[] = {
+	{MO_FLOWS, "mo_flows_total", "counter",
+		"Flows matched by monitoring object filter"},
+	{FWM_KEYS, "fwm_keys", "gauge",
+		"Keys in last exported fixed window"},
+	{FWM_MEM, "fwm_memory_bytes", "gauge",
+		"Memory used by last merged fixed window"},
+	{FWM_EXPORTS, "fwm_exports_total", "counter",
+		"Exports of fixed window"},
+	{FWM_EXPORT_SECONDS, "fwm_export_seconds_total", "counter",
+		"Time spent on merge and export of fixed window"},
+	{FWM_LAST_EXPORT_SECONDS, "fwm_last_export_seconds", "gauge",
+		"Duration of last export of fixed window"},
+	{FWM_EXPORT_BYTES, "fwm_export_bytes_total", "counter",
+		"Bytes written to export files"},
+	{MAVG_KEYS, "mavg_keys", "gauge",
+		"Items in moving average databases"},
+	{MAVG_MEM, "mavg_memory_bytes", "gauge",
+		"Memory used by moving average databases"},
+	{MAVG_MEM_LIMIT, "mavg_memory_limit_bytes", "gauge",
+		"Memory limit of moving average databases"},
+	{MO_COST, "mo_cost_seconds_total", "counter",
+		"Estimated processing time, sampled time multiplied by rate"},
+	{FWM_LIVE_MEM, "fwm_live_memory_bytes", "gauge",
+		"Memory used by per-thread fixed window databases"},
+	{CLSF_MEM, "classification_memory_bytes", "gauge",
+		"Memory used by classification databases"}
+};
+
+static const char *cost_names[MO_COST_MAX] = {"filter", "key", "db"};
+
+static const char *proto_names[METRICS_PROTO_MAX] = {
+	"netflow_v5", "netflow_v9", "ipfix", "sflow", "unknown"
+};
+
+static const char *stage_names[PROF_STAGE_MAX] = {
+	"packet", "decode", "filter", "fwm", "mavg", "classification"
+};
+
+static struct xe_data *globl = NULL;
+static int unix_fd = -1, http_fd = -1;
+
+/* monitoring object in cost report */
+struct mo_report_item
+{
+	struct monit_object *mo;
+	uint64_t cost_ns[MO_COST_MAX];
+	uint64_t total_ns;
+	uint64_t flows;
+	uint64_t mem;
+};
+
+struct mo_report
+{
+	size_t n, size;
+	struct mo_report_item *items;
+};
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+metrics_config(struct aajson *a, aajson_val *value, struct metrics_conf *c)
+{
+	if (STRCMP(a, 2, "unix-socket") == 0) {
+		if (strlen(value->str) >= sizeof(((struct sockaddr_un *)0)
+			->sun_path)) {
+
+			LOG("metrics: path to socket is too long");
+			return 0;
+		}
+		strcpy(c->unix_socket, value->str);
+	} else if (STRCMP(a, 2, "http-port") == 0) {
+		c->http_port = atoi(value->str);
+		if ((c->http_port < 0) || (c->http_port > UINT16_MAX)) {
+			LOG("metrics: incorrect port '%s'", value->str);
+			return 0;
+		}
+	} else if (STRCMP(a, 2, "mo-report") == 0) {
+		if (strlen(value->str) >= (sizeof(c->mo_report) - 4)) {
+			LOG("metrics: path to report is too long");
+			return 0;
+		}
+		strcpy(c->mo_report, value->str);
+	} else if (STRCMP(a, 2, "mo-report-interval") == 0) {
+		c->mo_report_interval = atoi(value->str);
+		if (c->mo_report_interval <= 0) {
+			LOG("metrics: incorrect report interval '%s'",
+				value->str);
+			return 0;
+		}
+	} else if (STRCMP(a, 2, "profile-sample") == 0) {
+		uint64_t n = 1;
+
+		c->profile_sample = strtoull(value->str, NULL, 10);
+		if (c->profile_sample == 0) {
+			c->profile_mask = 0;
+			return 1;
+		}
+
+		/* round up to power of two */
+		while (n < c->profile_sample) {
+			n <<= 1;
+		}
+		c->profile_sample = n;
+		c->profile_mask = n - 1;
+	}
+
+	return 1;
+}
+#undef STRCMP
+
+static void
+family(FILE *f, const char *name, const char *type, const char *help)
+{
+	fprintf(f, "# HELP xenoeye_%s %s\n", name, help);
+	fprintf(f, "# TYPE xenoeye_%s %s\n", name, type);
+}
+
+/* label value with escaped quotes, backslashes and newlines */
+static void
+print_label(FILE *f, const char *s)
+{
+	for (; *s; s++) {
+		if ((*s == '\\') || (*s == '"')) {
+			fputc('\\', f);
+			fputc(*s, f);
+		} else if (*s == '\n') {
+			fputs("\\n", f);
+		} else {
+			fputc(*s, f);
+		}
+	}
+}
+
+#define LOAD(CNT) atomic_load_explicit(&(CNT), memory_order_relaxed)
+
+static uint64_t
+tr_mem(tkvdb_tr *tr)
+{
+	return tr ? tr->mem(tr) : 0;
+}
+
+/* sampled time multiplied by sampling rate */
+static uint64_t
+mo_cost_ns(struct monit_object *mo, enum MO_COST c)
+{
+	uint64_t ns = 0;
+	size_t t;
+
+	for (t=0; t<globl->nthreads; t++) {
+		ns += LOAD(mo->metrics[t].cost_ns[c]);
+	}
+
+	return ns * (globl->metrics.profile_mask + 1);
+}
+
+static uint64_t
+mo_flows(struct monit_object *mo)
+{
+	uint64_t flows = 0;
+	size_t t;
+
+	for (t=0; t<globl->nthreads; t++) {
+		flows += LOAD(mo->metrics[t].flows);
+	}
+
+	return flows;
+}
+
+static uint64_t
+fwm_live_mem(struct mo_fwm *fwm)
+{
+	uint64_t mem = 0;
+	size_t t;
+
+	for (t=0; t<globl->nthreads; t++) {
+		mem += tr_mem(fwm->thread_data[t].trs[0]);
+		mem += tr_mem(fwm->thread_data[t].trs[1]);
+	}
+
+	return mem;
+}
+
+static uint64_t
+mavg_mem(struct mo_mavg *mavg)
+{
+	uint64_t mem = 0;
+	size_t t;
+
+	for (t=0; t<mavg->nthreads; t++) {
+		mem += tr_mem(atomic_load_explicit(&mavg->thr_data[t].db,
+			memory_order_relaxed));
+	}
+
+	return mem;
+}
+
+static uint64_t
+clsf_mem(struct monit_object *mo)
+{
+	uint64_t mem = 0;
+	size_t i, t;
+
+	for (i=0; i<mo->nclassifications; i++) {
+		struct mo_classification *clsf = &mo->classifications[i];
+
+		for (t=0; t<globl->nthreads; t++) {
+			mem += tr_mem(clsf->thread_data[t].trs[0]);
+			mem += tr_mem(clsf->thread_data[t].trs[1]);
+		}
+		mem += tr_mem(clsf->db.bank[0]);
+		mem += tr_mem(clsf->db.bank[1]);
+	}
+
+	return mem;
+}
+
+static uint64_t
+mo_mem(struct monit_object *mo)
+{
+	uint64_t mem = clsf_mem(mo);
+	size_t i;
+
+	for (i=0; i<mo->nfwm; i++) {
+		mem += fwm_live_mem(&mo->fwms[i]);
+	}
+	for (i=0; i<mo->nmavg; i++) {
+		mem += mavg_mem(&mo->mavgs[i]);
+	}
+
+	return mem;
+}
+
+static void
+print_capture(FILE *f)
+{
+	size_t i, ncap = globl->nnfcap + globl->nsfcap;
+
+#define CAPTURE_METRIC(FLD, NAME, TYPE, HELP)                              \
+	family(f, NAME, TYPE, HELP);                                       \
+	for (i=0; i<ncap; i++) {                                           \
+		fprintf(f, "xenoeye_%s{thread=\"%lu\",type=\"%s\"} %lu\n", \
+			NAME, i, i < globl->nnfcap ? "netflow" : "sflow",  \
+			LOAD(globl->m_capture[i].FLD));                    \
+	}
+
+	CAPTURE_METRIC(packets, "capture_packets_total", "counter",
+		"Packets received by capture thread");
+	CAPTURE_METRIC(bytes, "capture_bytes_total", "counter",
+		"Bytes received by capture thread");
+	CAPTURE_METRIC(socket_drops, "capture_socket_drops_total", "counter",
+		"Packets dropped by kernel, SO_RXQ_OVFL");
+	CAPTURE_METRIC(pcap_recv, "capture_pcap_received_total", "counter",
+		"Packets received by pcap, pcap_stats()");
+	CAPTURE_METRIC(pcap_drop, "capture_pcap_dropped_total", "counter",
+		"Packets dropped by pcap, pcap_stats()");
+	CAPTURE_METRIC(pcap_ifdrop, "capture_pcap_ifdropped_total", "counter",
+		"Packets dropped by interface, pcap_stats()");
+#undef CAPTURE_METRIC
+
+	family(f, "workers_ring_drops_total", "counter",
+		"Packets dropped because rings of workers are full");
+	fprintf(f, "xenoeye_workers_ring_drops_total %lu\n", workers_drops());
+}
+
+static void
+print_proc(FILE *f)
+{
+	size_t i;
+	int p;
+
+	family(f, "decode_packets_total", "counter",
+		"Packets processed by decoder");
+	for (i=0; i<globl->nthreads; i++) {
+		for (p=0; p<METRICS_PROTO_MAX; p++) {
+			fprintf(f, "xenoeye_decode_packets_total"
+				"{thread=\"%lu\",proto=\"%s\"} %lu\n",
+				i, proto_names[p],
+				LOAD(globl->m_proc[i].packets[p]));
+		}
+	}
+
+	family(f, "decode_records_total", "counter",
+		"Flow records and sFlow samples decoded");
+	for (i=0; i<globl->nthreads; i++) {
+		for (p=0; p<METRICS_PROTO_MAX; p++) {
+			if (p == METRICS_UNKNOWN) {
+				continue;
+			}
+			fprintf(f, "xenoeye_decode_records_total"
+				"{thread=\"%lu\",proto=\"%s\"} %lu\n",
+				i, proto_names[p],
+				LOAD(globl->m_proc[i].records[p]));
+		}
+	}
+
+#define PROC_METRIC(FLD, NAME, HELP)                                       \
+	family(f, NAME, "counter", HELP);                                  \
+	for (i=0; i<globl->nthreads; i++) {                                \
+		fprintf(f, "xenoeye_%s{thread=\"%lu\"} %lu\n", NAME, i,    \
+			LOAD(globl->m_proc[i].FLD));                       \
+	}
+
+	PROC_METRIC(template_misses, "decode_template_misses_total",
+		"Data flowsets without template");
+	PROC_METRIC(unknown_flowsets, "decode_unknown_flowsets_total",
+		"Options templates and flowsets with unknown id");
+	PROC_METRIC(decode_errors, "decode_errors_total",
+		"Packets with decoding errors");
+	PROC_METRIC(filter_leaves, "filter_leaves_total",
+		"Basic filters of monitoring objects checked for flows");
+	PROC_METRIC(filter_evals, "filter_leaf_evals_total",
+		"Basic filters evaluated, the rest are taken from memo");
+	PROC_METRIC(combined, "combined_records_total",
+		"Records of windows summed with other records of packet");
+#undef PROC_METRIC
+
+	family(f, "log_suppressed_total", "counter",
+		"Log messages suppressed by rate limiter");
+	fprintf(f, "xenoeye_log_suppressed_total %lu\n",
+		(unsigned long)log_suppressed());
+	family(f, "log_dropped_total", "counter",
+		"Log messages dropped because log queue is full");
+	fprintf(f, "xenoeye_log_dropped_total %lu\n",
+		(unsigned long)log_dropped());
+}
+
+/* per-thread histograms are merged, only non-empty buckets are printed */
+static void
+print_prof(FILE *f)
+{
+	size_t i, b;
+	int s;
+
+	family(f, "stage_duration_seconds", "histogram",
+		"Sampled processing time of packet by stage");
+
+	for (s=0; s<PROF_STAGE_MAX; s++) {
+		uint64_t hist[PROF_NBUCKETS];
+		uint64_t count = 0, sum_ns = 0, cum = 0;
+
+		memset(hist, 0, sizeof(hist));
+		for (i=0; i<globl->nthreads; i++) {
+			struct metrics_prof *p = &globl->m_prof[i];
+
+			count += LOAD(p->count[s]);
+			sum_ns += LOAD(p->sum_ns[s]);
+			for (b=0; b<PROF_NBUCKETS; b++) {
+				hist[b] += LOAD(p->hist[s][b]);
+			}
+		}
+
+		for (b=0; b<PROF_NBUCKETS; b++) {
+			if (hist[b] == 0) {
+				continue;
+			}
+			cum += hist[b];
+			fprintf(f, "xenoeye_stage_duration_seconds_bucket"
+				"{stage=\"%s\",le=\"%.9f\"} %lu\n",
+				stage_names[s], prof_bucket_le(b) / 1e9, cum);
+		}
+		fprintf(f, "xenoeye_stage_duration_seconds_bucket"
+			"{stage=\"%s\",le=\"+Inf\"} %lu\n", stage_names[s], count);
+		fprintf(f, "xenoeye_stage_duration_seconds_sum"
+			"{stage=\"%s\"} %.9f\n", stage_names[s], sum_ns / 1e9);
+		fprintf(f, "xenoeye_stage_duration_seconds_count"
+			"{stage=\"%s\"} %lu\n", stage_names[s], count);
+	}
+}
+
+static void
+print_mo_value(FILE *f, struct mo_metric_desc *d, struct monit_object *mo,
+	const char *sub_label, const char *sub_name, double v)
+{
+	fprintf(f, "xenoeye_%s{mo=\"", d->name);
+	print_label(f, mo->name);
+	if (sub_label) {
+		fprintf(f, "\",%s=\"", sub_label);
+		print_label(f, sub_name);
+	}
+	fprintf(f, "\"} %.17g\n", v);
+}
+
+static void
+print_mo_rec(FILE *f, struct mo_metric_desc *d, struct monit_object *mos,
+	size_t n_mo)
+{
+	size_t i, j, t;
+
+	for (i=0; i<n_mo; i++) {
+		struct monit_object *mo = &mos[i];
+
+		if (d->id == MO_FLOWS) {
+			print_mo_value(f, d, mo, NULL, NULL, mo_flows(mo));
+		} else if (d->id == MO_COST) {
+			for (t=0; t<MO_COST_MAX; t++) {
+				print_mo_value(f, d, mo, "part", cost_names[t],
+					mo_cost_ns(mo, t) / 1e9);
+			}
+		} else if (d->id == CLSF_MEM) {
+			print_mo_value(f, d, mo, NULL, NULL, clsf_mem(mo));
+		}
+
+		for (j=0; j<mo->nfwm; j++) {
+			struct mo_fwm *fwm = &mo->fwms[j];
+			double v;
+
+			switch (d->id) {
+				case FWM_KEYS:
+					v = LOAD(fwm->m_keys);
+					break;
+				case FWM_MEM:
+					v = LOAD(fwm->m_mem);
+					break;
+				case FWM_EXPORTS:
+					v = LOAD(fwm->m_exports);
+					break;
+				case FWM_EXPORT_SECONDS:
+					v = LOAD(fwm->m_export_ns) / 1e9;
+					break;
+				case FWM_LAST_EXPORT_SECONDS:
+					v = LOAD(fwm->m_last_export_ns) / 1e9;
+					break;
+				case FWM_EXPORT_BYTES:
+					v = LOAD(fwm->m_export_bytes);
+					break;
+				case FWM_LIVE_MEM:
+					v = fwm_live_mem(fwm);
+					break;
+				default:
+					continue;
+			}
+			print_mo_value(f, d, mo, "window", fwm->name, v);
+		}
+
+		for (j=0; j<mo->nmavg; j++) {
+			struct mo_mavg *mavg = &mo->mavgs[j];
+			double v = 0.0;
+
+			if ((d->id != MAVG_KEYS) && (d->id != MAVG_MEM)
+				&& (d->id != MAVG_MEM_LIMIT)) {
+
+				continue;
+			}
+
+			if (d->id == MAVG_MEM) {
+				v = mavg_mem(mavg);
+			} else {
+				for (t=0; t<mavg->nthreads; t++) {
+					if (d->id == MAVG_KEYS) {
+						v += LOAD(mavg->thr_data[t].nkeys);
+					} else {
+						v += mavg->db_mem;
+					}
+				}
+			}
+			print_mo_value(f, d, mo, "mavg", mavg->name, v);
+		}
+
+		if (mo->n_mo) {
+			print_mo_rec(f, d, mo->mos, mo->n_mo);
+		}
+	}
+}
+
+static void
+print_notify(FILE *f)
+{
+	uint64_t queued, coalesced, dropped, sent;
+
+	mavg_notify_stats(&queued, &coalesced, &dropped, &sent);
+
+	family(f, "notify_queued_total", "counter",
+		"Overlimit events queued to notification dispatcher");
+	fprintf(f, "xenoeye_notify_queued_total %lu\n", queued);
+	family(f, "notify_coalesced_total", "counter",
+		"Events coalesced with pending events for the same item");
+	fprintf(f, "xenoeye_notify_coalesced_total %lu\n", coalesced);
+	family(f, "notify_dropped_total", "counter",
+		"Events dropped because queue is full");
+	fprintf(f, "xenoeye_notify_dropped_total %lu\n", dropped);
+	family(f, "notify_sent_total", "counter",
+		"Events sent to helper processes");
+	fprintf(f, "xenoeye_notify_sent_total %lu\n", sent);
+}
+
+#undef LOAD
+
+static char *
+metrics_format(size_t *size)
+{
+	FILE *f;
+	char *buf = NULL;
+	size_t i;
+
+	f = open_memstream(&buf, size);
+	if (!f) {
+		LOG("open_memstream() failed: %s", strerror(errno));
+		return NULL;
+	}
+
+	print_capture(f);
+	print_proc(f);
+	if (globl->metrics.profile_sample) {
+		print_prof(f);
+	}
+	for (i=0; i<sizeof(mo_metrics) / sizeof(mo_metrics[0]); i++) {
+		struct mo_metric_desc *d = &mo_metrics[i];
+
+		if ((d->id == MO_COST) && !globl->metrics.profile_sample) {
+			continue;
+		}
+		family(f, d->name, d->type, d->help);
+		print_mo_rec(f, d, globl->monit_objects, globl->nmonit_objects);
+	}
+	print_notify(f);
+
+	fclose(f);
+
+	return buf;
+}
+
+/* flat list of monitoring objects with cost since previous report */
+static int
+report_collect(struct mo_report *r, struct monit_object *mos, size_t n_mo)
+{
+	size_t i;
+	int c;
+
+	for (i=0; i<n_mo; i++) {
+		struct monit_object *mo = &mos[i];
+		struct mo_report_item *item;
+		uint64_t flows;
+
+		if (r->n >= r->size) {
+			size_t size = r->size ? r->size * 2 : 64;
+			struct mo_report_item *tmp;
+
+			tmp = realloc(r->items,
+				size * sizeof(struct mo_report_item));
+			if (!tmp) {
+				LOG("realloc() failed");
+				return 0;
+			}
+			r->items = tmp;
+			r->size = size;
+		}
+
+		item = &r->items[r->n++];
+		item->mo = mo;
+		item->total_ns = 0;
+		for (c=0; c<MO_COST_MAX; c++) {
+			uint64_t ns = mo_cost_ns(mo, c);
+
+			item->cost_ns[c] = ns - mo->report_cost_ns[c];
+			item->total_ns += item->cost_ns[c];
+			mo->report_cost_ns[c] = ns;
+		}
+		flows = mo_flows(mo);
+		item->flows = flows - mo->report_flows;
+		mo->report_flows = flows;
+		item->mem = mo_mem(mo);
+
+		if (mo->n_mo) {
+			if (!report_collect(r, mo->mos, mo->n_mo)) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int
+report_cmp(const void *a, const void *b)
+{
+	const struct mo_report_item *ia = a, *ib = b;
+
+	if (ia->total_ns != ib->total_ns) {
+		return ia->total_ns < ib->total_ns ? 1 : -1;
+	}
+	if (ia->mem != ib->mem) {
+		return ia->mem < ib->mem ? 1 : -1;
+	}
+	return strcmp(ia->mo->name, ib->mo->name);
+}
+
+/* ranked report, file is replaced atomically */
+static void
+mo_report_write(double secs)
+{
+	struct mo_report r;
+	char tmp_path[PATH_MAX + 8];
+	FILE *f;
+	size_t i;
+	int c;
+
+	memset(&r, 0, sizeof(struct mo_report));
+	if (!report_collect(&r, globl->monit_objects, globl->nmonit_objects)) {
+		goto done;
+	}
+	qsort(r.items, r.n, sizeof(struct mo_report_item), &report_cmp);
+
+	sprintf(tmp_path, "%s.tmp", globl->metrics.mo_report);
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		LOG("Can't open '%s': %s", tmp_path, strerror(errno));
+		goto done;
+	}
+
+	fprintf(f, "# monitoring objects by estimated CPU time, "
+		"last %.1f seconds, ", secs);
+	if (globl->metrics.profile_sample) {
+		fprintf(f, "sampling 1/%lu\n",
+			(unsigned long)globl->metrics.profile_sample);
+	} else {
+		fprintf(f, "profiler is disabled\n");
+	}
+	fprintf(f, "# CPU is in percents of one core\n");
+	fprintf(f, "%5s %8s %8s %8s %8s %12s %12s  %s\n", "#rank", "cpu",
+		"filter", "key", "db", "flows/s", "memory", "mo");
+
+	for (i=0; i<r.n; i++) {
+		struct mo_report_item *item = &r.items[i];
+
+		fprintf(f, "%5lu %8.2f", i + 1,
+			item->total_ns / (secs * 1e9) * 100.0);
+		for (c=0; c<MO_COST_MAX; c++) {
+			fprintf(f, " %8.2f",
+				item->cost_ns[c] / (secs * 1e9) * 100.0);
+		}
+		fprintf(f, " %12.1f %12lu  %s\n", item->flows / secs,
+			(unsigned long)item->mem, item->mo->name);
+	}
+
+	if (fclose(f) != 0) {
+		LOG("Can't write '%s': %s", tmp_path, strerror(errno));
+		goto done;
+	}
+
+	if (rename(tmp_path, globl->metrics.mo_report) != 0) {
+		LOG("Can't rename '%s' to '%s': %s", tmp_path,
+			globl->metrics.mo_report, strerror(errno));
+	}
+
+done:
+	free(r.items);
+}
+
+static int
+send_all(int fd, const char *buf, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 0;
+		}
+		buf += n;
+		size -= n;
+	}
+
+	return 1;
+}
+
+/* read HTTP request headers, returns 0 on timeout or error */
+static int
+http_read_request(int fd, char *req, size_t size)
+{
+	size_t len = 0;
+
+	while (len < (size - 1)) {
+		struct pollfd pfd;
+		ssize_t n;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, METRICS_TIMEOUT_MS) <= 0) {
+			return 0;
+		}
+
+		n = recv(fd, req + len, size - 1 - len, 0);
+		if (n <= 0) {
+			return 0;
+		}
+		len += n;
+		req[len] = '\0';
+
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) {
+			return 1;
+		}
+	}
+
+	/* too long, but request line is here */
+	return 1;
+}
+
+static void
+http_serve(int fd)
+{
+	char req[METRICS_REQUEST_MAX];
+	char hdr[256];
+	char *body;
+	size_t size;
+
+	if (!http_read_request(fd, req, sizeof(req))) {
+		return;
+	}
+
+	if ((strncmp(req, "GET /metrics", 12) != 0)
+		|| ((req[12] != ' ') && (req[12] != '?'))) {
+
+		const char *resp = "HTTP/1.1 404 Not Found\r\n"
+			"Content-Length: 0\r\nConnection: close\r\n\r\n";
+
+		send_all(fd, resp, strlen(resp));
+		return;
+	}
+
+	body = metrics_format(&size);
+	if (!body) {
+		return;
+	}
+
+	sprintf(hdr, "HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %lu\r\n"
+		"Connection: close\r\n\r\n", size);
+
+	if (send_all(fd, hdr, strlen(hdr))) {
+		send_all(fd, body, size);
+	}
+
+	free(body);
+}
+
+static void
+unix_serve(int fd)
+{
+	char *body;
+	size_t size;
+
+	body = metrics_format(&size);
+	if (!body) {
+		return;
+	}
+
+	send_all(fd, body, size);
+	free(body);
+}
+
+static void
+accept_and_serve(int lfd, int is_http)
+{
+	int fd;
+	struct timeval tv;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0) {
+		LOG("accept() failed: %s", strerror(errno));
+		return;
+	}
+
+	tv.tv_sec = METRICS_TIMEOUT_MS / 1000;
+	tv.tv_usec = (METRICS_TIMEOUT_MS % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (is_http) {
+		http_serve(fd);
+	} else {
+		unix_serve(fd);
+	}
+
+	close(fd);
+}
+
+static void *
+metrics_thread(void *arg)
+{
+	uint64_t report_prev, report_ns;
+
+	(void)arg;
+
+	LOG("Starting metrics thread");
+
+	report_prev = prof_now();
+	report_ns = (uint64_t)globl->metrics.mo_report_interval * 1000000000ULL;
+
+	for (;;) {
+		struct pollfd pfd[2];
+		int nfds = 0, http_idx = -1, unix_idx = -1;
+		int rc;
+		uint64_t now;
+
+		if (atomic_load_explicit(&globl->stop, memory_order_relaxed)) {
+			break;
+		}
+
+		now = prof_now();
+		if (*globl->metrics.mo_report
+			&& ((now - report_prev) >= report_ns)) {
+
+			mo_report_write((now - report_prev) / 1e9);
+			report_prev = now;
+		}
+
+		if (unix_fd >= 0) {
+			pfd[nfds].fd = unix_fd;
+			pfd[nfds].events = POLLIN;
+			unix_idx = nfds++;
+		}
+		if (http_fd >= 0) {
+			pfd[nfds].fd = http_fd;
+			pfd[nfds].events = POLLIN;
+			http_idx = nfds++;
+		}
+
+		rc = poll(pfd, nfds, METRICS_TIMEOUT_MS);
+		if (rc < 0) {
+			if (errno != EINTR) {
+				LOG("poll() failed: %s", strerror(errno));
+			}
+			continue;
+		}
+
+		if ((unix_idx >= 0) && (pfd[unix_idx].revents & POLLIN)) {
+			accept_and_serve(unix_fd, 0);
+		}
+		if ((http_idx >= 0) && (pfd[http_idx].revents & POLLIN)) {
+			accept_and_serve(http_fd, 1);
+		}
+	}
+
+	return NULL;
+}
+
+static int
+unix_listen(const char *path)
+{
+	int fd;
+	struct sockaddr_un addr;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		LOG("socket() failed: %s", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* socket from previous run */
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		LOG("bind('%s') failed: %s", path, strerror(errno));
+		goto fail;
+	}
+
+	if (listen(fd, 16) < 0) {
+		LOG("listen() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+static int
+http_listen(int port)
+{
+	int fd, one = 1;
+	struct sockaddr_in addr;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		LOG("socket() failed: %s", strerror(errno));
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, METRICS_HTTP_ADDR, &addr.sin_addr);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		LOG("bind(%s:%d) failed: %s", METRICS_HTTP_ADDR, port,
+			strerror(errno));
+		goto fail;
+	}
+
+	if (listen(fd, 16) < 0) {
+		LOG("listen() failed: %s", strerror(errno));
+		goto fail;
+	}
+
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+int
+metrics_init(struct xe_data *data)
+{
+	size_t ncap = data->nnfcap + data->nsfcap;
+	int thread_err;
+
+	globl = data;
+
+	data->m_capture = calloc_cl(ncap ? ncap : 1,
+		sizeof(struct metrics_capture));
+	if (!data->m_capture) {
+		LOG("calloc_cl() failed");
+		return 0;
+	}
+
+	data->m_proc = calloc_cl(data->nthreads ? data->nthreads : 1,
+		sizeof(struct metrics_proc));
+	if (!data->m_proc) {
+		LOG("calloc_cl() failed");
+		return 0;
+	}
+
+	data->m_prof = calloc_cl(data->nthreads ? data->nthreads : 1,
+		sizeof(struct metrics_prof));
+	if (!data->m_prof) {
+		LOG("calloc_cl() failed");
+		return 0;
+	}
+	if (data->metrics.profile_sample) {
+		LOG("Profiling each %lu packet",
+			(unsigned long)data->metrics.profile_sample);
+	}
+
+	if (data->metrics.mo_report_interval == 0) {
+		data->metrics.mo_report_interval = METRICS_MO_REPORT_SECS;
+	}
+	if (*data->metrics.mo_report && !data->metrics.profile_sample) {
+		LOG("metrics: 'profile-sample' is not set, report '%s' "
+			"will contain only flows and memory",
+			data->metrics.mo_report);
+	}
+
+	if (*data->metrics.unix_socket) {
+		unix_fd = unix_listen(data->metrics.unix_socket);
+	}
+	if (data->metrics.http_port) {
+		http_fd = http_listen(data->metrics.http_port);
+	}
+
+	if ((unix_fd < 0) && (http_fd < 0) && !*data->metrics.mo_report) {
+		/* counters only */
+		return 1;
+	}
+
+	thread_err = pthread_create(&data->metrics_tid, NULL,
+		&metrics_thread, NULL);
+	if (thread_err) {
+		LOG("Can't start thread: %s", strerror(thread_err));
+		return 0;
+	}
+
+	if (unix_fd >= 0) {
+		LOG("Metrics are available on socket '%s'",
+			data->metrics.unix_socket);
+	}
+	if (http_fd >= 0) {
+		LOG("Metrics are available on http://%s:%d/metrics",
+			METRICS_HTTP_ADDR, data->metrics.http_port);
+	}
+
+	return 1;
+}
+
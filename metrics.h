@@ -0,0 +1,255 @@
+#ifndef metrics_h_included
+#define metrics_h_included
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <time.h>
+
+#include "utils.h"
+#include "aajson/aajson.h"
+
+/*
+ * Runtime counters
+ *
+ * Each capture and processing thread has its own cache line aligned slot
+ * with counters. Counter has only one writer, so it is updated with plain
+ * relaxed load/store, without atomic read-modify-write. Metrics thread
+ * reads all slots and monitoring objects on request and returns text in
+ * Prometheus exposition format.
+ *
+ * Metrics are served over UNIX socket (text is written right after
+ * connect) and/or over HTTP on loopback interface ("GET /metrics").
+ *
+ * Optional sampling profiler: every Nth packet is timed per stage with
+ * CLOCK_MONOTONIC_RAW. Timings go to per-thread log-linear histograms:
+ * values below PROF_LINEAR ns have own buckets, each next power of two is
+ * split into 1 << PROF_SUB_BITS buckets.
+ */
+
+#define METRICS_HTTP_ADDR "127.0.0.1"
+#define METRICS_REQUEST_MAX 4096
+#define METRICS_TIMEOUT_MS 1000
+
+/* how often capture threads ask pcap for statistics */
+#define METRICS_PCAP_STATS_SECS 1
+
+/* default interval of monitoring objects cost report */
+#define METRICS_MO_REPORT_SECS 60
+
+/* counters have one writer */
+#define METRICS_ADD(CNT, V)                                            \
+	atomic_store_explicit(&(CNT),                                  \
+		atomic_load_explicit(&(CNT), memory_order_relaxed) + (V), \
+		memory_order_relaxed)
+
+#define METRICS_SET(CNT, V)                                            \
+	atomic_store_explicit(&(CNT), (V), memory_order_relaxed)
+
+enum METRICS_PROTO
+{
+	METRICS_NETFLOW_V5,
+	METRICS_NETFLOW_V9,
+	METRICS_IPFIX,
+	METRICS_SFLOW,
+	METRICS_UNKNOWN,
+
+	METRICS_PROTO_MAX
+};
+
+enum PROF_STAGE
+{
+	PROF_PACKET,    /* whole packet */
+	PROF_DECODE,    /* packet without stages below */
+	PROF_FILTER,
+	PROF_FWM,
+	PROF_MAVG,
+	PROF_CLSF,
+
+	PROF_STAGE_MAX
+};
+
+#define PROF_LINEAR 16
+#define PROF_SUB_BITS 2
+#define PROF_NBUCKETS (PROF_LINEAR + (40 - 4) * (1 << PROF_SUB_BITS))
+
+struct metrics_conf
+{
+	/* path to UNIX socket, empty - don't listen */
+	char unix_socket[PATH_MAX];
+
+	/* loopback TCP port, 0 - don't listen */
+	int http_port;
+
+	/* profile each Nth packet, 0 - disabled */
+	uint64_t profile_sample;
+	/* profile_sample rounded to power of two, minus one */
+	uint64_t profile_mask;
+
+	/* ranked report of monitoring objects cost, empty - disabled */
+	char mo_report[PATH_MAX];
+	int mo_report_interval;
+};
+
+/* capture thread */
+struct metrics_capture
+{
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t packets;
+	_Atomic uint64_t bytes;
+
+	/* SO_RXQ_OVFL, packets dropped by kernel */
+	_Atomic uint64_t socket_drops;
+
+	/* pcap_stats() */
+	_Atomic uint64_t pcap_recv;
+	_Atomic uint64_t pcap_drop;
+	_Atomic uint64_t pcap_ifdrop;
+};
+
+/* processing thread */
+struct metrics_proc
+{
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t packets[METRICS_PROTO_MAX];
+	_Atomic uint64_t records[METRICS_PROTO_MAX];
+
+	/* data flowset without template */
+	_Atomic uint64_t template_misses;
+	/* options templates and unknown flowsets */
+	_Atomic uint64_t unknown_flowsets;
+	_Atomic uint64_t decode_errors;
+
+	/* basic filters of objects for flows and really evaluated ones */
+	_Atomic uint64_t filter_leaves;
+	_Atomic uint64_t filter_evals;
+
+	/* records of windows summed with previous records of packet */
+	_Atomic uint64_t combined;
+};
+
+/* sampling profiler of processing thread */
+struct metrics_prof
+{
+	_Alignas(CACHE_LINE_SIZE) uint64_t npackets;
+	int active;
+	uint64_t t_packet;
+	uint64_t nested_ns;
+
+	_Atomic uint64_t count[PROF_STAGE_MAX];
+	_Atomic uint64_t sum_ns[PROF_STAGE_MAX];
+	_Atomic uint64_t hist[PROF_STAGE_MAX][PROF_NBUCKETS];
+};
+
+static inline uint64_t
+prof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline size_t
+prof_bucket(uint64_t ns)
+{
+	int e;
+	size_t idx;
+
+	if (ns < PROF_LINEAR) {
+		return ns;
+	}
+
+	e = 63 - __builtin_clzll(ns);
+	idx = PROF_LINEAR + (e - 4) * (1 << PROF_SUB_BITS)
+		+ ((ns >> (e - PROF_SUB_BITS)) & ((1 << PROF_SUB_BITS) - 1));
+
+	if (idx >= PROF_NBUCKETS) {
+		idx = PROF_NBUCKETS - 1;
+	}
+	return idx;
+}
+
+/* upper bound of bucket in nanoseconds */
+static inline uint64_t
+prof_bucket_le(size_t idx)
+{
+	size_t e, sub;
+
+	if (idx < PROF_LINEAR) {
+		return idx;
+	}
+
+	e = (idx - PROF_LINEAR) / (1 << PROF_SUB_BITS) + 4;
+	sub = (idx - PROF_LINEAR) % (1 << PROF_SUB_BITS);
+
+	return (((1ULL << PROF_SUB_BITS) + sub + 1) << (e - PROF_SUB_BITS)) - 1;
+}
+
+static inline void
+prof_add(struct metrics_prof *p, enum PROF_STAGE s, uint64_t ns)
+{
+	METRICS_ADD(p->count[s], 1);
+	METRICS_ADD(p->sum_ns[s], ns);
+	METRICS_ADD(p->hist[s][prof_bucket(ns)], 1);
+}
+
+static inline void
+prof_packet_begin(struct metrics_prof *p, struct metrics_conf *c)
+{
+	p->npackets++;
+	p->active = c->profile_sample
+		&& ((p->npackets & c->profile_mask) == 0);
+	if (p->active) {
+		p->nested_ns = 0;
+		p->t_packet = prof_now();
+	}
+}
+
+static inline void
+prof_packet_end(struct metrics_prof *p)
+{
+	uint64_t total;
+
+	if (!p->active) {
+		return;
+	}
+
+	total = prof_now() - p->t_packet;
+	prof_add(p, PROF_PACKET, total);
+	prof_add(p, PROF_DECODE,
+		total > p->nested_ns ? total - p->nested_ns : 0);
+	p->active = 0;
+}
+
+static inline uint64_t
+prof_start(struct metrics_prof *p)
+{
+	return p->active ? prof_now() : 0;
+}
+
+/* returns time of stage, 0 if packet is not sampled */
+static inline uint64_t
+prof_end(struct metrics_prof *p, enum PROF_STAGE s, uint64_t t0)
+{
+	uint64_t ns;
+
+	if (!p->active) {
+		return 0;
+	}
+
+	ns = prof_now() - t0;
+	p->nested_ns += ns;
+	prof_add(p, s, ns);
+
+	return ns;
+}
+
+struct xe_data;
+
+int metrics_config(struct aajson *a, aajson_val *value,
+	struct metrics_conf *c);
+
+/* allocate counters, start server thread if enabled */
+int metrics_init(struct xe_data *data);
+
+#endif
+
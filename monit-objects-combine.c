@@ -0,0 +1,190 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Combiner of records of packet: under flood most of records of NetFlow
+ * packet (or sFlow datagram) have the same key of window (victim address,
+ * the same pair of hosts). Values of such records are summed in small
+ * per-thread hash table and written to database of window once, after
+ * packet is processed. All records of packet have the same time, so moving
+ * averages get the same values as with record by record updates
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "xenoeye.h"
+#include "monit-objects.h"
+
+/* combiners with records, per processing thread */
+static _Thread_local struct mo_combiner *dirty = NULL;
+
+static uint64_t
+key_hash(uint8_t *key, size_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	/* FNV-1a */
+	for (i=0; i<size; i++) {
+		h ^= key[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+struct mo_combiner *
+mo_combiner_new(struct xe_data *globl, struct monit_object *mo, void *window,
+	int is_mavg, size_t keysize, size_t valsize)
+{
+	struct mo_combiner *c;
+
+	c = calloc(1, sizeof(struct mo_combiner));
+	if (!c) {
+		LOG_RL("Not enough memory for combiner");
+		goto fail_c;
+	}
+
+	c->mo = mo;
+	c->window = window;
+	c->is_mavg = is_mavg;
+	c->keysize = keysize;
+	c->valsize = valsize;
+
+	/* load factor is at most 1/2 */
+	c->maxkeys = globl->combine;
+	c->nslots = 2;
+	while (c->nslots < c->maxkeys * 2) {
+		c->nslots *= 2;
+	}
+
+	c->order = malloc(c->maxkeys * sizeof(uint32_t));
+	c->used = calloc(c->nslots, 1);
+	c->keys = malloc(c->nslots * keysize);
+	c->vals = malloc(c->nslots * valsize);
+	if (!c->order || !c->used || !c->keys || !c->vals) {
+		LOG_RL("Not enough memory for combiner");
+		goto fail_tables;
+	}
+
+	return c;
+
+fail_tables:
+	free(c->order);
+	free(c->used);
+	free(c->keys);
+	free(c->vals);
+	free(c);
+fail_c:
+	return NULL;
+}
+
+void *
+mo_combiner_slot(struct mo_combiner *c, uint8_t *key, uint64_t time_ns)
+{
+	size_t i;
+
+	i = key_hash(key, c->keysize) & (c->nslots - 1);
+	while (c->used[i]) {
+		if (memcmp(c->keys + i * c->keysize, key, c->keysize) == 0) {
+			c->nrecords++;
+			return c->vals + i * c->valsize;
+		}
+		i = (i + 1) & (c->nslots - 1);
+	}
+
+	if (c->nkeys == c->maxkeys) {
+		/* full, record goes directly to database */
+		return NULL;
+	}
+
+	c->used[i] = 1;
+	memcpy(c->keys + i * c->keysize, key, c->keysize);
+	memset(c->vals + i * c->valsize, 0, c->valsize);
+	c->order[c->nkeys++] = i;
+	c->nrecords++;
+	c->time_ns = time_ns;
+
+	if (!c->is_dirty) {
+		c->is_dirty = 1;
+		c->next = dirty;
+		dirty = c;
+	}
+
+	return c->vals + i * c->valsize;
+}
+
+static void
+combiner_flush(struct xe_data *globl, size_t thread_id, struct mo_combiner *c)
+{
+	size_t k;
+
+	for (k=0; k<c->nkeys; k++) {
+		size_t i = c->order[k];
+		uint8_t *key = c->keys + i * c->keysize;
+		uint8_t *vals = c->vals + i * c->valsize;
+
+		if (c->is_mavg) {
+			struct mo_mavg *mavg = c->window;
+			struct mavg_thread_data *data;
+
+			data = &mavg->thr_data[thread_id];
+			memcpy(data->key, key, c->keysize);
+			monit_object_mavg_add(globl, mavg, thread_id,
+				c->time_ns, (MAVG_TYPE *)vals);
+		} else {
+			struct mo_fwm *fwm = c->window;
+			struct fwm_thread_data *fdata;
+
+			fdata = &fwm->thread_data[thread_id];
+			memcpy(fdata->key, key, c->keysize);
+			memcpy(fdata->val, vals, c->valsize);
+			monit_object_fwm_add(fwm, fdata);
+		}
+
+		c->used[i] = 0;
+	}
+
+	METRICS_ADD(globl->m_proc[thread_id].combined,
+		c->nrecords - c->nkeys);
+
+	c->nkeys = 0;
+	c->nrecords = 0;
+	c->is_dirty = 0;
+}
+
+void
+monit_objects_combine_flush(struct xe_data *globl, size_t thread_id)
+{
+	struct metrics_prof *prof = &globl->m_prof[thread_id];
+
+	while (dirty) {
+		struct mo_combiner *c = dirty;
+		struct mo_thread_metrics *m = &c->mo->metrics[thread_id];
+		uint64_t t0;
+
+		dirty = c->next;
+
+		t0 = prof_start(prof);
+		combiner_flush(globl, thread_id, c);
+		mo_cost_lap(m, MO_COST_DB, t0);
+		prof_end(prof, c->is_mavg ? PROF_MAVG : PROF_FWM, t0);
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef monit_objects_conf_h_included
+#define monit_objects_conf_h_included
+
+#include <stddef.h>
+#include <limits.h>
+
+/*
+ * Settings of monitoring objects background threads from main config,
+ * xenoeye.h and monit-objects.h both need them
+ */
+
+/* notification dispatcher */
+#define MAVG_NOTIFY_DEFAULT_QUEUE 1024
+#define MAVG_NOTIFY_DEFAULT_BATCH 64
+#define MAVG_NOTIFY_DEFAULT_FLUSH_MS 100
+#define MAVG_NOTIFY_LINE_MAX 2048
+
+struct mavg_notify_conf
+{
+	int enabled;
+	size_t queue_size;
+	size_t batch_size;
+	unsigned int flush_ms;
+};
+
+/* warm restart */
+#define SNAPSHOT_DEFAULT_PATH "/var/lib/xenoeye/snapshot.bin"
+#define SNAPSHOT_DEFAULT_INTERVAL 60
+
+struct snapshot_conf
+{
+	int enabled;
+	char path[PATH_MAX];
+	/* seconds between periodic snapshots, 0 - only on shutdown */
+	int interval;
+};
+
+#endif
+
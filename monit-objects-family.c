@@ -0,0 +1,358 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Family of monitoring objects: one object for many tenants. Tenant id is
+ * found by source or destination address of flow in map file (longest
+ * prefix match) and becomes the first key field of all windows, so tenants
+ * share the same per-thread tables
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "monit-objects.h"
+#include "flow-info.h"
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+family_config(struct aajson *a, aajson_val *value, struct monit_object *mo)
+{
+	if (a->path_stack_pos != 2) {
+		LOG("'family' must be object");
+		return 0;
+	}
+
+	if (!mo->family) {
+		mo->family = calloc(1, sizeof(struct mo_family));
+		if (!mo->family) {
+			LOG("calloc() failed");
+			return 0;
+		}
+		mo->family->direction = FILTER_BASIC_DIR_DST;
+	}
+
+	if (STRCMP(a, 2, "map") == 0) {
+		if (strlen(value->str) >= sizeof(mo->family->map)) {
+			LOG("Map file name is too long");
+			return 0;
+		}
+		strcpy(mo->family->map, value->str);
+	} else if (STRCMP(a, 2, "direction") == 0) {
+		if (strcmp(value->str, "src") == 0) {
+			mo->family->direction = FILTER_BASIC_DIR_SRC;
+		} else if (strcmp(value->str, "dst") == 0) {
+			mo->family->direction = FILTER_BASIC_DIR_DST;
+		} else {
+			LOG("Unknown direction '%s', expected 'src' or 'dst'",
+				value->str);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+#undef STRCMP
+
+static int
+family_trie_add(struct mo_family_trie *t, uint8_t *addr, int mask,
+	uint32_t tenant)
+{
+	int i;
+	uint32_t node = 0;
+
+	if (t->n == 0) {
+		t->nodes = calloc(1, sizeof(struct mo_family_node));
+		if (!t->nodes) {
+			return 0;
+		}
+		t->n = 1;
+	}
+
+	for (i=0; i<mask; i++) {
+		struct mo_family_node *tmp;
+		int bit = (addr[i / 8] >> (7 - (i % 8))) & 1;
+
+		if (t->nodes[node].next[bit]) {
+			node = t->nodes[node].next[bit];
+			continue;
+		}
+
+		tmp = realloc(t->nodes, (t->n + 1) * sizeof(struct mo_family_node));
+		if (!tmp) {
+			return 0;
+		}
+		t->nodes = tmp;
+		memset(&t->nodes[t->n], 0, sizeof(struct mo_family_node));
+		t->nodes[node].next[bit] = t->n;
+		node = t->n;
+		t->n++;
+	}
+
+	t->nodes[node].is_leaf = 1;
+	t->nodes[node].tenant = tenant;
+
+	return 1;
+}
+
+static int
+family_trie_lookup(struct mo_family_trie *t, const uint8_t *addr, int bits,
+	uint32_t *tenant)
+{
+	int i, found = 0;
+	uint32_t node = 0;
+
+	if (t->n == 0) {
+		return 0;
+	}
+
+	for (i=0; ; i++) {
+		int bit;
+
+		if (t->nodes[node].is_leaf) {
+			/* longer prefix wins */
+			*tenant = t->nodes[node].tenant;
+			found = 1;
+		}
+
+		if (i == bits) {
+			break;
+		}
+
+		bit = (addr[i / 8] >> (7 - (i % 8))) & 1;
+		node = t->nodes[node].next[bit];
+		if (!node) {
+			break;
+		}
+	}
+
+	return found;
+}
+
+/* map file is relative to directory of mo.conf */
+static int
+family_map_load(struct mo_family *fm, const char *mo_path)
+{
+	FILE *f;
+	char path[PATH_MAX * 2];
+	const char *slash;
+	int line_no = 0, ret = 0;
+	size_t nprefixes = 0;
+
+	slash = strrchr(mo_path, '/');
+	if ((fm->map[0] == '/') || !slash) {
+		strcpy(path, fm->map);
+	} else {
+		sprintf(path, "%.*s/%s", (int)(slash - mo_path), mo_path,
+			fm->map);
+	}
+
+	f = fopen(path, "r");
+	if (!f) {
+		LOG("Can't open tenant map '%s': %s", path, strerror(errno));
+		return 0;
+	}
+
+	for (;;) {
+		char line[1024];
+		char *str_addr, *str_tenant, *mask_sym, *endptr;
+		uint8_t addr[16];
+		unsigned long tenant;
+		int mask, ok;
+
+		if (!fgets(line, sizeof(line) - 1, f)) {
+			break;
+		}
+		line_no++;
+
+		line[strcspn(line, "\n#")] = 0;
+		str_addr = string_trim(line);
+		if (strlen(str_addr) == 0) {
+			continue;
+		}
+
+		/* <network> <tenant id> */
+		str_tenant = str_addr + strcspn(str_addr, " \t");
+		if (*str_tenant == '\0') {
+			LOG("'%s', line %d: tenant id expected", path, line_no);
+			goto fail_line;
+		}
+		*str_tenant = '\0';
+		str_tenant = string_trim(str_tenant + 1);
+
+		errno = 0;
+		tenant = strtoul(str_tenant, &endptr, 10);
+		if ((*endptr != '\0') || (errno != 0) || (tenant > UINT32_MAX)) {
+			LOG("'%s', line %d: incorrect tenant id '%s'", path,
+				line_no, str_tenant);
+			goto fail_line;
+		}
+
+		mask = -1;
+		mask_sym = strchr(str_addr, '/');
+		if (mask_sym) {
+			*mask_sym = '\0';
+			mask = strtol(mask_sym + 1, &endptr, 10);
+			if ((*endptr != '\0') || (mask < 0)) {
+				LOG("'%s', line %d: incorrect mask", path,
+					line_no);
+				goto fail_line;
+			}
+		}
+
+		if (inet_pton(AF_INET, str_addr, addr) == 1) {
+			if (mask > 32) {
+				LOG("'%s', line %d: incorrect mask", path,
+					line_no);
+				goto fail_line;
+			}
+			ok = family_trie_add(&fm->v4, addr,
+				(mask < 0) ? 32 : mask, tenant);
+		} else if (inet_pton(AF_INET6, str_addr, addr) == 1) {
+			if (mask > 16 * 8) {
+				LOG("'%s', line %d: incorrect mask", path,
+					line_no);
+				goto fail_line;
+			}
+			ok = family_trie_add(&fm->v6, addr,
+				(mask < 0) ? 16 * 8 : mask, tenant);
+		} else {
+			LOG("'%s', line %d: can't parse address '%s'", path,
+				line_no, str_addr);
+			goto fail_line;
+		}
+
+		if (!ok) {
+			LOG("Not enough memory");
+			goto fail_line;
+		}
+		nprefixes++;
+	}
+
+	LOG("Tenant map '%s': %lu networks", path, (unsigned long)nprefixes);
+	ret = 1;
+
+fail_line:
+	fclose(f);
+	return ret;
+}
+
+static int
+family_field_prepend(struct field **fields, size_t *n, struct field *fld)
+{
+	struct field *tmp;
+
+	tmp = realloc(*fields, (*n + 1) * sizeof(struct field));
+	if (!tmp) {
+		LOG("realloc() failed");
+		return 0;
+	}
+	memmove(&tmp[1], &tmp[0], *n * sizeof(struct field));
+	tmp[0] = *fld;
+	*fields = tmp;
+	(*n)++;
+
+	return 1;
+}
+
+static int
+family_fieldset_prepend(struct mo_fieldset *fs, struct field *fld)
+{
+	return family_field_prepend(&fs->fields, &fs->n, fld)
+		&& family_field_prepend(&fs->naggr, &fs->n_naggr, fld);
+}
+
+int
+family_init(struct monit_object *mo, const char *mo_path)
+{
+	struct field fld;
+	char err[ERR_MSG_LEN];
+	size_t i;
+
+	if (!mo->family->map[0]) {
+		LOG("Tenant map for family is not set");
+		return 0;
+	}
+
+	if (!family_map_load(mo->family, mo_path)) {
+		return 0;
+	}
+
+	/* tenant is implicit first key field of all windows */
+	if (!parse_field("tenant", &fld, err)) {
+		LOG("Can't parse field 'tenant': %s", err);
+		return 0;
+	}
+
+	for (i=0; i<mo->nfwm; i++) {
+		if (!family_fieldset_prepend(&mo->fwms[i].fieldset, &fld)) {
+			return 0;
+		}
+		mo->fwms[i].group_size = fld.size;
+	}
+
+	for (i=0; i<mo->nmavg; i++) {
+		if (!family_fieldset_prepend(&mo->mavgs[i].fieldset, &fld)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int
+family_tenant_resolve(struct mo_family *fm, struct flow_info *flow)
+{
+	uint32_t tenant;
+	int found = 0;
+
+	if (fm->direction == FILTER_BASIC_DIR_SRC) {
+		if (flow->has_ip4_src_addr) {
+			found = family_trie_lookup(&fm->v4, flow->ip4_src_addr,
+				32, &tenant);
+		} else if (flow->has_ip6_src_addr) {
+			found = family_trie_lookup(&fm->v6, flow->ip6_src_addr,
+				16 * 8, &tenant);
+		}
+	} else {
+		if (flow->has_ip4_dst_addr) {
+			found = family_trie_lookup(&fm->v4, flow->ip4_dst_addr,
+				32, &tenant);
+		} else if (flow->has_ip6_dst_addr) {
+			found = family_trie_lookup(&fm->v6, flow->ip6_dst_addr,
+				16 * 8, &tenant);
+		}
+	}
+
+	if (!found) {
+		flow->has_tenant = 0;
+		return 0;
+	}
+
+	tenant = htobe32(tenant);
+	memcpy(flow->tenant, &tenant, sizeof(uint32_t));
+	flow->tenant_size = sizeof(uint32_t);
+	flow->has_tenant = 1;
+
+	return 1;
+}
+
@@ -25,9 +25,11 @@
 #include "monit-objects.h"
 
 int
-fwm_fields_init(size_t nthreads, struct mo_fwm *window)
+fwm_fields_init(struct xe_data *globl, struct mo_fwm *window)
 {
 	size_t i, keysize, valsize;
+	size_t nthreads = globl->nthreads;
+	int ret = 0;
 
 	keysize = 0;
 	for (i=0; i<window->fieldset.n_naggr; i++) {
@@ -36,50 +38,55 @@ fwm_fields_init(size_t nthreads, struct mo_fwm *window)
 
 	valsize = window->fieldset.n_aggr * sizeof(uint64_t);
 
-	window->thread_data = calloc(nthreads, sizeof(struct fwm_thread_data));
+	window->thread_data = calloc_cl(nthreads,
+		sizeof(struct fwm_thread_data));
 	if (!window->thread_data) {
-		LOG("calloc() failed");
+		LOG("calloc_cl() failed");
 		return 0;
 	}
 
 	for (i=0; i<nthreads; i++) {
-		window->thread_data[i].keysize = keysize;
-		window->thread_data[i].key = malloc(keysize);
-		if (!window->thread_data[i].key) {
-			LOG("malloc() failed");
-			return 0;
+		struct fwm_thread_data *tdata = &window->thread_data[i];
+
+		/* banks are on node of processing thread */
+		monit_objects_thread_mem(globl, i);
+
+		tdata->keysize = keysize;
+		tdata->key = malloc_cl(keysize);
+		if (!tdata->key) {
+			LOG("malloc_cl() failed");
+			goto fail;
 		}
 
-		window->thread_data[i].valsize = valsize;
-		window->thread_data[i].val = malloc(valsize);
-		if (!window->thread_data[i].val) {
-			LOG("malloc() failed");
-			return 0;
+		tdata->valsize = valsize;
+		tdata->val = malloc_cl(valsize);
+		if (!tdata->val) {
+			LOG("malloc_cl() failed");
+			goto fail;
 		}
 
-		window->thread_data[i].trs[0] = tkvdb_tr_create(NULL, NULL);
-		if (!window->thread_data[i].trs[0]) {
+		tdata->trs[0] = tkvdb_tr_create(NULL, NULL);
+		if (!tdata->trs[0]) {
 			LOG("tkvdb_tr_create() failed");
-			return 0;
+			goto fail;
 		}
-		window->thread_data[i].trs[1] = tkvdb_tr_create(NULL, NULL);
-		if (!window->thread_data[i].trs[1]) {
+		tdata->trs[1] = tkvdb_tr_create(NULL, NULL);
+		if (!tdata->trs[1]) {
 			LOG("tkvdb_tr_create() failed");
-			return 0;
+			goto fail;
 		}
 
-		window->thread_data[i].trs[0]
-			->begin(window->thread_data[i].trs[0]);
-
-		window->thread_data[i].trs[1]
-			->begin(window->thread_data[i].trs[1]);
-
-		atomic_store_explicit(&window->thread_data[i].tr,
-			window->thread_data[i].trs[0], memory_order_relaxed);
+		tdata->trs[0]->begin(tdata->trs[0]);
+		tdata->trs[1]->begin(tdata->trs[1]);
 
+		atomic_store_explicit(&tdata->tr, tdata->trs[0],
+			memory_order_relaxed);
 	}
 
-	return 1;
+	ret = 1;
+fail:
+	monit_objects_thread_mem(globl, -1);
+	return ret;
 }
 
 static int
@@ -224,26 +231,198 @@ print_field_sql(enum DB_TYPE db_type, struct field *fld, FILE *f,
 	}
 }
 
+static void
+fwm_print_time(enum DB_TYPE db_type, FILE *f, time_t t)
+{
+	if (db_type == DB_PG) {
+		fprintf(f, "  ( to_timestamp(%llu), ", (long long unsigned)t);
+	} else {
+		fprintf(f, "  ( fromUnixTimestamp(%llu), ",
+			(long long unsigned)t);
+	}
+}
+
+static void
+fwm_print_row(struct mo_fwm *fwm, FILE *f, enum DB_TYPE db_type, time_t t,
+	uint8_t *data)
+{
+	size_t i;
+	int first_field = 1;
+	uint8_t data_mut[512];
+
+	fwm_print_time(db_type, f, t);
+
+	/* parse key */
+	for (i=0; i<fwm->fieldset.n; i++) {
+		struct field *fld = &fwm->fieldset.fields[i];
+
+		if (!first_field) {
+			fprintf(f, ", ");
+		} else {
+			first_field = 0;
+		}
+
+		if (fld->aggr) {
+			uint64_t v, *vptr;
+			vptr = (uint64_t *)data;
+
+			v = be64toh(*vptr);
+			if (fld->descending) {
+				/* invert value */
+				v = ~v;
+			}
+			fprintf(f, " %lu ", v);
+
+			data += sizeof(uint64_t);
+		} else {
+			if (fld->descending) {
+				int j;
+
+				for (j=0; j<fld->size; j++) {
+					/* invert value */
+					data_mut[j] = ~*data;
+					data++;
+				}
+				print_field_sql(db_type, fld, f, data_mut);
+			} else {
+				print_field_sql(db_type, fld, f, data);
+				data += fld->size;
+			}
+		}
+	}
+
+	fprintf(f, ")");
+}
+
+static void
+fwm_others_add(struct mo_fwm *fwm, uint8_t *data, uint64_t *others)
+{
+	size_t i, j = 0;
+
+	for (i=0; i<fwm->fieldset.n; i++) {
+		struct field *fld = &fwm->fieldset.fields[i];
+
+		if (fld->aggr) {
+			uint64_t v, *vptr;
+			vptr = (uint64_t *)data;
+
+			v = be64toh(*vptr);
+			if (fld->descending) {
+				/* invert value */
+				v = ~v;
+			}
+			others[j] += v;
+			j++;
+
+			data += sizeof(uint64_t);
+		} else {
+			data += fld->size;
+		}
+	}
+}
+
+/* group is key prefix with leading field (tenant) or NULL */
+static void
+fwm_print_others(struct mo_fwm *fwm, FILE *f, enum DB_TYPE db_type, time_t t,
+	uint8_t *group, uint64_t *others)
+{
+	size_t i, j = 0;
+	int first_field = 1;
+
+	fwm_print_time(db_type, f, t);
+
+	for (i=0; i<fwm->fieldset.n; i++) {
+		struct field *fld = &fwm->fieldset.fields[i];
+
+		if (!first_field) {
+			fprintf(f, ", ");
+		} else {
+			first_field = 0;
+		}
+
+		if (fld->aggr) {
+			fprintf(f, " %lu ", others[j]);
+			j++;
+		} else if (group && (i == 0)) {
+			print_field_sql(db_type, fld, f, group);
+		} else {
+			fprintf(f, " NULL ");
+		}
+	}
+
+	fprintf(f, ")");
+}
+
+/*
+ * Family of objects: keys are sorted by tenant first, limit and others are
+ * per tenant
+ */
+static void
+fwm_dump_groups(struct mo_fwm *fwm, tkvdb_cursor *c, FILE *f,
+	enum DB_TYPE db_type, time_t t)
+{
+	uint8_t group[sizeof(uint64_t)];
+	uint64_t others[fwm->fieldset.n_aggr];
+	int n = 0, hit_limit = 0, first_line = 1;
+	size_t i;
+
+	memcpy(group, c->key(c), fwm->group_size);
+	do {
+		uint8_t *data = c->key(c);
+
+		if (memcmp(data, group, fwm->group_size) != 0) {
+			/* next tenant */
+			if (hit_limit) {
+				fprintf(f, ",%s", (db_type == DB_PG) ? "\n" : "");
+				fwm_print_others(fwm, f, db_type, t, group,
+					others);
+			}
+			memcpy(group, data, fwm->group_size);
+			n = 0;
+			hit_limit = 0;
+		}
+
+		if (n < fwm->limit) {
+			if (!first_line) {
+				fprintf(f, ",%s", (db_type == DB_PG) ? "\n" : "");
+			} else {
+				first_line = 0;
+			}
+			fwm_print_row(fwm, f, db_type, t, data);
+		} else {
+			if (!hit_limit) {
+				for (i=0; i<fwm->fieldset.n_aggr; i++) {
+					others[i] = 0;
+				}
+				hit_limit = 1;
+			}
+			fwm_others_add(fwm, data, others);
+		}
+		n++;
+	} while (c->next(c) == TKVDB_OK);
+
+	if (hit_limit) {
+		fprintf(f, ",%s", (db_type == DB_PG) ? "\n" : "");
+		fwm_print_others(fwm, f, db_type, t, group, others);
+	}
+	fprintf(f, ";\n");
+}
+
 static int
 fwm_dump(struct mo_fwm *fwm, tkvdb_tr *tr, const char *mo_name,
-	const char *exp_dir, enum DB_TYPE db_type, const char *ch_codec)
+	const char *exp_dir, enum DB_TYPE db_type, const char *ch_codec,
+	time_t t)
 {
 	int ret = 0;
 	tkvdb_cursor *c;
 	FILE *f;
-	time_t t;
 	char path[PATH_MAX * 3];
 	size_t i;
 	int first_field, first_line;
 	int n;
 	int hit_limit = 0;
 	char table_name[PATH_MAX + 512];
-
-	t = time(NULL);
-	if (t == ((time_t) -1)) {
-		LOG("time() failed: %s", strerror(errno));
-		goto time_fail;
-	}
+	long size;
 
 	sprintf(table_name, "%s_%s", mo_name, fwm->name);
 
@@ -333,16 +512,18 @@ fwm_dump(struct mo_fwm *fwm, tkvdb_tr *tr, const char *mo_name,
 		}
 	}
 
-	n = 0;
-
 	/*fprintf(f, "BEGIN;\n");*/
 	fprintf(f, "insert into \"%s\" ", table_name);
 	fprintf(f, "values\n");
+
+	if (fwm->group_size && fwm->limit) {
+		fwm_dump_groups(fwm, c, f, db_type, t);
+		goto dumped;
+	}
+
+	n = 0;
 	first_line = 1;
 	do {
-		uint8_t *data = c->key(c);
-		uint8_t data_mut[512];
-
 		if (!first_line) {
 			fprintf(f, ",");
 			if (db_type == DB_PG) {
@@ -351,56 +532,7 @@ fwm_dump(struct mo_fwm *fwm, tkvdb_tr *tr, const char *mo_name,
 		} else {
 			first_line = 0;
 		}
-		if (db_type == DB_PG) {
-			fprintf(f, "  ( to_timestamp(%llu), ",
-				(long long unsigned)t);
-		} else {
-			fprintf(f, "  ( fromUnixTimestamp(%llu), ",
-				(long long unsigned)t);
-		}
-		first_field = 1;
-		/* parse key */
-		for (i=0; i<fwm->fieldset.n; i++) {
-			struct field *fld = &fwm->fieldset.fields[i];
-
-			if (!first_field) {
-				fprintf(f, ", ");
-			} else {
-				first_field = 0;
-			}
-
-			if (fld->aggr) {
-				uint64_t v, *vptr;
-				vptr = (uint64_t *)data;
-
-				v = be64toh(*vptr);
-				if (fld->descending) {
-					/* invert value */
-					v = ~v;
-				}
-				fprintf(f, " %lu ", v);
-
-				data += sizeof(uint64_t);
-			} else {
-				if (fld->descending) {
-					int j;
-
-					for (j=0; j<fld->size; j++) {
-						/* invert value */
-						data_mut[j] = ~*data;
-						data++;
-					}
-					print_field_sql(db_type, fld, f,
-						data_mut);
-				} else {
-					print_field_sql(db_type, fld, f,
-						data);
-					data += fld->size;
-				}
-			}
-		}
-
-		fprintf(f, ")");
+		fwm_print_row(fwm, f, db_type, t, c->key(c));
 
 		/* check limit */
 		n++;
@@ -415,79 +547,33 @@ fwm_dump(struct mo_fwm *fwm, tkvdb_tr *tr, const char *mo_name,
 
 	/* calculate others */
 	if (hit_limit) {
-		size_t j = 0;
-
 		uint64_t others[fwm->fieldset.n_aggr];
 		for (i=0; i<fwm->fieldset.n_aggr; i++) {
 			others[i] = 0;
 		}
 
 		while (c->next(c) == TKVDB_OK) {
-			uint8_t *data = c->key(c);
-
-			j = 0;
-			for (i=0; i<fwm->fieldset.n; i++) {
-				struct field *fld = &fwm->fieldset.fields[i];
-
-				if (fld->aggr) {
-					uint64_t v, *vptr;
-					vptr = (uint64_t *)data;
-
-					v = be64toh(*vptr);
-					if (fld->descending) {
-						/* invert value */
-						v = ~v;
-					}
-					others[j] += v;
-					j++;
-
-					data += sizeof(uint64_t);
-				} else {
-					data += fld->size;
-				}
-			}
+			fwm_others_add(fwm, c->key(c), others);
 		}
 		/* print others */
-		fprintf(f, "insert into \"%s\" ", table_name);
-
-		if (db_type == DB_PG) {
-			fprintf(f, "values ( to_timestamp(%llu), ",
-				(long long unsigned)t);
-		} else {
-			fprintf(f, "values ( fromUnixTimestamp(%llu), ",
-				(long long unsigned)t);
-		}
-
-		first_field = 1;
-		j = 0;
-		for (i=0; i<fwm->fieldset.n; i++) {
-			struct field *fld = &fwm->fieldset.fields[i];
-
-			if (!first_field) {
-				fprintf(f, ", ");
-			} else {
-				first_field = 0;
-			}
-
-			if (fld->aggr) {
-				fprintf(f, " %lu ", others[j]);
-				j++;
-			} else {
-				fprintf(f, " NULL ");
-			}
-		}
-
-		fprintf(f, ");\n");
+		fprintf(f, "insert into \"%s\" values", table_name);
+		fwm_print_others(fwm, f, db_type, t, NULL, others);
+		fprintf(f, ";\n");
 	}
+
+dumped:
 	/*fprintf(f, "COMMIT;\n");*/
 
 	ret = 1;
 empty:
+	size = ftell(f);
+	if (size > 0) {
+		METRICS_ADD(fwm->m_export_bytes, size);
+	}
 	fclose(f);
 	c->free(c);
 
 fopen_fail:
-time_fail:
 cursor_fail:
 
 	return ret;
@@ -496,11 +582,12 @@ cursor_fail:
 static int
 fwm_sort_and_dump(struct mo_fwm *fwm, tkvdb_tr *tr, const char *mo_name,
 	const char *exp_dir, int *is_not_empty, enum DB_TYPE db_type,
-	const char *ch_codec)
+	const char *ch_codec, time_t t)
 {
 	int ret = 0;
 	tkvdb_cursor *c;
 	tkvdb_tr *tr_merge;
+	uint64_t nkeys = 0;
 
 	c = tkvdb_cursor_create(tr);
 	if (!c) {
@@ -573,9 +660,12 @@ fwm_sort_and_dump(struct mo_fwm *fwm, tkvdb_tr *tr, const char *mo_name,
 		if (rc != TKVDB_OK) {
 			LOG("put() failed");
 		}
+		nkeys++;
 	} while (c->next(c) == TKVDB_OK);
 
-	fwm_dump(fwm, tr_merge, mo_name, exp_dir, db_type, ch_codec);
+	METRICS_SET(fwm->m_keys, nkeys);
+
+	fwm_dump(fwm, tr_merge, mo_name, exp_dir, db_type, ch_codec, t);
 
 	tr_merge->free(tr_merge);
 
@@ -646,12 +736,32 @@ empty:
 	return 1;
 }
 
+tkvdb_tr *
+fwm_inactive_tr(struct fwm_thread_data *tdata)
+{
+	tkvdb_tr *tr;
+
+	tr = atomic_load_explicit(&tdata->tr, memory_order_relaxed);
+	return (tr == tdata->trs[0]) ? tdata->trs[1] : tdata->trs[0];
+}
+
+void
+fwm_swap_tr(struct fwm_thread_data *tdata)
+{
+	atomic_store_explicit(&tdata->tr, fwm_inactive_tr(tdata),
+		memory_order_relaxed);
+}
+
 static int
 fwm_merge_and_dump(struct xe_data *globl, struct mo_fwm *fwm,
-	const char *mo_name, int *is_not_empty)
+	const char *mo_name, int *is_not_empty, time_t t)
 {
 	size_t i;
 	tkvdb_tr *tr_merge;
+	struct timespec t1, t2;
+	uint64_t export_ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
 
 	tr_merge = tkvdb_tr_create(NULL, NULL);
 	if (!tr_merge) {
@@ -661,38 +771,43 @@ fwm_merge_and_dump(struct xe_data *globl, struct mo_fwm *fwm,
 
 	tr_merge->begin(tr_merge);
 
-	/* merge data from all threads */
+	/* swap banks of all threads */
 	for (i=0; i<globl->nthreads; i++) {
-		tkvdb_tr *tr;
+		struct fwm_thread_data *tdata = &fwm->thread_data[i];
 
-		tr = atomic_load_explicit(&fwm->thread_data[i].tr,
-			memory_order_relaxed);
+		/* inactive bank is not empty after snapshot */
+		fwm_merge_tr(fwm, tr_merge, fwm_inactive_tr(tdata));
+		fwm_swap_tr(tdata);
+	}
 
-		/* swap banks */
-		if (tr == fwm->thread_data[i].trs[0]) {
-			atomic_store_explicit(&fwm->thread_data[i].tr,
-				fwm->thread_data[i].trs[1],
-				memory_order_relaxed);
-		} else {
-			atomic_store_explicit(&fwm->thread_data[i].tr,
-				fwm->thread_data[i].trs[0],
-				memory_order_relaxed);
-		}
-		usleep(10);
-		fwm_merge_tr(fwm, tr_merge, tr);
+	/* merge data from all threads */
+	monit_objects_wait_threads(globl);
+	for (i=0; i<globl->nthreads; i++) {
+		fwm_merge_tr(fwm, tr_merge,
+			fwm_inactive_tr(&fwm->thread_data[i]));
 	}
 
+	METRICS_SET(fwm->m_keys, 0);
+	METRICS_SET(fwm->m_mem, tr_merge->mem(tr_merge));
+
 	fwm_sort_and_dump(fwm, tr_merge, mo_name, globl->exp_dir, is_not_empty,
-		globl->db_type, globl->ch_codec);
+		globl->db_type, globl->ch_codec, t);
 
 	tr_merge->free(tr_merge);
 
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	export_ns = (t2.tv_sec - t1.tv_sec) * 1000000000ULL
+		+ t2.tv_nsec - t1.tv_nsec;
+	METRICS_ADD(fwm->m_exports, 1);
+	METRICS_ADD(fwm->m_export_ns, export_ns);
+	METRICS_SET(fwm->m_last_export_ns, export_ns);
+
 	return 1;
 }
 
 static void
 fwm_merge_rec(struct xe_data *globl, struct monit_object *mos, size_t n_mo,
-	time_t t, int *need_sleep, int *is_not_empty)
+	time_t t, int force, int *need_sleep, int *is_not_empty)
 {
 	size_t i, j;
 	for (i=0; i<n_mo; i++) {
@@ -701,10 +816,13 @@ fwm_merge_rec(struct xe_data *globl, struct monit_object *mos, size_t n_mo,
 		for (j=0; j<mo->nfwm; j++) {
 			struct mo_fwm *fwm = &mo->fwms[j];
 
-			if ((fwm->last_export / fwm->time) != (t / fwm->time)) {
+			if (force
+				|| ((fwm->last_export / fwm->time)
+					!= (t / fwm->time))) {
+
 				/* time to export */
 				if (fwm_merge_and_dump(globl, fwm, mo->name,
-					is_not_empty)) {
+					is_not_empty, t)) {
 
 					fwm->last_export = t;
 					*need_sleep = 0;
@@ -715,7 +833,7 @@ fwm_merge_rec(struct xe_data *globl, struct monit_object *mos, size_t n_mo,
 		}
 
 		if (mo->n_mo) {
-			fwm_merge_rec(globl, mo->mos, mo->n_mo, t,
+			fwm_merge_rec(globl, mo->mos, mo->n_mo, t, force,
 				need_sleep, is_not_empty);
 		}
 	}
@@ -772,9 +890,15 @@ fwm_bg_thread(void *arg)
 			return NULL;
 		}
 
+		/* don't switch banks while snapshot is written */
+		pthread_mutex_lock(&globl->snapshot_mtx);
 		fwm_merge_rec(globl, globl->monit_objects,
-			globl->nmonit_objects, t,
+			globl->nmonit_objects, t, 0,
 			&need_sleep, &is_not_empty);
+		pthread_mutex_unlock(&globl->snapshot_mtx);
+
+		/* frequencies of mfreq() */
+		freqmap_merge_all();
 
 		if (is_not_empty) {
 			/* has files to export */
@@ -789,3 +913,15 @@ fwm_bg_thread(void *arg)
 	return NULL;
 }
 
+
+void
+fwm_replay_export(struct xe_data *globl, time_t t, int force)
+{
+	int need_sleep = 1, is_not_empty = 0;
+
+	/* files are not passed to DB export script */
+	fwm_merge_rec(globl, globl->monit_objects, globl->nmonit_objects, t,
+		force, &need_sleep, &is_not_empty);
+
+	freqmap_merge_all();
+}
@@ -22,6 +22,8 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
 #include <stdatomic.h>
 
 #include "utils.h"
@@ -120,7 +122,7 @@ build_file_content(char *text, struct mo_mavg *mavg, uint8_t *key,
 static void
 exec_script(struct mo_mavg *mavg, uint8_t *key, size_t limit_id, char *mo_name,
 	char *script, char *filename, MAVG_TYPE val, MAVG_TYPE limit,
-	int is_overlim)
+	int is_overlim, int is_back2norm)
 {
 	int pid;
 	char **args;
@@ -167,6 +169,18 @@ exec_script(struct mo_mavg *mavg, uint8_t *key, size_t limit_id, char *mo_name,
 
 	args[argidx++] = NULL;
 
+	if (mavg_notify_enabled()) {
+		/* pass event to long-lived helper */
+		const char *event;
+
+		if (is_back2norm) {
+			event = "back2norm";
+		} else {
+			event = is_overlim ? "overlimit" : "underlimit";
+		}
+		mavg_notify_send(script, event, &args[1], argidx - 2);
+		return;
+	}
 
 	pid = fork();
 	if (pid == 0) {
@@ -189,8 +203,8 @@ exec_script(struct mo_mavg *mavg, uint8_t *key, size_t limit_id, char *mo_name,
 }
 
 
-static void
-ext_stats_toggle(struct mo_mavg *mavg, int on, int is_overlim)
+void
+mavg_ext_stats_toggle(struct mo_mavg *mavg, int on, int is_overlim)
 {
 	size_t i, j, n;
 
@@ -240,7 +254,7 @@ on_limit(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
 	struct mavg_limits *lim_curr = MAVG_LIM_CURR(mavg);
 
 	/* turn on extended statistics */
-	ext_stats_toggle(mavg, 1, is_overlim);
+	mavg_ext_stats_toggle(mavg, 1, is_overlim);
 
 	if (!build_file_name(filename, mavg, key, keysize, &limit_id,
 		is_overlim)) {
@@ -253,14 +267,22 @@ on_limit(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
 		return;
 	}
 
-	/* write file */
-	f = fopen(filename, "w");
-	if (!f) {
-		LOG("Can't create file '%s': %s", filename, strerror(errno));
-		return;
+	if (status_table_enabled()) {
+		ovr->status_slot = status_table_update(ovr->status_slot,
+			is_overlim, filename, filecont, ovr->val, ovr->limit);
+	}
+
+	if (status_table_keep_files()) {
+		/* write file */
+		f = fopen(filename, "w");
+		if (!f) {
+			LOG("Can't create file '%s': %s", filename,
+				strerror(errno));
+			return;
+		}
+		fputs(filecont, f);
+		fclose(f);
 	}
-	fputs(filecont, f);
-	fclose(f);
 
 	/* start script */
 	if (is_overlim) {
@@ -270,19 +292,21 @@ on_limit(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
 	}
 
 	exec_script(mavg, key, limit_id, mo_name, script, filename, ovr->val,
-		ovr->limit, is_overlim);
+		ovr->limit, is_overlim, 0);
 }
 
 static void
 on_update(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
-	struct mavg_lim_data *ovr, MAVG_TYPE val)
+	struct mavg_lim_data *ovr, MAVG_TYPE val, int is_overlim)
 {
 	FILE *f;
 	char filename[PATH_MAX];
 	char filecont[1024];
 	size_t limit_id;
 
-	if (!build_file_name(filename, mavg, key, keysize, &limit_id, 1)) {
+	if (!build_file_name(filename, mavg, key, keysize, &limit_id,
+		is_overlim)) {
+
 		LOG("Update failed");
 		return;
 	}
@@ -291,6 +315,15 @@ on_update(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
 		return;
 	}
 
+	if (status_table_enabled()) {
+		ovr->status_slot = status_table_update(ovr->status_slot,
+			is_overlim, filename, filecont, val, ovr->limit);
+	}
+
+	if (!status_table_keep_files()) {
+		return;
+	}
+
 	/* write file */
 	f = fopen(filename, "w");
 	if (!f) {
@@ -313,7 +346,7 @@ on_back_to_norm(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
 	struct mavg_limits *lim_curr = MAVG_LIM_CURR(mavg);
 
 	/* turn off extended statistics */
-	ext_stats_toggle(mavg, 0, is_overlim);
+	mavg_ext_stats_toggle(mavg, 0, is_overlim);
 
 	if (!build_file_name(filename, mavg, key, keysize, &limit_id,
 		is_overlim)) {
@@ -321,7 +354,10 @@ on_back_to_norm(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
 		return;
 	}
 
-	if (unlink(filename) < 0) {
+	status_table_remove(ld->status_slot);
+	ld->status_slot = -1;
+
+	if (status_table_keep_files() && (unlink(filename) < 0)) {
 		LOG("Can't remove file '%s': %s", filename, strerror(errno));
 	}
 
@@ -336,7 +372,7 @@ on_back_to_norm(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
 		script = lim_curr->underlimit[limit_id].back2norm_script;
 	}
 	exec_script(mavg, key, limit_id, mo_name, script, filename, val,
-		ld->limit, is_overlim);
+		ld->limit, is_overlim, 1);
 }
 
 int
@@ -429,7 +465,7 @@ act(struct mo_mavg *mavg, tkvdb_tr *db, MAVG_TYPE wnd_size_ns, char *mo_name,
 		}
 
 		/* update notification file */
-		on_update(mavg, c->key(c), c->keysize(c), ld, val);
+		on_update(mavg, c->key(c), c->keysize(c), ld, val, is_overlim);
 		ld->time_dump = time_ns;
 
 skip: ;
@@ -509,6 +545,7 @@ check_items(tkvdb_tr *db, tkvdb_tr *db_thread)
 			val.val = val_thr->val;
 			val.limit = val_thr->limit;
 			val.back2norm_time_ns = val_thr->back2norm_time_ns;
+			val.status_slot = -1;
 
 			dtv.data = &val;
 			dtv.size = c->valsize(c);
@@ -532,7 +569,7 @@ cursor_fail:
 
 static void
 check_rec(struct xe_data *globl, size_t bank,
-	struct monit_object *mos, size_t n_mo)
+	struct monit_object *mos, size_t n_mo, int is_timer)
 {
 	size_t i;
 	for (i=0; i<n_mo; i++) {
@@ -544,9 +581,21 @@ check_rec(struct xe_data *globl, size_t bank,
 			size_t tidx;
 			struct mo_mavg *mavg = &mo->mavgs[mwidx];
 			tkvdb_tr *db_glb = mavg->ovrerlm_db;
+			int pending;
+
+			pending = atomic_exchange_explicit(
+				&mavg->ovr_pending[bank], 0,
+				memory_order_acquire);
+
+			if (!pending && !is_timer) {
+				/* nothing new and no need to update states */
+				continue;
+			}
 
 			/* for each thread data */
-			for (tidx=0; tidx<globl->nthreads; tidx++) {
+			for (tidx=0; pending && (tidx<globl->nthreads);
+				tidx++) {
+
 				tkvdb_tr *db_thr
 					= mavg->thr_data[tidx].ovr_db[bank];
 
@@ -561,33 +610,108 @@ check_rec(struct xe_data *globl, size_t bank,
 		}
 
 		if (mo->n_mo) {
-			check_rec(globl, bank, mo->mos, mo->n_mo);
+			check_rec(globl, bank, mo->mos, mo->n_mo, is_timer);
 		}
 	}
 }
 
+static uint64_t
+monotonic_us(void)
+{
+	struct timespec tmsp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tmsp);
+	return tmsp.tv_sec * 1000000ULL + tmsp.tv_nsec / 1000;
+}
+
 void *
 mavg_act_thread(void *arg)
 {
 	struct xe_data *globl = (struct xe_data *)arg;
+	int tfd;
+	struct itimerspec its;
+	uint64_t last_us = 0;
+
+	/* timer for state transitions (ALMOST_GONE -> GONE, file updates) */
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tfd < 0) {
+		LOG("timerfd_create() failed: %s", strerror(errno));
+		return NULL;
+	}
+
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = MAVG_ACT_TIMER_MS * 1000000L;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+		LOG("timerfd_settime() failed: %s", strerror(errno));
+		close(tfd);
+		return NULL;
+	}
 
 	for (;;) {
 		size_t bank;
+		struct pollfd fds[2];
+		uint64_t cnt, now_us;
+		int is_timer = 0;
 
 		if (atomic_load_explicit(&globl->stop, memory_order_relaxed)) {
 			/* stop */
 			break;
 		}
 
+		fds[0].fd = globl->mavg_act_evfd;
+		fds[0].events = POLLIN;
+		fds[1].fd = tfd;
+		fds[1].events = POLLIN;
+
+		if (poll(fds, 2, 1000) < 0) {
+			if (errno != EINTR) {
+				LOG("poll() failed: %s", strerror(errno));
+			}
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			/* reset counter */
+			if ((read(globl->mavg_act_evfd, &cnt, sizeof(cnt)) < 0)
+				&& (errno != EAGAIN)) {
+
+				LOG("read() failed: %s", strerror(errno));
+			}
+		}
+
+		if (fds[1].revents & POLLIN) {
+			if (read(tfd, &cnt, sizeof(cnt)) > 0) {
+				is_timer = 1;
+			}
+		}
+
+		if (!(fds[0].revents & POLLIN) && !is_timer) {
+			continue;
+		}
+
+		/* don't spin when items are overlimited continuously */
+		now_us = monotonic_us();
+		if ((now_us - last_us) < MAVG_ACT_MIN_INTERVAL_US) {
+			usleep(MAVG_ACT_MIN_INTERVAL_US - (now_us - last_us));
+		}
+
 		/* switch bank and get previous */
-		bank = atomic_fetch_add_explicit(&globl->mavg_db_bank_idx, 1,
-			memory_order_relaxed) % 2;
+		bank = atomic_fetch_add(&globl->mavg_db_bank_idx, 1) % 2;
 
-		usleep(100000);
+		/* wait until processing threads leave previous bank */
+		monit_objects_wait_threads(globl);
+
+		pthread_mutex_lock(&globl->snapshot_mtx);
 		check_rec(globl, bank,
-			globl->monit_objects, globl->nmonit_objects);
+			globl->monit_objects, globl->nmonit_objects, is_timer);
+		pthread_mutex_unlock(&globl->snapshot_mtx);
+
+		last_us = monotonic_us();
 	}
 
+	close(tfd);
+
 	return NULL;
 }
 
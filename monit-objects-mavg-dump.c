@@ -33,7 +33,7 @@
 
 static int
 mavg_dump_tr(FILE *out, struct mo_mavg *mavg, tkvdb_tr *tr,
-	size_t val_itemsize)
+	size_t val_itemsize, uint64_t time_ns)
 {
 	size_t i;
 	int ret = 0;
@@ -42,16 +42,8 @@ mavg_dump_tr(FILE *out, struct mo_mavg *mavg, tkvdb_tr *tr,
 
 	MAVG_TYPE wnd_size_ns;
 
-	struct timespec tmsp;
-	uint64_t time_ns;
-
 	struct mavg_limits *lim_curr = MAVG_LIM_CURR(mavg);
 
-	if (clock_gettime(CLOCK_REALTIME_COARSE, &tmsp) < 0) {
-		LOG("clock_gettime() failed: %s", strerror(errno));
-	}
-	time_ns = tmsp.tv_sec * 1e9 + tmsp.tv_nsec;
-
 	/* time window in nanoseconds */
 	wnd_size_ns = (MAVG_TYPE)mavg->size_secs * 1e9;
 
@@ -174,6 +166,8 @@ mavg_dump_do(struct mo_mavg *mavg, size_t nthreads, struct monit_object *mo,
 	size_t i;
 	char timebuf[100];
 	time_t t;
+	struct timespec tmsp;
+	uint64_t time_ns;
 
 	t = time(NULL);
 	if (t == (time_t)-1) {
@@ -181,6 +175,11 @@ mavg_dump_do(struct mo_mavg *mavg, size_t nthreads, struct monit_object *mo,
 		return 0;
 	}
 
+	if (clock_gettime(CLOCK_REALTIME_COARSE, &tmsp) < 0) {
+		LOG("clock_gettime() failed: %s", strerror(errno));
+	}
+	time_ns = tmsp.tv_sec * 1e9 + tmsp.tv_nsec;
+
 	sprintf(dump_path, append? "%s/%s.adump" : "%s/%s.dump",
 		mo->dir, mavg->name);
 
@@ -203,7 +202,8 @@ mavg_dump_do(struct mo_mavg *mavg, size_t nthreads, struct monit_object *mo,
 		db = atomic_load_explicit(&mavg->thr_data[i].db,
 			memory_order_relaxed);
 
-		mavg_dump_tr(f, mavg, db, mavg->thr_data[i].val_itemsize);
+		mavg_dump_tr(f, mavg, db, mavg->thr_data[i].val_itemsize,
+			time_ns);
 	}
 
 	if (append) {
@@ -314,3 +314,41 @@ mavg_dump_thread(void *arg)
 	return NULL;
 }
 
+
+static void
+mavg_dump_results_rec(struct monit_object *mos, size_t n_mo, size_t nthreads,
+	FILE *out, uint64_t time_ns)
+{
+	size_t i, j, t;
+
+	for (i=0; i<n_mo; i++) {
+		struct monit_object *mo = &mos[i];
+
+		for (j=0; j<mo->nmavg; j++) {
+			struct mo_mavg *mavg = &mo->mavgs[j];
+
+			fprintf(out, "mavg %s/%s\n", mo->name, mavg->name);
+			for (t=0; t<nthreads; t++) {
+				tkvdb_tr *db;
+
+				db = atomic_load_explicit(&mavg->thr_data[t].db,
+					memory_order_relaxed);
+
+				mavg_dump_tr(out, mavg, db,
+					mavg->thr_data[t].val_itemsize, time_ns);
+			}
+		}
+
+		if (mo->n_mo) {
+			mavg_dump_results_rec(mo->mos, mo->n_mo, nthreads,
+				out, time_ns);
+		}
+	}
+}
+
+void
+mavg_dump_results(struct xe_data *globl, FILE *out, uint64_t time_ns)
+{
+	mavg_dump_results_rec(globl->monit_objects, globl->nmonit_objects,
+		globl->nthreads, out, time_ns);
+}
@@ -21,13 +21,112 @@
 #include <arpa/inet.h>
 #include "monit-objects.h"
 
+/*
+ * Limits for windows with address in key
+ *
+ * All limits files of the window are compiled into one binary trie. Trie key
+ * is window key with address field moved to the end, so prefix of address
+ * ("10.0.0.0/22") is prefix of trie key. Each leaf has a row with values
+ * for all limits (overlimit first, then underlimit) and all aggregable
+ * fields. Values that are not set in leaf are inherited from shorter prefix
+ * or taken from defaults, so lookup is just a walk to the deepest leaf.
+ */
+
+struct mavg_lim_lpm_node
+{
+	uint32_t next[2];
+	/* row index + 1, 0 if node is not a leaf */
+	uint32_t row;
+};
+
+struct mavg_lim_lpm
+{
+	struct mavg_lim_lpm_node *nodes;
+	size_t nnodes, nodes_alloc;
+
+	/* nrows * (nlim * n_aggr) values */
+	MAVG_TYPE *rows;
+	/* nrows * nlim flags, value is set in file */
+	uint8_t *is_set;
+	size_t nrows, rows_alloc;
+
+	size_t nlim, n_aggr;
+
+	/* offset and size of address field in window key */
+	size_t keysize, addr_off, addr_size;
+	/* window key reordered for trie */
+	uint8_t *tkey;
+};
+
+/* offset of first address field in key or -1 */
+static ssize_t
+mavg_lim_addr_offset(struct mo_mavg *window, size_t *size)
+{
+	size_t i, off = 0;
+
+	for (i=0; i<window->fieldset.n_naggr; i++) {
+		struct field *fld = &window->fieldset.naggr[i];
+
+		if ((fld->type == FILTER_BASIC_ADDR4)
+			|| (fld->type == FILTER_BASIC_ADDR6)) {
+
+			*size = fld->size;
+			return off;
+		}
+		off += fld->size;
+	}
+
+	return -1;
+}
+
+int
+mavg_lim_lpm_enabled(struct mo_mavg *window)
+{
+	size_t size;
+
+	return mavg_lim_addr_offset(window, &size) >= 0;
+}
+
+/* parse address with optional "/mask" */
+static int
+mavg_limits_parse_addr(int af, char *token, uint8_t *addr, int *mask)
+{
+	char *slash;
+	int maxmask = (af == AF_INET) ? 32 : 128;
+
+	slash = strchr(token, '/');
+	if (slash) {
+		char *end;
+
+		*slash = '\0';
+		*mask = strtol(slash + 1, &end, 10);
+		if ((*end != '\0') || (end == (slash + 1)) || (*mask < 0)
+			|| (*mask > maxmask)) {
+
+			LOG("Incorrect prefix length '%s'", slash + 1);
+			return 0;
+		}
+	} else {
+		*mask = maxmask;
+	}
+
+	if (inet_pton(af, token, addr) != 1) {
+		return 0;
+	}
+
+	return 1;
+}
+
 static int
 mavg_limits_parse_line(struct mo_mavg *window, char *line, uint8_t *key,
-	MAVG_TYPE *val)
+	MAVG_TYPE *val, int *mask)
 {
 	char token[TOKEN_MAX_SIZE];
 	size_t i;
 	size_t validx = 0;
+	int addr_seen = 0;
+
+	*mask = -1;
 
 	for (i=0; i<window->fieldset.n; i++) {
 		struct field *fld = &window->fieldset.fields[i];
@@ -40,24 +139,34 @@ mavg_limits_parse_line(struct mo_mavg *window, char *line, uint8_t *key,
 			validx++;
 		} else {
 			/* append to key */
-			int res;
+			int res, m;
 			uint8_t d8;
 			uint16_t d16;
 			uint32_t d32;
 			uint64_t d64;
 
-			if (fld->type == FILTER_BASIC_ADDR4) {
-				res = inet_pton(AF_INET, token, key);
-				if (res != 1) {
+			if ((fld->type == FILTER_BASIC_ADDR4)
+				|| (fld->type == FILTER_BASIC_ADDR6)) {
+
+				int af = (fld->type == FILTER_BASIC_ADDR4)
+					? AF_INET : AF_INET6;
+
+				res = mavg_limits_parse_addr(af, token, key,
+					&m);
+				if (!res) {
 					LOG("Can't convert '%s' to "
-						"IPv4 address", token);
+						"IPv%d address", token,
+						af == AF_INET ? 4 : 6);
 					return 0;
 				}
-			} else if (fld->type == FILTER_BASIC_ADDR6) {
-				res = inet_pton(AF_INET6, token, key);
-				if (res != 1) {
-					LOG("Can't convert '%s' to "
-						"IPv6 address", token);
+
+				if (!addr_seen) {
+					/* only first address may be prefix */
+					*mask = m;
+					addr_seen = 1;
+				} else if (m != fld->size * 8) {
+					LOG("Prefix '%s' is allowed only for "
+						"first address field", token);
 					return 0;
 				}
 			} else if (fld->type == FILTER_BASIC_MAC) {
@@ -110,6 +219,7 @@ mavg_limits_file_load(struct mo_mavg *window, struct mavg_limit *l)
 	TKVDB_RES rc;
 	uint8_t *key;
 	MAVG_TYPE *val;
+	int mask;
 
 	FILE *f = fopen(l->file, "r");
 	if (!f) {
@@ -144,7 +254,7 @@ mavg_limits_file_load(struct mo_mavg *window, struct mavg_limit *l)
 			continue;
 		}
 
-		if (!mavg_limits_parse_line(window, trline, key, val)) {
+		if (!mavg_limits_parse_line(window, trline, key, val, &mask)) {
 			continue;
 		}
 
@@ -160,3 +270,319 @@ mavg_limits_file_load(struct mo_mavg *window, struct mavg_limit *l)
 	return 1;
 }
 
+static int
+lpm_node_new(struct mavg_lim_lpm *lpm, uint32_t *idx)
+{
+	if (lpm->nnodes == lpm->nodes_alloc) {
+		struct mavg_lim_lpm_node *tmp;
+		size_t n = lpm->nodes_alloc ? lpm->nodes_alloc * 2 : 1024;
+
+		tmp = realloc(lpm->nodes, n * sizeof(struct mavg_lim_lpm_node));
+		if (!tmp) {
+			LOG("realloc() failed");
+			return 0;
+		}
+		lpm->nodes = tmp;
+		lpm->nodes_alloc = n;
+	}
+
+	memset(&lpm->nodes[lpm->nnodes], 0, sizeof(struct mavg_lim_lpm_node));
+	*idx = lpm->nnodes;
+	lpm->nnodes++;
+
+	return 1;
+}
+
+static int
+lpm_row_new(struct mavg_lim_lpm *lpm, uint32_t *idx)
+{
+	size_t rowsize = lpm->nlim * lpm->n_aggr;
+
+	if (lpm->nrows == lpm->rows_alloc) {
+		MAVG_TYPE *tmp_rows;
+		uint8_t *tmp_set;
+		size_t n = lpm->rows_alloc ? lpm->rows_alloc * 2 : 256;
+
+		tmp_rows = realloc(lpm->rows, n * rowsize * sizeof(MAVG_TYPE));
+		if (!tmp_rows) {
+			LOG("realloc() failed");
+			return 0;
+		}
+		lpm->rows = tmp_rows;
+
+		tmp_set = realloc(lpm->is_set, n * lpm->nlim);
+		if (!tmp_set) {
+			LOG("realloc() failed");
+			return 0;
+		}
+		lpm->is_set = tmp_set;
+		lpm->rows_alloc = n;
+	}
+
+	memset(&lpm->is_set[lpm->nrows * lpm->nlim], 0, lpm->nlim);
+	*idx = lpm->nrows;
+	lpm->nrows++;
+
+	return 1;
+}
+
+/* move address to the end of key */
+static void
+lpm_key_make(struct mavg_lim_lpm *lpm, uint8_t *key)
+{
+	size_t tail = lpm->keysize - lpm->addr_off - lpm->addr_size;
+
+	memcpy(lpm->tkey, key, lpm->addr_off);
+	memcpy(lpm->tkey + lpm->addr_off, key + lpm->addr_off
+		+ lpm->addr_size, tail);
+	memcpy(lpm->tkey + lpm->addr_off + tail, key + lpm->addr_off,
+		lpm->addr_size);
+}
+
+static int
+lpm_add(struct mavg_lim_lpm *lpm, uint8_t *key, int mask, size_t lidx,
+	MAVG_TYPE *val)
+{
+	size_t i, nbits;
+	uint32_t node = 0, row;
+
+	lpm_key_make(lpm, key);
+	nbits = (lpm->keysize - lpm->addr_size) * 8 + mask;
+
+	for (i=0; i<nbits; i++) {
+		int bit = !!(lpm->tkey[i / 8] & (1 << (7 - (i % 8))));
+		uint32_t next = lpm->nodes[node].next[bit];
+
+		if (!next) {
+			if (!lpm_node_new(lpm, &next)) {
+				return 0;
+			}
+			lpm->nodes[node].next[bit] = next;
+		}
+		node = next;
+	}
+
+	if (lpm->nodes[node].row == 0) {
+		if (!lpm_row_new(lpm, &row)) {
+			return 0;
+		}
+		lpm->nodes[node].row = row + 1;
+	} else {
+		row = lpm->nodes[node].row - 1;
+	}
+
+	memcpy(&lpm->rows[(row * lpm->nlim + lidx) * lpm->n_aggr], val,
+		sizeof(MAVG_TYPE) * lpm->n_aggr);
+	lpm->is_set[row * lpm->nlim + lidx] = 1;
+
+	return 1;
+}
+
+static void
+lpm_file_load(struct mo_mavg *window, struct mavg_lim_lpm *lpm,
+	struct mavg_limit *l, size_t lidx)
+{
+	uint8_t *key;
+	MAVG_TYPE *val;
+	int mask;
+	size_t nitems = 0;
+
+	FILE *f = fopen(l->file, "r");
+	if (!f) {
+		LOG("Can't open file '%s': %s", l->file, strerror(errno));
+		return;
+	}
+
+	key = alloca(lpm->keysize);
+	val = alloca(sizeof(MAVG_TYPE) * lpm->n_aggr);
+
+	for (;;) {
+		char line[2048], *trline;
+
+		if (!fgets(line, sizeof(line) - 1, f)) {
+			break;
+		}
+
+		trline = string_trim(line);
+		if ((strlen(trline) == 0) || (trline[0] == '#')) {
+			/* skip empty lines and comments */
+			continue;
+		}
+
+		if (!mavg_limits_parse_line(window, trline, key, val, &mask)) {
+			continue;
+		}
+
+		if (!lpm_add(lpm, key, mask, lidx, val)) {
+			LOG("Can't add item from '%s' to limits", l->file);
+			break;
+		}
+		nitems++;
+	}
+	fclose(f);
+
+	LOG("%lu prefixes loaded from '%s'", nitems, l->file);
+}
+
+static struct mavg_limit *
+lpm_limit(struct mavg_limits *lim, size_t lidx)
+{
+	if (lidx < lim->noverlimit) {
+		return &lim->overlimit[lidx];
+	}
+	return &lim->underlimit[lidx - lim->noverlimit];
+}
+
+/* fill values that are not set in file */
+static void
+lpm_propagate(struct mavg_lim_lpm *lpm, struct mavg_limits *lim,
+	uint32_t node, uint32_t parent_row)
+{
+	uint32_t row = lpm->nodes[node].row;
+	int bit;
+
+	if (row) {
+		size_t j;
+
+		for (j=0; j<lpm->nlim; j++) {
+			MAVG_TYPE *dst;
+
+			if (lpm->is_set[(row - 1) * lpm->nlim + j]) {
+				continue;
+			}
+
+			dst = &lpm->rows[((row - 1) * lpm->nlim + j)
+				* lpm->n_aggr];
+			if (parent_row) {
+				memcpy(dst, &lpm->rows[((parent_row - 1)
+					* lpm->nlim + j) * lpm->n_aggr],
+					sizeof(MAVG_TYPE) * lpm->n_aggr);
+			} else {
+				memcpy(dst, lpm_limit(lim, j)->def,
+					sizeof(MAVG_TYPE) * lpm->n_aggr);
+			}
+		}
+		parent_row = row;
+	}
+
+	for (bit=0; bit<2; bit++) {
+		if (lpm->nodes[node].next[bit]) {
+			lpm_propagate(lpm, lim, lpm->nodes[node].next[bit],
+				parent_row);
+		}
+	}
+}
+
+void
+mavg_lim_lpm_free(struct mavg_lim_lpm *lpm)
+{
+	if (!lpm) {
+		return;
+	}
+
+	free(lpm->nodes);
+	free(lpm->rows);
+	free(lpm->is_set);
+	free(lpm->tkey);
+	free(lpm);
+}
+
+/* compile all limits files of window */
+struct mavg_lim_lpm *
+mavg_lim_lpm_load(struct mo_mavg *window, struct mavg_limits *lim)
+{
+	struct mavg_lim_lpm *lpm;
+	size_t lidx;
+	ssize_t addr_off;
+	uint32_t root;
+
+	lpm = calloc(1, sizeof(struct mavg_lim_lpm));
+	if (!lpm) {
+		LOG("calloc() failed");
+		goto fail_alloc;
+	}
+
+	addr_off = mavg_lim_addr_offset(window, &lpm->addr_size);
+	if (addr_off < 0) {
+		LOG("Window '%s' has no address field", window->name);
+		goto fail_addr;
+	}
+
+	lpm->addr_off = addr_off;
+	lpm->keysize = window->thr_data[0].keysize;
+	lpm->nlim = lim->noverlimit + lim->nunderlimit;
+	lpm->n_aggr = window->fieldset.n_aggr;
+
+	lpm->tkey = malloc(lpm->keysize);
+	if (!lpm->tkey) {
+		LOG("malloc() failed");
+		goto fail_addr;
+	}
+
+	if (!lpm_node_new(lpm, &root)) {
+		goto fail_addr;
+	}
+
+	for (lidx=0; lidx<lpm->nlim; lidx++) {
+		struct mavg_limit *l = lpm_limit(lim, lidx);
+
+		if (l->file[0]) {
+			lpm_file_load(window, lpm, l, lidx);
+		}
+	}
+
+	lpm_propagate(lpm, lim, root, 0);
+
+	return lpm;
+
+fail_addr:
+	mavg_lim_lpm_free(lpm);
+fail_alloc:
+	return NULL;
+}
+
+/* returns row with values of all limits or NULL if key is not found */
+MAVG_TYPE *
+mavg_lim_lpm_lookup(struct mavg_lim_lpm *lpm, uint8_t *key)
+{
+	size_t i, nbits;
+	uint32_t node = 0, row = 0;
+	size_t tail = lpm->keysize - lpm->addr_off - lpm->addr_size;
+
+	nbits = lpm->keysize * 8;
+
+	for (i=0; i<nbits; i++) {
+		uint8_t byte;
+		size_t byte_idx = i / 8;
+		int bit;
+
+		/* same order of bytes as in lpm_key_make() */
+		if (byte_idx < lpm->addr_off) {
+			byte = key[byte_idx];
+		} else if (byte_idx < (lpm->addr_off + tail)) {
+			byte = key[byte_idx + lpm->addr_size];
+		} else {
+			byte = key[byte_idx - tail];
+		}
+
+		if (lpm->nodes[node].row) {
+			row = lpm->nodes[node].row;
+		}
+
+		bit = !!(byte & (1 << (7 - (i % 8))));
+		node = lpm->nodes[node].next[bit];
+		if (!node) {
+			break;
+		}
+	}
+
+	if (node && lpm->nodes[node].row) {
+		row = lpm->nodes[node].row;
+	}
+
+	if (!row) {
+		return NULL;
+	}
+
+	return &lpm->rows[(row - 1) * lpm->nlim * lpm->n_aggr];
+}
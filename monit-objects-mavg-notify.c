@@ -0,0 +1,546 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Notification dispatcher
+ *
+ * Instead of fork()+execve() of action script for each overlimited item,
+ * xenoeye starts one long-lived helper process per script and writes
+ * events to helper's stdin, one tab-separated record per line:
+ *
+ * event mo_name mavg_name limit_name filename key1 ... keyN val limit
+ *
+ * event is "overlimit"/"underlimit" for start and "back2norm" for end.
+ * Records are queued by act() and written to helpers in batches by
+ * dispatcher thread. Records for the same item (mo, mavg, limit and file
+ * name, any event) and helper are coalesced in queue: newest event replaces
+ * queued one, so helper always ends in the latest state. If queue is full,
+ * record is dropped and drop counter is incremented.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "utils.h"
+#include "xenoeye.h"
+#include "monit-objects.h"
+
+#define NOTIFY_HELPERS_MAX 64
+
+struct notify_helper
+{
+	char script[PATH_MAX];
+	pid_t pid;
+	int fd;
+};
+
+struct notify_rec
+{
+	size_t helper;
+	uint32_t hash;
+	/* "mo mavg limit file" part of line, item key without event */
+	size_t keyoff;
+	size_t keylen;
+	size_t len;
+	char line[MAVG_NOTIFY_LINE_MAX];
+};
+
+struct notify_queue
+{
+	struct notify_rec *recs;
+	size_t n;
+};
+
+static struct mavg_notify_conf *conf = NULL;
+
+static pthread_mutex_t notify_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* two queues, act() threads append to current, dispatcher drains other */
+static struct notify_queue queues[2];
+static size_t q_curr = 0;
+
+/* open addressing hash table for coalescing, indexes in current queue */
+static ssize_t *q_hash = NULL;
+static size_t q_hash_size = 0;
+
+/* helpers, appended under mutex, processes started by dispatcher only */
+static struct notify_helper helpers[NOTIFY_HELPERS_MAX];
+static size_t nhelpers = 0;
+
+static _Atomic uint64_t n_queued = 0;
+static _Atomic uint64_t n_coalesced = 0;
+static _Atomic uint64_t n_dropped = 0;
+static _Atomic uint64_t n_sent = 0;
+
+static uint32_t
+notify_hash(const char *s, size_t len)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		h ^= (uint8_t)s[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+mavg_notify_config(struct aajson *a, aajson_val *value,
+	struct mavg_notify_conf *c)
+{
+	if (STRCMP(a, 2, "enabled") == 0) {
+		c->enabled = (value->type == AAJSON_VALUE_TRUE);
+	} else if (STRCMP(a, 2, "queue-size") == 0) {
+		if (atoi(value->str) <= 0) {
+			LOG("notify-dispatcher: incorrect queue size '%s'",
+				value->str);
+			return 0;
+		}
+		c->queue_size = atoi(value->str);
+	} else if (STRCMP(a, 2, "batch-size") == 0) {
+		if (atoi(value->str) <= 0) {
+			LOG("notify-dispatcher: incorrect batch size '%s'",
+				value->str);
+			return 0;
+		}
+		c->batch_size = atoi(value->str);
+	} else if (STRCMP(a, 2, "flush-ms") == 0) {
+		if (atoi(value->str) <= 0) {
+			LOG("notify-dispatcher: incorrect flush time '%s'",
+				value->str);
+			return 0;
+		}
+		c->flush_ms = atoi(value->str);
+	}
+
+	return 1;
+}
+#undef STRCMP
+
+int
+mavg_notify_enabled(void)
+{
+	return conf && conf->enabled;
+}
+
+static void
+hash_reset(void)
+{
+	size_t i;
+
+	for (i=0; i<q_hash_size; i++) {
+		q_hash[i] = -1;
+	}
+}
+
+int
+mavg_notify_init(struct xe_data *globl)
+{
+	size_t i;
+	int thread_err;
+
+	conf = &globl->notify;
+
+	if (!conf->enabled) {
+		return 1;
+	}
+
+	if (!conf->queue_size) {
+		conf->queue_size = MAVG_NOTIFY_DEFAULT_QUEUE;
+	}
+	if (!conf->batch_size) {
+		conf->batch_size = MAVG_NOTIFY_DEFAULT_BATCH;
+	}
+	if (!conf->flush_ms) {
+		conf->flush_ms = MAVG_NOTIFY_DEFAULT_FLUSH_MS;
+	}
+
+	for (i=0; i<2; i++) {
+		queues[i].recs = calloc(conf->queue_size,
+			sizeof(struct notify_rec));
+		if (!queues[i].recs) {
+			LOG("calloc() failed");
+			goto fail_alloc;
+		}
+		queues[i].n = 0;
+	}
+
+	/* power of 2, at least twice as big as queue */
+	q_hash_size = 1;
+	while (q_hash_size < conf->queue_size * 2) {
+		q_hash_size *= 2;
+	}
+	q_hash = malloc(q_hash_size * sizeof(ssize_t));
+	if (!q_hash) {
+		LOG("malloc() failed");
+		goto fail_alloc;
+	}
+	hash_reset();
+
+	thread_err = pthread_create(&globl->mavg_notify_tid, NULL,
+		&mavg_notify_thread, globl);
+	if (thread_err) {
+		LOG("Can't start thread: %s", strerror(thread_err));
+		goto fail_thread;
+	}
+
+	LOG("Notification dispatcher started, queue size %lu, batch size %lu",
+		conf->queue_size, conf->batch_size);
+
+	return 1;
+
+fail_thread:
+	free(q_hash);
+	q_hash = NULL;
+fail_alloc:
+	free(queues[0].recs);
+	free(queues[1].recs);
+	queues[0].recs = queues[1].recs = NULL;
+	conf->enabled = 0;
+	return 0;
+}
+
+static ssize_t
+helper_find_or_add(const char *script)
+{
+	size_t i;
+
+	for (i=0; i<nhelpers; i++) {
+		if (strcmp(helpers[i].script, script) == 0) {
+			return i;
+		}
+	}
+
+	if (nhelpers >= NOTIFY_HELPERS_MAX) {
+		return -1;
+	}
+
+	strcpy(helpers[nhelpers].script, script);
+	helpers[nhelpers].pid = 0;
+	helpers[nhelpers].fd = -1;
+	nhelpers++;
+
+	return nhelpers - 1;
+}
+
+int
+mavg_notify_send(char *script, const char *event, char **args, size_t nargs)
+{
+	struct notify_queue *q;
+	struct notify_rec rec;
+	size_t i, h_idx;
+	ssize_t helper;
+	int len;
+
+	/* build record: event, mo, mavg, limit, file, keys..., val, limit */
+	len = snprintf(rec.line, sizeof(rec.line), "%s", event);
+	rec.keyoff = len + 1;
+	rec.keylen = 0;
+	for (i=0; i<nargs; i++) {
+		len += snprintf(rec.line + len, sizeof(rec.line) - len,
+			"\t%s", args[i]);
+		if ((size_t)len >= (sizeof(rec.line) - 1)) {
+			LOG("Notification record is too long, skipping");
+			atomic_fetch_add_explicit(&n_dropped, 1,
+				memory_order_relaxed);
+			return 0;
+		}
+		if (i == 3) {
+			/* file name is unique for mavg, limit and key */
+			rec.keylen = len - rec.keyoff;
+		}
+	}
+	rec.line[len++] = '\n';
+	rec.len = len;
+	rec.hash = notify_hash(rec.line + rec.keyoff, rec.keylen);
+
+	pthread_mutex_lock(&notify_mtx);
+
+	helper = helper_find_or_add(script);
+	if (helper < 0) {
+		pthread_mutex_unlock(&notify_mtx);
+		LOG("Too many notification scripts, can't add '%s'", script);
+		atomic_fetch_add_explicit(&n_dropped, 1, memory_order_relaxed);
+		return 0;
+	}
+	rec.helper = helper;
+
+	q = &queues[q_curr];
+
+	/* search for record of the same item, event doesn't matter */
+	h_idx = rec.hash & (q_hash_size - 1);
+	while (q_hash[h_idx] >= 0) {
+		struct notify_rec *r = &q->recs[q_hash[h_idx]];
+
+		if ((r->hash == rec.hash) && (r->helper == rec.helper)
+			&& (r->keylen == rec.keylen)
+			&& (memcmp(r->line + r->keyoff, rec.line + rec.keyoff,
+				rec.keylen) == 0)) {
+
+			/* replace with newest, e.g. back2norm after overlimit */
+			memcpy(r, &rec, sizeof(struct notify_rec));
+			pthread_mutex_unlock(&notify_mtx);
+			atomic_fetch_add_explicit(&n_coalesced, 1,
+				memory_order_relaxed);
+			return 1;
+		}
+		h_idx = (h_idx + 1) & (q_hash_size - 1);
+	}
+
+	if (q->n >= conf->queue_size) {
+		pthread_mutex_unlock(&notify_mtx);
+		atomic_fetch_add_explicit(&n_dropped, 1, memory_order_relaxed);
+		return 0;
+	}
+
+	memcpy(&q->recs[q->n], &rec, sizeof(struct notify_rec));
+	q_hash[h_idx] = q->n;
+	q->n++;
+
+	pthread_mutex_unlock(&notify_mtx);
+
+	atomic_fetch_add_explicit(&n_queued, 1, memory_order_relaxed);
+
+	return 1;
+}
+
+static int
+helper_start(struct notify_helper *h)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		LOG("pipe() failed: %s", strerror(errno));
+		return 0;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		/* child */
+		char *args[2];
+		sigset_t set;
+
+		/* signal mask is inherited from dispatcher thread */
+		sigemptyset(&set);
+		sigaddset(&set, SIGPIPE);
+		pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+		dup2(fds[0], STDIN_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+
+		setsid();
+		args[0] = h->script;
+		args[1] = NULL;
+		if (execve(args[0], args, NULL) == -1) {
+			LOG("Can't start notification helper '%s': %s",
+				args[0], strerror(errno));
+		}
+		exit(EXIT_FAILURE);
+	} else if (pid == -1) {
+		LOG("Can't fork(): %s", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return 0;
+	}
+
+	close(fds[0]);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	h->pid = pid;
+	h->fd = fds[1];
+
+	LOG("Notification helper '%s' started, pid %d", h->script, (int)pid);
+
+	return 1;
+}
+
+static void
+helper_stop(struct notify_helper *h)
+{
+	if (h->fd >= 0) {
+		close(h->fd);
+	}
+	h->fd = -1;
+	h->pid = 0;
+}
+
+static int
+helper_write(struct notify_helper *h, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t rc = write(h->fd, buf, len);
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			LOG("Can't write to notification helper '%s': %s",
+				h->script, strerror(errno));
+			return 0;
+		}
+		buf += rc;
+		len -= rc;
+	}
+
+	return 1;
+}
+
+static void
+flush_batch(struct notify_helper *h, char *buf, size_t buflen, size_t nbatch)
+{
+	if (helper_write(h, buf, buflen)) {
+		atomic_fetch_add_explicit(&n_sent, nbatch,
+			memory_order_relaxed);
+	} else {
+		/* helper is dead, restart it on next batch */
+		atomic_fetch_add_explicit(&n_dropped, nbatch,
+			memory_order_relaxed);
+		helper_stop(h);
+	}
+}
+
+static void
+flush_helper(struct notify_queue *q, size_t helper_idx, char *buf)
+{
+	size_t i, nbatch = 0, buflen = 0;
+	int failed = 0;
+	struct notify_helper *h = &helpers[helper_idx];
+
+	for (i=0; i<q->n; i++) {
+		struct notify_rec *r = &q->recs[i];
+
+		if (r->helper != helper_idx) {
+			continue;
+		}
+
+		/* don't try to restart helper for each record */
+		if (!failed && (h->fd < 0) && !helper_start(h)) {
+			failed = 1;
+		}
+		if (failed) {
+			atomic_fetch_add_explicit(&n_dropped, 1,
+				memory_order_relaxed);
+			continue;
+		}
+
+		memcpy(buf + buflen, r->line, r->len);
+		buflen += r->len;
+		nbatch++;
+
+		if (nbatch == conf->batch_size) {
+			flush_batch(h, buf, buflen, nbatch);
+			nbatch = 0;
+			buflen = 0;
+		}
+	}
+
+	if (nbatch) {
+		flush_batch(h, buf, buflen, nbatch);
+	}
+}
+
+void
+mavg_notify_stats(uint64_t *queued, uint64_t *coalesced, uint64_t *dropped,
+	uint64_t *sent)
+{
+	*queued = atomic_load_explicit(&n_queued, memory_order_relaxed);
+	*coalesced = atomic_load_explicit(&n_coalesced, memory_order_relaxed);
+	*dropped = atomic_load_explicit(&n_dropped, memory_order_relaxed);
+	*sent = atomic_load_explicit(&n_sent, memory_order_relaxed);
+}
+
+void *
+mavg_notify_thread(void *arg)
+{
+	struct xe_data *globl = (struct xe_data *)arg;
+	sigset_t set;
+	char *buf;
+	uint64_t dropped_prev = 0;
+	size_t i;
+
+	/* helper may exit, get EPIPE from write() instead of signal */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	buf = malloc(conf->batch_size * MAVG_NOTIFY_LINE_MAX);
+	if (!buf) {
+		LOG("malloc() failed");
+		return NULL;
+	}
+
+	for (;;) {
+		struct notify_queue *q;
+		size_t nh;
+		uint64_t dropped;
+		struct timespec zero = {0, 0};
+
+		if (atomic_load_explicit(&globl->stop, memory_order_relaxed)) {
+			/* stop */
+			break;
+		}
+
+		usleep(conf->flush_ms * 1000);
+
+		/* swap queues */
+		pthread_mutex_lock(&notify_mtx);
+		q = &queues[q_curr];
+		q_curr = (q_curr + 1) % 2;
+		queues[q_curr].n = 0;
+		hash_reset();
+		nh = nhelpers;
+		pthread_mutex_unlock(&notify_mtx);
+
+		for (i=0; i<nh; i++) {
+			flush_helper(q, i, buf);
+		}
+		q->n = 0;
+
+		/* consume pending SIGPIPE if any */
+		sigtimedwait(&set, NULL, &zero);
+
+		dropped = atomic_load_explicit(&n_dropped,
+			memory_order_relaxed);
+		if (dropped != dropped_prev) {
+			LOG("Notification dispatcher: %lu records dropped",
+				dropped - dropped_prev);
+			dropped_prev = dropped;
+		}
+	}
+
+	for (i=0; i<nhelpers; i++) {
+		helper_stop(&helpers[i]);
+	}
+	free(buf);
+
+	return NULL;
+}
+
@@ -81,6 +81,7 @@ underlimit_item_check(struct mo_mavg *mavg, uint8_t *key, size_t keysize,
 			ld.limit = limit;
 			ld.back2norm_time_ns
 				= lim_curr->underlimit[limit_index].back2norm_time_ns;
+			ld.status_slot = -1;
 
 			dtv.data = &ld;
 			dtv.size = sizeof(struct mavg_lim_data);
@@ -29,13 +29,15 @@
 #include "monit-objects.h"
 #include "monit-objects-common.h"
 #include "flow-info.h"
+#include "xe-log.h"
 
 #define MAVG_VAL(DATUM, I, SIZE) ((struct mavg_val *)&DATUM[SIZE * I])
 
 int
-mavg_fields_init(size_t nthreads, struct mo_mavg *mavg)
+mavg_fields_init(struct xe_data *globl, struct mo_mavg *mavg)
 {
 	size_t i, keysize, valsize, val_itemsize;
+	size_t nthreads = globl->nthreads;
 
 	struct mavg_limits *lim_curr = MAVG_LIM_CURR(mavg);
 
@@ -62,9 +64,9 @@ mavg_fields_init(size_t nthreads, struct mo_mavg *mavg)
 
 
 	/* per-thread data */
-	mavg->thr_data = calloc(nthreads, sizeof(struct mavg_thread_data));
+	mavg->thr_data = calloc_cl(nthreads, sizeof(struct mavg_thread_data));
 	if (!mavg->thr_data) {
-		LOG("calloc() failed");
+		LOG("calloc_cl() failed");
 		return 0;
 	}
 
@@ -72,28 +74,31 @@ mavg_fields_init(size_t nthreads, struct mo_mavg *mavg)
 		struct mavg_thread_data *data = &mavg->thr_data[i];
 		tkvdb_tr *tmp_db;
 
+		/* databases are on node of processing thread */
+		monit_objects_thread_mem(globl, i);
+
 		data->keysize = keysize;
 		/* allocate memory for key plus level number */
 		data->key_fullsize = keysize + sizeof(size_t);
-		data->key = malloc(data->key_fullsize);
+		data->key = malloc_cl(data->key_fullsize);
 		if (!data->key) {
-			LOG("malloc() failed");
-			return 0;
+			LOG("malloc_cl() failed");
+			goto fail_thread;
 		}
 
 		data->valsize = valsize;
 		data->val_itemsize = val_itemsize;
-		data->val = malloc(valsize);
+		data->val = malloc_cl(valsize);
 		if (!data->val) {
-			LOG("malloc() failed");
-			return 0;
+			LOG("malloc_cl() failed");
+			goto fail_thread;
 		}
 
 		/* init database */
 		tmp_db = tkvdb_tr_create(NULL, params);
 		if (!tmp_db) {
 			LOG("tkvdb_tr_create() failed");
-			return 0;
+			goto fail_thread;
 		}
 
 		tmp_db->begin(tmp_db);
@@ -104,18 +109,20 @@ mavg_fields_init(size_t nthreads, struct mo_mavg *mavg)
 		data->ovr_db[0] = tkvdb_tr_create(NULL, params_ovr);
 		if (!data->ovr_db[0]) {
 			LOG("Can't create database for overlimited items");
-			return 0;
+			goto fail_thread;
 		}
 		data->ovr_db[0]->begin(data->ovr_db[0]);
 
 		data->ovr_db[1] = tkvdb_tr_create(NULL, params_ovr);
 		if (!data->ovr_db[1]) {
 			LOG("Can't create database for overlimited items");
-			return 0;
+			goto fail_thread;
 		}
 		data->ovr_db[1]->begin(data->ovr_db[1]);
 	}
 
+	monit_objects_thread_mem(globl, -1);
+
 	/* databases with over- and underlimited items */
 	mavg->ovrerlm_db = tkvdb_tr_create(NULL, params_ovr);
 	if (!mavg->ovrerlm_db) {
@@ -136,6 +143,10 @@ mavg_fields_init(size_t nthreads, struct mo_mavg *mavg)
 	tkvdb_params_free(params);
 	tkvdb_params_free(params_ovr);
 	return 1;
+
+fail_thread:
+	monit_objects_thread_mem(globl, -1);
+	return 0;
 }
 
 static int
@@ -442,7 +453,8 @@ mavg_config(struct aajson *a, aajson_val *value,
 }
 
 static int
-mavg_limits_do_init(struct mo_mavg *mavg, struct mavg_limit *limit, size_t n)
+mavg_limits_do_init(struct mo_mavg *mavg, struct mavg_limit *limit, size_t n,
+	int use_lpm)
 {
 	size_t i;
 	tkvdb_params *params;
@@ -464,7 +476,7 @@ mavg_limits_do_init(struct mo_mavg *mavg, struct mavg_limit *limit, size_t n)
 		}
 
 		l->db->begin(l->db);
-		if (l->file[0]) {
+		if (l->file[0] && !use_lpm) {
 			/* try to read file */
 			mavg_limits_file_load(mavg, l);
 		}
@@ -479,6 +491,7 @@ int
 mavg_limits_init(struct mo_mavg *mavg, int is_reloading)
 {
 	struct mavg_limits *lim;
+	int use_lpm;
 
 	if (!is_reloading) {
 		lim = MAVG_LIM_CURR(mavg);
@@ -486,21 +499,38 @@ mavg_limits_init(struct mo_mavg *mavg, int is_reloading)
 		lim = MAVG_LIM_NOT_CURR(mavg);
 	}
 
-	if (!mavg_limits_do_init(mavg, lim->overlimit, lim->noverlimit)) {
+	/* windows with address in key use prefixes instead of exact keys */
+	use_lpm = mavg_lim_lpm_enabled(mavg);
+
+	if (!mavg_limits_do_init(mavg, lim->overlimit, lim->noverlimit,
+		use_lpm)) {
+
 		return 0;
 	}
 
-	if (!mavg_limits_do_init(mavg, lim->underlimit, lim->nunderlimit)) {
+	if (!mavg_limits_do_init(mavg, lim->underlimit, lim->nunderlimit,
+		use_lpm)) {
+
 		return 0;
 	}
 
+	lim->lpm = NULL;
+	if (use_lpm && (lim->noverlimit + lim->nunderlimit)) {
+		lim->lpm = mavg_lim_lpm_load(mavg, lim);
+		if (!lim->lpm) {
+			LOG("Can't load limits of '%s', using defaults",
+				mavg->name);
+		}
+	}
+
 	return 1;
 }
 
 /* react on overlimit */
 static void
-mavg_on_overlimit(struct xe_data *globl, struct mavg_thread_data *data,
-	size_t limit_id, struct mavg_lim_data *od)
+mavg_on_overlimit(struct xe_data *globl, struct mo_mavg *mavg,
+	struct mavg_thread_data *data, size_t limit_id,
+	struct mavg_lim_data *od)
 {
 	TKVDB_RES rc;
 	tkvdb_datum dtk, dtv;
@@ -508,9 +538,9 @@ mavg_on_overlimit(struct xe_data *globl, struct mavg_thread_data *data,
 
 	size_t ovr_idx;
 
-	/* select bank */
-	ovr_idx = atomic_load_explicit(&globl->mavg_db_bank_idx,
-		memory_order_relaxed) % 2;
+	/* select bank, sequentially consistent load after
+	   monit_objects_packet_begin(), see monit_objects_wait_threads() */
+	ovr_idx = atomic_load(&globl->mavg_db_bank_idx) % 2;
 
 	db = data->ovr_db[ovr_idx];
 
@@ -526,10 +556,27 @@ mavg_on_overlimit(struct xe_data *globl, struct mavg_thread_data *data,
 	/* put without checks if this item exists */
 	rc = db->put(db, &dtk, &dtv);
 	if (rc != TKVDB_OK) {
-		LOG("Can't append item to db with "\
+		LOG_RL("Can't append item to db with "\
 			"overlimited records, error code %d", rc);
 		return;
 	}
+
+	/* wake up act thread, only once per bank */
+	if (atomic_load_explicit(&mavg->ovr_pending[ovr_idx],
+		memory_order_relaxed)) {
+
+		return;
+	}
+
+	if (!atomic_exchange_explicit(&mavg->ovr_pending[ovr_idx], 1,
+		memory_order_release)) {
+
+		uint64_t ev = 1;
+
+		if (write(globl->mavg_act_evfd, &ev, sizeof(ev)) < 0) {
+			LOG_RL("Can't notify act thread: %s", strerror(errno));
+		}
+	}
 }
 
 static void
@@ -562,7 +609,7 @@ mavg_limits_check(struct xe_data *globl, struct mo_mavg *mavg,
 				od.back2norm_time_ns
 					= lim_curr->overlimit[j].back2norm_time_ns;
 
-				mavg_on_overlimit(globl, data, j, &od);
+				mavg_on_overlimit(globl, mavg, data, j, &od);
 			}
 		}
 	}
@@ -593,72 +640,73 @@ mavg_recalc(_Atomic MAVG_TYPE *oldval_p, _Atomic uint64_t *old_time_ns_p,
 }
 
 
+/* limit for key, lidx is index of overlimit or underlimit item */
+static MAVG_TYPE
+mavg_limit_value(struct mo_mavg *mavg, struct mavg_limits *lim, size_t lidx,
+	size_t i, MAVG_TYPE *lpm_row, tkvdb_datum *dtkey)
+{
+	struct mavg_limit *l;
+	tkvdb_tr *tr;
+	tkvdb_datum dtval;
+
+	if (lidx < lim->noverlimit) {
+		l = &lim->overlimit[lidx];
+	} else {
+		l = &lim->underlimit[lidx - lim->noverlimit];
+	}
+
+	if (lim->lpm) {
+		if (lpm_row) {
+			return lpm_row[lidx * mavg->fieldset.n_aggr + i];
+		}
+		return l->def[i];
+	}
+
+	/* search in limits database */
+	tr = l->db;
+	if (tr && (tr->get(tr, dtkey, &dtval) == TKVDB_OK)) {
+		/* found, using value as limit */
+		return *((MAVG_TYPE *)dtval.data);
+	}
+
+	/* not found, using default */
+	return l->def[i];
+}
+
 static void
-mavg_val_init(struct mo_mavg *mavg, struct flow_info *flow,
+mavg_val_init(struct mo_mavg *mavg, MAVG_TYPE *flow_vals,
 	uint64_t time_ns, struct mavg_thread_data *data, MAVG_TYPE *vals)
 {
-	size_t i, j;
+	size_t i, j, nlim;
+	tkvdb_datum dtkey;
+	MAVG_TYPE *lpm_row = NULL;
 
 	struct mavg_limits *lim_curr = MAVG_LIM_CURR(mavg);
 
 	memset(data->val, 0, data->valsize);
 
+	nlim = lim_curr->noverlimit + lim_curr->nunderlimit;
+
+	dtkey.data = data->key;
+	dtkey.size = data->keysize;
+
+	if (lim_curr->lpm) {
+		/* one lookup for all limits */
+		lpm_row = mavg_lim_lpm_lookup(lim_curr->lpm, data->key);
+	}
+
 	for (i=0; i<mavg->fieldset.n_aggr; i++) {
-		struct field *fld = &mavg->fieldset.aggr[i];
-		MAVG_TYPE val;
+		MAVG_TYPE val = flow_vals[i];
 		struct mavg_val *pval;
 
-		val = monit_object_nf_val(flow, fld)
-			* fld->scale * flow->sampling_rate;
-
 		pval = MAVG_VAL(data->val, i, data->valsize);
 
 		/* setup limits */
-		/* overlimit */
-		for (j=0; j<lim_curr->noverlimit; j++) {
-			TKVDB_RES rc;
-			tkvdb_datum dtkey, dtval;
-			tkvdb_tr *tr = lim_curr->overlimit[j].db;
-
-			dtkey.data = data->key;
-			dtkey.size = data->keysize;
-
-			rc = tr->get(tr, &dtkey, &dtval);
-			if (rc == TKVDB_OK) {
-				/* found, using value as limit */
-				MAVG_TYPE *limptr = (MAVG_TYPE *)dtval.data;
-				atomic_store_explicit(&pval->limits[j],
-					*limptr, memory_order_relaxed);
-			} else {
-				/* not found, using default */
-				atomic_store_explicit(&pval->limits[j],
-					lim_curr->overlimit[j].def[i],
-					memory_order_relaxed);
-			}
-		}
-
-		/* underlimit */
-		for (j=0; j<lim_curr->nunderlimit; j++) {
-			TKVDB_RES rc;
-			tkvdb_datum dtkey, dtval;
-			tkvdb_tr *tr = lim_curr->underlimit[j].db;
-			size_t lidx = j + lim_curr->noverlimit;
-
-			dtkey.data = data->key;
-			dtkey.size = data->keysize;
-
-			rc = tr->get(tr, &dtkey, &dtval);
-			if (rc == TKVDB_OK) {
-				/* found, using value as limit */
-				MAVG_TYPE *limptr = (MAVG_TYPE *)dtval.data;
-				atomic_store_explicit(&pval->limits[lidx],
-					*limptr, memory_order_relaxed);
-			} else {
-				/* not found, using default */
-				atomic_store_explicit(&pval->limits[lidx],
-					lim_curr->underlimit[j].def[i],
-					memory_order_relaxed);
-			}
+		for (j=0; j<nlim; j++) {
+			atomic_store_explicit(&pval->limits[j],
+				mavg_limit_value(mavg, lim_curr, j, i, lpm_row,
+					&dtkey),
+				memory_order_relaxed);
 		}
 
 		atomic_store_explicit(&pval->val, val, memory_order_relaxed);
@@ -670,11 +718,12 @@ mavg_val_init(struct mo_mavg *mavg, struct flow_info *flow,
 	}
 }
 
-static void
+void
 mavg_limits_update_db(struct mo_mavg *mavg, tkvdb_tr *db,
 	struct mavg_limits *lim, size_t val_itemsize)
 {
 	tkvdb_cursor *c;
+	size_t nlim = lim->noverlimit + lim->nunderlimit;
 
 	c = tkvdb_cursor_create(db);
 	if (!c) {
@@ -689,62 +738,26 @@ mavg_limits_update_db(struct mo_mavg *mavg, tkvdb_tr *db,
 	/* iterate over all set */
 	do {
 		size_t i;
+		MAVG_TYPE *lpm_row = NULL;
 
 		tkvdb_datum dtk = c->key_datum(c);
 		tkvdb_datum dtv = c->val_datum(c);
 
+		if (lim->lpm) {
+			lpm_row = mavg_lim_lpm_lookup(lim->lpm, dtk.data);
+		}
+
 		for (i=0; i<mavg->fieldset.n_aggr; i++) {
 			struct mavg_val *pval;
 			size_t j;
 
 			pval = MAVG_VAL(((uint8_t *)dtv.data), i, val_itemsize);
 
-			for (j=0; j<lim->noverlimit; j++) {
-				TKVDB_RES rc;
-				tkvdb_datum dtval;
-
-				/* search in limits database */
-				tkvdb_tr *tr = lim->overlimit[j].db;
-				if (tr) {
-					rc = tr->get(tr, &dtk, &dtval);
-				} else {
-					rc = TKVDB_NOT_FOUND;
-				}
-
-				if (rc == TKVDB_OK) {
-					/* found, using value as limit */
-					MAVG_TYPE *limptr = (MAVG_TYPE *)dtval.data;
-					atomic_store_explicit(&pval->limits[j],
-						*limptr, memory_order_relaxed);
-				} else {
-					/* not found, using default */
-					atomic_store_explicit(&pval->limits[j],
-						lim->overlimit[j].def[i],
-						memory_order_relaxed);
-				}
-			}
-
-			for (j=0; j<lim->nunderlimit; j++) {
-				TKVDB_RES rc;
-				tkvdb_datum dtval;
-				size_t lidx = j + lim->noverlimit;
-
-				tkvdb_tr *tr = lim->underlimit[j].db;
-				if (tr) {
-					rc = tr->get(tr, &dtk, &dtval);
-				} else {
-					rc = TKVDB_NOT_FOUND;
-				}
-
-				if (rc == TKVDB_OK) {
-					MAVG_TYPE *limptr = (MAVG_TYPE *)dtval.data;
-					atomic_store_explicit(&pval->limits[lidx],
-						*limptr, memory_order_relaxed);
-				} else {
-					atomic_store_explicit(&pval->limits[lidx],
-						lim->underlimit[j].def[i],
-						memory_order_relaxed);
-				}
+			for (j=0; j<nlim; j++) {
+				atomic_store_explicit(&pval->limits[j],
+					mavg_limit_value(mavg, lim, j, i,
+						lpm_row, &dtk),
+					memory_order_relaxed);
 			}
 		}
 	} while (c->next(c) == TKVDB_OK);
@@ -787,6 +800,7 @@ try_reset_db(struct mo_mavg *mavg, struct mavg_thread_data *thr_data)
 
 	tkvdb_params *params;
 	tkvdb_tr *newdb, *olddb;
+	uint64_t nkeys = 0;
 
 	/* create new database with the same params as old */
 	params = tkvdb_params_create();
@@ -855,12 +869,14 @@ try_reset_db(struct mo_mavg *mavg, struct mavg_thread_data *thr_data)
 				LOG("put() failed with code %d", rc);
 				goto put_failed;
 			}
+			nkeys++;
 		}
 
 	} while (c->next(c) == TKVDB_OK);
 
 	/* replace old database with new one */
 	atomic_store_explicit(&thr_data->db, newdb, memory_order_relaxed);
+	METRICS_SET(thr_data->nkeys, nkeys);
 
 	/* sleep a bit to wait for other threads to finish working with the
 	   old database*/
@@ -884,152 +900,190 @@ newdb_fail:
 	return ret;
 }
 
-int
-monit_object_mavg_process_nf(struct xe_data *globl, struct monit_object *mo,
-	size_t thread_id, uint64_t time_ns, struct flow_info *flow)
+void
+monit_object_mavg_add(struct xe_data *globl, struct mo_mavg *mavg,
+	size_t thread_id, uint64_t time_ns, MAVG_TYPE *vals)
 {
-	size_t i, f, t;
+	size_t t;
+	tkvdb_tr *db;
+	TKVDB_RES rc;
+	tkvdb_datum dtkey, dtval, nval;
+	MAVG_TYPE wndsize;
+	struct mavg_thread_data *data = &mavg->thr_data[thread_id];
 
-	for (i=0; i<mo->nmavg; i++) {
-		tkvdb_tr *db;
-		TKVDB_RES rc;
-		tkvdb_datum dtkey, dtval, nval;
-		MAVG_TYPE wndsize;
+	/* reserve space for merged values */
+	MAVG_TYPE *mvals = alloca(mavg->fieldset.n_aggr * sizeof(MAVG_TYPE));
 
-		struct mo_mavg *mavg = &mo->mavgs[i];
-		struct mavg_thread_data *data = &mavg->thr_data[thread_id];
+	/* window size in nanoseconds */
+	wndsize = mavg->size_secs * 1e9;
 
-		uint8_t *key = data->key;
+	db = atomic_load_explicit(&data->db, memory_order_relaxed);
 
-		/* reserve space for merged values */
-		MAVG_TYPE *mvals = alloca(mavg->fieldset.n_aggr
-			* sizeof(MAVG_TYPE));
+	dtkey.data = data->key;
+	dtkey.size = data->keysize;
 
-		/* window size in nanoseconds */
-		wndsize = mavg->size_secs * 1e9;
+	/* search for key */
+	rc = db->get(db, &dtkey, &dtval);
+	if (rc == TKVDB_OK) {
+		size_t j;
+		/* update existing values */
+		for (j=0; j<mavg->fieldset.n_aggr; j++) {
+			/* all aggregable fields */
+			struct mavg_val *pval;
 
-		/* make key */
-		for (f=0; f<mavg->fieldset.n_naggr; f++) {
-			struct field *fld = &mavg->fieldset.naggr[f];
+			pval = MAVG_VAL(((uint8_t *)dtval.data), j,
+				data->valsize);
+			mavg_recalc(&pval->val, &pval->time_prev, vals[j],
+				time_ns, wndsize, &pval->val);
 
-			monit_object_key_add_fld(fld, key, flow);
-			key += fld->size;
+			/* update time */
+			atomic_store_explicit(&pval->time_prev, time_ns,
+				memory_order_relaxed);
+
+			mvals[j] = pval->val;
 		}
 
-		db = atomic_load_explicit(&data->db, memory_order_relaxed);
+		/* values from another threads */
+		for (t=0; t<mavg->nthreads; t++) {
+			struct mavg_thread_data *ndata;
+			tkvdb_tr *ndb;
 
-		dtkey.data = data->key;
-		dtkey.size = data->keysize;
+			if (t == thread_id) {
+				/* skip self thread */
+				continue;
+			}
 
-		/* search for key */
-		rc = db->get(db, &dtkey, &dtval);
-		if (rc == TKVDB_OK) {
-			size_t j;
-			/* update existing values */
-			for (j=0; j<mavg->fieldset.n_aggr; j++) {
-				/* all aggregable fields */
-				struct field *fld = &mavg->fieldset.aggr[j];
-				MAVG_TYPE val;
-				struct mavg_val *pval;
+			ndata = &mavg->thr_data[t];
+			ndb = atomic_load_explicit(&ndata->db,
+				memory_order_relaxed);
+			rc = ndb->get(ndb, &dtkey, &nval);
+			if (rc == TKVDB_OK) {
+				for (j=0; j<mavg->fieldset.n_aggr; j++) {
+					_Atomic MAVG_TYPE tmp_thr_val;
+					struct mavg_val *pval;
+					pval = MAVG_VAL(((uint8_t *)nval.data),
+						j, data->valsize);
+
+					mavg_recalc(&pval->val,
+						&pval->time_prev,
+						0, time_ns,
+						wndsize,
+						&tmp_thr_val);
+					mvals[j] += tmp_thr_val;
+				}
+			}
+		}
 
-				val = monit_object_nf_val(flow, fld)
-					* fld->scale * flow->sampling_rate;
+		mavg_limits_check(globl, mavg, data, dtval.data, mvals,
+			time_ns);
+	} else if ((rc == TKVDB_EMPTY) || (rc == TKVDB_NOT_FOUND)) {
+		size_t j;
+		/* try to add new key-value pair */
 
-				pval = MAVG_VAL(((uint8_t *)dtval.data), j,
-					data->valsize);
-				mavg_recalc(&pval->val, &pval->time_prev, val,
-					time_ns, wndsize, &pval->val);
+		if (data->db_is_full) {
+			/* skip */
+			return;
+		}
 
-				/* update time */
-				atomic_store_explicit(&pval->time_prev, time_ns,
-					memory_order_relaxed);
+		/*
+		 * FIXME: it's not really needed, trying to suppress
+		 * valgring warning
+		*/
+		for (j=0; j<mavg->fieldset.n_aggr; j++) {
+			mvals[j] = 0.0f;
+		}
 
-				mvals[j] = pval->val;
-			}
+		mavg_val_init(mavg, vals, time_ns, data, mvals);
 
-			/* values from another threads */
-			for (t=0; t<mavg->nthreads; t++) {
-				struct mavg_thread_data *ndata;
-				tkvdb_tr *ndb;
+		mavg_limits_check(globl, mavg, data, data->val, mvals,
+			time_ns);
 
-				if (t == thread_id) {
-					/* skip self thread */
-					continue;
-				}
+		dtval.data = data->val;
+		dtval.size = data->valsize;
 
-				ndata = &mavg->thr_data[t];
-				ndb = atomic_load_explicit(&ndata->db,
-					memory_order_relaxed);
-				rc = ndb->get(ndb, &dtkey, &nval);
-				if (rc == TKVDB_OK) {
-					for (j=0; j<mavg->fieldset.n_aggr; j++) {
-						_Atomic MAVG_TYPE tmp_thr_val;
-						struct mavg_val *pval;
-						pval =
-						MAVG_VAL(((uint8_t *)nval.data),
-							j, data->valsize);
-
-						mavg_recalc(&pval->val,
-							&pval->time_prev,
-							0, time_ns,
-							wndsize,
-							&tmp_thr_val);
-						mvals[j] += tmp_thr_val;
-					}
-				}
+		rc = db->put(db, &dtkey, &dtval);
+
+		if (rc == TKVDB_OK) {
+			METRICS_ADD(data->nkeys, 1);
+		} else if (rc == TKVDB_ENOMEM) {
+			/* FIXME: out of memory */
+			LOG_RL("Not enough memory for MA database, "
+				"please increase value of 'mem-m'");
+			if (!try_reset_db(mavg, data)) {
+				LOG_RL("Can't cleanup MA database, all "
+					"new items will be discarded");
+
+				data->db_is_full = 1;
 			}
+		} else if (rc != TKVDB_OK) {
+			LOG_RL("Can't insert data, error code %d", rc);
+		}
+	} else {
+		LOG_RL("Can't find key, error code %d", rc);
+	}
+}
 
-			mavg_limits_check(globl, mavg, data, dtval.data, mvals,
-				time_ns);
-		} else if ((rc == TKVDB_EMPTY) || (rc == TKVDB_NOT_FOUND)) {
-			size_t j;
-			/* try to add new key-value pair */
+int
+monit_object_mavg_process_nf(struct xe_data *globl, struct monit_object *mo,
+	size_t thread_id, uint64_t time_ns, struct flow_info *flow)
+{
+	size_t i, f, j;
+	struct metrics_prof *prof = &globl->m_prof[thread_id];
+	struct mo_thread_metrics *m = &mo->metrics[thread_id];
 
-			if (data->db_is_full) {
-				/* skip */
-				continue;
-			}
+	for (i=0; i<mo->nmavg; i++) {
+		uint64_t t_cost;
+		MAVG_TYPE *vals, *cvals = NULL;
 
-			/*
-			 * FIXME: it's not really needed, trying to suppress
-			 * valgring warning
-			*/
-			for (j=0; j<mavg->fieldset.n_aggr; j++) {
-				mvals[j] = 0.0f;
-			}
+		struct mo_mavg *mavg = &mo->mavgs[i];
+		struct mavg_thread_data *data = &mavg->thr_data[thread_id];
 
-			mavg_val_init(mavg, flow, time_ns, data, mvals);
+		uint8_t *key = data->key;
 
-			mavg_limits_check(globl, mavg, data, data->val, mvals,
-				time_ns);
+		/* make key */
+		t_cost = prof_start(prof);
+		for (f=0; f<mavg->fieldset.n_naggr; f++) {
+			struct field *fld = &mavg->fieldset.naggr[f];
 
-			dtval.data = data->val;
-			dtval.size = data->valsize;
+			monit_object_key_add_fld(fld, key, flow);
+			key += fld->size;
+		}
+		t_cost = mo_cost_lap(m, MO_COST_KEY, t_cost);
 
-			rc = db->put(db, &dtkey, &dtval);
+		/* aggregable values of flow */
+		vals = alloca(mavg->fieldset.n_aggr * sizeof(MAVG_TYPE));
+		for (j=0; j<mavg->fieldset.n_aggr; j++) {
+			struct field *fld = &mavg->fieldset.aggr[j];
 
-			if (rc == TKVDB_ENOMEM) {
-				/* FIXME: out of memory */
-				LOG("Not enough memory for MA database, "
-					"please increase value of 'mem-m'");
-				if (!try_reset_db(mavg, data)) {
-					LOG("Can't cleanup MA database, all "
-						"new items will be discarded");
+			vals[j] = monit_object_nf_val(flow, fld)
+				* fld->scale * flow->sampling_rate;
+		}
 
-					data->db_is_full = 1;
-				}
-			} else if (rc != TKVDB_OK) {
-				LOG("Can't insert data, error code %d", rc);
+		/* sum records of packet with the same key */
+		if (globl->combine && !data->comb) {
+			data->comb = mo_combiner_new(globl, mo, mavg, 1,
+				data->keysize,
+				mavg->fieldset.n_aggr * sizeof(MAVG_TYPE));
+		}
+		if (data->comb) {
+			cvals = mo_combiner_slot(data->comb, data->key,
+				time_ns);
+		}
+
+		if (cvals) {
+			for (j=0; j<mavg->fieldset.n_aggr; j++) {
+				cvals[j] += vals[j];
 			}
 		} else {
-			LOG("Can't find key, error code %d", rc);
+			monit_object_mavg_add(globl, mavg, thread_id, time_ns,
+				vals);
 		}
+		mo_cost_lap(m, MO_COST_DB, t_cost);
 	}
 
 	return 1;
 }
 
-
 static void
 monit_objects_mavg_link(struct monit_object *mo, struct mavg_limit_ext_stat *e)
 {
@@ -1165,6 +1219,9 @@ mavg_limits_free(struct mo_mavg *mavg)
 		mavg_limits_do_free(lim->underlimit, lim->nunderlimit);
 	}
 
+	mavg_lim_lpm_free(lim->lpm);
+	lim->lpm = NULL;
+
 	lim->noverlimit = lim->nunderlimit = 0;
 }
 
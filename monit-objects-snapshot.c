@@ -0,0 +1,822 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Warm restart
+ *
+ * Binary snapshot of moving averages (per-thread databases), overlimited
+ * items and current fixed windows banks. Snapshot is written periodically
+ * and on shutdown, and restored at start before background threads are
+ * created.
+ *
+ * Only data that nobody writes is saved: banks of fixed windows are switched
+ * and previous banks are copied when processing threads leave them (they
+ * stay in inactive banks and are exported with the window), processing
+ * threads are held between packets while a moving average is copied. Data
+ * is copied to memory one window or moving average at a time and written to
+ * file after threads are released.
+ *
+ * File format: header, then records (struct snapshot_rec) each followed by
+ * MO name, window name, key and value. Records of windows with different
+ * key or value size (configuration was changed) are skipped on restore.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "utils.h"
+#include "xenoeye.h"
+#include "monit-objects.h"
+#include "monit-objects-common.h"
+
+#define SNAPSHOT_MAGIC 0x5845534e41503031ULL /* "XESNAP01" */
+#define SNAPSHOT_VERSION 1
+
+#define MAVG_VAL(DATUM, I, SIZE) ((struct mavg_val *)&DATUM[SIZE * I])
+
+enum SNAPSHOT_REC_TYPE
+{
+	SNAPSHOT_MAVG,        /* item of per-thread mavg database */
+	SNAPSHOT_MAVG_OVR,    /* overlimited item */
+	SNAPSHOT_FWM,         /* item of current fwm bank */
+	SNAPSHOT_FWM_EXPORT   /* fwm last export time */
+};
+
+struct snapshot_header
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t mavg_type_size;
+	uint64_t time_ns;
+};
+
+struct snapshot_rec
+{
+	uint32_t type;
+	uint32_t thread;
+	uint32_t mo_name_size;
+	uint32_t name_size;
+	uint32_t keysize;
+	uint32_t valsize;
+};
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+snapshot_config(struct aajson *a, aajson_val *value, struct snapshot_conf *c)
+{
+	if (STRCMP(a, 2, "enabled") == 0) {
+		c->enabled = (value->type == AAJSON_VALUE_TRUE);
+	} else if (STRCMP(a, 2, "path") == 0) {
+		strcpy(c->path, value->str);
+	} else if (STRCMP(a, 2, "interval") == 0) {
+		if (atoi(value->str) < 0) {
+			LOG("snapshot: incorrect interval '%s'", value->str);
+			return 0;
+		}
+		c->interval = atoi(value->str);
+	}
+
+	return 1;
+}
+#undef STRCMP
+
+static uint64_t
+realtime_ns(void)
+{
+	struct timespec tmsp;
+
+	if (clock_gettime(CLOCK_REALTIME_COARSE, &tmsp) < 0) {
+		LOG("clock_gettime() failed: %s", strerror(errno));
+		return 0;
+	}
+	return tmsp.tv_sec * 1e9 + tmsp.tv_nsec;
+}
+
+/* records of one window or moving average, written to file after copying */
+struct snapshot_buf
+{
+	uint8_t *data;
+	size_t size;
+	size_t alloc;
+};
+
+static int
+buf_add(struct snapshot_buf *b, const void *data, size_t size)
+{
+	if ((b->size + size) > b->alloc) {
+		size_t alloc = b->alloc ? b->alloc : 64 * 1024;
+		uint8_t *tmp;
+
+		while (alloc < (b->size + size)) {
+			alloc *= 2;
+		}
+		tmp = realloc(b->data, alloc);
+		if (!tmp) {
+			LOG("Not enough memory for snapshot");
+			return 0;
+		}
+		b->data = tmp;
+		b->alloc = alloc;
+	}
+
+	if (size) {
+		memcpy(b->data + b->size, data, size);
+		b->size += size;
+	}
+	return 1;
+}
+
+/* write and empty buffer */
+static int
+buf_flush(struct snapshot_buf *b, FILE *f)
+{
+	size_t size = b->size;
+
+	b->size = 0;
+	if (size && (fwrite(b->data, 1, size, f) != size)) {
+		LOG("Can't write snapshot: %s", strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+rec_write(struct snapshot_buf *b, enum SNAPSHOT_REC_TYPE type, size_t thread,
+	const char *mo_name, const char *name,
+	void *key, size_t keysize, void *val, size_t valsize)
+{
+	struct snapshot_rec r;
+
+	r.type = type;
+	r.thread = thread;
+	r.mo_name_size = strlen(mo_name);
+	r.name_size = strlen(name);
+	r.keysize = keysize;
+	r.valsize = valsize;
+
+	return buf_add(b, &r, sizeof(r))
+		&& buf_add(b, mo_name, r.mo_name_size)
+		&& buf_add(b, name, r.name_size)
+		&& buf_add(b, key, keysize)
+		&& buf_add(b, val, valsize);
+}
+
+static int
+tr_write(struct snapshot_buf *b, tkvdb_tr *tr, enum SNAPSHOT_REC_TYPE type,
+	size_t thread, const char *mo_name, const char *name)
+{
+	int ret = 0;
+	tkvdb_cursor *c;
+
+	c = tkvdb_cursor_create(tr);
+	if (!c) {
+		LOG("tkvdb_cursor_create() failed");
+		return 0;
+	}
+
+	if (c->first(c) != TKVDB_OK) {
+		ret = 1;
+		goto empty;
+	}
+
+	do {
+		if (!rec_write(b, type, thread, mo_name, name,
+			c->key(c), c->keysize(c), c->val(c), c->valsize(c))) {
+
+			goto fail;
+		}
+	} while (c->next(c) == TKVDB_OK);
+
+	ret = 1;
+fail:
+empty:
+	c->free(c);
+	return ret;
+}
+
+/* fwm and act threads don't touch banks while we are reading them */
+static int
+save_fwm(struct xe_data *globl, struct snapshot_buf *b,
+	struct monit_object *mo, struct mo_fwm *fwm)
+{
+	uint64_t last_export = fwm->last_export;
+	size_t t;
+
+	if (!rec_write(b, SNAPSHOT_FWM_EXPORT, 0, mo->name, fwm->name, NULL, 0,
+		&last_export, sizeof(last_export))) {
+
+		return 0;
+	}
+
+	/* data left by previous snapshot, then switch banks */
+	for (t=0; t<globl->nthreads; t++) {
+		struct fwm_thread_data *tdata = &fwm->thread_data[t];
+
+		if (!tr_write(b, fwm_inactive_tr(tdata), SNAPSHOT_FWM, t,
+			mo->name, fwm->name)) {
+
+			return 0;
+		}
+		fwm_swap_tr(tdata);
+	}
+
+	monit_objects_wait_threads(globl);
+	for (t=0; t<globl->nthreads; t++) {
+		if (!tr_write(b, fwm_inactive_tr(&fwm->thread_data[t]),
+			SNAPSHOT_FWM, t, mo->name, fwm->name)) {
+
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* processing threads are held */
+static int
+save_mavg(struct xe_data *globl, struct snapshot_buf *b,
+	struct monit_object *mo, struct mo_mavg *mavg)
+{
+	size_t t;
+
+	for (t=0; t<globl->nthreads; t++) {
+		tkvdb_tr *db = atomic_load_explicit(&mavg->thr_data[t].db,
+			memory_order_relaxed);
+
+		if (!tr_write(b, db, SNAPSHOT_MAVG, t, mo->name, mavg->name)) {
+			return 0;
+		}
+	}
+
+	return tr_write(b, mavg->ovrerlm_db, SNAPSHOT_MAVG_OVR, 0, mo->name,
+		mavg->name);
+}
+
+/*
+ * each window and moving average is copied to memory under snapshot_mtx
+ * (and with processing threads held for moving averages), file is written
+ * after release, so I/O doesn't stop processing
+ */
+static int
+save_rec(struct xe_data *globl, FILE *f, struct snapshot_buf *b,
+	struct monit_object *mos, size_t n_mo)
+{
+	size_t i, j;
+	int ret;
+
+	for (i=0; i<n_mo; i++) {
+		struct monit_object *mo = &mos[i];
+
+		for (j=0; j<mo->nfwm; j++) {
+			pthread_mutex_lock(&globl->snapshot_mtx);
+			ret = save_fwm(globl, b, mo, &mo->fwms[j]);
+			pthread_mutex_unlock(&globl->snapshot_mtx);
+
+			if (!ret || !buf_flush(b, f)) {
+				return 0;
+			}
+		}
+
+		for (j=0; j<mo->nmavg; j++) {
+			pthread_mutex_lock(&globl->snapshot_mtx);
+			/* processing threads wait between packets */
+			atomic_store(&globl->mo_hold, 1);
+			monit_objects_wait_threads(globl);
+			ret = save_mavg(globl, b, mo, &mo->mavgs[j]);
+			atomic_store(&globl->mo_hold, 0);
+			pthread_mutex_unlock(&globl->snapshot_mtx);
+
+			if (!ret || !buf_flush(b, f)) {
+				return 0;
+			}
+		}
+
+		if (mo->n_mo) {
+			if (!save_rec(globl, f, b, mo->mos, mo->n_mo)) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+int
+snapshot_save(struct xe_data *globl)
+{
+	FILE *f;
+	char tmp_path[PATH_MAX + 5];
+	struct snapshot_header h;
+	struct snapshot_buf b;
+	int ret;
+
+	sprintf(tmp_path, "%s.tmp", globl->snapshot.path);
+
+	f = fopen(tmp_path, "wb");
+	if (!f) {
+		LOG("Can't create snapshot '%s': %s", tmp_path,
+			strerror(errno));
+		return 0;
+	}
+
+	h.magic = SNAPSHOT_MAGIC;
+	h.version = SNAPSHOT_VERSION;
+	h.mavg_type_size = sizeof(MAVG_TYPE);
+	h.time_ns = realtime_ns();
+
+	if (fwrite(&h, sizeof(h), 1, f) != 1) {
+		LOG("Can't write snapshot: %s", strerror(errno));
+		goto fail_write;
+	}
+
+	memset(&b, 0, sizeof(b));
+	ret = save_rec(globl, f, &b, globl->monit_objects,
+		globl->nmonit_objects);
+	free(b.data);
+
+	if (!ret) {
+		goto fail_write;
+	}
+
+	if (fclose(f) != 0) {
+		LOG("Can't write snapshot: %s", strerror(errno));
+		unlink(tmp_path);
+		return 0;
+	}
+
+	if (rename(tmp_path, globl->snapshot.path) < 0) {
+		LOG("Can't rename '%s' to '%s': %s", tmp_path,
+			globl->snapshot.path, strerror(errno));
+		unlink(tmp_path);
+		return 0;
+	}
+
+	return 1;
+
+fail_write:
+	fclose(f);
+	unlink(tmp_path);
+	return 0;
+}
+
+static struct monit_object *
+mo_find(struct monit_object *mos, size_t n_mo, const char *name)
+{
+	size_t i;
+
+	for (i=0; i<n_mo; i++) {
+		struct monit_object *mo;
+
+		if (strcmp(mos[i].name, name) == 0) {
+			return &mos[i];
+		}
+
+		mo = mo_find(mos[i].mos, mos[i].n_mo, name);
+		if (mo) {
+			return mo;
+		}
+	}
+
+	return NULL;
+}
+
+static struct mo_mavg *
+mavg_find(struct monit_object *mo, const char *name)
+{
+	size_t i;
+
+	for (i=0; i<mo->nmavg; i++) {
+		if (strcmp(mo->mavgs[i].name, name) == 0) {
+			return &mo->mavgs[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct mo_fwm *
+fwm_find(struct monit_object *mo, const char *name)
+{
+	size_t i;
+
+	for (i=0; i<mo->nfwm; i++) {
+		if (strcmp(mo->fwms[i].name, name) == 0) {
+			return &mo->fwms[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* apply decay for the time since last update, returns 0 if item is gone */
+static int
+restore_mavg_decay(struct mo_mavg *mavg, uint8_t *val, size_t val_itemsize,
+	uint64_t time_ns)
+{
+	size_t i;
+	int keep = 0;
+	MAVG_TYPE wndsize = mavg->size_secs * 1e9;
+
+	for (i=0; i<mavg->fieldset.n_aggr; i++) {
+		struct mavg_val *pval = MAVG_VAL(val, i, val_itemsize);
+		MAVG_TYPE v = atomic_load_explicit(&pval->val,
+			memory_order_relaxed);
+		uint64_t time_prev = atomic_load_explicit(&pval->time_prev,
+			memory_order_relaxed);
+		MAVG_TYPE tmdiff;
+
+		if (time_ns > time_prev) {
+			tmdiff = time_ns - time_prev;
+		} else {
+			tmdiff = 0;
+		}
+
+		if (tmdiff < wndsize) {
+			v = v - tmdiff / wndsize * v;
+			keep = 1;
+		} else {
+			v = 0;
+		}
+
+		atomic_store_explicit(&pval->val, v, memory_order_relaxed);
+		atomic_store_explicit(&pval->time_prev, time_ns,
+			memory_order_relaxed);
+	}
+
+	return keep;
+}
+
+static int
+restore_mavg(struct xe_data *globl, struct mo_mavg *mavg,
+	struct snapshot_rec *r, uint8_t *key, uint8_t *val, uint64_t time_ns)
+{
+	struct mavg_thread_data *data;
+	tkvdb_tr *db;
+	tkvdb_datum dtk, dtv;
+	TKVDB_RES rc;
+	size_t i;
+
+	data = &mavg->thr_data[r->thread % globl->nthreads];
+
+	if ((r->keysize != data->keysize) || (r->valsize != data->valsize)) {
+		return 0;
+	}
+
+	if (!restore_mavg_decay(mavg, val, data->val_itemsize, time_ns)) {
+		return 1;
+	}
+
+	db = atomic_load_explicit(&data->db, memory_order_relaxed);
+
+	dtk.data = key;
+	dtk.size = r->keysize;
+
+	rc = db->get(db, &dtk, &dtv);
+	if (rc == TKVDB_OK) {
+		/* number of threads was changed, merge values */
+		for (i=0; i<mavg->fieldset.n_aggr; i++) {
+			struct mavg_val *pval, *padd;
+
+			pval = MAVG_VAL(((uint8_t *)dtv.data), i,
+				data->val_itemsize);
+			padd = MAVG_VAL(val, i, data->val_itemsize);
+
+			atomic_store_explicit(&pval->val,
+				atomic_load_explicit(&pval->val,
+					memory_order_relaxed)
+				+ atomic_load_explicit(&padd->val,
+					memory_order_relaxed),
+				memory_order_relaxed);
+		}
+		return 1;
+	}
+
+	dtv.data = val;
+	dtv.size = r->valsize;
+
+	rc = db->put(db, &dtk, &dtv);
+	if (rc != TKVDB_OK) {
+		LOG("Can't restore moving average item, error code %d", rc);
+		return 0;
+	}
+	METRICS_ADD(data->nkeys, 1);
+
+	return 1;
+}
+
+static int
+restore_mavg_ovr(struct mo_mavg *mavg, struct snapshot_rec *r, uint8_t *key,
+	uint8_t *val)
+{
+	tkvdb_datum dtk, dtv;
+	TKVDB_RES rc;
+	struct mavg_lim_data *ld = (struct mavg_lim_data *)val;
+
+	if ((r->keysize != mavg->thr_data[0].key_fullsize)
+		|| (r->valsize != sizeof(struct mavg_lim_data))) {
+
+		return 0;
+	}
+
+	/* status table is created at start */
+	ld->status_slot = -1;
+
+	if ((ld->state == MAVG_LIM_UPDATE)
+		|| (ld->state == MAVG_LIM_ALMOST_GONE)) {
+
+		/* scripts were started before restart, but extended stats
+		   should be turned on again */
+		mavg_ext_stats_toggle(mavg, 1, 1);
+	}
+
+	dtk.data = key;
+	dtk.size = r->keysize;
+	dtv.data = val;
+	dtv.size = r->valsize;
+
+	rc = mavg->ovrerlm_db->put(mavg->ovrerlm_db, &dtk, &dtv);
+	if (rc != TKVDB_OK) {
+		LOG("Can't restore overlimited item, error code %d", rc);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+restore_fwm(struct xe_data *globl, struct mo_fwm *fwm,
+	struct snapshot_rec *r, uint8_t *key, uint8_t *val)
+{
+	struct fwm_thread_data *data;
+	tkvdb_tr *tr;
+	tkvdb_datum dtk, dtv;
+	TKVDB_RES rc;
+	size_t i;
+
+	data = &fwm->thread_data[r->thread % globl->nthreads];
+
+	if ((r->keysize != data->keysize) || (r->valsize != data->valsize)) {
+		return 0;
+	}
+
+	tr = atomic_load_explicit(&data->tr, memory_order_relaxed);
+
+	dtk.data = key;
+	dtk.size = r->keysize;
+
+	rc = tr->get(tr, &dtk, &dtv);
+	if (rc == TKVDB_OK) {
+		uint64_t *vals = dtv.data;
+		uint64_t *vals_add = (uint64_t *)val;
+
+		for (i=0; i<fwm->fieldset.n_aggr; i++) {
+			vals[i] += vals_add[i];
+		}
+		return 1;
+	}
+
+	dtv.data = val;
+	dtv.size = r->valsize;
+
+	rc = tr->put(tr, &dtk, &dtv);
+	if (rc != TKVDB_OK) {
+		LOG("Can't restore fixed window item, error code %d", rc);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void
+limits_refresh_rec(struct xe_data *globl, struct monit_object *mos,
+	size_t n_mo)
+{
+	size_t i, j, t;
+
+	for (i=0; i<n_mo; i++) {
+		struct monit_object *mo = &mos[i];
+
+		for (j=0; j<mo->nmavg; j++) {
+			struct mo_mavg *mavg = &mo->mavgs[j];
+
+			for (t=0; t<globl->nthreads; t++) {
+				tkvdb_tr *db = atomic_load_explicit(
+					&mavg->thr_data[t].db,
+					memory_order_relaxed);
+
+				mavg_limits_update_db(mavg, db,
+					MAVG_LIM_CURR(mavg),
+					mavg->thr_data[t].val_itemsize);
+			}
+		}
+
+		if (mo->n_mo) {
+			limits_refresh_rec(globl, mo->mos, mo->n_mo);
+		}
+	}
+}
+
+int
+snapshot_load(struct xe_data *globl)
+{
+	FILE *f;
+	struct snapshot_header h;
+	uint64_t time_ns;
+	size_t nrestored = 0, nskipped = 0;
+	uint8_t *buf = NULL;
+	size_t bufsize = 0;
+	long mem_thread = -1;
+
+	if (!globl->snapshot.enabled || (globl->nthreads == 0)) {
+		return 1;
+	}
+
+	f = fopen(globl->snapshot.path, "rb");
+	if (!f) {
+		if (errno != ENOENT) {
+			LOG("Can't open snapshot '%s': %s",
+				globl->snapshot.path, strerror(errno));
+		}
+		return 0;
+	}
+
+	if ((fread(&h, sizeof(h), 1, f) != 1)
+		|| (h.magic != SNAPSHOT_MAGIC)
+		|| (h.version != SNAPSHOT_VERSION)
+		|| (h.mavg_type_size != sizeof(MAVG_TYPE))) {
+
+		LOG("'%s' is not a snapshot or has unsupported version",
+			globl->snapshot.path);
+		fclose(f);
+		return 0;
+	}
+
+	time_ns = realtime_ns();
+
+	for (;;) {
+		struct snapshot_rec r;
+		size_t size;
+		char *mo_name, *name;
+		uint8_t *key, *val;
+		struct monit_object *mo;
+		int ok = 0;
+
+		if (fread(&r, sizeof(r), 1, f) != 1) {
+			break;
+		}
+
+		size = r.mo_name_size + 1 + r.name_size + 1 + r.keysize
+			+ r.valsize;
+		if (size > bufsize) {
+			uint8_t *tmp = realloc(buf, size);
+			if (!tmp) {
+				LOG("realloc() failed");
+				break;
+			}
+			buf = tmp;
+			bufsize = size;
+		}
+
+		mo_name = (char *)buf;
+		name = mo_name + r.mo_name_size + 1;
+		key = (uint8_t *)name + r.name_size + 1;
+		val = key + r.keysize;
+
+		if ((fread(mo_name, 1, r.mo_name_size, f) != r.mo_name_size)
+			|| (fread(name, 1, r.name_size, f) != r.name_size)
+			|| (fread(key, 1, r.keysize, f) != r.keysize)
+			|| (fread(val, 1, r.valsize, f) != r.valsize)) {
+
+			LOG("Snapshot '%s' is truncated",
+				globl->snapshot.path);
+			break;
+		}
+		mo_name[r.mo_name_size] = '\0';
+		name[r.name_size] = '\0';
+
+		mo = mo_find(globl->monit_objects, globl->nmonit_objects,
+			mo_name);
+
+		/* items are added on node of processing thread */
+		if (((r.type == SNAPSHOT_MAVG) || (r.type == SNAPSHOT_FWM))
+			&& ((long)(r.thread % globl->nthreads) != mem_thread)) {
+
+			mem_thread = r.thread % globl->nthreads;
+			monit_objects_thread_mem(globl, mem_thread);
+		}
+
+		if (mo && (r.type == SNAPSHOT_MAVG)) {
+			struct mo_mavg *mavg = mavg_find(mo, name);
+			if (mavg) {
+				ok = restore_mavg(globl, mavg, &r, key, val,
+					time_ns);
+			}
+		} else if (mo && (r.type == SNAPSHOT_MAVG_OVR)) {
+			struct mo_mavg *mavg = mavg_find(mo, name);
+			if (mavg) {
+				ok = restore_mavg_ovr(mavg, &r, key, val);
+			}
+		} else if (mo && (r.type == SNAPSHOT_FWM)) {
+			struct mo_fwm *fwm = fwm_find(mo, name);
+			if (fwm) {
+				ok = restore_fwm(globl, fwm, &r, key, val);
+			}
+		} else if (mo && (r.type == SNAPSHOT_FWM_EXPORT)) {
+			struct mo_fwm *fwm = fwm_find(mo, name);
+			if (fwm && (r.valsize == sizeof(uint64_t))) {
+				uint64_t last_export;
+
+				memcpy(&last_export, val, sizeof(uint64_t));
+				fwm->last_export = last_export;
+				ok = 1;
+			}
+		}
+
+		if (ok) {
+			nrestored++;
+		} else {
+			nskipped++;
+		}
+	}
+
+	free(buf);
+	fclose(f);
+
+	if (mem_thread >= 0) {
+		monit_objects_thread_mem(globl, -1);
+	}
+
+	/* limits files may be changed */
+	limits_refresh_rec(globl, globl->monit_objects,
+		globl->nmonit_objects);
+
+	LOG("Snapshot '%s' restored: %lu items (%lu skipped), %lu seconds old",
+		globl->snapshot.path, nrestored, nskipped,
+		(time_ns - h.time_ns) / 1000000000UL);
+
+	return 1;
+}
+
+void *
+snapshot_thread(void *arg)
+{
+	struct xe_data *globl = (struct xe_data *)arg;
+	time_t last_save;
+
+	last_save = time(NULL);
+
+	for (;;) {
+		time_t t;
+
+		if (atomic_load_explicit(&globl->shutdown,
+			memory_order_relaxed)) {
+
+			LOG("Saving snapshot to '%s'", globl->snapshot.path);
+			snapshot_save(globl);
+			LOG("Snapshot saved, exiting");
+			/* main thread exits after join */
+			break;
+		}
+
+		if (atomic_load_explicit(&globl->stop, memory_order_relaxed)) {
+			/* stop */
+			break;
+		}
+
+		t = time(NULL);
+		if ((globl->snapshot.interval > 0)
+			&& ((last_save + globl->snapshot.interval) <= t)) {
+
+			snapshot_save(globl);
+			last_save = t;
+		}
+
+		usleep(100000);
+	}
+
+	return NULL;
+}
+
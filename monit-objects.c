@@ -21,6 +21,7 @@
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -36,6 +37,7 @@
 #include "monit-objects.h"
 #include "monit-objects-common.h"
 #include "flow-info.h"
+#include "xe-log.h"
 #include "geoip.h"
 
 #define STR_MAX_LEN 512
@@ -101,6 +103,14 @@ monit_object_json_callback(struct aajson *a, aajson_val *value, void *user)
 		return classification_config(a, value, mo);
 	}
 
+	if (STRCMP(a, 1, "family") == 0) {
+		if (mo->is_reloading) {
+			return 1;
+		}
+
+		return family_config(a, value, mo);
+	}
+
 	return 1;
 }
 
@@ -155,6 +165,14 @@ monit_object_info_parse(struct monit_object *mo, const char *moname,
 		goto fail_parse;
 	}
 
+	/* tenant map and implicit key field, after all windows are parsed */
+	if (mo->family && !mo->is_reloading) {
+		if (!family_init(mo, fn)) {
+			LOG("Can't init family '%s'", fn);
+			goto fail_parse;
+		}
+	}
+
 	/* copy path to file */
 	strcpy(mo->mo_path, fn);
 
@@ -329,6 +347,13 @@ monit_objects_load_rec(struct xe_data *globl,
 				continue;
 			}
 			mo = &((*mos)[*n_mo - 1]);
+
+			mo->metrics = calloc_cl(globl->nthreads,
+				sizeof(struct mo_thread_metrics));
+			if (!mo->metrics) {
+				LOG("calloc_cl() failed");
+				return;
+			}
 		}
 
 		for (i=0; i<mo->nfwm; i++) {
@@ -336,7 +361,7 @@ monit_objects_load_rec(struct xe_data *globl,
 			struct mo_fwm *fwm = &mo->fwms[i];
 
 			if (!is_reload) {
-				if (!fwm_fields_init(globl->nthreads, fwm)) {
+				if (!fwm_fields_init(globl, fwm)) {
 					return;
 				}
 			}
@@ -389,7 +414,7 @@ monit_objects_load_rec(struct xe_data *globl,
 
 				strcpy(mavg->notif_pfx, tmp_pfx);
 
-				if (!mavg_fields_init(globl->nthreads, mavg)) {
+				if (!mavg_fields_init(globl, mavg)) {
 					return;
 				}
 			}
@@ -457,6 +482,104 @@ monit_objects_load_rec(struct xe_data *globl,
 	closedir(d);
 }
 
+/* filters are not changed on reload, so index is built once */
+static struct filter_index *
+monit_objects_index_rec(struct xe_data *globl, struct monit_object *mos,
+	size_t n_mo)
+{
+	struct filter_index *idx;
+	struct filter_expr **exprs;
+	size_t i;
+
+	for (i=0; i<n_mo; i++) {
+		mos[i].index = monit_objects_index_rec(globl, mos[i].mos,
+			mos[i].n_mo);
+	}
+
+	if (n_mo < FILTER_INDEX_MIN) {
+		return NULL;
+	}
+
+	exprs = malloc(n_mo * sizeof(struct filter_expr *));
+	if (!exprs) {
+		LOG("malloc() failed");
+		return NULL;
+	}
+	for (i=0; i<n_mo; i++) {
+		exprs[i] = mos[i].expr;
+	}
+
+	idx = filter_index_new(exprs, n_mo, globl->nthreads);
+	free(exprs);
+	if (!idx) {
+		LOG("Can't build index of monitoring objects, all filters "
+			"will be checked");
+		return NULL;
+	}
+
+	if (idx->nindexed == 0) {
+		filter_index_free(idx);
+		return NULL;
+	}
+
+	LOG("%lu of %lu monitoring objects are indexed by addresses",
+		(unsigned long)idx->nindexed, (unsigned long)n_mo);
+
+	return idx;
+}
+
+static int
+monit_objects_preds_rec(struct filter_preds *preds, struct monit_object *mos,
+	size_t n_mo)
+{
+	size_t i;
+
+	for (i=0; i<n_mo; i++) {
+		if (!filter_preds_add(preds, mos[i].expr)) {
+			return 0;
+		}
+		if (!monit_objects_preds_rec(preds, mos[i].mos, mos[i].n_mo)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* filters are not changed on reload, so table is built once too */
+static struct filter_preds *
+monit_objects_preds(struct xe_data *globl)
+{
+	struct filter_preds *preds;
+
+	preds = filter_preds_new();
+	if (!preds) {
+		goto fail_preds;
+	}
+
+	if (!monit_objects_preds_rec(preds, globl->monit_objects,
+		globl->nmonit_objects)) {
+
+		goto fail_add;
+	}
+
+	if (!filter_preds_memo_init(preds, globl->nthreads)) {
+		goto fail_add;
+	}
+
+	LOG("Filters of monitoring objects: %lu basic filters, %lu distinct "
+		"shared", (unsigned long)preds->nleaves,
+		(unsigned long)preds->n);
+
+	return preds;
+
+fail_add:
+	filter_preds_free(preds);
+fail_preds:
+	LOG("Basic filters are not shared, all filters will be evaluated");
+	return NULL;
+}
+
 int
 monit_objects_reload(struct xe_data *globl)
 {
@@ -467,6 +590,73 @@ monit_objects_reload(struct xe_data *globl)
 	return 1;
 }
 
+void
+monit_objects_packet_begin(struct xe_data *globl, size_t thread_id)
+{
+	atomic_size_t *seen = &globl->mo_thread_ack[thread_id].seen;
+	size_t pkt;
+
+	pkt = (atomic_load_explicit(seen, memory_order_relaxed) >> 1) + 1;
+
+	for (;;) {
+		atomic_store(seen, (pkt << 1) | 1);
+		if (!atomic_load(&globl->mo_hold)) {
+			break;
+		}
+
+		/* snapshot is written, wait as idle thread */
+		atomic_store(seen, pkt << 1);
+		while (atomic_load(&globl->mo_hold)) {
+			usleep(MO_THREAD_WAIT_US);
+		}
+	}
+}
+
+void
+monit_objects_packet_end(struct xe_data *globl, size_t thread_id)
+{
+	atomic_size_t *seen = &globl->mo_thread_ack[thread_id].seen;
+
+	atomic_store_explicit(seen,
+		atomic_load_explicit(seen, memory_order_relaxed) & ~(size_t)1,
+		memory_order_release);
+}
+
+/*
+ * Thread that was idle will see switched banks in next packet. Thread that
+ * was busy may use previous bank until the end of packet
+ */
+void
+monit_objects_wait_threads(struct xe_data *globl)
+{
+	size_t i;
+
+	/* banks are switched before states are read */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	for (i=0; i<globl->nthreads; i++) {
+		atomic_size_t *seen = &globl->mo_thread_ack[i].seen;
+		size_t s = atomic_load(seen);
+
+		if (!(s & 1)) {
+			continue;
+		}
+
+		while (atomic_load(seen) == s) {
+			usleep(MO_THREAD_WAIT_US);
+		}
+	}
+}
+
+void
+monit_objects_thread_mem(struct xe_data *globl, long thread_id)
+{
+	/* without pool each capture thread processes its own packets */
+	affinity_mempolicy(&globl->affinity,
+		globl->workers.n ? AFFINITY_WORKER : AFFINITY_CAPTURE,
+		thread_id);
+}
+
 int
 monit_objects_init(struct xe_data *globl)
 {
@@ -481,10 +671,49 @@ monit_objects_init(struct xe_data *globl)
 		&globl->monit_objects,
 		&globl->nmonit_objects, 0);
 
+	globl->mo_index = monit_objects_index_rec(globl, globl->monit_objects,
+		globl->nmonit_objects);
+	globl->mo_preds = monit_objects_preds(globl);
 
 	/* all monitoring objects are parsed, so we can link extended stats */
 	monit_objects_mavg_link_ext_stat(globl);
 
+	/* warm restart, restore data before background threads are started */
+	pthread_mutex_init(&globl->snapshot_mtx, NULL);
+	if (globl->snapshot.enabled) {
+		if (!*globl->snapshot.path) {
+			strcpy(globl->snapshot.path, SNAPSHOT_DEFAULT_PATH);
+		}
+		if (!snapshot_load(globl)) {
+			LOG("Snapshot '%s' is not loaded, starting with empty "
+				"data", globl->snapshot.path);
+		}
+	}
+
+	/* packet handoff between processing and background threads */
+	if (!globl->mo_thread_ack) {
+		globl->mo_thread_ack = calloc_cl(
+			globl->nthreads ? globl->nthreads : 1,
+			sizeof(struct mo_thread_ack));
+		if (!globl->mo_thread_ack) {
+			LOG("calloc_cl() failed");
+			goto fail_mavgthread;
+		}
+	}
+
+	/* workers wake up act thread using eventfd */
+	globl->mavg_act_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (globl->mavg_act_evfd < 0) {
+		LOG("eventfd() failed: %s", strerror(errno));
+		goto fail_mavgthread;
+	}
+
+	if (globl->replay) {
+		/* windows are exported by replay loop, no actions and
+		   periodic dumps */
+		return 1;
+	}
+
 	/* create thread for background processing fixed windows in memory */
 	thread_err = pthread_create(&globl->fwm_tid, NULL,
 		&fwm_bg_thread, globl);
@@ -495,6 +724,7 @@ monit_objects_init(struct xe_data *globl)
 	}
 
 	/* moving averages */
+
 	/* thread with actions on overflow */
 	thread_err = pthread_create(&globl->mavg_act_tid, NULL,
 		&mavg_act_thread, globl);
@@ -531,11 +761,27 @@ monit_objects_init(struct xe_data *globl)
 		goto fail_clsfthread;
 	}
 
+	/* periodic snapshots and snapshot on shutdown */
+	if (globl->snapshot.enabled) {
+		thread_err = pthread_create(&globl->snapshot_tid, NULL,
+			&snapshot_thread, globl);
+
+		if (thread_err) {
+			LOG("Can't start thread: %s", strerror(thread_err));
+			goto fail_snapshotthread;
+		}
+	}
+
 	ret = 1;
 
+fail_snapshotthread:
 fail_clsfthread:
 fail_mavgthread:
 fail_fwmthread:
+	if (!ret) {
+		/* no thread to save snapshot on shutdown */
+		globl->snapshot.enabled = 0;
+	}
 	/* FIXME: free monitoring objects */
 	return ret;
 }
@@ -729,8 +975,8 @@ monit_object_func_mfreq(struct field *fld, struct flow_info *flow,
 	arg2 = get_nf_val((uintptr_t)flow + fld->func_data.mfreq.arg2_off,
 		fld->func_data.mfreq.arg2_size);
 
-	freq1 = fld->func_data.mfreq.freqmap[arg1];
-	freq2 = fld->func_data.mfreq.freqmap[arg2];
+	freq1 = freqmap_get(fld->func_data.mfreq.freqmap, arg1);
+	freq2 = freqmap_get(fld->func_data.mfreq.freqmap, arg2);
 
 	if (freq1 != freq2) {
 		res = htobe64((freq1 > freq2) ? arg1 : arg2);
@@ -739,10 +985,8 @@ monit_object_func_mfreq(struct field *fld, struct flow_info *flow,
 	}
 
 	/* update freqmap */
-	atomic_fetch_add_explicit(&fld->func_data.mfreq.freqmap[arg1], 1,
-		memory_order_relaxed);
-	atomic_fetch_add_explicit(&fld->func_data.mfreq.freqmap[arg2], 1,
-		memory_order_relaxed);
+	freqmap_add(fld->func_data.mfreq.freqmap, arg1);
+	freqmap_add(fld->func_data.mfreq.freqmap, arg2);
 
 	memcpy(key, &res, sizeof(res));
 }
@@ -824,6 +1068,60 @@ monit_object_func_as(struct field *fld, struct flow_info *flow,
 	}
 }
 
+static void
+monit_object_func_pfx(struct field *fld, struct flow_info *flow,
+	uint8_t *key)
+{
+	struct function_pfx *pfx = &fld->func_data.pfx;
+	char *res;
+	int found;
+
+	memset(key, 0, RIB_PFX_SIZE);
+
+	if (pfx->ip_size == sizeof(uint32_t)) {
+		uint32_t addr = *((uint32_t *)
+			((uintptr_t)flow + pfx->ip_off));
+
+		found = rib_lookup4(addr, &res);
+	} else {
+		xe_ip *addr = (xe_ip *)((uintptr_t)flow + pfx->ip_off);
+
+		found = rib_lookup6(addr, &res);
+	}
+
+	if (!found) {
+		key[0] = '?';
+		return;
+	}
+	strcpy((char *)key, res);
+}
+
+static void
+monit_object_func_net(struct field *fld, struct flow_info *flow,
+	uint8_t *key)
+{
+	struct function_net *net = &fld->func_data.net;
+	unsigned int i, mask;
+
+	memcpy(key, (uint8_t *)((uintptr_t)flow + net->ip_off), net->ip_size);
+
+	if (net->ip_size == sizeof(uint32_t)) {
+		mask = net->mask4;
+	} else {
+		mask = net->mask6;
+	}
+
+	/* clear host bits */
+	i = mask / 8;
+	if (mask % 8) {
+		key[i] &= 0xff << (8 - mask % 8);
+		i++;
+	}
+	for (; i<net->ip_size; i++) {
+		key[i] = 0;
+	}
+}
+
 static void
 monit_object_func_tfstr(struct field *fld, struct flow_info *flow,
 	uint8_t *key)
@@ -875,6 +1173,74 @@ monit_object_func_ppstr(struct field *fld, struct flow_info *flow,
 	ports_pair_to_str((char *)key, port1, port2);
 }
 
+int
+monit_object_match(struct monit_object *mo, struct flow_info *flow,
+	struct filter_memo *memo)
+{
+	if (mo->family && !family_tenant_resolve(mo->family, flow)) {
+		/* address is not in tenant map */
+		return 0;
+	}
+
+	return filter_match_memo(mo->expr, flow, memo);
+}
+
+/* rows of block which match object */
+uint64_t
+monit_object_match_batch(struct monit_object *mo, struct filter_block *b,
+	uint64_t rows, struct filter_memo *memo)
+{
+	if (mo->family) {
+		uint64_t r = rows;
+
+		while (r) {
+			int i = __builtin_ctzll(r);
+
+			r &= r - 1;
+			if (!family_tenant_resolve(mo->family, b->flows[i])) {
+				rows &= ~(1ULL << i);
+			}
+		}
+	}
+
+	return filter_match_batch(mo->expr, b, rows, memo);
+}
+
+/* memo of shared basic filters, cleared for each flow */
+struct filter_memo *
+monit_objects_flow_memo(struct xe_data *globl, size_t thread_id)
+{
+	struct filter_memo *memo;
+
+	memo = filter_preds_memo(globl->mo_preds, thread_id);
+	filter_memo_reset(memo);
+
+	return memo;
+}
+
+struct filter_memo *
+monit_objects_batch_memo(struct xe_data *globl, size_t thread_id)
+{
+	struct filter_memo *memo;
+
+	memo = filter_preds_memo(globl->mo_preds, thread_id);
+	filter_memo_reset_batch(memo);
+
+	return memo;
+}
+
+void
+monit_objects_flow_done(struct xe_data *globl, size_t thread_id,
+	struct filter_memo *memo)
+{
+	if (!memo) {
+		return;
+	}
+
+	METRICS_ADD(globl->m_proc[thread_id].filter_leaves, memo->nleaves);
+	METRICS_ADD(globl->m_proc[thread_id].filter_evals, memo->nevals);
+}
+
 void
 monit_object_key_add_fld(struct field *fld, uint8_t *key,
 	struct flow_info *flow)
@@ -902,6 +1268,12 @@ FOR_LIST_OF_GEOIP_FIELDS
 			case ASD:
 				monit_object_func_as(fld, flow, key);
 				break;
+			case PFX:
+				monit_object_func_pfx(fld, flow, key);
+				break;
+			case NET:
+				monit_object_func_net(fld, flow, key);
+				break;
 			case TFSTR:
 				monit_object_func_tfstr(fld, flow, key);
 				break;
@@ -920,23 +1292,68 @@ FOR_LIST_OF_GEOIP_FIELDS
 	}
 }
 
+void
+monit_object_fwm_add(struct mo_fwm *fwm, struct fwm_thread_data *fdata)
+{
+	size_t j;
+	tkvdb_tr *tr;
+	TKVDB_RES rc;
+	tkvdb_datum dtkey, dtval;
+
+	/* get current database bank */
+	tr = atomic_load_explicit(&fdata->tr, memory_order_relaxed);
+
+	dtkey.data = fdata->key;
+	dtkey.size = fdata->keysize;
+
+	/* search for key */
+	rc = tr->get(tr, &dtkey, &dtval);
+	if (rc == TKVDB_OK) {
+		/* update existing values */
+		uint64_t *vals = dtval.data;
+		for (j=0; j<fwm->fieldset.n_aggr; j++) {
+			vals[j] += fdata->val[j];
+		}
+	} else if ((rc == TKVDB_EMPTY) || (rc == TKVDB_NOT_FOUND)) {
+		/* try to add new key-value pair */
+		dtval.data = fdata->val;
+		dtval.size = fdata->valsize;
+
+		rc = tr->put(tr, &dtkey, &dtval);
+		if (rc == TKVDB_OK) {
+		} else if (rc == TKVDB_ENOMEM) {
+			/* not enough memory */
+		} else {
+			LOG_RL("Can't append key, error code %d", rc);
+		}
+	} else {
+		LOG_RL("Can't find key, error code %d", rc);
+	}
+}
+
 int
 monit_object_process_nf(struct xe_data *globl, struct monit_object *mo,
 	size_t thread_id, uint64_t time_ns, struct flow_info *flow)
 {
 	size_t i, j, f;
+	struct metrics_prof *prof = &globl->m_prof[thread_id];
+	struct mo_thread_metrics *m = &mo->metrics[thread_id];
+	uint64_t t0;
+	int rc_mavg;
 
-	classification_process_nf(mo, thread_id, flow);
+	METRICS_ADD(m->flows, 1);
+
+	t0 = prof_start(prof);
+	classification_process_nf(mo, thread_id, flow, prof);
+	prof_end(prof, PROF_CLSF, t0);
 
 	/* fixed windows */
+	t0 = prof_start(prof);
 	for (i=0; i<mo->nfwm; i++) {
-		tkvdb_tr *tr;
-		TKVDB_RES rc;
-		tkvdb_datum dtkey, dtval;
-
 		struct mo_fwm *fwm;
 		struct fwm_thread_data *fdata;
 		uint8_t *key;
+		uint64_t t, *vals;
 
 		fwm = &mo->fwms[i];
 
@@ -970,66 +1387,52 @@ monit_object_process_nf(struct xe_data *globl, struct monit_object *mo,
 
 		/* fwm */
 		/* make key */
+		t = prof_start(prof);
 		for (f=0; f<fwm->fieldset.n_naggr; f++) {
 			struct field *fld = &fwm->fieldset.naggr[f];
 
 			monit_object_key_add_fld(fld, key, flow);
 			key += fld->size;
 		}
+		t = mo_cost_lap(m, MO_COST_KEY, t);
 
-		/* get current database bank */
-		tr = atomic_load_explicit(&fdata->tr, memory_order_relaxed);
-
-		dtkey.data = fdata->key;
-		dtkey.size = fdata->keysize;
+		/* aggregable values of flow */
+		for (j=0; j<fwm->fieldset.n_aggr; j++) {
+			struct field *fld = &fwm->fieldset.aggr[j];
+			uint64_t val = monit_object_nf_val(flow, fld);
 
-		/* search for key */
-		rc = tr->get(tr, &dtkey, &dtval);
-		if (rc == TKVDB_OK) {
-			/* update existing values */
-			uint64_t *vals = dtval.data;
-			for (j=0; j<fwm->fieldset.n_aggr; j++) {
-				struct field *fld = &fwm->fieldset.aggr[j];
-				uint64_t val = monit_object_nf_val(flow, fld);
+			fdata->val[j] = val * fld->scale * flow->sampling_rate;
+		}
 
-				vals[j] += val * fld->scale
-					* flow->sampling_rate;
-			}
-		} else if ((rc == TKVDB_EMPTY) || (rc == TKVDB_NOT_FOUND)) {
-			/* try to add new key-value pair */
+		/* sum records of packet with the same key */
+		vals = NULL;
+		if (globl->combine && !fdata->comb) {
+			fdata->comb = mo_combiner_new(globl, mo, fwm, 0,
+				fdata->keysize, fdata->valsize);
+		}
+		if (fdata->comb) {
+			vals = mo_combiner_slot(fdata->comb, fdata->key,
+				time_ns);
+		}
 
-			/* init new aggregable values */
+		if (vals) {
 			for (j=0; j<fwm->fieldset.n_aggr; j++) {
-				struct field *fld = &fwm->fieldset.aggr[j];
-				uint64_t val = monit_object_nf_val(flow, fld);
-
-				fdata->val[j] = val * fld->scale
-					* flow->sampling_rate;
-			}
-
-			dtval.data = fdata->val;
-			dtval.size = fdata->valsize;
-
-			rc = tr->put(tr, &dtkey, &dtval);
-			if (rc == TKVDB_OK) {
-			} else if (rc == TKVDB_ENOMEM) {
-				/* not enough memory */
-			} else {
-				LOG("Can't append key, error code %d", rc);
+				vals[j] += fdata->val[j];
 			}
 		} else {
-			LOG("Can't find key, error code %d", rc);
+			monit_object_fwm_add(fwm, fdata);
 		}
+		mo_cost_lap(m, MO_COST_DB, t);
 	}
+	prof_end(prof, PROF_FWM, t0);
 
 	/* moving average */
-	if (!monit_object_mavg_process_nf(globl, mo, thread_id, time_ns,
-		flow)) {
-
-		return 0;
-	}
+	t0 = prof_start(prof);
+	rc_mavg = monit_object_mavg_process_nf(globl, mo, thread_id, time_ns,
+		flow);
+	prof_end(prof, PROF_MAVG, t0);
 
-	return 1;
+	return rc_mavg;
 }
 
 static void
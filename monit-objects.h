@@ -4,6 +4,11 @@
 #include "xe-debug.h"
 #include "aajson/aajson.h"
 #include "filter.h"
+#include "filter-index.h"
+#include "filter-preds.h"
+#include "status-table.h"
+#include "monit-objects-conf.h"
+#include "metrics.h"
 
 #include "tkvdb.h"
 
@@ -15,6 +20,11 @@
 
 #define MAVG_DEFAULT_DB_SIZE (1024*1024*256)
 
+/* act thread: timer for state transitions and minimal interval between
+ * passes */
+#define MAVG_ACT_TIMER_MS 100
+#define MAVG_ACT_MIN_INTERVAL_US 5000
+
 #define MAVG_SCRIPT_STR_SIZE (10*1024)
 
 /*#define MAVG_TYPE __float128*/
@@ -57,10 +67,52 @@ struct mo_fieldset
 	struct field *aggr;
 };
 
+/* per-thread slots are cache line aligned to avoid false sharing */
+#define MO_COMBINE_MAX 4096
+
+/*
+ * Per-thread combiner of window: records of packet with equal keys are
+ * summed in small hash table, then written to database once
+ */
+struct mo_combiner
+{
+	/* list of combiners with records, flushed after packet */
+	struct mo_combiner *next;
+	int is_dirty;
+
+	struct monit_object *mo;
+	void *window; /* struct mo_fwm or struct mo_mavg */
+	int is_mavg;
+
+	size_t nslots, maxkeys, nkeys, nrecords;
+	size_t keysize, valsize;
+	uint64_t time_ns;
+
+	/* slots of keys in order of appearance */
+	uint32_t *order;
+	uint8_t *used;
+	uint8_t *keys;
+	uint8_t *vals;
+};
+
+/* poll interval while background thread waits for processing threads */
+#define MO_THREAD_WAIT_US 10
+
+/*
+ * Processing thread state: (packet number << 1) | 1 while thread processes
+ * packet, (packet number << 1) when it is idle. Background thread switches
+ * bank and waits in monit_objects_wait_threads() until each thread is idle or
+ * starts next packet, after that nobody writes to previous bank
+ */
+struct mo_thread_ack
+{
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t seen;
+};
+
 struct fwm_thread_data
 {
 	/* using two banks */
-	tkvdb_tr *trs[2];
+	_Alignas(CACHE_LINE_SIZE) tkvdb_tr *trs[2];
 
 	/* current bank */
 	tkvdb_tr *_Atomic tr;
@@ -69,6 +121,8 @@ struct fwm_thread_data
 	uint64_t *val;
 
 	size_t keysize, valsize;
+
+	struct mo_combiner *comb;
 };
 
 struct mo_fwm
@@ -83,6 +137,8 @@ struct mo_fwm
 	int time;
 
 	int limit;
+	/* family: size of tenant at start of sorted key, limit is per tenant */
+	size_t group_size;
 
 	int dont_create_index;
 
@@ -92,6 +148,14 @@ struct mo_fwm
 
 	/* each thread has it's own data */
 	struct fwm_thread_data *thread_data;
+
+	/* metrics, updated by background thread on export */
+	_Atomic uint64_t m_keys;
+	_Atomic uint64_t m_mem;
+	_Atomic uint64_t m_exports;
+	_Atomic uint64_t m_export_ns;
+	_Atomic uint64_t m_last_export_ns;
+	_Atomic uint64_t m_export_bytes;
 };
 
 
@@ -99,7 +163,7 @@ struct mo_fwm
 struct classification_thread_data
 {
 	/* using two banks */
-	tkvdb_tr *trs[2];
+	_Alignas(CACHE_LINE_SIZE) tkvdb_tr *trs[2];
 
 	/* current bank index */
 	atomic_size_t tr_idx;
@@ -144,7 +208,7 @@ struct mavg_val
 struct mavg_thread_data
 {
 	/* atomic pointer to database */
-	tkvdb_tr *_Atomic db;
+	_Alignas(CACHE_LINE_SIZE) tkvdb_tr *_Atomic db;
 	int db_is_full;
 
 	uint8_t *key;
@@ -154,6 +218,11 @@ struct mavg_thread_data
 
 	/* per-thread database of overlimited items, 2 banks */
 	tkvdb_tr *ovr_db[2];
+
+	struct mo_combiner *comb;
+
+	/* number of items in db, for metrics */
+	_Atomic uint64_t nkeys;
 };
 
 struct mavg_limit_ext_stat
@@ -184,6 +253,8 @@ struct mavg_limit
 };
 
 
+struct mavg_lim_lpm;
+
 struct mavg_limits
 {
 	struct mavg_limit *overlimit;
@@ -191,6 +262,9 @@ struct mavg_limits
 
 	struct mavg_limit *underlimit;
 	size_t nunderlimit;
+
+	/* limits files with prefixes, used if window key has address */
+	struct mavg_lim_lpm *lpm;
 };
 
 enum MAVG_LIM_STATE
@@ -208,6 +282,8 @@ struct mavg_lim_data
 	MAVG_TYPE val;
 	MAVG_TYPE limit;
 	MAVG_TYPE back2norm_time_ns;
+	/* slot in status table or -1 */
+	ssize_t status_slot;
 };
 
 struct mo_mavg
@@ -231,6 +307,9 @@ struct mo_mavg
 	/* per-mavg database of overlimited items */
 	tkvdb_tr *ovrerlm_db;
 
+	/* set by worker threads when they put items to per-thread ovr_db */
+	atomic_int ovr_pending[2];
+
 	/* underlimited items */
 	tkvdb_tr *underlm_db;
 
@@ -241,6 +320,70 @@ struct mo_mavg
 	struct mavg_thread_data *thr_data;
 };
 
+/* per-thread counters of monitoring object */
+/* sampled cost of monitoring object (metrics "profile-sample") */
+enum MO_COST
+{
+	MO_COST_FILTER,
+	MO_COST_KEY,
+	MO_COST_DB,
+
+	MO_COST_MAX
+};
+
+struct mo_thread_metrics
+{
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t flows;
+	_Atomic uint64_t cost_ns[MO_COST_MAX];
+};
+
+static inline void
+mo_cost_add(struct mo_thread_metrics *m, enum MO_COST c, uint64_t ns)
+{
+	if (ns) {
+		METRICS_ADD(m->cost_ns[c], ns);
+	}
+}
+
+/* t0 from prof_start(), 0 if packet is not sampled */
+static inline uint64_t
+mo_cost_lap(struct mo_thread_metrics *m, enum MO_COST c, uint64_t t0)
+{
+	uint64_t now;
+
+	if (!t0) {
+		return 0;
+	}
+
+	now = prof_now();
+	METRICS_ADD(m->cost_ns[c], now - t0);
+
+	return now;
+}
+
+/* family of objects, tenant is found by address in map file */
+struct mo_family_node
+{
+	uint32_t next[2];
+	int is_leaf;
+	uint32_t tenant;
+};
+
+struct mo_family_trie
+{
+	size_t n;
+	struct mo_family_node *nodes;
+};
+
+struct mo_family
+{
+	char map[PATH_MAX];
+	/* FILTER_BASIC_DIR_SRC or FILTER_BASIC_DIR_DST */
+	int direction;
+
+	struct mo_family_trie v4, v6;
+};
+
 struct monit_object
 {
 	char dir[PATH_MAX];
@@ -255,6 +398,9 @@ struct monit_object
 
 	struct filter_expr *expr;
 
+	/* family of objects, NULL for regular object */
+	struct mo_family *family;
+
 	struct xe_debug debug;
 
 	/* fixed windows in memory */
@@ -276,6 +422,15 @@ struct monit_object
 	/* hierarchical objects */
 	size_t n_mo;
 	struct monit_object *mos;
+	/* index of child objects by addresses, may be NULL */
+	struct filter_index *index;
+
+	/* nthreads slots */
+	struct mo_thread_metrics *metrics;
+
+	/* previous values for cost report, used by metrics thread */
+	uint64_t report_cost_ns[MO_COST_MAX];
+	uint64_t report_flows;
 };
 
 
@@ -284,7 +439,24 @@ int monit_objects_free(struct xe_data *data);
 
 int monit_objects_reload(struct xe_data *data);
 
-int monit_object_match(struct monit_object *mo, struct flow_info *fi);
+/* called by processing thread before and after each packet */
+void monit_objects_packet_begin(struct xe_data *globl, size_t thread_id);
+void monit_objects_packet_end(struct xe_data *globl, size_t thread_id);
+/* wait until processing threads don't use switched banks */
+void monit_objects_wait_threads(struct xe_data *globl);
+/* memory of calling thread goes to node of processing thread, -1 - default */
+void monit_objects_thread_mem(struct xe_data *globl, long thread_id);
+
+int monit_object_match(struct monit_object *mo, struct flow_info *fi,
+	struct filter_memo *memo);
+uint64_t monit_object_match_batch(struct monit_object *mo,
+	struct filter_block *b, uint64_t rows, struct filter_memo *memo);
+struct filter_memo *monit_objects_flow_memo(struct xe_data *globl,
+	size_t thread_id);
+struct filter_memo *monit_objects_batch_memo(struct xe_data *globl,
+	size_t thread_id);
+void monit_objects_flow_done(struct xe_data *globl, size_t thread_id,
+	struct filter_memo *memo);
 int monit_object_process_nf(struct xe_data *globl, struct monit_object *mo,
 	size_t thread_id, uint64_t time_ns, struct flow_info *flow);
 
@@ -296,22 +468,53 @@ void monit_object_field_print_str(struct field *fld, char *str, uint8_t *data,
 void monit_object_key_add_fld(struct field *fld, uint8_t *key,
 	struct flow_info *flow);
 
+/* add values in fwm->thread_data[thread_id].val to key */
+void monit_object_fwm_add(struct mo_fwm *fwm, struct fwm_thread_data *fdata);
+
+/* combiner of records of packet */
+struct mo_combiner *mo_combiner_new(struct xe_data *globl,
+	struct monit_object *mo, void *window, int is_mavg, size_t keysize,
+	size_t valsize);
+void *mo_combiner_slot(struct mo_combiner *c, uint8_t *key,
+	uint64_t time_ns);
+void monit_objects_combine_flush(struct xe_data *globl, size_t thread_id);
+
 /* fixed windows in memory */
 int fwm_config(struct aajson *a, aajson_val *value, struct monit_object *mo);
-int fwm_fields_init(size_t nthreads, struct mo_fwm *fwm);
+int fwm_fields_init(struct xe_data *globl, struct mo_fwm *fwm);
 void *fwm_bg_thread(void *);
+/* banks are switched by fwm and snapshot threads under snapshot_mtx */
+tkvdb_tr *fwm_inactive_tr(struct fwm_thread_data *tdata);
+void fwm_swap_tr(struct fwm_thread_data *tdata);
+/* replay: export windows by virtual time from processing thread */
+void fwm_replay_export(struct xe_data *globl, time_t t, int force);
 
 /* moving averages */
 int mavg_config(struct aajson *a, aajson_val *value, struct monit_object *mo);
-int mavg_fields_init(size_t nthreads, struct mo_mavg *mavg);
+int mavg_fields_init(struct xe_data *globl, struct mo_mavg *mavg);
 int mavg_limits_init(struct mo_mavg *mavg, int is_reloading);
 int mavg_limits_file_load(struct mo_mavg *mavg, struct mavg_limit *l);
+int mavg_lim_lpm_enabled(struct mo_mavg *mavg);
+struct mavg_lim_lpm *mavg_lim_lpm_load(struct mo_mavg *mavg,
+	struct mavg_limits *lim);
+void mavg_lim_lpm_free(struct mavg_lim_lpm *lpm);
+MAVG_TYPE *mavg_lim_lpm_lookup(struct mavg_lim_lpm *lpm, uint8_t *key);
 void monit_objects_mavg_link_ext_stat(struct xe_data *globl);
 int monit_object_mavg_process_nf(struct xe_data *globl,
 	struct monit_object *mo, size_t thread_id,
 	uint64_t time_ns, struct flow_info *flow);
+/* add values to key in data->key */
+void monit_object_mavg_add(struct xe_data *globl, struct mo_mavg *mavg,
+	size_t thread_id, uint64_t time_ns, MAVG_TYPE *vals);
 void mavg_limits_update(struct xe_data *globl, struct monit_object *mo);
 void mavg_limits_free(struct mo_mavg *mavg);
+void mavg_limits_update_db(struct mo_mavg *mavg, tkvdb_tr *db,
+	struct mavg_limits *lim, size_t val_itemsize);
+
+/* family of objects */
+int family_config(struct aajson *a, aajson_val *value, struct monit_object *mo);
+int family_init(struct monit_object *mo, const char *mo_path);
+int family_tenant_resolve(struct mo_family *fm, struct flow_info *flow);
 
 /* classification */
 void *classification_bg_thread(void *);
@@ -320,14 +523,45 @@ int classification_config(struct aajson *a, aajson_val *value,
 int classification_fields_init(size_t nthreads,
 	struct mo_classification *clsf);
 int classification_process_nf(struct monit_object *mo, size_t thread_id,
-	struct flow_info *flow);
+	struct flow_info *flow, struct metrics_prof *prof);
 
 void *mavg_dump_thread(void *);
+/* print values of all moving averages at time_ns */
+void mavg_dump_results(struct xe_data *globl, FILE *out, uint64_t time_ns);
 void *mavg_act_thread(void *);
 void *mavg_check_underlimit_thread(void *);
 
 int act(struct mo_mavg *mw, tkvdb_tr *db, MAVG_TYPE wnd_size_ns, char *mo_name,
 	int is_overlim);
+void mavg_ext_stats_toggle(struct mo_mavg *mavg, int on, int is_overlim);
+
+/* notification dispatcher */
+int mavg_notify_config(struct aajson *a, aajson_val *value,
+	struct mavg_notify_conf *c);
+int mavg_notify_init(struct xe_data *globl);
+int mavg_notify_enabled(void);
+int mavg_notify_send(char *script, const char *event, char **args,
+	size_t nargs);
+void mavg_notify_stats(uint64_t *queued, uint64_t *coalesced,
+	uint64_t *dropped, uint64_t *sent);
+void *mavg_notify_thread(void *);
+
+/* status table */
+int status_table_config(struct aajson *a, aajson_val *value,
+	struct status_table_conf *c);
+int status_table_init(struct xe_data *globl);
+int status_table_enabled(void);
+int status_table_keep_files(void);
+ssize_t status_table_update(ssize_t slot, int is_overlim, const char *name,
+	const char *text, double val, double limit);
+void status_table_remove(ssize_t slot);
+
+/* warm restart */
+int snapshot_config(struct aajson *a, aajson_val *value,
+	struct snapshot_conf *c);
+int snapshot_save(struct xe_data *globl);
+int snapshot_load(struct xe_data *globl);
+void *snapshot_thread(void *);
 
 #endif
 
@@ -36,9 +36,11 @@
 #include "netflow-templates.h"
 #include "xenoeye.h"
 #include "filter.h"
+#include "filter-preds.h"
 #include "flow-debug.h"
 #include "devices.h"
 #include "flow-info.h"
+#include "xe-log.h"
 
 
 typedef void (*flow_parse_func_t)(struct flow_info *, int, uint8_t *);
@@ -81,7 +83,7 @@ static void                                                                   \
 flow_parse_##FLDID(struct flow_info *flow, int flength, uint8_t *fptr)        \
 {                                                                             \
 	if ((flength < SIZEMIN) || (flength > SIZEMAX)) {                     \
-		LOG("Incorrect '" #NAME                                       \
+		LOG_RL("Incorrect '" #NAME                                    \
 			"' field size (got %d, expected from %d to %d)",      \
 			flength, SIZEMIN, SIZEMAX);                           \
 	} else {                                                              \
@@ -160,7 +162,7 @@ parse_netflow_v9_template(struct xe_data *data, struct flow_packet_info *fpi,
 	template_size = 4 + field_count * 4;
 	if (template_size > length) {
 		/* packet too short */
-		LOG("Template is too short (size: %d, packet length %d)",
+		LOG_RL("Template is too short (size: %d, packet length %d)",
 			template_size, length);
 		return 0;
 	}
@@ -173,12 +175,12 @@ parse_netflow_v9_template(struct xe_data *data, struct flow_packet_info *fpi,
 	*ptr += template_size;
 
 	if (!tmplitem) {
-		LOG("Unknown template, id %d", ntohs(template_id));
+		LOG_RL("Unknown template, id %d", ntohs(template_id));
 		return netflow_template_add(&tkey, ptmpl, template_size);
 	}
 
 	if (memcmp(ptmpl, tmplitem, template_size) != 0) {
-		LOG("Template modified");
+		LOG_RL("Template modified");
 		return netflow_template_add(&tkey, ptmpl, template_size);
 	}
 
@@ -210,17 +212,186 @@ print_netflow_v9_flowset(struct nf_parse_data *pd, char *debug_flow_str)
 }
 
 
+/*
+ * Block of flow records of one flowset (NetFlow v9, IPFIX) or packet
+ * (NetFlow v5). Records are decoded into rows, fields referenced by shared
+ * basic filters are copied to columns of block, then filters of objects are
+ * evaluated for all rows at once (filter_match_batch()) and matched rows are
+ * processed by object, object by object
+ */
+struct nf_batch
+{
+	int version;
+	struct filter_block *blk;
+	/* for debug print of records */
+	struct nf_parse_data pd[FILTER_BATCH_MAX];
+	struct flow_info flows[FILTER_BATCH_MAX];
+};
+
+static _Thread_local struct nf_batch *batch = NULL;
+
+static void print_ipfix_flowset(struct nf_parse_data *pd,
+	char *debug_flow_str);
+static void print_netflow_v5_flowset(struct flow_info *flow,
+	char *debug_flow_str);
+
+/* next row of block or flow_buf if records are processed one by one */
+static struct flow_info *
+nf_batch_row(struct xe_data *globl, struct flow_info *flow_buf)
+{
+	if (globl->flow_batch < 2) {
+		return flow_buf;
+	}
+
+	if (!batch) {
+		struct nf_batch *b;
+
+		b = malloc(sizeof(struct nf_batch));
+		if (!b) {
+			LOG_RL("Not enough memory for block of flows");
+			return flow_buf;
+		}
+		b->blk = filter_block_new(globl->mo_preds
+			? globl->mo_preds->columns : NULL);
+		if (!b->blk) {
+			free(b);
+			return flow_buf;
+		}
+		batch = b;
+	}
+
+	return &batch->flows[batch->blk->n];
+}
+
+static void
+nf_batch_print(struct nf_batch *b, size_t r, char *debug_flow_str)
+{
+	switch (b->version) {
+		case 5:
+			print_netflow_v5_flowset(b->blk->flows[r],
+				debug_flow_str);
+			break;
+		case 9:
+			print_netflow_v9_flowset(&b->pd[r], debug_flow_str);
+			break;
+		default:
+			print_ipfix_flowset(&b->pd[r], debug_flow_str);
+			break;
+	}
+}
+
+static void
+process_mo_batch_rec(struct xe_data *globl, struct flow_packet_info *fpi,
+	size_t thread_id, struct nf_batch *b, uint64_t rows,
+	struct monit_object *mos, size_t n_mo,
+	struct filter_index *idx, struct filter_memo *memo)
+{
+	size_t i;
+	struct metrics_prof *prof = &globl->m_prof[thread_id];
+
+	for (i=filter_index_first_batch(idx, thread_id, b->blk, rows);
+		i<n_mo; i=filter_index_next(idx, thread_id, i)) {
+
+		struct monit_object *mo = &mos[i];
+		uint64_t t0, match, m;
+
+		match = filter_index_rows(idx, thread_id, i, rows);
+		if (!match) {
+			continue;
+		}
+
+		/* selection mask of object */
+		t0 = prof_start(prof);
+		match = monit_object_match_batch(mo, b->blk, match, memo);
+		mo_cost_add(&mo->metrics[thread_id], MO_COST_FILTER,
+			prof_end(prof, PROF_FILTER, t0));
+		if (!match) {
+			continue;
+		}
+
+		for (m=match; m; m&=m-1) {
+			int r = __builtin_ctzll(m);
+
+			monit_object_process_nf(globl, mo, thread_id,
+				fpi->time_ns, b->blk->flows[r]);
+
+			if (mo->debug.print_flows) {
+				char debug_flow_str[2048];
+
+				nf_batch_print(b, r, debug_flow_str);
+				flow_print_str(&mo->debug, b->blk->flows[r],
+					debug_flow_str, 0);
+			}
+		}
+
+		/* child objects, only for matched rows */
+		if (mo->n_mo) {
+			process_mo_batch_rec(globl, fpi, thread_id, b, match,
+				mo->mos, mo->n_mo, mo->index, memo);
+		}
+	}
+}
+
+static void
+nf_batch_flush(struct xe_data *globl, size_t thread_id,
+	struct flow_packet_info *fpi)
+{
+	struct filter_memo *memo;
+
+	if (!batch || (batch->blk->n == 0)) {
+		return;
+	}
+
+	memo = monit_objects_batch_memo(globl, thread_id);
+	process_mo_batch_rec(globl, fpi, thread_id, batch,
+		filter_block_rows(batch->blk),
+		globl->monit_objects, globl->nmonit_objects,
+		globl->mo_index, memo);
+	monit_objects_flow_done(globl, thread_id, memo);
+
+	filter_block_reset(batch->blk);
+}
+
+/* row returned by nf_batch_row() is ready */
+static void
+nf_batch_add(struct xe_data *globl, size_t thread_id,
+	struct flow_packet_info *fpi, struct nf_parse_data *pd, int version)
+{
+	struct filter_block *blk = batch->blk;
+
+	if (pd) {
+		batch->pd[blk->n] = *pd;
+	}
+	batch->version = version;
+	filter_block_add(blk, &batch->flows[blk->n]);
+
+	if ((int)blk->n >= globl->flow_batch) {
+		nf_batch_flush(globl, thread_id, fpi);
+	}
+}
+
 static void
 process_mo_nf9_rec(struct xe_data *globl, struct flow_packet_info *fpi,
 	size_t thread_id, struct flow_info *flow,
 	struct nf_parse_data *pd,
-	struct monit_object *mos, size_t n_mo)
+	struct monit_object *mos, size_t n_mo,
+	struct filter_index *idx, struct filter_memo *memo)
 {
 	size_t i;
-	for (i=0; i<n_mo; i++) {
-		struct monit_object *mo = &mos[i];
+	struct metrics_prof *prof = &globl->m_prof[thread_id];
 
-		if (!filter_match(mo->expr, flow)) {
+	for (i=filter_index_first(idx, thread_id, flow); i<n_mo;
+		i=filter_index_next(idx, thread_id, i)) {
+
+		struct monit_object *mo = &mos[i];
+		uint64_t t0;
+		int match;
+
+		t0 = prof_start(prof);
+		match = monit_object_match(mo, flow, memo);
+		mo_cost_add(&mo->metrics[thread_id], MO_COST_FILTER,
+			prof_end(prof, PROF_FILTER, t0));
+		if (!match) {
 			continue;
 		}
 
@@ -238,7 +409,7 @@ process_mo_nf9_rec(struct xe_data *globl, struct flow_packet_info *fpi,
 		/* child objects */
 		if (mo->n_mo) {
 			process_mo_nf9_rec(globl, fpi, thread_id, flow, pd,
-				mo->mos, mo->n_mo);
+				mo->mos, mo->n_mo, mo->index, memo);
 		}
 	}
 }
@@ -263,6 +434,7 @@ parse_netflow_v9_flowset(struct xe_data *globl, size_t thread_id,
 
 	if (!pd.tmpl_9) {
 /*		LOG("Unknown flowset id %d", ntohs(flowset_id));*/
+		METRICS_ADD(globl->m_proc[thread_id].template_misses, 1);
 		return 0;
 	}
 
@@ -270,9 +442,11 @@ parse_netflow_v9_flowset(struct xe_data *globl, size_t thread_id,
 
 	fptr = (*ptr);
 	for (cnt=0; cnt<count; cnt++) {
-		struct flow_info flow;
+		struct flow_info flow_buf, *flow;
+		struct filter_memo *memo;
 
-		memset(&flow, 0, sizeof(struct flow_info));
+		flow = nf_batch_row(globl, &flow_buf);
+		memset(flow, 0, sizeof(struct flow_info));
 		pd.tmpfptr = fptr;
 
 		for (i=0; i<pd.template_field_count; i++) {
@@ -285,13 +459,13 @@ parse_netflow_v9_flowset(struct xe_data *globl, size_t thread_id,
 				break;
 			}
 
-			flow_parse_functions[ftype](&flow, flength, fptr);
+			flow_parse_functions[ftype](flow, flength, fptr);
 
 			fptr += flength;
 		}
 		/* virtual fields */
-		virtual_fields_init(&flow, fpi);
-		if (!device_rules_check(&flow, fpi)) {
+		virtual_fields_init(flow, fpi);
+		if (!device_rules_check(flow, fpi)) {
 			continue;
 		}
 
@@ -301,17 +475,32 @@ parse_netflow_v9_flowset(struct xe_data *globl, size_t thread_id,
 
 			print_netflow_v9_flowset(&pd, debug_flow_str);
 
-			flow_print_str(&globl->debug, &flow, debug_flow_str, 0);
+			flow_print_str(&globl->debug, flow, debug_flow_str, 0);
+		}
+
+		if (globl->tap.enabled) {
+			flow_tap_write(thread_id, flow, fpi->time_ns);
+		}
+
+		if (flow != &flow_buf) {
+			nf_batch_add(globl, thread_id, fpi, &pd, 9);
+		} else {
+			memo = monit_objects_flow_memo(globl, thread_id);
+			process_mo_nf9_rec(globl, fpi, thread_id, flow, &pd,
+				globl->monit_objects, globl->nmonit_objects,
+				globl->mo_index, memo);
+			monit_objects_flow_done(globl, thread_id, memo);
 		}
 
-		process_mo_nf9_rec(globl, fpi, thread_id, &flow, &pd,
-				globl->monit_objects, globl->nmonit_objects);
+		METRICS_ADD(globl->m_proc[thread_id].records[METRICS_NETFLOW_V9],
+			1);
 
 #ifdef FLOWS_CNT
 		atomic_fetch_add_explicit(&globl->nflows, 1,
 			memory_order_relaxed);
 #endif
 	}
+	nf_batch_flush(globl, thread_id, fpi);
 	(*ptr) += length;
 	return 1;
 }
@@ -351,7 +540,8 @@ parse_netflow_v9(struct xe_data *data, size_t thread_id,
 				return 0;
 			}
 		} else if (flowset_id_host == 1) {
-			LOG("options template");
+			LOG_RL("options template");
+			METRICS_ADD(data->m_proc[thread_id].unknown_flowsets, 1);
 			break;
 		} else {
 			if (!parse_netflow_v9_flowset(data, thread_id, fpi,
@@ -408,7 +598,7 @@ ipfix_template_convert(struct ipfix_stored_template *tmpl, uint8_t *ptr,
 			int l = ptr - pstart
 				+ sizeof(struct ipfix_inf_element_enterprise);
 			if (l > length) {
-				LOG("IPFIX template: packet too short");
+				LOG_RL("IPFIX template: packet too short");
 				return 0;
 			}
 			tmpl->elements[i].id = htons(ntohs(ent->id) & 0x7fff);
@@ -420,7 +610,7 @@ ipfix_template_convert(struct ipfix_stored_template *tmpl, uint8_t *ptr,
 			int l = ptr - pstart
 				+ sizeof(struct ipfix_inf_element_iana);
 			if (l > length) {
-				LOG("IPFIX template: packet too short");
+				LOG_RL("IPFIX template: packet too short");
 				return 0;
 			}
 			tmpl->elements[i].id = ent->id;
@@ -444,7 +634,7 @@ parse_ipfix_template(struct xe_data *data, struct flow_packet_info *fpi,
 	size_t template_size;
 
 	if (sizeof(struct ipfix_template_header) > (size_t)length) {
-		LOG("IPFIX template: packet too short");
+		LOG_RL("IPFIX template: packet too short");
 		return 0;
 	}
 
@@ -454,7 +644,7 @@ parse_ipfix_template(struct xe_data *data, struct flow_packet_info *fpi,
 
 	/* search for template in database */
 	if (field_count < 1) {
-		LOG("ipfix: incorrect field count %u", field_count);
+		LOG_RL("ipfix: incorrect field count %u", field_count);
 		return 0;
 	}
 
@@ -477,7 +667,7 @@ parse_ipfix_template(struct xe_data *data, struct flow_packet_info *fpi,
 	}
 
 	if (memcmp(tmpl_db, tmpl, template_size) != 0) {
-		LOG("Template ipfix modified");
+		LOG_RL("Template ipfix modified");
 		return netflow_template_add(&tkey, tmpl, template_size);
 	}
 
@@ -515,13 +705,24 @@ static void
 process_mo_ipfix_rec(struct xe_data *globl, struct flow_packet_info *fpi,
 	size_t thread_id, struct flow_info *flow,
 	struct nf_parse_data *pd,
-	struct monit_object *mos, size_t n_mo)
+	struct monit_object *mos, size_t n_mo,
+	struct filter_index *idx, struct filter_memo *memo)
 {
 	size_t i;
-	for (i=0; i<n_mo; i++) {
-		struct monit_object *mo = &mos[i];
+	struct metrics_prof *prof = &globl->m_prof[thread_id];
 
-		if (!filter_match(mo->expr, flow)) {
+	for (i=filter_index_first(idx, thread_id, flow); i<n_mo;
+		i=filter_index_next(idx, thread_id, i)) {
+
+		struct monit_object *mo = &mos[i];
+		uint64_t t0;
+		int match;
+
+		t0 = prof_start(prof);
+		match = monit_object_match(mo, flow, memo);
+		mo_cost_add(&mo->metrics[thread_id], MO_COST_FILTER,
+			prof_end(prof, PROF_FILTER, t0));
+		if (!match) {
 			continue;
 		}
 
@@ -539,7 +740,7 @@ process_mo_ipfix_rec(struct xe_data *globl, struct flow_packet_info *fpi,
 		/* child objects */
 		if (mo->n_mo) {
 			process_mo_ipfix_rec(globl, fpi, thread_id, flow, pd,
-				mo->mos, mo->n_mo);
+				mo->mos, mo->n_mo, mo->index, memo);
 		}
 	}
 }
@@ -563,7 +764,8 @@ parse_ipfix_flowset(struct xe_data *globl, size_t thread_id,
 		globl->allow_templates_in_future);
 
 	if (!pd.tmpl_ipfix) {
-		LOG("Unknown flowset id %d", ntohs(flowset_id));
+		LOG_RL("Unknown flowset id %d", ntohs(flowset_id));
+		METRICS_ADD(globl->m_proc[thread_id].template_misses, 1);
 		return 0;
 	}
 
@@ -571,13 +773,15 @@ parse_ipfix_flowset(struct xe_data *globl, size_t thread_id,
 
 	fptr = (*ptr);
 	while (!stop) {
-		struct flow_info flow;
+		struct flow_info flow_buf, *flow;
+		struct filter_memo *memo;
 
 		if ((length - (fptr - (*ptr))) < pd.template_field_count) {
 			break;
 		}
 
-		memset(&flow, 0, sizeof(struct flow_info));
+		flow = nf_batch_row(globl, &flow_buf);
+		memset(flow, 0, sizeof(struct flow_info));
 		pd.tmpfptr = fptr;
 
 		for (i=0; i<pd.template_field_count; i++) {
@@ -588,7 +792,7 @@ parse_ipfix_flowset(struct xe_data *globl, size_t thread_id,
 
 			ipfix_adjust_flength(&flength, fptr, &flengthadj);
 
-			flow_parse_functions[ftype](&flow, flength,
+			flow_parse_functions[ftype](flow, flength,
 				fptr + flengthadj);
 
 			fptr += flength + flengthadj;
@@ -599,8 +803,8 @@ parse_ipfix_flowset(struct xe_data *globl, size_t thread_id,
 			}
 		}
 		/* virtual fields */
-		virtual_fields_init(&flow, fpi);
-		if (!device_rules_check(&flow, fpi)) {
+		virtual_fields_init(flow, fpi);
+		if (!device_rules_check(flow, fpi)) {
 			continue;
 		}
 
@@ -609,18 +813,32 @@ parse_ipfix_flowset(struct xe_data *globl, size_t thread_id,
 
 			print_ipfix_flowset(&pd, debug_flow_str);
 
-			flow_print_str(&globl->debug, &flow,
+			flow_print_str(&globl->debug, flow,
 				debug_flow_str, 0);
 		}
 
-		process_mo_ipfix_rec(globl, fpi, thread_id, &flow, &pd,
-			globl->monit_objects, globl->nmonit_objects);
+		if (globl->tap.enabled) {
+			flow_tap_write(thread_id, flow, fpi->time_ns);
+		}
+
+		if (flow != &flow_buf) {
+			nf_batch_add(globl, thread_id, fpi, &pd, 10);
+		} else {
+			memo = monit_objects_flow_memo(globl, thread_id);
+			process_mo_ipfix_rec(globl, fpi, thread_id, flow, &pd,
+				globl->monit_objects, globl->nmonit_objects,
+				globl->mo_index, memo);
+			monit_objects_flow_done(globl, thread_id, memo);
+		}
+
+		METRICS_ADD(globl->m_proc[thread_id].records[METRICS_IPFIX], 1);
 
 #ifdef FLOWS_CNT
 		atomic_fetch_add_explicit(&globl->nflows, 1,
 			memory_order_relaxed);
 #endif
 	}
+	nf_batch_flush(globl, thread_id, fpi);
 	return 1;
 }
 
@@ -659,7 +877,8 @@ parse_ipfix(struct xe_data *data, size_t thread_id,
 				break;
 			}
 		} else if (flowset_id_host == 3) {
-			LOG("options template ipfix, skipping");
+			LOG_RL("options template ipfix, skipping");
+			METRICS_ADD(data->m_proc[thread_id].unknown_flowsets, 1);
 		} else if (flowset_id_host > 255) {
 			/* data */
 			if (!parse_ipfix_flowset(data, thread_id, fpi, &ptr,
@@ -668,7 +887,8 @@ parse_ipfix(struct xe_data *data, size_t thread_id,
 				break;
 			}
 		} else {
-			LOG("unknown flowset id %u", flowset_id_host);
+			LOG_RL("unknown flowset id %u", flowset_id_host);
+			METRICS_ADD(data->m_proc[thread_id].unknown_flowsets, 1);
 			/* skip flowset */
 		}
 
@@ -695,13 +915,24 @@ NF5_FIELDS
 static void
 process_mo_nf5_rec(struct xe_data *globl, struct flow_packet_info *fpi,
 	size_t thread_id, struct flow_info *flow,
-	struct monit_object *mos, size_t n_mo)
+	struct monit_object *mos, size_t n_mo,
+	struct filter_index *idx, struct filter_memo *memo)
 {
 	size_t i;
-	for (i=0; i<n_mo; i++) {
-		struct monit_object *mo = &mos[i];
+	struct metrics_prof *prof = &globl->m_prof[thread_id];
 
-		if (!filter_match(mo->expr, flow)) {
+	for (i=filter_index_first(idx, thread_id, flow); i<n_mo;
+		i=filter_index_next(idx, thread_id, i)) {
+
+		struct monit_object *mo = &mos[i];
+		uint64_t t0;
+		int match;
+
+		t0 = prof_start(prof);
+		match = monit_object_match(mo, flow, memo);
+		mo_cost_add(&mo->metrics[thread_id], MO_COST_FILTER,
+			prof_end(prof, PROF_FILTER, t0));
+		if (!match) {
 			continue;
 		}
 
@@ -719,7 +950,7 @@ process_mo_nf5_rec(struct xe_data *globl, struct flow_packet_info *fpi,
 		/* child objects */
 		if (mo->n_mo) {
 			process_mo_nf5_rec(globl, fpi, thread_id, flow,
-				mo->mos, mo->n_mo);
+				mo->mos, mo->n_mo, mo->index, memo);
 		}
 	}
 }
@@ -735,7 +966,7 @@ parse_netflow_v5(struct xe_data *globl, size_t thread_id,
 	if ((int)(sizeof(struct nf5_header) + sizeof(struct nf5_flow) * nflows)
 		!= length) {
 
-		LOG("Invalid number of flows: %d", nflows);
+		LOG_RL("Invalid number of flows: %d", nflows);
 		return 0;
 	}
 
@@ -745,23 +976,25 @@ parse_netflow_v5(struct xe_data *globl, size_t thread_id,
 	sampling_rate_init(fpi);
 
 	for (i=0; i<nflows; i++) {
-		struct flow_info flow;
+		struct flow_info flow_buf, *flow;
+		struct filter_memo *memo;
 
-		memset(&flow, 0, sizeof(struct flow_info));
+		flow = nf_batch_row(globl, &flow_buf);
+		memset(flow, 0, sizeof(struct flow_info));
 
 		/* parse flow */
 #define FIELD(USE, TYPE, V5, V9, ID)                                      \
 	if (USE) {                                                        \
-		size_t shift = sizeof(flow.V9) - sizeof(TYPE);            \
-		memcpy(&flow.V9[shift], &pkt->flows[i].V5, sizeof(TYPE)); \
-		flow.has_##V9 = 1;                                        \
-		flow.V9##_size = sizeof(TYPE);                            \
+		size_t shift = sizeof(flow->V9) - sizeof(TYPE);           \
+		memcpy(&flow->V9[shift], &pkt->flows[i].V5, sizeof(TYPE));\
+		flow->has_##V9 = 1;                                       \
+		flow->V9##_size = sizeof(TYPE);                           \
 	}
 NF5_FIELDS
 #undef FIELD
 
-		virtual_fields_init(&flow, fpi);
-		if (!device_rules_check(&flow, fpi)) {
+		virtual_fields_init(flow, fpi);
+		if (!device_rules_check(flow, fpi)) {
 			continue;
 		}
 
@@ -769,12 +1002,26 @@ NF5_FIELDS
 		if (globl->debug.print_flows) {
 			char debug_flow_str[2048];
 
-			print_netflow_v5_flowset(&flow, debug_flow_str);
-			flow_print_str(&globl->debug, &flow, debug_flow_str, 0);
+			print_netflow_v5_flowset(flow, debug_flow_str);
+			flow_print_str(&globl->debug, flow, debug_flow_str, 0);
 		}
 
-		process_mo_nf5_rec(globl, fpi, thread_id, &flow,
-			globl->monit_objects, globl->nmonit_objects);
+		if (globl->tap.enabled) {
+			flow_tap_write(thread_id, flow, fpi->time_ns);
+		}
+
+		if (flow != &flow_buf) {
+			nf_batch_add(globl, thread_id, fpi, NULL, 5);
+		} else {
+			memo = monit_objects_flow_memo(globl, thread_id);
+			process_mo_nf5_rec(globl, fpi, thread_id, flow,
+				globl->monit_objects, globl->nmonit_objects,
+				globl->mo_index, memo);
+			monit_objects_flow_done(globl, thread_id, memo);
+		}
+
+		METRICS_ADD(globl->m_proc[thread_id].records[METRICS_NETFLOW_V5],
+			1);
 
 #ifdef FLOWS_CNT
 		atomic_fetch_add_explicit(&globl->nflows, 1,
@@ -782,6 +1029,8 @@ NF5_FIELDS
 #endif
 	}
 
+	nf_batch_flush(globl, thread_id, fpi);
+
 	return 1;
 }
 
@@ -793,31 +1042,44 @@ netflow_process(struct xe_data *data, size_t thread_id,
 	int version;
 	struct timespec tmsp;
 	int ret = 0;
+	struct metrics_proc *m = &data->m_proc[thread_id];
 
 	/* get time for moving averages */
-	if (clock_gettime(CLOCK_REALTIME_COARSE, &tmsp) < 0) {
-		LOG("clock_gettime() failed: %s", strerror(errno));
-		return 0;
+	if (data->replay) {
+		fpi->time_ns = data->replay_time_ns;
+	} else {
+		if (clock_gettime(CLOCK_REALTIME_COARSE, &tmsp) < 0) {
+			LOG_RL("clock_gettime() failed: %s", strerror(errno));
+			return 0;
+		}
+		fpi->time_ns = tmsp.tv_sec * 1e9 + tmsp.tv_nsec;
 	}
-	fpi->time_ns = tmsp.tv_sec * 1e9 + tmsp.tv_nsec;
 
 	version_ptr = (uint16_t *)fpi->rawpacket;
 	version = ntohs(*version_ptr);
 	switch (version) {
 		case 5:
+			METRICS_ADD(m->packets[METRICS_NETFLOW_V5], 1);
 			ret = parse_netflow_v5(data, thread_id, fpi, len);
 			break;
 		case 9:
+			METRICS_ADD(m->packets[METRICS_NETFLOW_V9], 1);
 			ret = parse_netflow_v9(data, thread_id, fpi, len);
 			break;
 		case 10:
+			METRICS_ADD(m->packets[METRICS_IPFIX], 1);
 			ret = parse_ipfix(data, thread_id, fpi, len);
 			break;
 		default:
-			LOG("Unknown netflow version %u", version);
+			METRICS_ADD(m->packets[METRICS_UNKNOWN], 1);
+			LOG_RL("Unknown netflow version %u", version);
 			break;
 	}
 
+	if (!ret) {
+		METRICS_ADD(m->decode_errors, 1);
+	}
+
 	return ret;
 }
 
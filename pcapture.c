@@ -30,8 +30,7 @@
 
 #include "utils.h"
 #include "xenoeye.h"
-#include "netflow.h"
-#include "sflow.h"
+#include "workers.h"
 #include "flow-info.h"
 
 
@@ -118,6 +117,7 @@ pcap_packet(struct capture_thread_params *params,
 	const unsigned char *payload;           /* Packet payload */
 
 	struct flow_packet_info pkt;          /* flow packet */
+	struct sockaddr_in *sin;
 
 	int size_ip;
 	int size_payload;
@@ -156,6 +156,13 @@ pcap_packet(struct capture_thread_params *params,
 
 	pkt.src_addr_ipv4 = ip->ip_src.s_addr;
 
+	/* exporter address and port, used to select worker */
+	memset(&pkt.src_addr, 0, sizeof(pkt.src_addr));
+	sin = (struct sockaddr_in *)&pkt.src_addr;
+	sin->sin_family = AF_INET;
+	sin->sin_addr = ip->ip_src;
+	sin->sin_port = udp->uh_sport;
+
 	/* define/compute udp payload (segment) offset */
 	payload = (u_char *)(packet + SIZE_ETHERNET + size_ip + SIZE_UDP);
 
@@ -166,17 +173,8 @@ pcap_packet(struct capture_thread_params *params,
 	}
 
 	memcpy(pkt.rawpacket, payload, size_payload);
-	if (params->type == FLOW_TYPE_NETFLOW) {
-		if (netflow_process(params->data, params->thread_idx, &pkt,
-			size_payload)) {
-			/* ok */
-			/*data->packets_processed++;*/
-		}
-	} else {
-		/* sflow */
-		sflow_process(params->data, params->thread_idx, &pkt,
-			size_payload);
-	}
+	workers_packet(params->data, params->thread_idx, params->type, &pkt,
+		size_payload);
 }
 
 static void *
@@ -187,39 +185,51 @@ pcapture_thread(void *arg)
 	struct pcap_pkthdr *header;
 	const unsigned char *packet;
 	int rc;
-	/*int64_t sec = 0;*/
+	time_t sec = 0;
+	struct metrics_capture *m;
 
 	params_ptr = (struct capture_thread_params *)arg;
 	params = *params_ptr;
 	free(params_ptr);
 
+	affinity_thread(&params.data->affinity, AFFINITY_CAPTURE,
+		params.thread_idx);
+
+	m = &params.data->m_capture[params.thread_idx];
+
 	LOG("Starting collector thread on interface '%s', filter '%s'",
 		params.cap->iface, params.cap->filter);
 
 	for (;;) {
 		rc = pcap_next_ex(params.cap->pcap_handle, &header, &packet);
-		if (rc >= 0) {
+		if (rc > 0) {
+			METRICS_ADD(m->packets, 1);
+			METRICS_ADD(m->bytes, header->caplen);
 			pcap_packet(&params, header, packet);
+		} else if (rc == 0) {
+			/* timeout */
 		} else {
 			LOG("Error reading the packets: %s",
 				pcap_geterr(params.cap->pcap_handle));
 		}
 
-#if 0
 		{
 			struct timespec ts;
 			struct pcap_stat ps;
 
 			clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
-			if ((ts.tv_sec / 10) != sec) {
-				pcap_stats(params.cap->pcap_handle, &ps);
-				LOG("thread: %lu, recv: %u, drop: %u, ifdrop: %u",
-					params.thread_idx,
-					ps.ps_recv, ps.ps_drop, ps.ps_ifdrop);
-				sec = ts.tv_sec / 10;
+			if ((ts.tv_sec / METRICS_PCAP_STATS_SECS) != sec) {
+				if (pcap_stats(params.cap->pcap_handle, &ps)
+					== 0) {
+
+					METRICS_SET(m->pcap_recv, ps.ps_recv);
+					METRICS_SET(m->pcap_drop, ps.ps_drop);
+					METRICS_SET(m->pcap_ifdrop,
+						ps.ps_ifdrop);
+				}
+				sec = ts.tv_sec / METRICS_PCAP_STATS_SECS;
 			}
 		}
-#endif
 	}
 	return NULL;
 }
@@ -0,0 +1,370 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "utils.h"
+#include "xenoeye.h"
+#include "replay.h"
+#include "flow-info.h"
+#include "monit-objects.h"
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+
+#define SLL_HDR_LEN 16
+
+struct replay_stats
+{
+	uint64_t packets;
+	uint64_t netflow;
+	uint64_t sflow;
+	uint64_t skipped;
+
+	time_t first, last;
+};
+
+static const char *stage_names[PROF_STAGE_MAX] = {
+	"packet", "decode", "filter", "fwm", "mavg", "classification"
+};
+
+static uint16_t
+get16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(uint16_t));
+	return ntohs(v);
+}
+
+static uint32_t
+get32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(uint32_t));
+	return ntohl(v);
+}
+
+/* find UDP payload in IPv4 packet, returns 0 if packet should be skipped */
+static int
+ipv4_udp(const uint8_t *p, const uint8_t *end, uint32_t *src,
+	const uint8_t **payload, size_t *len)
+{
+	size_t hlen, total, ulen;
+
+	if ((end - p) < 20) {
+		return 0;
+	}
+
+	if ((p[0] >> 4) != 4) {
+		return 0;
+	}
+
+	hlen = (p[0] & 0x0f) * 4;
+	total = get16(p + 2);
+	if ((hlen < 20) || (total < hlen) || (total > (size_t)(end - p))) {
+		return 0;
+	}
+
+	/* fragments */
+	if (get16(p + 6) & 0x3fff) {
+		return 0;
+	}
+
+	if (p[9] != IPPROTO_UDP) {
+		return 0;
+	}
+
+	/* network byte order, as in capture threads */
+	memcpy(src, p + 12, sizeof(uint32_t));
+
+	p += hlen;
+	if ((total - hlen) < 8) {
+		return 0;
+	}
+
+	ulen = get16(p + 4);
+	if ((ulen < 8) || (ulen > (total - hlen))) {
+		ulen = total - hlen;
+	}
+
+	*payload = p + 8;
+	*len = ulen - 8;
+
+	return 1;
+}
+
+static int
+udp_payload(int dlt, const uint8_t *p, size_t caplen, uint32_t *src,
+	const uint8_t **payload, size_t *len)
+{
+	const uint8_t *end = p + caplen;
+	uint16_t ethertype;
+
+	switch (dlt) {
+		case DLT_EN10MB:
+			if (caplen < 14) {
+				return 0;
+			}
+			ethertype = get16(p + 12);
+			p += 14;
+
+			while ((ethertype == ETHERTYPE_VLAN)
+				|| (ethertype == ETHERTYPE_QINQ)) {
+
+				if ((end - p) < 4) {
+					return 0;
+				}
+				ethertype = get16(p + 2);
+				p += 4;
+			}
+			break;
+
+		case DLT_LINUX_SLL:
+			if (caplen < SLL_HDR_LEN) {
+				return 0;
+			}
+			ethertype = get16(p + 14);
+			p += SLL_HDR_LEN;
+			break;
+
+		case DLT_RAW:
+			ethertype = ETHERTYPE_IPV4;
+			break;
+
+		default:
+			return 0;
+	}
+
+	if (ethertype != ETHERTYPE_IPV4) {
+		return 0;
+	}
+
+	return ipv4_udp(p, end, src, payload, len);
+}
+
+static int
+flow_type(const uint8_t *payload, size_t len, enum FLOW_TYPE *type)
+{
+	uint16_t version;
+
+	if (len < 4) {
+		return 0;
+	}
+
+	if (get32(payload) == 5) {
+		*type = FLOW_TYPE_SFLOW;
+		return 1;
+	}
+
+	version = get16(payload);
+	if ((version == 5) || (version == 9) || (version == 10)) {
+		*type = FLOW_TYPE_NETFLOW;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+print_fwm_rec(FILE *out, struct monit_object *mos, size_t n_mo)
+{
+	size_t i, j;
+
+	for (i=0; i<n_mo; i++) {
+		struct monit_object *mo = &mos[i];
+
+		for (j=0; j<mo->nfwm; j++) {
+			struct mo_fwm *fwm = &mo->fwms[j];
+
+			fprintf(out, "fwm %s/%s: windows %lu, keys in last %lu\n",
+				mo->name, fwm->name,
+				(unsigned long)atomic_load(&fwm->m_exports),
+				(unsigned long)atomic_load(&fwm->m_keys));
+		}
+
+		if (mo->n_mo) {
+			print_fwm_rec(out, mo->mos, mo->n_mo);
+		}
+	}
+}
+
+/* deterministic results to stdout */
+static void
+print_results(struct xe_data *data, struct replay_stats *st, uint64_t flows)
+{
+	printf("packets: %lu (netflow %lu, sflow %lu, skipped %lu)\n",
+		(unsigned long)st->packets, (unsigned long)st->netflow,
+		(unsigned long)st->sflow, (unsigned long)st->skipped);
+	printf("flows: %lu\n", (unsigned long)flows);
+	printf("capture time: %lu - %lu\n", (unsigned long)st->first,
+		(unsigned long)st->last);
+
+	print_fwm_rec(stdout, data->monit_objects, data->nmonit_objects);
+	mavg_dump_results(data, stdout, data->replay_time_ns);
+}
+
+/* speed and timings by stage to stderr */
+static void
+print_timings(struct xe_data *data, uint64_t flows, uint64_t elapsed_ns)
+{
+	struct metrics_prof *prof = &data->m_prof[0];
+	double secs = elapsed_ns / 1e9;
+	int s;
+
+	if (secs <= 0.0) {
+		secs = 1e-9;
+	}
+
+	fprintf(stderr, "replay: %.3f s, %.0f packets/s, %.0f flows/s\n",
+		secs, prof->npackets / secs, flows / secs);
+
+	fprintf(stderr, "%-16s %12s %12s %12s\n", "stage", "count",
+		"total, s", "avg, ns");
+	for (s=0; s<PROF_STAGE_MAX; s++) {
+		uint64_t count = atomic_load(&prof->count[s]);
+		uint64_t sum_ns = atomic_load(&prof->sum_ns[s]);
+
+		fprintf(stderr, "%-16s %12lu %12.6f %12.1f\n", stage_names[s],
+			(unsigned long)count, sum_ns / 1e9,
+			count ? (double)sum_ns / count : 0.0);
+	}
+}
+
+int
+replay_run(struct xe_data *data, const char *path,
+	workers_process_func process)
+{
+	pcap_t *handle;
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr *hdr;
+	const unsigned char *pkt;
+	struct flow_packet_info *fpi;
+	struct replay_stats st;
+	uint64_t t1, t2, flows = 0;
+	int dlt, rc, p;
+	int ret = 0;
+
+	handle = pcap_open_offline(path, errbuf);
+	if (!handle) {
+		LOG("Can't open '%s': %s", path, errbuf);
+		goto fail_open;
+	}
+
+	dlt = pcap_datalink(handle);
+	if ((dlt != DLT_EN10MB) && (dlt != DLT_LINUX_SLL) && (dlt != DLT_RAW)) {
+		LOG("Unsupported link type %d in '%s'", dlt, path);
+		goto fail_dlt;
+	}
+
+	fpi = malloc(sizeof(struct flow_packet_info));
+	if (!fpi) {
+		LOG("malloc() failed");
+		goto fail_dlt;
+	}
+
+	memset(&st, 0, sizeof(struct replay_stats));
+
+	LOG("Replaying '%s'", path);
+
+	t1 = prof_now();
+	while ((rc = pcap_next_ex(handle, &hdr, &pkt)) == 1) {
+		const uint8_t *payload;
+		size_t len;
+		uint32_t src;
+		enum FLOW_TYPE type;
+		struct sockaddr_in *sin;
+
+		st.packets++;
+
+		if (!udp_payload(dlt, pkt, hdr->caplen, &src, &payload, &len)
+			|| (len > MAX_NF_PACKET_SIZE)
+			|| !flow_type(payload, len, &type)) {
+
+			st.skipped++;
+			continue;
+		}
+
+		if ((st.netflow + st.sflow) == 0) {
+			st.first = hdr->ts.tv_sec;
+			st.last = hdr->ts.tv_sec;
+		}
+
+		/* capture time never goes back */
+		if (hdr->ts.tv_sec >= st.last) {
+			data->replay_time_ns = hdr->ts.tv_sec * 1000000000ULL
+				+ hdr->ts.tv_usec * 1000ULL;
+
+			if ((hdr->ts.tv_sec != st.last)
+				|| ((st.netflow + st.sflow) == 0)) {
+
+				/* windows are switched between seconds */
+				fwm_replay_export(data, hdr->ts.tv_sec, 0);
+			}
+			st.last = hdr->ts.tv_sec;
+		}
+
+		if (type == FLOW_TYPE_NETFLOW) {
+			st.netflow++;
+		} else {
+			st.sflow++;
+		}
+
+		memset(fpi, 0, offsetof(struct flow_packet_info, rawpacket));
+		sin = (struct sockaddr_in *)&fpi->src_addr;
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, &src, sizeof(uint32_t));
+		fpi->src_addr_ipv4 = src;
+		memcpy(fpi->rawpacket, payload, len);
+
+		process(data, 0, type, fpi, len);
+	}
+	t2 = prof_now();
+
+	if (rc == PCAP_ERROR) {
+		LOG("Error reading '%s': %s", path, pcap_geterr(handle));
+		goto fail_read;
+	}
+
+	/* last window, after the last second of capture */
+	fwm_replay_export(data, st.last + 1, 1);
+
+	for (p=0; p<METRICS_PROTO_MAX; p++) {
+		flows += atomic_load(&data->m_proc[0].records[p]);
+	}
+
+	print_results(data, &st, flows);
+	print_timings(data, flows, t2 - t1);
+
+	ret = 1;
+
+fail_read:
+	free(fpi);
+fail_dlt:
+	pcap_close(handle);
+fail_open:
+	return ret;
+}
+
@@ -0,0 +1,25 @@
+#ifndef replay_h_included
+#define replay_h_included
+
+#include "xenoeye.h"
+#include "workers.h"
+
+/*
+ * Offline replay of captured NetFlow/IPFIX/sFlow datagrams
+ *
+ * UDP payloads from pcap file are passed to the same processing function
+ * as in capture threads, in one thread and as fast as possible. Time of
+ * flows (moving averages) and time of fixed windows are taken from capture
+ * timestamps, so exported files and results don't depend on speed of
+ * replay. Every packet is timed by profiler.
+ *
+ * sFlow datagram starts with 32-bit version 5, NetFlow/IPFIX with 16-bit
+ * version 5, 9 or 10, other UDP packets are skipped. Fragmented IPv4 and
+ * IPv6 packets are skipped too.
+ */
+
+int replay_run(struct xe_data *data, const char *path,
+	workers_process_func process);
+
+#endif
+
@@ -0,0 +1,381 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "rib.h"
+
+/*
+ * Old table is freed by rib_free_old() at least this time after replace.
+ * Readers (processing threads) load the pointer, do one lookup and copy the
+ * prefix string, they never keep the pointer between flows and don't block
+ * inside lookup. So only a reader preempted in the middle of lookup may
+ * still use the old table, 100 ms is much more than such a stall
+ */
+#define RIB_FREE_DELAY_US 100000
+
+struct rib_node
+{
+	uint32_t next[2];
+
+	/* index of prefix string + 1, 0 if no prefix ends in this node */
+	uint32_t pfx;
+};
+
+struct rib_trie
+{
+	struct rib_node *nodes;
+	size_t n, alloc;
+	size_t nprefixes;
+};
+
+struct rib
+{
+	struct rib_trie t4, t6;
+
+	char (*pfx)[RIB_PFX_SIZE];
+	size_t npfx, alloc_pfx;
+};
+
+static struct rib * _Atomic _rib = NULL;
+
+/* replaced table waiting for readers and time of replace */
+static struct rib *_rib_old = NULL;
+static uint64_t _rib_old_us = 0;
+
+static uint64_t
+rib_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void
+rib_free(struct rib *r)
+{
+	if (!r) {
+		return;
+	}
+
+	free(r->t4.nodes);
+	free(r->t6.nodes);
+	free(r->pfx);
+	free(r);
+}
+
+static int
+rib_node_new(struct rib_trie *t, uint32_t *node)
+{
+	if (t->n == t->alloc) {
+		struct rib_node *tmp;
+		size_t alloc = t->alloc ? t->alloc * 2 : 1024;
+
+		tmp = realloc(t->nodes, alloc * sizeof(struct rib_node));
+		if (!tmp) {
+			return 0;
+		}
+		t->nodes = tmp;
+		t->alloc = alloc;
+	}
+
+	memset(&t->nodes[t->n], 0, sizeof(struct rib_node));
+	*node = t->n;
+	t->n++;
+
+	return 1;
+}
+
+static int
+rib_add(struct rib *r, int af, uint8_t *addr, int mask)
+{
+	struct rib_trie *t = (af == AF_INET) ? &r->t4 : &r->t6;
+	int i, len = (af == AF_INET) ? 4 : 16;
+	uint32_t node = 0;
+	char str[INET6_ADDRSTRLEN];
+
+	/* clear host bits */
+	for (i=mask; i<len*8; i++) {
+		addr[i / 8] &= ~(1 << (7 - i % 8));
+	}
+
+	if ((t->n == 0) && !rib_node_new(t, &node)) {
+		return 0;
+	}
+
+	for (i=0; i<mask; i++) {
+		int bit = (addr[i / 8] >> (7 - i % 8)) & 1;
+		uint32_t next = t->nodes[node].next[bit];
+
+		if (!next) {
+			if (!rib_node_new(t, &next)) {
+				return 0;
+			}
+			t->nodes[node].next[bit] = next;
+		}
+		node = next;
+	}
+
+	if (t->nodes[node].pfx) {
+		/* duplicate */
+		return 1;
+	}
+
+	if (r->npfx == r->alloc_pfx) {
+		char (*tmp)[RIB_PFX_SIZE];
+		size_t alloc = r->alloc_pfx ? r->alloc_pfx * 2 : 1024;
+
+		tmp = realloc(r->pfx, alloc * RIB_PFX_SIZE);
+		if (!tmp) {
+			return 0;
+		}
+		r->pfx = tmp;
+		r->alloc_pfx = alloc;
+	}
+
+	inet_ntop(af, addr, str, sizeof(str));
+	sprintf(r->pfx[r->npfx], "%s/%d", str, mask);
+	r->npfx++;
+	t->nodes[node].pfx = r->npfx;
+	t->nprefixes++;
+
+	return 1;
+}
+
+/*
+ * "prefix origin-as", returns 0 on incorrect line
+ * origin AS column is required but ignored, AS of address is given by asn()
+ * from AS database
+ */
+static int
+rib_parse_line(struct rib *r, char *line, int *err)
+{
+	char *str_pfx, *str_mask, *str_as, *endptr, *saveptr;
+	uint8_t addr[16];
+	int af, mask, maxmask;
+
+	*err = 0;
+
+	str_pfx = strtok_r(line, " \t", &saveptr);
+	str_as = strtok_r(NULL, " \t", &saveptr);
+	if (!str_pfx || !str_as) {
+		return 0;
+	}
+
+	str_mask = strchr(str_pfx, '/');
+	if (str_mask) {
+		*str_mask = '\0';
+		str_mask++;
+	}
+
+	if (inet_pton(AF_INET, str_pfx, addr) == 1) {
+		af = AF_INET;
+		maxmask = 32;
+	} else if (inet_pton(AF_INET6, str_pfx, addr) == 1) {
+		af = AF_INET6;
+		maxmask = 128;
+	} else {
+		return 0;
+	}
+
+	mask = maxmask;
+	if (str_mask) {
+		mask = strtol(str_mask, &endptr, 10);
+		if ((*str_mask == '\0') || (*endptr != '\0') || (mask < 0)
+			|| (mask > maxmask)) {
+
+			return 0;
+		}
+	}
+
+	if (!rib_add(r, af, addr, mask)) {
+		*err = 1;
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+rib_load(const char *path)
+{
+	struct rib *r, *old;
+	FILE *f;
+	int line_no = 0;
+	size_t nbad = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		LOG("Can't open '%s': %s", path, strerror(errno));
+		return 0;
+	}
+
+	r = calloc(1, sizeof(struct rib));
+	if (!r) {
+		LOG("Not enough memory");
+		goto fail_alloc;
+	}
+
+	for (;;) {
+		char line[1024];
+		char *s;
+		int err;
+
+		if (!fgets(line, sizeof(line), f)) {
+			break;
+		}
+		line_no++;
+
+		line[strcspn(line, "\r\n#")] = '\0';
+		s = string_trim(line);
+		if (*s == '\0') {
+			continue;
+		}
+
+		if (rib_parse_line(r, s, &err)) {
+			continue;
+		}
+		if (err) {
+			LOG("Not enough memory for routing table '%s'", path);
+			goto fail_add;
+		}
+		if (nbad < 10) {
+			LOG("Can't parse line %d of routing table '%s'",
+				line_no, path);
+		}
+		nbad++;
+	}
+	fclose(f);
+
+	if (_rib_old) {
+		/* previous table is still waiting, rare: two quick reloads */
+		uint64_t dt = rib_now_us() - _rib_old_us;
+
+		if (dt < RIB_FREE_DELAY_US) {
+			usleep(RIB_FREE_DELAY_US - dt);
+		}
+		rib_free(_rib_old);
+		_rib_old = NULL;
+	}
+
+	old = atomic_exchange_explicit(&_rib, r, memory_order_acq_rel);
+	if (old) {
+		_rib_old = old;
+		_rib_old_us = rib_now_us();
+	}
+
+	LOG("Routing table '%s' loaded: %lu IPv4 and %lu IPv6 prefixes, "
+		"%lu incorrect lines", path, (unsigned long)r->t4.nprefixes,
+		(unsigned long)r->t6.nprefixes, (unsigned long)nbad);
+
+	return 1;
+
+fail_add:
+	rib_free(r);
+fail_alloc:
+	fclose(f);
+	return 0;
+}
+
+void
+rib_free_old(void)
+{
+	if (!_rib_old) {
+		return;
+	}
+
+	if ((rib_now_us() - _rib_old_us) < RIB_FREE_DELAY_US) {
+		return;
+	}
+
+	rib_free(_rib_old);
+	_rib_old = NULL;
+}
+
+static uint32_t
+rib_trie_lookup(struct rib_trie *t, const uint8_t *addr, int bits)
+{
+	int i;
+	uint32_t node = 0, pfx;
+
+	if (!t->nodes) {
+		return 0;
+	}
+
+	/* longest prefix on path */
+	pfx = t->nodes[0].pfx;
+	for (i=0; i<bits; i++) {
+		int bit = (addr[i / 8] >> (7 - i % 8)) & 1;
+
+		node = t->nodes[node].next[bit];
+		if (!node) {
+			break;
+		}
+		if (t->nodes[node].pfx) {
+			pfx = t->nodes[node].pfx;
+		}
+	}
+
+	return pfx;
+}
+
+int
+rib_lookup4(uint32_t addr, char **pfx)
+{
+	struct rib *r = atomic_load_explicit(&_rib, memory_order_acquire);
+	uint32_t idx;
+
+	if (!r) {
+		return 0;
+	}
+
+	idx = rib_trie_lookup(&r->t4, (uint8_t *)&addr, 32);
+	if (!idx) {
+		return 0;
+	}
+
+	*pfx = r->pfx[idx - 1];
+	return 1;
+}
+
+int
+rib_lookup6(xe_ip *addr, char **pfx)
+{
+	struct rib *r = atomic_load_explicit(&_rib, memory_order_acquire);
+	uint32_t idx;
+
+	if (!r) {
+		return 0;
+	}
+
+	idx = rib_trie_lookup(&r->t6, (uint8_t *)addr, 128);
+	if (!idx) {
+		return 0;
+	}
+
+	*pfx = r->pfx[idx - 1];
+	return 1;
+}
+
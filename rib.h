@@ -0,0 +1,37 @@
+#ifndef rib_h_included
+#define rib_h_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include "utils.h"
+
+/*
+ * Announced prefixes from local dump of BGP table (RIB), text file with
+ * lines "prefix origin-as", e.g.
+ *   10.1.0.0/16 65001
+ *   2001:db8::/32 65002
+ *
+ * Lookup is longest prefix match, result is prefix as string
+ * ("10.1.0.0/16"), used by function pfx() in filters and windows. Origin AS
+ * is ignored, asn() gives it from AS database
+ */
+
+/* "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255/128" */
+#define RIB_PFX_SIZE (INET6_ADDRSTRLEN + 4)
+
+/*
+ * load table from file and replace current one, old table stays on errors
+ * rib_load() and rib_free_old() are called from one (helper) thread
+ */
+int rib_load(const char *path);
+
+/* free replaced table when readers are surely done with it, doesn't block */
+void rib_free_old(void);
+
+/* addresses in network order, copy '*pfx' right away, table may be replaced */
+int rib_lookup4(uint32_t addr, char **pfx);
+int rib_lookup6(xe_ip *addr, char **pfx);
+
+#endif
+
@@ -3,40 +3,71 @@
 #include <unistd.h>
 
 #include "xenoeye.h"
-#include "netflow.h"
-#include "sflow.h"
+#include "workers.h"
 #include "flow-info.h"
 
 static void *
 scapture_thread(void *arg)
 {
 	struct capture_thread_params params, *params_ptr;
-
-	socklen_t clientlen;
+	struct metrics_capture *m;
 
 	params_ptr = (struct capture_thread_params *)arg;
 	params = *params_ptr;
 	free(params_ptr);
 
-	clientlen = sizeof(struct sockaddr);
+	m = &params.data->m_capture[params.thread_idx];
+
+	affinity_thread(&params.data->affinity, AFFINITY_CAPTURE,
+		params.thread_idx);
 
 	LOG("Starting collector thread on port %d", params.cap->port);
 
 	for (;;) {
 		ssize_t len;
 		struct flow_packet_info pkt;
+		struct iovec iov;
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+		uint8_t cmsgbuf[CMSG_SPACE(sizeof(uint32_t))];
+
+		iov.iov_base = pkt.rawpacket;
+		iov.iov_len = MAX_NF_PACKET_SIZE;
 
-		len = recvfrom(params.cap->sockfd, pkt.rawpacket,
-			MAX_NF_PACKET_SIZE, 0,
-			&(pkt.src_addr), &clientlen);
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_name = &pkt.src_addr;
+		msg.msg_namelen = sizeof(pkt.src_addr);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsgbuf;
+		msg.msg_controllen = sizeof(cmsgbuf);
+
+		len = recvmsg(params.cap->sockfd, &msg, 0);
 
 		if (len < 0) {
-			LOG("recvfrom() failed: %s", strerror(errno));
+			LOG("recvmsg() failed: %s", strerror(errno));
 
 			continue;
 		}
 
-		if (pkt.src_addr.sa_family == AF_INET) {
+		METRICS_ADD(m->packets, 1);
+		METRICS_ADD(m->bytes, len);
+
+		/* number of packets dropped by kernel for this socket */
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+			if ((cmsg->cmsg_level == SOL_SOCKET)
+				&& (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+
+				uint32_t drops;
+
+				memcpy(&drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+				METRICS_SET(m->socket_drops, drops);
+			}
+		}
+
+		if (pkt.src_addr.ss_family == AF_INET) {
 			struct sockaddr_in *addr;
 
 			addr = (struct sockaddr_in *)&pkt.src_addr;
@@ -48,16 +79,9 @@ scapture_thread(void *arg)
 			pkt.src_addr_ipv4 = 0;
 		}
 
-		if (params.type == FLOW_TYPE_NETFLOW) {
-			if (netflow_process(params.data, params.thread_idx,
-				&pkt, len)) {
-				/* ok */
-			}
-		} else {
-			/* sflow */
-			sflow_process(params.data, params.thread_idx, &pkt,
-				len);
-		}
+		/* process or pass to worker */
+		workers_packet(params.data, params.thread_idx, params.type,
+			&pkt, len);
 	}
 
 	close(params.cap->sockfd);
@@ -134,6 +158,13 @@ scapture_start(struct xe_data *data, struct capture *cap, size_t thread_idx,
 		goto fail_setsockopt;
 	}
 
+	if (setsockopt(cap->sockfd, SOL_SOCKET, SO_RXQ_OVFL,
+		(const void *)&one, sizeof(int)) == -1) {
+
+		LOG("Can't enable SO_RXQ_OVFL, socket drops will not be "
+			"counted: %s", strerror(errno));
+	}
+
 	scapture_set_buf_size(data, cap);
 
 	bzero((char *)&serveraddr, sizeof(serveraddr));
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Reference helper for notification dispatcher ("notify-dispatcher" section
+# in xenoeye.conf)
+#
+# xenoeye starts this script once and writes events to its stdin,
+# one tab-separated record per line:
+# event mo_name mavg_name limit_name filename key1 ... keyN val limit
+#
+# event is "overlimit", "underlimit" or "back2norm"
+
+log=${XE_NOTIFY_LOG:-/var/lib/xenoeye/notifications/notify.log}
+
+while IFS=$'\t' read -r -a rec; do
+	n=${#rec[@]}
+	if [ "$n" -lt 7 ]; then
+		continue
+	fi
+
+	event=${rec[0]}
+	mo=${rec[1]}
+	mavg=${rec[2]}
+	limit_name=${rec[3]}
+	file=${rec[4]}
+	keys=${rec[*]:5:$((n - 7))}
+	val=${rec[$((n - 2))]}
+	limit=${rec[$((n - 1))]}
+
+	dt=$(date '+%F %T.%3N')
+	echo "${dt} ${event} ${mo}/${mavg}/${limit_name} [${keys}] val ${val}, limit ${limit} (${file})" >> "${log}"
+done
@@ -1,6 +1,11 @@
 #include <errno.h>
 #include "flow-info.h"
 
+/* errors in packets, debug output goes to LOG() */
+#ifndef SF_LOG_ERR
+#define SF_LOG_ERR LOG
+#endif
+
 enum SF5_ADDR_TYPE
 {
 	SF5_ADDR_UNKNOWN  = 0,
@@ -51,7 +56,7 @@ struct sflow_ip_v4
 #define READ_SF_BYTES(R, RLEN, P, END)               \
 do {                                                 \
 	if ((P + RLEN) > END) {                      \
-		LOG("Malformed sFlow packet");       \
+		SF_LOG_ERR("Malformed sFlow packet");\
 		return 0;                            \
 	}                                            \
 	memcpy(R, P, RLEN);                          \
@@ -313,16 +318,21 @@ sflow_process(struct xe_data *global, size_t thread_id,
 	sfd.flow = &flow;
 
 	/* get time for moving averages */
-	if (clock_gettime(CLOCK_REALTIME_COARSE, &tmsp) < 0) {
-		LOG("clock_gettime() failed: %s", strerror(errno));
-		return 0;
+	if (global && global->replay) {
+		fpi->time_ns = global->replay_time_ns;
+	} else {
+		if (clock_gettime(CLOCK_REALTIME_COARSE, &tmsp) < 0) {
+			SF_LOG_ERR("clock_gettime() failed: %s",
+				strerror(errno));
+			return 0;
+		}
+		fpi->time_ns = tmsp.tv_sec * 1e9 + tmsp.tv_nsec;
 	}
-	fpi->time_ns = tmsp.tv_sec * 1e9 + tmsp.tv_nsec;
 
 	READ32_H(v, p, end);
 	LOG("version: %u", v);
 	if (v != 5) {
-		LOG("Unknown sFlow version %u", v);
+		SF_LOG_ERR("Unknown sFlow version %u", v);
 		return 0;
 	}
 
@@ -343,7 +353,7 @@ sflow_process(struct xe_data *global, size_t thread_id,
 		inet_ntop(AF_INET6, &dev_ip6, s, INET6_ADDRSTRLEN);
 		LOG("agent address (IPv6): %s", s);
 	} else {
-		LOG("Unknown agent address type %u", v);
+		SF_LOG_ERR("Unknown agent address type %u", v);
 		return 0;
 	}
 
@@ -22,6 +22,7 @@
 #include "filter.h"
 #include "flow-debug.h"
 #include "devices.h"
+#include "xe-log.h"
 
 #define COPY_TO_FLOW(D, F, R, N)  \
 do {                              \
@@ -83,13 +84,23 @@ static int xe_dns(uint8_t *p, uint8_t *end, char *domain, char *ips);
 
 static void
 process_mo_sflow_rec(struct sfdata *s, uint8_t *end, struct monit_object *mos,
-	size_t n_mo)
+	size_t n_mo, struct filter_index *idx, struct filter_memo *memo)
 {
 	size_t i;
-	for (i=0; i<n_mo; i++) {
-		struct monit_object *mo = &mos[i];
+	struct metrics_prof *prof = &s->global->m_prof[s->thread_id];
+
+	for (i=filter_index_first(idx, s->thread_id, s->flow); i<n_mo;
+		i=filter_index_next(idx, s->thread_id, i)) {
 
-		if (!filter_match(mo->expr, s->flow)) {
+		struct monit_object *mo = &mos[i];
+		uint64_t t0;
+		int match;
+
+		t0 = prof_start(prof);
+		match = monit_object_match(mo, s->flow, memo);
+		mo_cost_add(&mo->metrics[s->thread_id], MO_COST_FILTER,
+			prof_end(prof, PROF_FILTER, t0));
+		if (!match) {
 			continue;
 		}
 
@@ -123,7 +134,8 @@ process_mo_sflow_rec(struct sfdata *s, uint8_t *end, struct monit_object *mos,
 
 		/* child objects */
 		if (mo->n_mo) {
-			process_mo_sflow_rec(s, end, mo->mos, mo->n_mo);
+			process_mo_sflow_rec(s, end, mo->mos, mo->n_mo,
+				mo->index, memo);
 		}
 	}
 }
@@ -132,6 +144,7 @@ static inline int
 sf5_parsed(struct sfdata *s, uint8_t *p, uint32_t header_len)
 {
 	uint8_t *end = p + header_len;
+	struct filter_memo *memo;
 
 	/* check interfaces */
 	if (!device_rules_check(s->flow, s->fpi)) {
@@ -147,8 +160,17 @@ sf5_parsed(struct sfdata *s, uint8_t *p, uint32_t header_len)
 		flow_print_str(&s->global->debug, s->flow, debug_flow_str, 1);
 	}
 
+	if (s->global->tap.enabled) {
+		flow_tap_write(s->thread_id, s->flow, s->fpi->time_ns);
+	}
+
+	memo = monit_objects_flow_memo(s->global, s->thread_id);
 	process_mo_sflow_rec(s, end,
-		s->global->monit_objects, s->global->nmonit_objects);
+		s->global->monit_objects, s->global->nmonit_objects,
+		s->global->mo_index, memo);
+	monit_objects_flow_done(s->global, s->thread_id, memo);
+
+	METRICS_ADD(s->global->m_proc[s->thread_id].records[METRICS_SFLOW], 1);
 
 #ifdef FLOWS_CNT
 	atomic_fetch_add_explicit(&s->global->nflows, 1, memory_order_relaxed);
@@ -170,9 +192,10 @@ sf5_eth(struct sfdata *s, uint8_t *p, enum RP_TYPE t, uint32_t header_len)
 	return sf5_parsed(s, p, header_len);
 }
 
-/* disable logging */
+/* disable debug logging, errors are rate limited */
 #undef LOG
 #define LOG(...)
+#define SF_LOG_ERR LOG_RL
 
 #include "xe-sni.h"
 #include "xe-dns.h"
@@ -0,0 +1,254 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "utils.h"
+#include "xenoeye.h"
+#include "status-table.h"
+
+static struct status_table_conf *conf = NULL;
+static struct status_table_header *tbl = NULL;
+
+/* act() is called from act and underlimit threads */
+static pthread_mutex_t tbl_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* stack of free slots */
+static size_t *free_slots = NULL;
+static size_t nfree = 0;
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+status_table_config(struct aajson *a, aajson_val *value,
+	struct status_table_conf *c)
+{
+	if (STRCMP(a, 2, "enabled") == 0) {
+		c->enabled = (value->type == AAJSON_VALUE_TRUE);
+	} else if (STRCMP(a, 2, "path") == 0) {
+		strcpy(c->path, value->str);
+	} else if (STRCMP(a, 2, "slots") == 0) {
+		if (atoi(value->str) <= 0) {
+			LOG("status-table: incorrect number of slots '%s'",
+				value->str);
+			return 0;
+		}
+		c->nslots = atoi(value->str);
+	} else if (STRCMP(a, 2, "keep-files") == 0) {
+		c->keep_files = (value->type == AAJSON_VALUE_TRUE);
+	}
+
+	return 1;
+}
+#undef STRCMP
+
+int
+status_table_enabled(void)
+{
+	return tbl != NULL;
+}
+
+int
+status_table_keep_files(void)
+{
+	return (tbl == NULL) || conf->keep_files;
+}
+
+int
+status_table_init(struct xe_data *globl)
+{
+	int fd;
+	size_t i, size;
+
+	conf = &globl->status_table;
+
+	if (!conf->enabled) {
+		return 1;
+	}
+
+	if (!*conf->path) {
+		strcpy(conf->path, STATUS_TABLE_DEFAULT_PATH);
+	}
+	if (!conf->nslots) {
+		conf->nslots = STATUS_TABLE_DEFAULT_SLOTS;
+	}
+
+	size = STATUS_TABLE_SIZE(conf->nslots);
+
+	free_slots = malloc(conf->nslots * sizeof(size_t));
+	if (!free_slots) {
+		LOG("malloc() failed");
+		goto fail_alloc;
+	}
+
+	/* readers may keep old mapping, so create new file */
+	unlink(conf->path);
+	fd = open(conf->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		LOG("Can't open status table '%s': %s", conf->path,
+			strerror(errno));
+		goto fail_open;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		LOG("Can't resize status table '%s': %s", conf->path,
+			strerror(errno));
+		goto fail_truncate;
+	}
+
+	tbl = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (tbl == MAP_FAILED) {
+		LOG("mmap() failed: %s", strerror(errno));
+		tbl = NULL;
+		goto fail_mmap;
+	}
+	close(fd);
+
+	/* file is new, all slots are zeroed */
+	tbl->version = STATUS_TABLE_VERSION;
+	tbl->slot_size = sizeof(struct status_table_slot);
+	tbl->nslots = conf->nslots;
+	atomic_store_explicit(&tbl->generation, 0, memory_order_relaxed);
+	atomic_store_explicit(&tbl->nused, 0, memory_order_relaxed);
+
+	for (i=0; i<conf->nslots; i++) {
+		free_slots[i] = conf->nslots - i - 1;
+	}
+	nfree = conf->nslots;
+
+	/* magic is written last, table is ready */
+	atomic_thread_fence(memory_order_release);
+	tbl->magic = STATUS_TABLE_MAGIC;
+
+	LOG("Status table '%s' created, %lu slots", conf->path, conf->nslots);
+
+	return 1;
+
+fail_mmap:
+fail_truncate:
+	close(fd);
+fail_open:
+	free(free_slots);
+	free_slots = NULL;
+fail_alloc:
+	return 0;
+}
+
+static void
+slot_write_begin(struct status_table_slot *s)
+{
+	uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void
+slot_write_end(struct status_table_slot *s)
+{
+	uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+	atomic_fetch_add_explicit(&tbl->generation, 1, memory_order_release);
+}
+
+ssize_t
+status_table_update(ssize_t slot, int is_overlim, const char *name,
+	const char *text, double val, double limit)
+{
+	struct status_table_slot *s;
+	struct timespec tmsp;
+	uint64_t time_ns;
+
+	if (!tbl) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME_COARSE, &tmsp);
+	time_ns = tmsp.tv_sec * 1e9 + tmsp.tv_nsec;
+
+	pthread_mutex_lock(&tbl_mtx);
+
+	if (slot < 0) {
+		/* new item */
+		if (nfree == 0) {
+			pthread_mutex_unlock(&tbl_mtx);
+			LOG("Status table is full, can't add '%s'", name);
+			return -1;
+		}
+		nfree--;
+		slot = free_slots[nfree];
+		atomic_fetch_add_explicit(&tbl->nused, 1,
+			memory_order_relaxed);
+
+		s = STATUS_TABLE_SLOT(tbl, slot);
+		slot_write_begin(s);
+		s->time_start_ns = time_ns;
+	} else {
+		s = STATUS_TABLE_SLOT(tbl, slot);
+		slot_write_begin(s);
+	}
+
+	s->state = is_overlim ? STATUS_SLOT_OVERLIMIT : STATUS_SLOT_UNDERLIMIT;
+	s->time_update_ns = time_ns;
+	s->val = val;
+	s->limit = limit;
+	strncpy(s->name, name, STATUS_TABLE_NAME_MAX - 1);
+	s->name[STATUS_TABLE_NAME_MAX - 1] = '\0';
+	strncpy(s->text, text, STATUS_TABLE_TEXT_MAX - 1);
+	s->text[STATUS_TABLE_TEXT_MAX - 1] = '\0';
+
+	slot_write_end(s);
+
+	pthread_mutex_unlock(&tbl_mtx);
+
+	return slot;
+}
+
+void
+status_table_remove(ssize_t slot)
+{
+	struct status_table_slot *s;
+
+	if (!tbl || (slot < 0)) {
+		return;
+	}
+
+	pthread_mutex_lock(&tbl_mtx);
+
+	s = STATUS_TABLE_SLOT(tbl, slot);
+	slot_write_begin(s);
+	s->state = STATUS_SLOT_FREE;
+	slot_write_end(s);
+
+	free_slots[nfree] = slot;
+	nfree++;
+	atomic_fetch_sub_explicit(&tbl->nused, 1, memory_order_relaxed);
+
+	pthread_mutex_unlock(&tbl_mtx);
+}
+
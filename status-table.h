@@ -0,0 +1,76 @@
+#ifndef status_table_h_included
+#define status_table_h_included
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+/*
+ * Memory-mapped table with overlimited/underlimited items
+ *
+ * Table is a file with header and fixed number of fixed-size slots.
+ * Header generation counter is incremented after each change in table.
+ * Each slot is protected by seqlock: writer increments seq before (seq
+ * becomes odd) and after (seq becomes even) update. Reader copies slot
+ * and retries if seq was odd or changed during copy.
+ */
+
+#define STATUS_TABLE_MAGIC 0x5845535454424c31ULL /* "XESTTBL1" */
+#define STATUS_TABLE_VERSION 1
+
+#define STATUS_TABLE_DEFAULT_SLOTS 16384
+#define STATUS_TABLE_DEFAULT_PATH "/var/lib/xenoeye/notifications/status.tbl"
+
+#define STATUS_TABLE_NAME_MAX 512
+#define STATUS_TABLE_TEXT_MAX 1024
+
+enum STATUS_SLOT_STATE
+{
+	STATUS_SLOT_FREE,
+	STATUS_SLOT_OVERLIMIT,
+	STATUS_SLOT_UNDERLIMIT
+};
+
+struct status_table_header
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t slot_size;
+	uint64_t nslots;
+	_Atomic uint64_t generation;
+	/* number of used slots */
+	_Atomic uint64_t nused;
+};
+
+struct status_table_slot
+{
+	_Atomic uint32_t seq;
+	uint32_t state;
+	uint64_t time_start_ns;
+	uint64_t time_update_ns;
+	double val;
+	double limit;
+	/* notification file name */
+	char name[STATUS_TABLE_NAME_MAX];
+	/* notification file content */
+	char text[STATUS_TABLE_TEXT_MAX];
+};
+
+struct status_table_conf
+{
+	int enabled;
+	char path[PATH_MAX];
+	size_t nslots;
+	/* write notification files too */
+	int keep_files;
+};
+
+#define STATUS_TABLE_SIZE(N) (sizeof(struct status_table_header)             \
+	+ (N) * sizeof(struct status_table_slot))
+
+#define STATUS_TABLE_SLOT(H, I) ((struct status_table_slot *)                 \
+	((uint8_t *)(H) + sizeof(struct status_table_header)                  \
+	+ (I) * sizeof(struct status_table_slot)))
+
+#endif
+
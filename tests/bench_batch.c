@@ -0,0 +1,458 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+#include "../filter.h"
+#include "../filter-index.h"
+#include "../filter-preds.h"
+#include "../flow-info.h"
+
+/*
+ * Filters of monitoring objects: flow by flow vs blocks of flows
+ *
+ * Tree of objects like in collector of ISP: parent objects are customer
+ * networks ("dst net 10.X.Y.0/24"), each has children with attack
+ * signatures (SYN flood, DNS and NTP amplification, ...). Children of all
+ * parents have the same basic filters.
+ *
+ * Modes:
+ *   flow    - filter_match() for each flow, as without shared basic filters
+ *   memo    - filter_match_memo(), basic filters are shared per flow
+ *   batch/N - filter_match_batch() for blocks of N flows, shared basic
+ *             filters over columns of block
+ *   rows/N  - the same blocks without columns
+ *
+ * Time of batch modes includes copying of fields to columns. For each matched
+ * flow counter of object is updated (emulation of aggregation).
+ *
+ * With -f percent of flows are a flood to one address of the first customer
+ * (UDP from port 123), the rest are random.
+ *
+ * Usage: bench_batch [-n flows] [-p parent objects] [-f flood percent]
+ *
+ * Output is tab-separated: name, flows, ns per flow, flows per second
+ */
+
+#define NFLOWS (1 << 16)
+#define MAX_PARENTS 32768
+
+static const char *children[] = {
+	"proto 6 and tcp-flags 2",
+	"proto 17 and src port 53",
+	"proto 17 and src port 123",
+	"proto 6 and (port 80 or 443)",
+	"proto 17 and not (port 53 or 123)",
+	"proto 1"
+};
+
+#define NCHILDREN (sizeof(children) / sizeof(children[0]))
+
+struct bench_object
+{
+	struct filter_expr *expr;
+	uint64_t octets;
+	struct filter_index *index;
+	size_t n_mo;
+	struct bench_object *mos;
+};
+
+static struct flow_info flows[NFLOWS];
+static struct bench_object *parents;
+static size_t nparents = 256;
+static unsigned int flood = 0;
+static struct filter_index *mo_index;
+static struct filter_preds *preds;
+static struct filter_memo *memo;
+static volatile uint64_t sink;
+
+static uint64_t rnd_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state;
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+report(const char *name, uint64_t ops, uint64_t ns)
+{
+	if (ns == 0) {
+		ns = 1;
+	}
+	printf("%s\t%lu\t%.2f\t%.0f\n", name, (unsigned long)ops,
+		(double)ns / ops, ops * 1e9 / ns);
+	fflush(stdout);
+}
+
+static void
+mkflood(struct flow_info *flow)
+{
+	uint32_t a;
+	uint16_t p;
+	uint64_t octets;
+
+	a = htobe32(0xc0000000 | (rnd() & 0xffffff));
+	memcpy(flow->ip4_src_addr, &a, sizeof(uint32_t));
+	a = htobe32(0x0a000001);
+	memcpy(flow->ip4_dst_addr, &a, sizeof(uint32_t));
+	flow->has_ip4_src_addr = 1;
+	flow->has_ip4_dst_addr = 1;
+
+	p = htobe16(123);
+	memcpy(flow->l4_src_port, &p, sizeof(uint16_t));
+	p = htobe16(1024 + rnd() % 60000);
+	memcpy(flow->l4_dst_port, &p, sizeof(uint16_t));
+	flow->has_l4_src_port = 1;
+	flow->has_l4_dst_port = 1;
+
+	flow->protocol[0] = 17;
+	flow->has_protocol = 1;
+	flow->has_tcp_flags = 1;
+
+	octets = htobe64(468);
+	memcpy(flow->in_bytes, &octets, sizeof(uint64_t));
+	flow->in_bytes_size = sizeof(uint64_t);
+	flow->has_in_bytes = 1;
+}
+
+static void
+mkflows(void)
+{
+	static const uint16_t ports[] = {53, 80, 123, 443, 8080, 40000};
+	static const uint8_t protos[] = {6, 6, 17, 17, 1};
+	size_t i;
+
+	for (i=0; i<NFLOWS; i++) {
+		struct flow_info *flow = &flows[i];
+		uint32_t a, c;
+		uint16_t p;
+		uint64_t octets;
+
+		memset(flow, 0, sizeof(struct flow_info));
+
+		if ((rnd() % 100) < flood) {
+			mkflood(flow);
+			continue;
+		}
+
+		a = htobe32(0xc0000000 | (rnd() & 0xffffff));
+		memcpy(flow->ip4_src_addr, &a, sizeof(uint32_t));
+		/*
+		 * half of flows are to customers, most of traffic is to few
+		 * big customers
+		 */
+		c = rnd() % (nparents * 2);
+		if (rnd() % 4) {
+			c %= 16;
+		}
+		a = htobe32(0x0a000000 | c << 8 | (rnd() & 0xff));
+		memcpy(flow->ip4_dst_addr, &a, sizeof(uint32_t));
+		flow->has_ip4_src_addr = 1;
+		flow->has_ip4_dst_addr = 1;
+
+		p = htobe16(ports[rnd() % 6]);
+		memcpy(flow->l4_src_port, &p, sizeof(uint16_t));
+		p = htobe16(ports[rnd() % 6]);
+		memcpy(flow->l4_dst_port, &p, sizeof(uint16_t));
+		flow->has_l4_src_port = 1;
+		flow->has_l4_dst_port = 1;
+
+		flow->protocol[0] = protos[rnd() % 5];
+		flow->has_protocol = 1;
+		flow->tcp_flags[0] = rnd() % 4;
+		flow->has_tcp_flags = 1;
+
+		octets = htobe64(64 + rnd() % 1400);
+		memcpy(flow->in_bytes, &octets, sizeof(uint64_t));
+		flow->in_bytes_size = sizeof(uint64_t);
+		flow->has_in_bytes = 1;
+	}
+}
+
+static struct filter_expr *
+mkexpr(const char *s)
+{
+	struct filter_input q;
+	struct filter_expr *e;
+
+	memset(&q, 0, sizeof(struct filter_input));
+	q.s = (char *)s;
+	e = parse_filter(&q);
+	if (!e) {
+		printf("Filter allocation failed\n");
+		return NULL;
+	}
+	if (q.error) {
+		printf("Parse error: %s\nFilter: %s\n", q.errmsg, s);
+		filter_free(e);
+		return NULL;
+	}
+	if (!filter_preds_add(preds, e)) {
+		printf("Can't add filter '%s'\n", s);
+		filter_free(e);
+		return NULL;
+	}
+
+	return e;
+}
+
+static int
+mkobjects(void)
+{
+	struct filter_expr **exprs;
+	size_t i, j;
+	char s[64];
+
+	preds = filter_preds_new();
+	parents = calloc(nparents, sizeof(struct bench_object));
+	exprs = calloc(nparents, sizeof(struct filter_expr *));
+	if (!preds || !parents || !exprs) {
+		printf("Can't allocate memory\n");
+		return 0;
+	}
+
+	for (i=0; i<nparents; i++) {
+		struct bench_object *mo = &parents[i];
+
+		sprintf(s, "dst net 10.%lu.%lu.0/24",
+			(unsigned long)i * 2 / 256, (unsigned long)i * 2 % 256);
+		mo->expr = exprs[i] = mkexpr(s);
+		mo->mos = calloc(NCHILDREN, sizeof(struct bench_object));
+		if (!mo->expr || !mo->mos) {
+			return 0;
+		}
+		mo->n_mo = NCHILDREN;
+
+		for (j=0; j<NCHILDREN; j++) {
+			mo->mos[j].expr = mkexpr(children[j]);
+			if (!mo->mos[j].expr) {
+				return 0;
+			}
+		}
+	}
+
+	mo_index = filter_index_new(exprs, nparents, 1);
+	free(exprs);
+	if (!mo_index) {
+		printf("Can't build index\n");
+		return 0;
+	}
+
+	if (!filter_preds_memo_init(preds, 1)) {
+		printf("Can't allocate memo\n");
+		return 0;
+	}
+	memo = filter_preds_memo(preds, 0);
+
+	return 1;
+}
+
+static void
+flow_rec(struct bench_object *mos, size_t n_mo, struct filter_index *idx,
+	struct flow_info *flow, struct filter_memo *m)
+{
+	size_t i;
+
+	for (i=filter_index_first(idx, 0, flow); i<n_mo;
+		i=filter_index_next(idx, 0, i)) {
+
+		struct bench_object *mo = &mos[i];
+		uint64_t octets;
+
+		if (!filter_match_memo(mo->expr, flow, m)) {
+			continue;
+		}
+
+		memcpy(&octets, flow->in_bytes, sizeof(uint64_t));
+		mo->octets += be64toh(octets);
+
+		if (mo->n_mo) {
+			flow_rec(mo->mos, mo->n_mo, mo->index, flow, m);
+		}
+	}
+}
+
+static void
+batch_rec(struct bench_object *mos, size_t n_mo, struct filter_index *idx,
+	struct filter_block *b, uint64_t mask)
+{
+	size_t i;
+
+	for (i=filter_index_first_batch(idx, 0, b, mask); i<n_mo;
+		i=filter_index_next(idx, 0, i)) {
+
+		struct bench_object *mo = &mos[i];
+		uint64_t match, m;
+
+		match = filter_index_rows(idx, 0, i, mask);
+		if (!match) {
+			continue;
+		}
+		match = filter_match_batch(mo->expr, b, match, memo);
+		if (!match) {
+			continue;
+		}
+
+		for (m=match; m; m&=m-1) {
+			uint64_t octets;
+
+			memcpy(&octets, b->flows[__builtin_ctzll(m)]->in_bytes,
+				sizeof(uint64_t));
+			mo->octets += be64toh(octets);
+		}
+
+		if (mo->n_mo) {
+			batch_rec(mo->mos, mo->n_mo, mo->index, b, match);
+		}
+	}
+}
+
+static uint64_t
+octets_total(void)
+{
+	size_t i, j;
+	uint64_t sum = 0;
+
+	for (i=0; i<nparents; i++) {
+		sum += parents[i].octets;
+		parents[i].octets = 0;
+		for (j=0; j<NCHILDREN; j++) {
+			sum += parents[i].mos[j].octets;
+			parents[i].mos[j].octets = 0;
+		}
+	}
+
+	return sum;
+}
+
+static uint64_t
+bench_flow(uint64_t n, int use_memo)
+{
+	uint64_t i, t1, t2;
+
+	t1 = now_ns();
+	for (i=0; i<n; i++) {
+		struct filter_memo *m = NULL;
+
+		if (use_memo) {
+			m = memo;
+			filter_memo_reset(m);
+		}
+		flow_rec(parents, nparents, mo_index,
+			&flows[i & (NFLOWS - 1)], m);
+	}
+	t2 = now_ns();
+
+	report(use_memo ? "memo" : "flow", n, t2 - t1);
+	return octets_total();
+}
+
+static uint64_t
+bench_batch(uint64_t n, size_t bsize, int use_columns)
+{
+	struct filter_block *b;
+	uint64_t i, t1, t2;
+	char name[32];
+
+	b = filter_block_new(use_columns ? preds->columns : NULL);
+	if (!b) {
+		printf("Can't allocate block\n");
+		return 0;
+	}
+
+	t1 = now_ns();
+	for (i=0; i<n; i+=bsize) {
+		size_t r, nrows = bsize;
+
+		if (nrows > n - i) {
+			nrows = n - i;
+		}
+		filter_block_reset(b);
+		for (r=0; r<nrows; r++) {
+			filter_block_add(b, &flows[(i + r) & (NFLOWS - 1)]);
+		}
+
+		filter_memo_reset_batch(memo);
+		batch_rec(parents, nparents, mo_index, b, filter_block_rows(b));
+	}
+	t2 = now_ns();
+
+	sprintf(name, "%s/%lu", use_columns ? "batch" : "rows",
+		(unsigned long)bsize);
+	report(name, n, t2 - t1);
+	filter_block_free(b);
+
+	return octets_total();
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t n = 4000000, expected;
+	size_t bsize;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:p:f:")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = strtoull(optarg, NULL, 10);
+				break;
+			case 'p':
+				nparents = atoi(optarg);
+				break;
+			case 'f':
+				flood = atoi(optarg);
+				break;
+			default:
+				printf("Usage: %s [-n flows] [-p parent objects] "
+					"[-f flood percent]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ((n == 0) || (nparents == 0) || (nparents > MAX_PARENTS)
+		|| (flood > 100)) {
+
+		printf("Incorrect number of flows or objects\n");
+		return EXIT_FAILURE;
+	}
+
+	mkflows();
+	if (!mkobjects()) {
+		return EXIT_FAILURE;
+	}
+
+	printf("# name\tflows\tns_per_flow\tflows_per_sec\n");
+	expected = bench_flow(n, 0);
+	if (bench_flow(n, 1) != expected) {
+		goto fail_result;
+	}
+	for (bsize=1; bsize<=FILTER_BATCH_MAX; bsize*=2) {
+		if ((bench_batch(n, bsize, 0) != expected)
+			|| (bench_batch(n, bsize, 1) != expected)) {
+
+			goto fail_result;
+		}
+	}
+
+	sink += expected;
+	return EXIT_SUCCESS;
+
+fail_result:
+	printf("Different results of modes\n");
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "../freqmap.h"
+
+/*
+ * Scaling of mfreq() function with number of threads
+ *
+ * Each thread does what mfreq(src port, dst port) does for each flow:
+ * compares frequencies of two ports and counts both. Most of flows have
+ * one of popular ports (53, 123, 443), so these counters are updated by all
+ * threads.
+ *
+ * Modes:
+ *   atomic  - one map for all threads with atomic increments (as before)
+ *   sharded - struct freqmap, per-thread shards and merged snapshot
+ *             (merged by separate thread, like housekeeping in collector)
+ *
+ * Usage: bench_mfreq [-t max threads] [-n flows per thread]
+ *
+ * Output is tab-separated: name, threads, flows, ns per flow (wall clock
+ * time of thread), flows per second (all threads)
+ */
+
+#define MAX_THREADS 256
+
+enum MODE
+{
+	MODE_ATOMIC,
+	MODE_SHARDED
+};
+
+static const char *mode_names[] = {"atomic", "sharded"};
+
+/* current run, set by main thread between barriers */
+static enum MODE mode;
+static size_t nactive;
+static uint64_t nflows = 10000000;
+static _Atomic uint64_t *atomic_map;
+static struct freqmap *fm;
+static int done = 0;
+static atomic_int merger_stop;
+
+static pthread_barrier_t barrier;
+static volatile uint64_t sink;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bench_flows(size_t idx)
+{
+	static const uint16_t popular[] = {53, 123, 443, 443};
+	uint64_t i, x = idx * 2654435761U + 1, sum = 0;
+
+	for (i=0; i<nflows; i++) {
+		uint16_t port1, port2;
+		uint64_t freq1, freq2;
+
+		/* xorshift, random flow */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+
+		/* server port and ephemeral client port */
+		port1 = popular[x & 3];
+		port2 = 32768 + ((x >> 8) & 0x7fff);
+		if (x & 0x10000) {
+			uint16_t tmp = port1;
+
+			port1 = port2;
+			port2 = tmp;
+		}
+
+		if (mode == MODE_ATOMIC) {
+			freq1 = atomic_load_explicit(&atomic_map[port1],
+				memory_order_relaxed);
+			freq2 = atomic_load_explicit(&atomic_map[port2],
+				memory_order_relaxed);
+			atomic_fetch_add_explicit(&atomic_map[port1], 1,
+				memory_order_relaxed);
+			atomic_fetch_add_explicit(&atomic_map[port2], 1,
+				memory_order_relaxed);
+		} else {
+			freq1 = freqmap_get(fm, port1);
+			freq2 = freqmap_get(fm, port2);
+			freqmap_add(fm, port1);
+			freqmap_add(fm, port2);
+		}
+
+		if (freq1 != freq2) {
+			sum += (freq1 > freq2) ? port1 : port2;
+		} else {
+			sum += (port1 < port2) ? port1 : port2;
+		}
+	}
+
+	sink += sum;
+}
+
+/* snapshots are merged more often than in collector (every second) */
+static void *
+merger_thread(void *p)
+{
+	(void)p;
+
+	while (!atomic_load(&merger_stop)) {
+		freqmap_merge_all();
+		usleep(250000);
+	}
+
+	return NULL;
+}
+
+/*
+ * threads are started once: shard of freqmap is bound to thread, like
+ * in collector, where processing threads live until exit
+ */
+static void *
+bench_thread(void *p)
+{
+	size_t idx = (size_t)p;
+
+	for (;;) {
+		pthread_barrier_wait(&barrier);
+		if (done) {
+			break;
+		}
+		if (idx < nactive) {
+			bench_flows(idx);
+		}
+		pthread_barrier_wait(&barrier);
+	}
+
+	return NULL;
+}
+
+static int
+run(enum MODE m, size_t n)
+{
+	uint64_t t1, t2;
+
+	if (m == MODE_ATOMIC) {
+		atomic_map = calloc(FREQMAP_SIZE, sizeof(uint64_t));
+		if (!atomic_map) {
+			printf("Can't allocate memory\n");
+			return 0;
+		}
+	} else {
+		fm = freqmap_new();
+		if (!fm) {
+			printf("Can't allocate memory\n");
+			return 0;
+		}
+	}
+	mode = m;
+	nactive = n;
+
+	pthread_barrier_wait(&barrier);
+	t1 = now_ns();
+	pthread_barrier_wait(&barrier);
+	t2 = now_ns();
+
+	printf("mfreq/%s\t%lu\t%lu\t%.2f\t%.0f\n", mode_names[m],
+		(unsigned long)n, (unsigned long)(nflows * n),
+		(double)(t2 - t1) / nflows,
+		(double)(nflows * n) / ((double)(t2 - t1) / 1e9));
+
+	free(atomic_map);
+	atomic_map = NULL;
+	freqmap_free(fm);
+	fm = NULL;
+
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	pthread_t tids[MAX_THREADS], merger;
+	size_t nthreads, n, i;
+	int opt, ret = EXIT_FAILURE;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > MAX_THREADS) {
+		nthreads = MAX_THREADS;
+	}
+
+	while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+		switch (opt) {
+			case 't':
+				nthreads = atoi(optarg);
+				break;
+			case 'n':
+				nflows = strtoull(optarg, NULL, 10);
+				break;
+			default:
+				printf("Usage: %s [-t max threads] "
+					"[-n flows per thread]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ((nthreads == 0) || (nthreads > MAX_THREADS) || (nflows == 0)) {
+		printf("Incorrect number of threads or flows\n");
+		return EXIT_FAILURE;
+	}
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i=0; i<nthreads; i++) {
+		pthread_create(&tids[i], NULL, &bench_thread, (void *)i);
+	}
+	pthread_create(&merger, NULL, &merger_thread, NULL);
+
+	printf("# name\tthreads\tflows\tns_per_flow\tflows_per_sec\n");
+	for (n=1; ; n*=2) {
+		if (n > nthreads) {
+			n = nthreads;
+		}
+
+		if (!run(MODE_ATOMIC, n) || !run(MODE_SHARDED, n)) {
+			goto fail_run;
+		}
+
+		if (n == nthreads) {
+			break;
+		}
+	}
+	ret = EXIT_SUCCESS;
+
+fail_run:
+	done = 1;
+	pthread_barrier_wait(&barrier);
+	for (i=0; i<nthreads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	atomic_store(&merger_stop, 1);
+	pthread_join(merger, NULL);
+
+	return ret;
+}
+
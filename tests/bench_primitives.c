@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "../xenoeye.h"
+#include "../filter.h"
+#include "../flow-info.h"
+#include "../monit-objects.h"
+#include "../iplist.h"
+#include "../geoip.h"
+#include "tkvdb.h"
+
+/*
+ * Microbenchmarks of hot primitives used by processing threads
+ *
+ *   filter/<mo>      - filter_match() on random flows, filters are taken
+ *                      from monitoring objects configs (lxc/mo by default)
+ *   iplist/match4    - lookup in IP list with large number of prefixes
+ *   iplist/load      - loading of this list from file
+ *   btrie/geo4       - IP_BTRIE_LOOKUP in geo database (geoip_lookup4())
+ *   btrie/as4        - the same in AS database (as_lookup4())
+ *   key/<field>      - monit_object_key_add_fld()
+ *   tkvdb/put        - insertion of new keys, like fwm does
+ *   tkvdb/get        - get and update of existing keys
+ *
+ * Each line of output is a tab-separated record "name ops ns_per_op
+ * ops_per_sec", lines started with '#' are comments. Geo databases are
+ * built by xemkgeodb from small fixtures, "make bench" does this.
+ *
+ * Usage: bench_primitives [-n iterations] [-m mo-dir] [-g geodb-dir]
+ *        [-p number of prefixes] [-k number of tkvdb keys]
+ */
+
+#define DEFAULT_MO_DIR "lxc/mo"
+#define DEFAULT_ITERATIONS (4 * 1024 * 1024)
+#define DEFAULT_PREFIXES (1000 * 1000)
+#define DEFAULT_KEYS (1000 * 1000)
+
+/* number of pre-generated flows, power of two */
+#define NFLOWS (64 * 1024)
+
+#define MAX_FILTERS 64
+
+/* key of fwm with 5-tuple */
+#define TKVDB_KEY_SIZE 13
+
+struct bench_filter
+{
+	char name[PATH_MAX];
+	struct filter_expr *expr;
+};
+
+static const char *key_fields[] = {
+	"src host",
+	"dst port",
+	"proto",
+	"tfstr(tcp-flags)",
+	"portstr(dst port)",
+	"asn(src host)",
+	"country_code(src host)"
+};
+
+static struct flow_info *flows;
+static uint32_t *prefixes;
+static size_t nprefixes;
+
+/* result of benchmarked functions goes here, so it can't be optimized out */
+static volatile uint64_t sink;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64* */
+static uint64_t
+rnd(void)
+{
+	static uint64_t s = 0x9e3779b97f4a7c15ULL;
+
+	s ^= s >> 12;
+	s ^= s << 25;
+	s ^= s >> 27;
+	return s * 2685821657736338717ULL;
+}
+
+static void
+report(const char *name, uint64_t ops, uint64_t ns)
+{
+	if (ns == 0) {
+		ns = 1;
+	}
+	printf("%s\t%lu\t%.2f\t%.0f\n", name, (unsigned long)ops,
+		(double)ns / ops, ops * 1e9 / ns);
+	fflush(stdout);
+}
+
+#define FLOW_SET(FLOW, FLD, V, SIZE)                                   \
+do {                                                                   \
+	uint64_t _v = htobe64(V);                                      \
+	memcpy((FLOW)->FLD, (uint8_t *)&_v + sizeof(uint64_t) - (SIZE),\
+		(SIZE));                                               \
+	(FLOW)->FLD##_size = (SIZE);                                   \
+	(FLOW)->has_##FLD = 1;                                         \
+} while (0)
+
+/* random IPv4 flows, half of them have destination in list of prefixes */
+static int
+flows_generate(void)
+{
+	static const uint8_t protos[] = {6, 6, 6, 17, 17, 1};
+	static const uint16_t ports[] = {0, 53, 80, 123, 443, 8080};
+	size_t i;
+
+	flows = calloc(NFLOWS, sizeof(struct flow_info));
+	if (!flows) {
+		printf("Can't allocate memory\n");
+		return 0;
+	}
+
+	for (i=0; i<NFLOWS; i++) {
+		struct flow_info *flow = &flows[i];
+		uint64_t r = rnd();
+		uint32_t src, dst;
+		uint8_t proto = protos[r % sizeof(protos)];
+
+		src = (uint32_t)rnd();
+		if ((r & 0x100) && nprefixes) {
+			dst = prefixes[rnd() % nprefixes] | (rnd() & 0xff);
+		} else {
+			dst = (uint32_t)rnd();
+		}
+
+		FLOW_SET(flow, ip4_src_addr, src, 4);
+		FLOW_SET(flow, ip4_dst_addr, dst, 4);
+		FLOW_SET(flow, protocol, proto, 1);
+		FLOW_SET(flow, l4_src_port, (r & 0x200) ?
+			ports[(r >> 16) % 6] : (r >> 24) & 0xffff, 2);
+		FLOW_SET(flow, l4_dst_port, (r & 0x400) ?
+			ports[(r >> 40) % 6] : (r >> 44) & 0xffff, 2);
+		FLOW_SET(flow, tcp_flags, proto == 6 ? (r >> 56) & 0x3f : 0, 1);
+		FLOW_SET(flow, in_bytes, 64 + (r >> 50), 8);
+		FLOW_SET(flow, in_pkts, 1 + ((r >> 20) & 0xf), 8);
+
+		flow->sampling_rate = 1;
+	}
+
+	return 1;
+}
+
+/* write file with random /24 prefixes and some /16 and /32 */
+static int
+iplist_generate(const char *dir)
+{
+	char path[PATH_MAX + 16];
+	FILE *f;
+	size_t i;
+
+	prefixes = malloc(nprefixes * sizeof(uint32_t));
+	if (!prefixes) {
+		printf("Can't allocate memory\n");
+		return 0;
+	}
+
+	sprintf(path, "%s/mynet", dir);
+	f = fopen(path, "w");
+	if (!f) {
+		printf("Can't create file '%s'\n", path);
+		return 0;
+	}
+
+	fprintf(f, "# generated by bench_primitives\n");
+	for (i=0; i<nprefixes; i++) {
+		uint32_t a = (uint32_t)rnd();
+		int mask;
+
+		switch (i % 16) {
+			case 0:
+				mask = 16;
+				break;
+			case 1:
+				mask = 32;
+				break;
+			default:
+				mask = 24;
+				break;
+		}
+		a &= mask == 32 ? 0xffffffff : ~(0xffffffffU >> mask);
+		prefixes[i] = a;
+
+		fprintf(f, "%u.%u.%u.%u/%d\n", a >> 24, (a >> 16) & 0xff,
+			(a >> 8) & 0xff, a & 0xff, mask);
+	}
+	fclose(f);
+
+	return 1;
+}
+
+static int
+bench_iplist(const char *dir, uint64_t n)
+{
+	struct iplist *l;
+	uint64_t i, t1, t2, matched = 0;
+
+	t1 = now_ns();
+	if (!iplists_load(dir)) {
+		printf("Can't load IP lists from '%s'\n", dir);
+		return 0;
+	}
+	t2 = now_ns();
+	report("iplist/load", nprefixes, t2 - t1);
+
+	l = iplist_get_by_name("mynet");
+	if (!l) {
+		printf("IP list 'mynet' not found\n");
+		return 0;
+	}
+
+	t1 = now_ns();
+	for (i=0; i<n; i++) {
+		uint32_t addr;
+
+		memcpy(&addr, flows[i & (NFLOWS - 1)].ip4_dst_addr,
+			sizeof(uint32_t));
+		matched += iplist_match4(l, addr);
+	}
+	t2 = now_ns();
+	report("iplist/match4", n, t2 - t1);
+
+	sink += matched;
+	return 1;
+}
+
+/* simple search of "filter": "..." in mo.conf, commented lines are skipped */
+static void
+filters_read_file(const char *path, const char *name,
+	struct bench_filter *filters, size_t *nfilters)
+{
+	FILE *f;
+	char line[4096];
+
+	f = fopen(path, "r");
+	if (!f) {
+		return;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *p, *end;
+		struct filter_input q;
+		struct bench_filter *bf;
+
+		p = strstr(line, "\"filter\"");
+		if (!p || strstr(line, "/*")) {
+			continue;
+		}
+		p = strchr(p + strlen("\"filter\""), '"');
+		if (!p) {
+			continue;
+		}
+		p++;
+		end = strchr(p, '"');
+		if (!end) {
+			continue;
+		}
+		*end = '\0';
+
+		if (*nfilters >= MAX_FILTERS) {
+			break;
+		}
+
+		bf = &filters[*nfilters];
+		memset(&q, 0, sizeof(struct filter_input));
+		q.s = p;
+		bf->expr = parse_filter(&q);
+		if (!bf->expr) {
+			continue;
+		}
+		if (q.error) {
+			printf("# %s: can't parse filter '%s': %s\n", name, p,
+				q.errmsg);
+			filter_free(bf->expr);
+			continue;
+		}
+		snprintf(bf->name, sizeof(bf->name), "filter/%s", name);
+		(*nfilters)++;
+	}
+
+	fclose(f);
+}
+
+static void
+filters_read_dir(const char *dir, const char *name,
+	struct bench_filter *filters, size_t *nfilters)
+{
+	DIR *d;
+	struct dirent *de;
+	char path[PATH_MAX * 2 + 16];
+
+	sprintf(path, "%s/mo.conf", dir);
+	if (*name) {
+		filters_read_file(path, name, filters, nfilters);
+	}
+
+	d = opendir(dir);
+	if (!d) {
+		return;
+	}
+
+	while ((de = readdir(d))) {
+		char subname[PATH_MAX * 2];
+		struct stat st;
+
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		sprintf(path, "%s/%s", dir, de->d_name);
+		if ((stat(path, &st) != 0) || !S_ISDIR(st.st_mode)) {
+			continue;
+		}
+		if (*name) {
+			sprintf(subname, "%s/%s", name, de->d_name);
+		} else {
+			strcpy(subname, de->d_name);
+		}
+		filters_read_dir(path, subname, filters, nfilters);
+	}
+	closedir(d);
+}
+
+static int
+bench_filters(const char *mo_dir, uint64_t n)
+{
+	static struct bench_filter filters[MAX_FILTERS];
+	size_t nfilters = 0, f;
+
+	filters_read_dir(mo_dir, "", filters, &nfilters);
+	if (nfilters == 0) {
+		printf("# no filters found in '%s'\n", mo_dir);
+		return 1;
+	}
+
+	for (f=0; f<nfilters; f++) {
+		uint64_t i, t1, t2, matched = 0;
+
+		t1 = now_ns();
+		for (i=0; i<n; i++) {
+			matched += filter_match(filters[f].expr,
+				&flows[i & (NFLOWS - 1)]);
+		}
+		t2 = now_ns();
+		report(filters[f].name, n, t2 - t1);
+
+		sink += matched;
+		filter_free(filters[f].expr);
+	}
+
+	return 1;
+}
+
+static void
+bench_btrie(const char *geodb_dir, uint64_t n)
+{
+	static struct xe_data data;
+	struct geoip_info *g;
+	struct as_info *a;
+	uint64_t i, t1, t2, found = 0;
+
+	strcpy(data.geodb_dir, geodb_dir);
+	geoip_reload(&data);
+
+	t1 = now_ns();
+	for (i=0; i<n; i++) {
+		uint32_t addr;
+
+		memcpy(&addr, flows[i & (NFLOWS - 1)].ip4_src_addr,
+			sizeof(uint32_t));
+		found += geoip_lookup4(addr, &g);
+	}
+	t2 = now_ns();
+	if (found == 0) {
+		printf("# geo database in '%s' is empty or not found\n",
+			geodb_dir);
+	}
+	report("btrie/geo4", n, t2 - t1);
+	sink += found;
+
+	found = 0;
+	t1 = now_ns();
+	for (i=0; i<n; i++) {
+		uint32_t addr;
+
+		memcpy(&addr, flows[i & (NFLOWS - 1)].ip4_src_addr,
+			sizeof(uint32_t));
+		found += as_lookup4(addr, &a);
+	}
+	t2 = now_ns();
+	if (found == 0) {
+		printf("# AS database in '%s' is empty or not found\n",
+			geodb_dir);
+	}
+	report("btrie/as4", n, t2 - t1);
+	sink += found;
+}
+
+static int
+bench_keys(uint64_t n)
+{
+	size_t k;
+	uint8_t key[1024];
+
+	for (k=0; k<sizeof(key_fields) / sizeof(key_fields[0]); k++) {
+		struct field fld;
+		char fldstr[256], err[ERR_MSG_LEN];
+		char name[300];
+		uint64_t i, t1, t2;
+
+		strcpy(fldstr, key_fields[k]);
+		if (!parse_field(fldstr, &fld, err)) {
+			printf("Can't parse field '%s': %s\n", key_fields[k],
+				err);
+			return 0;
+		}
+
+		t1 = now_ns();
+		for (i=0; i<n; i++) {
+			monit_object_key_add_fld(&fld, key,
+				&flows[i & (NFLOWS - 1)]);
+			sink += key[0];
+		}
+		t2 = now_ns();
+
+		sprintf(name, "key/%s", key_fields[k]);
+		report(name, n, t2 - t1);
+	}
+
+	return 1;
+}
+
+/* get/update/put of 5-tuple keys with two counters, as fwm does */
+static int
+bench_tkvdb(uint64_t n, size_t nkeys)
+{
+	tkvdb_tr *tr;
+	tkvdb_datum dtkey, dtval;
+	uint8_t key[TKVDB_KEY_SIZE];
+	uint64_t val[2];
+	uint64_t i, t1, t2, seed;
+
+	tr = tkvdb_tr_create(NULL, NULL);
+	if (!tr) {
+		printf("tkvdb_tr_create() failed\n");
+		return 0;
+	}
+	tr->begin(tr);
+
+	dtkey.data = key;
+	dtkey.size = TKVDB_KEY_SIZE;
+
+#define MK_KEY(I)                                                      \
+do {                                                                   \
+	struct flow_info *_f = &flows[(I) & (NFLOWS - 1)];             \
+	uint32_t _salt = (uint32_t)(I);                                \
+	memcpy(key, _f->ip4_src_addr, 4);                              \
+	memcpy(key + 4, &_salt, 4);                                    \
+	memcpy(key + 8, _f->l4_src_port, 2);                           \
+	memcpy(key + 10, _f->l4_dst_port, 2);                          \
+	key[12] = _f->protocol[0];                                     \
+} while (0)
+
+	/* fill */
+	t1 = now_ns();
+	for (i=0; i<nkeys; i++) {
+		int rc;
+
+		MK_KEY(i);
+		rc = tr->get(tr, &dtkey, &dtval);
+		if (rc == TKVDB_OK) {
+			uint64_t *vals = dtval.data;
+			vals[0] += 1;
+			vals[1] += 64;
+		} else if ((rc == TKVDB_EMPTY) || (rc == TKVDB_NOT_FOUND)) {
+			val[0] = 1;
+			val[1] = 64;
+			dtval.data = val;
+			dtval.size = sizeof(val);
+			if (tr->put(tr, &dtkey, &dtval) != TKVDB_OK) {
+				printf("tkvdb put failed after %lu keys\n",
+					(unsigned long)i);
+				tr->free(tr);
+				return 0;
+			}
+		}
+	}
+	t2 = now_ns();
+	report("tkvdb/put", nkeys, t2 - t1);
+
+	/* update of random existing keys */
+	t1 = now_ns();
+	for (i=0; i<n; i++) {
+		seed = rnd() % nkeys;
+		MK_KEY(seed);
+		if (tr->get(tr, &dtkey, &dtval) == TKVDB_OK) {
+			uint64_t *vals = dtval.data;
+			vals[0] += 1;
+			vals[1] += 64;
+		}
+	}
+	t2 = now_ns();
+	report("tkvdb/get", n, t2 - t1);
+#undef MK_KEY
+
+	tr->free(tr);
+	return 1;
+}
+
+static int
+rmdir_iplists(const char *dir)
+{
+	char path[PATH_MAX + 16];
+
+	sprintf(path, "%s/mynet", dir);
+	unlink(path);
+	return rmdir(dir) == 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	uint64_t n = DEFAULT_ITERATIONS;
+	size_t nkeys = DEFAULT_KEYS;
+	const char *mo_dir = DEFAULT_MO_DIR;
+	const char *geodb_dir = DEFAULT_GEODB_DIR;
+	char tmpdir[] = "/tmp/xe-bench-XXXXXX";
+	int ret = EXIT_FAILURE;
+
+	nprefixes = DEFAULT_PREFIXES;
+
+	while ((opt = getopt(argc, argv, "n:m:g:p:k:")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = strtoull(optarg, NULL, 10);
+				break;
+			case 'm':
+				mo_dir = optarg;
+				break;
+			case 'g':
+				geodb_dir = optarg;
+				break;
+			case 'p':
+				nprefixes = strtoull(optarg, NULL, 10);
+				break;
+			case 'k':
+				nkeys = strtoull(optarg, NULL, 10);
+				break;
+			default:
+				printf("Usage: %s [-n iterations] [-m mo-dir] "
+					"[-g geodb-dir] [-p prefixes] "
+					"[-k tkvdb keys]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ((n == 0) || (nprefixes == 0) || (nkeys == 0)) {
+		printf("Number of iterations, prefixes and keys must be "
+			"positive\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!mkdtemp(tmpdir)) {
+		printf("Can't create temporary directory\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("# iterations: %lu, prefixes: %lu, tkvdb keys: %lu\n",
+		(unsigned long)n, (unsigned long)nprefixes,
+		(unsigned long)nkeys);
+	printf("# name\tops\tns_per_op\tops_per_sec\n");
+
+	if (!iplist_generate(tmpdir)) {
+		goto fail;
+	}
+	if (!flows_generate()) {
+		goto fail;
+	}
+	if (!bench_iplist(tmpdir, n)) {
+		goto fail;
+	}
+	if (!bench_filters(mo_dir, n)) {
+		goto fail;
+	}
+	bench_btrie(geodb_dir, n);
+	if (!bench_keys(n)) {
+		goto fail;
+	}
+	if (!bench_tkvdb(n, nkeys)) {
+		goto fail;
+	}
+
+	ret = EXIT_SUCCESS;
+
+fail:
+	rmdir_iplists(tmpdir);
+	free(flows);
+	free(prefixes);
+
+	return ret;
+}
+
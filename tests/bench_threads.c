@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "../affinity.h"
+
+/*
+ * Benchmark for per-thread data layout, CPU pinning and NUMA-local memory
+ *
+ * Each thread emulates processing of flows by monitoring object: builds key
+ * in per-thread buffer, updates counters in per-thread slot and in its own
+ * large table (like tkvdb arena). Throughput is measured by wall clock, no
+ * performance counters required.
+ *
+ * Modes:
+ *   packed  - slots and key buffers are allocated as before, neighbour
+ *             threads share cache lines, table is touched by main thread
+ *   padded  - slots and buffers are cache line aligned
+ *   pinned  - padded, each thread is pinned to CPU from list
+ *   numa    - pinned, preferred memory policy is set to local node and
+ *             table is first touched by owner thread
+ *
+ * Usage: bench_threads [-t threads] [-c cpu-list] [-n flows per thread]
+ */
+
+#define MAX_THREADS 256
+#define KEY_SIZE 13
+#define TABLE_ITEMS (1024 * 1024)
+
+struct slot_packed
+{
+	void *_Atomic tr;
+	uint8_t *key;
+	uint64_t *val;
+	uint64_t nflows;
+};
+
+struct slot_padded
+{
+	_Alignas(CACHE_LINE_SIZE) void *_Atomic tr;
+	uint8_t *key;
+	uint64_t *val;
+	uint64_t nflows;
+};
+
+enum MODE
+{
+	MODE_PACKED,
+	MODE_PADDED,
+	MODE_PINNED,
+	MODE_NUMA
+};
+
+static const char *mode_names[] = {"packed", "padded", "pinned", "numa"};
+
+struct thread_arg
+{
+	size_t idx;
+	enum MODE mode;
+	uint64_t nflows;
+	struct affinity_conf *aff;
+
+	void *_Atomic *tr;
+	uint8_t *key;
+	uint64_t *val;
+	uint64_t *nflows_ptr;
+	uint64_t *table;
+};
+
+static pthread_barrier_t barrier;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+hash_key(const uint8_t *key)
+{
+	uint64_t h = 14695981039346656037ULL;
+	int i;
+
+	for (i=0; i<KEY_SIZE; i++) {
+		h = (h ^ key[i]) * 1099511628211ULL;
+	}
+
+	return h;
+}
+
+static void *
+bench_thread(void *p)
+{
+	struct thread_arg *arg = p;
+	uint64_t i, x = arg->idx * 2654435761U + 1;
+
+	if (arg->mode >= MODE_PINNED) {
+		affinity_thread(arg->aff, AFFINITY_WORKER, arg->idx);
+	}
+	if (arg->mode == MODE_NUMA) {
+		/* first touch by owner */
+		memset(arg->table, 0, TABLE_ITEMS * sizeof(uint64_t));
+	}
+
+	pthread_barrier_wait(&barrier);
+
+	for (i=0; i<arg->nflows; i++) {
+		uint64_t h;
+
+		/* xorshift, random flow */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+
+		memcpy(arg->key, &x, sizeof(uint64_t));
+		memcpy(arg->key + sizeof(uint64_t), &i,
+			KEY_SIZE - sizeof(uint64_t));
+
+		if (!atomic_load_explicit(arg->tr, memory_order_relaxed)) {
+			continue;
+		}
+
+		h = hash_key(arg->key);
+		arg->table[h % TABLE_ITEMS] += x & 0xffff;
+		arg->val[0] += x & 0xffff;
+		arg->val[1]++;
+		(*arg->nflows_ptr)++;
+	}
+
+	pthread_barrier_wait(&barrier);
+
+	return NULL;
+}
+
+static double
+run(enum MODE mode, size_t nthreads, uint64_t nflows,
+	struct affinity_conf *aff)
+{
+	struct thread_arg args[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	struct slot_packed *packed = NULL;
+	struct slot_padded *padded = NULL;
+	uint64_t t1, t2, total = 0;
+	size_t i;
+
+	if (mode == MODE_PACKED) {
+		packed = calloc(nthreads, sizeof(struct slot_packed));
+	} else {
+		padded = calloc_cl(nthreads, sizeof(struct slot_padded));
+	}
+
+	for (i=0; i<nthreads; i++) {
+		struct thread_arg *arg = &args[i];
+
+		arg->idx = i;
+		arg->mode = mode;
+		arg->nflows = nflows;
+		arg->aff = aff;
+
+		if (packed) {
+			packed[i].key = malloc(KEY_SIZE);
+			packed[i].val = calloc(2, sizeof(uint64_t));
+			atomic_store(&packed[i].tr, (void *)&packed[i]);
+			arg->tr = &packed[i].tr;
+			arg->key = packed[i].key;
+			arg->val = packed[i].val;
+			arg->nflows_ptr = &packed[i].nflows;
+		} else {
+			padded[i].key = malloc_cl(KEY_SIZE);
+			padded[i].val = calloc_cl(2, sizeof(uint64_t));
+			atomic_store(&padded[i].tr, (void *)&padded[i]);
+			arg->tr = &padded[i].tr;
+			arg->key = padded[i].key;
+			arg->val = padded[i].val;
+			arg->nflows_ptr = &padded[i].nflows;
+		}
+
+		arg->table = malloc(TABLE_ITEMS * sizeof(uint64_t));
+		if (!arg->table) {
+			printf("Can't allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+		if (mode != MODE_NUMA) {
+			/* allocated and touched by main thread */
+			memset(arg->table, 0, TABLE_ITEMS * sizeof(uint64_t));
+		}
+	}
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i=0; i<nthreads; i++) {
+		pthread_create(&tids[i], NULL, &bench_thread, &args[i]);
+	}
+
+	pthread_barrier_wait(&barrier);
+	t1 = now_ns();
+	pthread_barrier_wait(&barrier);
+	t2 = now_ns();
+
+	for (i=0; i<nthreads; i++) {
+		pthread_join(tids[i], NULL);
+		total += *args[i].nflows_ptr;
+		free(args[i].key);
+		free(args[i].val);
+		free(args[i].table);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	free(packed);
+	free(padded);
+
+	return (double)total / ((double)(t2 - t1) / 1e9) / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct affinity_conf aff;
+	size_t nthreads;
+	uint64_t nflows = 10000000;
+	double base = 0.0;
+	int opt, m;
+	char cpus_str[64];
+
+	memset(&aff, 0, sizeof(struct affinity_conf));
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > MAX_THREADS) {
+		nthreads = MAX_THREADS;
+	}
+
+	while ((opt = getopt(argc, argv, "t:c:n:")) != -1) {
+		switch (opt) {
+			case 't':
+				nthreads = atoi(optarg);
+				break;
+			case 'c':
+				if (!affinity_parse_cpus(optarg, &aff.workers)) {
+					printf("Incorrect list of CPUs '%s'\n",
+						optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'n':
+				nflows = strtoull(optarg, NULL, 10);
+				break;
+			default:
+				printf("Usage: %s [-t threads] [-c cpu-list] "
+					"[-n flows per thread]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ((nthreads == 0) || (nthreads > MAX_THREADS)) {
+		printf("Incorrect number of threads\n");
+		return EXIT_FAILURE;
+	}
+
+	if (aff.workers.n == 0) {
+		sprintf(cpus_str, "0-%ld", sysconf(_SC_NPROCESSORS_ONLN) - 1);
+		affinity_parse_cpus(cpus_str, &aff.workers);
+	}
+
+	printf("threads: %lu, flows per thread: %lu\n", nthreads, nflows);
+	for (m=MODE_PACKED; m<=MODE_NUMA; m++) {
+		double mflows;
+
+		aff.numa_local = (m == MODE_NUMA);
+		mflows = run(m, nthreads, nflows, &aff);
+
+		if (m == MODE_PACKED) {
+			base = mflows;
+		}
+		printf("%-8s %10.2f Mflows/s  %+6.1f%%\n", mode_names[m], mflows,
+			(mflows / base - 1.0) * 100.0);
+	}
+
+	return EXIT_SUCCESS;
+}
+
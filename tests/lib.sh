@@ -0,0 +1,217 @@
+# Common code of shell tests, sourced by tests/test_*.sh
+#
+# Temporary directory with config, running collector, NetFlow v5 packets
+# (UDP and pcap) and metrics. Tests set PORT, HTTP_PORT etc. before calling
+# functions which use them
+
+XENOEYE=${XENOEYE:-./xenoeye}
+XEGEN=${XEGEN:-./xegen}
+XETAP=${XETAP:-./xetap}
+
+# capture time of the first packet in pcap files, 2026-01-01 00:00:00
+TS=1767225600
+
+PID=
+
+# skip test (exit code 77) if program is not built or not installed
+require()
+{
+	local p
+
+	for p in "$@"; do
+		if ! command -v "$p" > /dev/null; then
+			echo "$p not found, skipping"
+			exit 77
+		fi
+	done
+}
+
+cleanup()
+{
+	if [ -n "$PID" ]; then
+		kill $PID 2>/dev/null
+	fi
+	# additional cleanup of test
+	if declare -F test_cleanup > /dev/null; then
+		test_cleanup
+	fi
+	rm -rf "$TMP"
+}
+
+# $TMP with directories used by collector, removed on exit
+setup_tmp()
+{
+	TMP=$(mktemp -d)
+	trap cleanup EXIT
+
+	mkdir -p "$TMP/mo" "$TMP/exp" "$TMP/notif" "$TMP/clsf" \
+		"$TMP/iplists" "$TMP/geoip"
+}
+
+# config $1 with directories in $TMP, export to $2, $3 - other keys
+write_conf()
+{
+	cat > "$1" << EOF
+{
+$3
+	"templates": {"db": "$TMP/templates.tkvdb"},
+	"mo-dir": "$TMP/mo",
+	"export-dir": "$2",
+	"notifications-dir": "$TMP/notif",
+	"clsf-dir": "$TMP/clsf",
+	"iplists-dir": "$TMP/iplists",
+	"geodb": "$TMP/geoip",
+	"db-export": ""
+}
+EOF
+}
+
+# NetFlow capture on loopback port $PORT
+capture_conf()
+{
+	echo "	\"capture\": ["
+	echo "		{\"socket\": {\"listen-on\": \"127.0.0.1\", \"port\": \"$PORT\"}}"
+	echo "	],"
+}
+
+# collector with $TMP/xenoeye.conf in background, log in $TMP/xenoeye.log
+start_daemon()
+{
+	"$XENOEYE" -c "$TMP/xenoeye.conf" > "$TMP/xenoeye.log" 2>&1 &
+	PID=$!
+	sleep 2
+	if ! kill -0 $PID 2>/dev/null; then
+		echo "xenoeye is not started"
+		cat "$TMP/xenoeye.log"
+		exit 77
+	fi
+}
+
+# SIGINT, wait up to 5 seconds
+stop_daemon()
+{
+	local i
+
+	kill -INT $PID
+	for i in $(seq 50); do
+		kill -0 $PID 2>/dev/null || break
+		sleep 0.1
+	done
+	wait $PID 2>/dev/null
+	PID=
+}
+
+le32()
+{
+	printf '\\x%02x\\x%02x\\x%02x\\x%02x' \
+		$(($1 & 255)) $(($1 >> 8 & 255)) \
+		$(($1 >> 16 & 255)) $(($1 >> 24 & 255))
+}
+
+be16()
+{
+	printf '\\x%02x\\x%02x' $(($1 >> 8 & 255)) $(($1 & 255))
+}
+
+be32()
+{
+	printf '\\x%02x\\x%02x\\x%02x\\x%02x' \
+		$(($1 >> 24 & 255)) $(($1 >> 16 & 255)) \
+		$(($1 >> 8 & 255)) $(($1 & 255))
+}
+
+# NetFlow v5 header: time $1, sequence $2, $3 records
+v5_header()
+{
+	# version, count, uptime, secs, nsecs, seq, engine, sampling
+	printf "\x00\x05$(be16 $3)\x00\x00\x00\x00$(be32 $1)\x00\x00\x00\x00$(be32 $2)\x00\x00\x00\x00"
+}
+
+# NetFlow v5 flow from address $1 (escaped bytes) to 10.0.0.1, $2 octets,
+# $3 packets
+v5_record()
+{
+	# src, dst, nexthop, in/out ifaces, packets, octets, first, last,
+	# ports, pad, flags, proto, tos, ASes, masks, pad
+	printf "$1\x0a\x00\x00\x01\x00\x00\x00\x00\x00\x01\x00\x02$(be32 $3)$(be32 $2)\x00\x00\x00\x00\x00\x00\x00\x00\x04\xd2\x00\x50\x00\x00\x11\x00\x00\x00\x00\x00\x18\x18\x00\x00"
+}
+
+# $1 packets with one flow of 1000000 octets from 10.1.2.3 to UDP $PORT
+send_v5()
+{
+	local i
+
+	for i in $(seq ${1:-1}); do
+		{
+			v5_header $(date +%s) $i 1
+			v5_record '\x0a\x01\x02\x03' 1000000 1000
+		} > "$TMP/packet.bin"
+		# one datagram
+		cat "$TMP/packet.bin" > /dev/udp/127.0.0.1/$PORT
+	done
+}
+
+# pcap file header, Ethernet link type
+pcap_header()
+{
+	printf "\xd4\xc3\xb2\xa1\x02\x00\x04\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff\x00\x00\x01\x00\x00\x00"
+}
+
+# pcap record with NetFlow v5 packet: time $1, sequence $2, $3 records,
+# records are written by caller with v5_record
+pcap_v5()
+{
+	local udp=$((8 + 24 + 48 * $3))
+	local cap=$((14 + 20 + udp))
+
+	# record header: time, captured and on wire length
+	printf "$(le32 $1)\x00\x00\x00\x00$(le32 $cap)$(le32 $cap)"
+	# Ethernet, IPv4 10.0.0.254 -> 10.0.0.1, UDP 2055 -> 2055
+	printf "\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x02\x08\x00"
+	printf "\x45\x00$(be16 $((20 + udp)))\x00\x00\x00\x00\x40\x11\x00\x00\x0a\x00\x00\xfe\x0a\x00\x00\x01"
+	printf "\x08\x07\x08\x07$(be16 $udp)\x00\x00"
+	v5_header $1 $2 $3
+}
+
+# replay $TMP/flows.pcap with $TMP/xenoeye$1.conf, export to $TMP/exp$1,
+# $2 - other keys of config; output in $TMP/out$1.txt and $TMP/err$1.txt
+replay()
+{
+	mkdir -p "$TMP/exp$1"
+	rm -f "$TMP/templates.tkvdb"
+
+	write_conf "$TMP/xenoeye$1.conf" "$TMP/exp$1" \
+		"$(printf '\t"capture": [],\n%s' "$2")"
+
+	if ! "$XENOEYE" -c "$TMP/xenoeye$1.conf" -r "$TMP/flows.pcap" \
+		> "$TMP/out$1.txt" 2> "$TMP/err$1.txt"; then
+
+		echo "replay failed"
+		cat "$TMP/err$1.txt"
+		exit 1
+	fi
+}
+
+# metrics from HTTP endpoint on $HTTP_PORT to $TMP/metrics.txt
+fetch_metrics()
+{
+	curl -s "http://127.0.0.1:$HTTP_PORT/metrics" > "$TMP/metrics.txt"
+}
+
+# sum of metric over all threads
+metric()
+{
+	grep "^xenoeye_$1" "$TMP/metrics.txt" | awk '{s += $NF} END {print s + 0}'
+}
+
+# compare metric $1 with $2, sets fail=1 on mismatch
+fail=0
+check()
+{
+	local v=$(metric "$1")
+
+	echo "$1: $v (expected $2)"
+	if [ "$v" != "$2" ]; then
+		fail=1
+	fi
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/env bash
+
+# Combiner of records of packet: the same results as without it
+#
+# Each NetFlow v5 packet has four flows, three of them from the same source,
+# replay pcap file with and without "combine" and compare fixed windows and
+# moving averages
+
+. "$(dirname "$0")/lib.sh"
+
+NPACKETS=20
+NRECORDS=4
+
+require "$XENOEYE"
+setup_tmp
+
+mkdir -p "$TMP/mo/test"
+
+cat > "$TMP/mo/test/mo.conf" << EOF
+{
+	"filter": "src net 10.1.0.0/16",
+	"fwm": [
+		{
+			"name": "bytes",
+			"time": 10,
+			"fields": ["src host", "octets", "packets"]
+		}
+	],
+	"mavg": [
+		{
+			"name": "bytes",
+			"time": 600,
+			"mem-m": 16,
+			"fields": ["src host", "octets"]
+		}
+	]
+}
+EOF
+
+{
+	pcap_header
+	for i in $(seq 0 $((NPACKETS - 1))); do
+		pcap_v5 $((TS + i)) $((i * NRECORDS)) $NRECORDS
+		v5_record '\x0a\x01\x02\x03' $((1000 + i)) 10
+		v5_record '\x0a\x01\x02\x04' 2000 10
+		v5_record '\x0a\x01\x02\x03' 3000 10
+		v5_record '\x0a\x01\x02\x03' 4000 10
+	done
+} > "$TMP/flows.pcap"
+
+replay 0 '	"combine": 0,'
+replay 8 '	"combine": 8,'
+
+if ! grep -q "^flows: $((NPACKETS * NRECORDS))$" "$TMP/out8.txt"; then
+	echo "expected $((NPACKETS * NRECORDS)) flows"
+	cat "$TMP/out8.txt" "$TMP/err8.txt"
+	exit 1
+fi
+
+if ! diff "$TMP/out0.txt" "$TMP/out8.txt"; then
+	echo "moving averages with combiner differ"
+	exit 1
+fi
+
+if ! diff -r "$TMP/exp0" "$TMP/exp8"; then
+	echo "exported windows with combiner differ"
+	exit 1
+fi
+
+exit 0
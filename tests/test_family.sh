@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+
+# Family of monitoring objects: tenant is found by address in map file
+#
+# Replay NetFlow v5 flows from three sources, two of them are in the tenant
+# map, and check that exported windows are keyed by tenant id
+
+. "$(dirname "$0")/lib.sh"
+
+NPACKETS=30
+
+require "$XENOEYE"
+setup_tmp
+
+mkdir -p "$TMP/mo/customers"
+
+cat > "$TMP/mo/customers/mo.conf" << EOF
+{
+	"filter": "tenant 1-2",
+	"family": {
+		"map": "tenants.txt",
+		"direction": "src"
+	},
+	"fwm": [
+		{
+			"name": "bytes",
+			"time": 10,
+			"fields": ["src host", "octets"]
+		}
+	]
+}
+EOF
+
+# 10.1.2.3 is in two networks, longer prefix wins
+cat > "$TMP/mo/customers/tenants.txt" << EOF
+# customers
+10.1.0.0/16	2
+10.1.2.0/24	1
+10.2.0.0/16	2
+2001:db8::/32	3
+EOF
+
+# flow sources: tenant 1, tenant 2, not in map
+SRCS=('\x0a\x01\x02\x03' '\x0a\x02\x03\x04' '\xc0\xa8\x01\x01')
+
+{
+	pcap_header
+	for i in $(seq 0 $((NPACKETS - 1))); do
+		pcap_v5 $((TS + i)) $i 1
+		v5_record "${SRCS[$((i % 3))]}" 1000000 1000
+	done
+} > "$TMP/flows.pcap"
+
+replay 1
+
+if ! grep -q "Tenant map .*: 4 networks" "$TMP/err1.txt"; then
+	echo "tenant map is not loaded"
+	cat "$TMP/err1.txt"
+	exit 1
+fi
+
+cat "$TMP/exp1"/*.sql > "$TMP/all.sql"
+
+if ! grep -Eq "[(,] *1 *, *'10\.1\.2\.3'" "$TMP/all.sql"; then
+	echo "no rows of tenant 1"
+	cat "$TMP/all.sql"
+	exit 1
+fi
+
+if ! grep -Eq "[(,] *2 *, *'10\.2\.3\.4'" "$TMP/all.sql"; then
+	echo "no rows of tenant 2"
+	cat "$TMP/all.sql"
+	exit 1
+fi
+
+if grep -q "192\.168\.1\.1" "$TMP/all.sql"; then
+	echo "flows without tenant are exported"
+	cat "$TMP/all.sql"
+	exit 1
+fi
+
+exit 0
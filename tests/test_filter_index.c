@@ -0,0 +1,427 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "../filter.h"
+#include "../filter-index.h"
+#include "../flow-info.h"
+
+/*
+ * Index of filters by address prefixes gives the same matched filters as
+ * matching of all filters, in the same order
+ *
+ * Random filters (list of prefixes, conjunctions and disjunctions with other
+ * fields, negations, etc.) are indexed together, as top-level monitoring
+ * objects, and matched against random flows
+ *
+ * For blocks of flows each row which matches filter is in mask of rows of
+ * candidate, with addresses from columns of block and from rows. Rows of
+ * block often have the same addresses
+ */
+
+#define NFILTERS 1200
+#define NFLOWS 20000
+#define MAX_LITERALS 20
+#define NBLOCKS 50
+
+/* prefixes from all filters, flows are generated near them */
+#define MAX_PREFIXES (NFILTERS * MAX_LITERALS * 2)
+
+struct prefix
+{
+	int v6;
+	uint8_t addr[16];
+	int mask;
+};
+
+static struct prefix prefixes[MAX_PREFIXES];
+static size_t nprefixes = 0;
+
+static uint64_t rnd_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state;
+}
+
+static void
+rnd_addr4(uint8_t *a)
+{
+	/* 10.0.0.0/8 */
+	uint32_t v = htobe32(0x0a000000 | (rnd() & 0x00ffffff));
+
+	memcpy(a, &v, sizeof(uint32_t));
+}
+
+static void
+rnd_addr6(uint8_t *a)
+{
+	/* 2001:db8::/32 */
+	memset(a, 0, 16);
+	a[0] = 0x20;
+	a[1] = 0x01;
+	a[2] = 0x0d;
+	a[3] = 0xb8;
+	a[4] = rnd() % 4;
+	a[5] = rnd() % 256;
+	a[15] = rnd() % 4;
+}
+
+/* address from random prefix of some filter or just random address */
+static void
+rnd_flow_addr(uint8_t *a, int v6)
+{
+	struct prefix *p;
+	size_t i, size = v6 ? 16 : 4;
+
+	if (v6) {
+		rnd_addr6(a);
+	} else {
+		rnd_addr4(a);
+	}
+
+	if ((nprefixes == 0) || (rnd() % 3 == 0)) {
+		return;
+	}
+
+	p = &prefixes[rnd() % nprefixes];
+	if (p->v6 != v6) {
+		return;
+	}
+
+	for (i=0; i<size; i++) {
+		int bits = p->mask - (int)i * 8;
+		uint8_t m;
+
+		if (bits >= 8) {
+			m = 0xff;
+		} else if (bits <= 0) {
+			m = 0;
+		} else {
+			m = 0xff << (8 - bits);
+		}
+		a[i] = (p->addr[i] & m) | (rnd() & ~m);
+	}
+}
+
+static void
+add_prefixes(char *s, const char *name, int v6, size_t n)
+{
+	size_t i;
+
+	strcat(s, name);
+	for (i=0; i<n; i++) {
+		struct prefix *p = &prefixes[nprefixes++];
+		char astr[INET6_ADDRSTRLEN], buf[128];
+
+		p->v6 = v6;
+		if (v6) {
+			rnd_addr6(p->addr);
+			p->mask = 32 + (int)(rnd() % 97);
+			inet_ntop(AF_INET6, p->addr, astr, sizeof(astr));
+		} else {
+			rnd_addr4(p->addr);
+			p->mask = 16 + (int)(rnd() % 17);
+			inet_ntop(AF_INET, p->addr, astr, sizeof(astr));
+		}
+
+		sprintf(buf, "%s%s/%d", i ? " or " : " ", astr, p->mask);
+		strcat(s, buf);
+	}
+}
+
+static void
+mkfilter(char *s)
+{
+	size_t n = 1 + rnd() % MAX_LITERALS;
+
+	s[0] = '\0';
+	switch (rnd() % 12) {
+		case 0:
+		case 1:
+		case 2:
+			/* most common: customer networks */
+			add_prefixes(s, "dst net", 0, n);
+			break;
+		case 3:
+			add_prefixes(s, "src net", 0, n);
+			break;
+		case 4:
+			add_prefixes(s, "net", 0, n);
+			strcat(s, " and port 53 or 443");
+			break;
+		case 5:
+			strcat(s, "proto 6 and (");
+			add_prefixes(s, "dst net", 0, n);
+			strcat(s, " or ");
+			add_prefixes(s, "src net6", 1, n);
+			strcat(s, ")");
+			break;
+		case 6:
+			add_prefixes(s, "dst net", 0, n);
+			strcat(s, " and not ");
+			add_prefixes(s, "src net", 0, 1);
+			break;
+		case 7:
+			add_prefixes(s, "dst net6", 1, n);
+			break;
+		case 8:
+			/* not indexed */
+			strcat(s, "not ");
+			add_prefixes(s, "dst net", 0, n);
+			break;
+		case 9:
+			/* not indexed */
+			strcat(s, "port 53 or ");
+			add_prefixes(s, "dst host", 0, 1);
+			break;
+		case 10:
+			strcat(s, "port 80 and ");
+			add_prefixes(s, "src host", 0, 1);
+			break;
+		default:
+			/* not indexed */
+			strcat(s, "proto 17");
+			break;
+	}
+}
+
+static void
+mkflow(struct flow_info *flow)
+{
+	static const uint16_t ports[] = {53, 80, 443, 8080};
+	uint16_t p1, p2;
+
+	memset(flow, 0, sizeof(struct flow_info));
+
+	if (rnd() % 4 == 0) {
+		rnd_flow_addr(flow->ip6_src_addr, 1);
+		rnd_flow_addr(flow->ip6_dst_addr, 1);
+		flow->has_ip6_src_addr = 1;
+		flow->has_ip6_dst_addr = 1;
+	} else {
+		rnd_flow_addr(flow->ip4_src_addr, 0);
+		rnd_flow_addr(flow->ip4_dst_addr, 0);
+		flow->has_ip4_src_addr = 1;
+		flow->has_ip4_dst_addr = 1;
+	}
+
+	p1 = htobe16(ports[rnd() % 4]);
+	p2 = htobe16(ports[rnd() % 4]);
+	memcpy(flow->l4_src_port, &p1, sizeof(uint16_t));
+	memcpy(flow->l4_dst_port, &p2, sizeof(uint16_t));
+	flow->has_l4_src_port = 1;
+	flow->has_l4_dst_port = 1;
+
+	flow->protocol[0] = (rnd() % 2) ? 6 : 17;
+	flow->has_protocol = 1;
+}
+
+static int
+check_block(struct filter_index *idx, struct filter_expr **exprs,
+	struct filter_block *b)
+{
+	static struct flow_info flows[FILTER_BATCH_MAX];
+	static uint64_t expected[NFILTERS];
+	size_t i, j, r;
+
+	for (i=0; i<NBLOCKS; i++) {
+		uint64_t mask;
+
+		filter_block_reset(b);
+		for (r=0; r<FILTER_BATCH_MAX; r++) {
+			if (r && (rnd() % 3 == 0)) {
+				/* flood to one address */
+				flows[r] = flows[r - 1];
+			} else {
+				mkflow(&flows[r]);
+			}
+			filter_block_add(b, &flows[r]);
+		}
+		mask = (i % 2) ? rnd() : filter_block_rows(b);
+
+		for (j=0; j<NFILTERS; j++) {
+			expected[j] = 0;
+			for (r=0; r<FILTER_BATCH_MAX; r++) {
+				if ((mask & (1ULL << r))
+					&& filter_match(exprs[j], &flows[r])) {
+
+					expected[j] |= 1ULL << r;
+				}
+			}
+		}
+
+		for (j=filter_index_first_batch(idx, 0, b, mask);
+			j<NFILTERS; j=filter_index_next(idx, 0, j)) {
+
+			uint64_t m = filter_index_rows(idx, 0, j, mask);
+
+			if ((m & expected[j]) != expected[j]) {
+				printf("Block %lu, filter %lu: matched rows "
+					"are not in mask\n", (unsigned long)i,
+					(unsigned long)j);
+				return 0;
+			}
+			expected[j] = 0;
+		}
+
+		for (j=0; j<NFILTERS; j++) {
+			if (expected[j]) {
+				printf("Block %lu, filter %lu matches, but it "
+					"is not a candidate\n",
+					(unsigned long)i, (unsigned long)j);
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int
+check_batch(struct filter_index *idx, struct filter_expr **exprs)
+{
+	uint64_t columns[(FILTER_NCOLUMNS + 63) / 64];
+	struct filter_block *b;
+	int ret;
+
+	/* addresses of "net" and "host6" filters in columns */
+	memset(columns, 0, sizeof(columns));
+	FILTER_BITMAP_SET(columns, FILTER_BASIC_NAME_NET * 2);
+	FILTER_BITMAP_SET(columns, FILTER_BASIC_NAME_NET * 2 + 1);
+	FILTER_BITMAP_SET(columns, FILTER_BASIC_NAME_HOST6 * 2);
+	FILTER_BITMAP_SET(columns, FILTER_BASIC_NAME_HOST6 * 2 + 1);
+
+	b = filter_block_new(columns);
+	if (!b) {
+		printf("Can't allocate block\n");
+		return 0;
+	}
+	ret = check_block(idx, exprs, b);
+	filter_block_free(b);
+	if (!ret) {
+		return 0;
+	}
+
+	b = filter_block_new(NULL);
+	if (!b) {
+		printf("Can't allocate block\n");
+		return 0;
+	}
+	ret = check_block(idx, exprs, b);
+	filter_block_free(b);
+
+	return ret;
+}
+
+int
+main()
+{
+	static char s[MAX_LITERALS * 2 * 64 + 128];
+	static struct filter_expr *exprs[NFILTERS];
+	static int expected[NFILTERS];
+	struct filter_index *idx;
+	size_t i, j, nmatched = 0, ncandidates = 0;
+	int ret = EXIT_FAILURE;
+
+	for (i=0; i<NFILTERS; i++) {
+		struct filter_input q;
+
+		mkfilter(s);
+		memset(&q, 0, sizeof(struct filter_input));
+		q.s = s;
+		exprs[i] = parse_filter(&q);
+		if (!exprs[i]) {
+			printf("Filter allocation failed\n");
+			return EXIT_FAILURE;
+		}
+		if (q.error) {
+			printf("Parse error: %s\nFilter: %s\n", q.errmsg, s);
+			return EXIT_FAILURE;
+		}
+	}
+
+	idx = filter_index_new(exprs, NFILTERS, 1);
+	if (!idx) {
+		printf("Can't build index\n");
+		goto fail_idx;
+	}
+
+	/* ~3/4 of filters are indexed */
+	if (idx->nindexed < NFILTERS / 2) {
+		printf("Only %lu of %d filters are indexed\n",
+			(unsigned long)idx->nindexed, NFILTERS);
+		goto fail_match;
+	}
+
+	for (i=0; i<NFLOWS; i++) {
+		struct flow_info flow;
+		size_t prev = 0;
+		int first = 1;
+
+		mkflow(&flow);
+
+		for (j=0; j<NFILTERS; j++) {
+			expected[j] = filter_match(exprs[j], &flow);
+		}
+
+		for (j=filter_index_first(idx, 0, &flow); j<NFILTERS;
+			j=filter_index_next(idx, 0, j)) {
+
+			if (!first && (j <= prev)) {
+				printf("Candidates are not ordered: %lu after "
+					"%lu\n", (unsigned long)j,
+					(unsigned long)prev);
+				goto fail_match;
+			}
+			first = 0;
+			prev = j;
+			ncandidates++;
+
+			if (filter_match(exprs[j], &flow) != expected[j]) {
+				printf("Filter %lu: different result\n",
+					(unsigned long)j);
+				goto fail_match;
+			}
+			/* mark as seen */
+			if (expected[j]) {
+				expected[j] = 2;
+				nmatched++;
+			}
+		}
+
+		for (j=0; j<NFILTERS; j++) {
+			if (expected[j] == 1) {
+				printf("Filter %lu matches, but it is not a "
+					"candidate\n", (unsigned long)j);
+				filter_dump(exprs[j], stdout);
+				goto fail_match;
+			}
+		}
+	}
+
+	if (!check_batch(idx, exprs)) {
+		goto fail_match;
+	}
+
+	printf("%d filters (%lu indexed), %d flows, %lu candidates, "
+		"%lu matched\n", NFILTERS, (unsigned long)idx->nindexed,
+		NFLOWS, (unsigned long)ncandidates, (unsigned long)nmatched);
+
+	ret = EXIT_SUCCESS;
+
+fail_match:
+	filter_index_free(idx);
+fail_idx:
+	for (i=0; i<NFILTERS; i++) {
+		filter_free(exprs[i]);
+	}
+
+	return ret;
+}
+
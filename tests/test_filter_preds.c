@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "../filter.h"
+#include "../filter-preds.h"
+#include "../flow-info.h"
+
+/*
+ * Filters with shared basic filters give the same results with memo as
+ * without it, each distinct basic filter is evaluated at most once per flow
+ *
+ * Filters are random combinations of basic filters from small pool, so many
+ * of them are repeated in different filters and in the same filter
+ *
+ * Filters for blocks of flows (filter_match_batch()) give the same rows as
+ * filters for each flow, with shared leaves evaluated over columns of block
+ * and with rows only
+ */
+
+#define NFILTERS 300
+#define NFLOWS 20000
+#define MAX_TERMS 6
+#define NBLOCKS 300
+
+static uint64_t rnd_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state;
+}
+
+static const char *leaves[] = {
+	"proto 6",
+	"proto 17",
+	"proto 6 or 17",
+	"dst net 10.0.0.0/8",
+	"dst net 10.1.0.0/16",
+	"src net 10.1.0.0/16",
+	"net 10.2.0.0/16",
+	"dst host 10.1.2.3",
+	"port 53",
+	"dst port 53",
+	"src port 123",
+	"port 80 or 443",
+	"port 1 or 2 or 3 or 4 or 5 or 6 or 7 or 443",
+	"dst net 10.0.0.0/16 or 10.2.0.0/16 or 10.4.0.0/16 or 10.5.0.0/16 "
+		"or 10.6.0.0/16 or 10.7.0.0/16 or 10.8.0.0/16 or 10.9.0.0/16",
+	"tcp-flags 2",
+	"dev-mark 1-3",
+	"dst net6 2001:db8::/32",
+	"net6 2001:db8::/32",
+	"tenant 1",
+	"tenant 2-5"
+};
+
+#define NLEAVES (sizeof(leaves) / sizeof(leaves[0]))
+
+static void
+mkfilter(char *s)
+{
+	size_t i, n = 1 + rnd() % MAX_TERMS;
+
+	s[0] = '\0';
+	for (i=0; i<n; i++) {
+		if (i) {
+			strcat(s, (rnd() % 2) ? " and " : " or ");
+		}
+		if (rnd() % 5 == 0) {
+			strcat(s, "not ");
+		}
+		strcat(s, "(");
+		strcat(s, leaves[rnd() % NLEAVES]);
+		strcat(s, ")");
+	}
+}
+
+static void
+mkflow(struct flow_info *flow)
+{
+	static const uint16_t ports[] = {53, 80, 123, 443};
+	uint16_t p1, p2;
+	uint32_t a, mark, tenant;
+
+	memset(flow, 0, sizeof(struct flow_info));
+
+	if (rnd() % 4 == 0) {
+		flow->ip6_src_addr[0] = 0x20;
+		flow->ip6_src_addr[1] = 0x01;
+		flow->ip6_dst_addr[0] = 0x20;
+		flow->ip6_dst_addr[1] = 0x01;
+		flow->ip6_dst_addr[2] = (rnd() % 2) ? 0x0d : 0x0e;
+		flow->ip6_dst_addr[3] = 0xb8;
+		flow->has_ip6_src_addr = 1;
+		flow->has_ip6_dst_addr = 1;
+	} else {
+		a = htobe32(0x0a000000 | (rnd() % 4) << 16 | (rnd() & 0xffff));
+		memcpy(flow->ip4_src_addr, &a, sizeof(uint32_t));
+		a = htobe32(((rnd() % 8) ? 0x0a000000 : 0xc0000000)
+			| (rnd() % 4) << 16 | 0x0203);
+		memcpy(flow->ip4_dst_addr, &a, sizeof(uint32_t));
+		flow->has_ip4_src_addr = 1;
+		flow->has_ip4_dst_addr = 1;
+	}
+
+	p1 = htobe16(ports[rnd() % 4]);
+	p2 = htobe16(ports[rnd() % 4]);
+	memcpy(flow->l4_src_port, &p1, sizeof(uint16_t));
+	memcpy(flow->l4_dst_port, &p2, sizeof(uint16_t));
+	flow->has_l4_src_port = 1;
+	flow->has_l4_dst_port = 1;
+
+	flow->protocol[0] = (rnd() % 2) ? 6 : 17;
+	flow->has_protocol = 1;
+	flow->tcp_flags[0] = rnd() % 4;
+	flow->has_tcp_flags = 1;
+
+	mark = htobe32(rnd() % 5);
+	memcpy(flow->dev_mark, &mark, sizeof(uint32_t));
+	flow->dev_mark_size = sizeof(uint32_t);
+	flow->has_dev_mark = 1;
+
+	tenant = htobe32(rnd() % 6);
+	memcpy(flow->tenant, &tenant, sizeof(uint32_t));
+	flow->tenant_size = sizeof(uint32_t);
+	flow->has_tenant = 1;
+}
+
+static int
+check_block(struct filter_expr **exprs, struct filter_memo *memo,
+	struct filter_block *b)
+{
+	static struct flow_info flows[FILTER_BATCH_MAX];
+	size_t i, j, r;
+
+	for (i=0; i<NBLOCKS; i++) {
+		size_t n = (i % 5 == 0) ? 1 + rnd() % FILTER_BATCH_MAX
+			: FILTER_BATCH_MAX;
+		uint64_t mask;
+
+		filter_block_reset(b);
+		for (r=0; r<n; r++) {
+			mkflow(&flows[r]);
+			filter_block_add(b, &flows[r]);
+		}
+		mask = (i % 3 == 0) ? filter_block_rows(b)
+			: rnd() & filter_block_rows(b);
+		filter_memo_reset_batch(memo);
+
+		for (j=0; j<NFILTERS; j++) {
+			uint64_t expected = 0, res, res_memo;
+
+			if (j % 7 == 0) {
+				uint32_t tenant = htobe32(j % 6);
+
+				for (r=0; r<n; r++) {
+					memcpy(flows[r].tenant, &tenant,
+						sizeof(uint32_t));
+				}
+			}
+
+			for (r=0; r<n; r++) {
+				if ((mask & (1ULL << r))
+					&& filter_match(exprs[j], &flows[r])) {
+
+					expected |= 1ULL << r;
+				}
+			}
+
+			res = filter_match_batch(exprs[j], b, mask, NULL);
+			/* children see only part of rows */
+			res_memo = filter_match_batch(exprs[j], b,
+				(j % 2) ? mask : (mask & 0xffff0000ffffULL),
+				memo);
+			if (!(j % 2)) {
+				expected &= 0xffff0000ffffULL;
+				res &= 0xffff0000ffffULL;
+			}
+
+			if ((res != expected) || (res_memo != expected)) {
+				printf("Block %lu, filter %lu%s: different "
+					"rows\n", (unsigned long)i,
+					(unsigned long)j,
+					b->data ? " (columns)" : "");
+				filter_dump(exprs[j], stdout);
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int
+check_batch(struct filter_expr **exprs, struct filter_preds *preds,
+	struct filter_memo *memo)
+{
+	struct filter_block *b;
+	int ret;
+
+	/* shared leaves over columns */
+	b = filter_block_new(preds->columns);
+	if (!b) {
+		printf("Can't allocate block\n");
+		return 0;
+	}
+	if (!b->data) {
+		printf("No columns in block\n");
+		filter_block_free(b);
+		return 0;
+	}
+	ret = check_block(exprs, memo, b);
+	filter_block_free(b);
+	if (!ret) {
+		return 0;
+	}
+
+	/* rows only */
+	b = filter_block_new(NULL);
+	if (!b) {
+		printf("Can't allocate block\n");
+		return 0;
+	}
+	ret = check_block(exprs, memo, b);
+	filter_block_free(b);
+
+	return ret;
+}
+
+int
+main()
+{
+	static char s[MAX_TERMS * 64];
+	static struct filter_expr *exprs[NFILTERS];
+	struct filter_preds *preds;
+	struct filter_memo *memo;
+	size_t i, j, nmatched = 0;
+	uint64_t nleaves = 0, nevals = 0;
+	int ret = EXIT_FAILURE;
+
+	for (i=0; i<NFILTERS; i++) {
+		struct filter_input q;
+
+		mkfilter(s);
+		memset(&q, 0, sizeof(struct filter_input));
+		q.s = s;
+		exprs[i] = parse_filter(&q);
+		if (!exprs[i]) {
+			printf("Filter allocation failed\n");
+			return EXIT_FAILURE;
+		}
+		if (q.error) {
+			printf("Parse error: %s\nFilter: %s\n", q.errmsg, s);
+			return EXIT_FAILURE;
+		}
+	}
+
+	preds = filter_preds_new();
+	if (!preds) {
+		printf("Can't create table of predicates\n");
+		goto fail_preds;
+	}
+
+	for (i=0; i<NFILTERS; i++) {
+		if (!filter_preds_add(preds, exprs[i])) {
+			printf("Can't add filter %lu\n", (unsigned long)i);
+			goto fail_add;
+		}
+	}
+
+	/* tenant leaves are not shared */
+	if (preds->n > NLEAVES - 2) {
+		printf("%lu distinct predicates, expected at most %lu\n",
+			(unsigned long)preds->n, (unsigned long)NLEAVES - 2);
+		goto fail_add;
+	}
+
+	if (!filter_preds_memo_init(preds, 2)) {
+		printf("Can't allocate memo\n");
+		goto fail_add;
+	}
+	memo = filter_preds_memo(preds, 1);
+
+	for (i=0; i<NFLOWS; i++) {
+		struct flow_info flow;
+		uint64_t flow_nevals;
+
+		mkflow(&flow);
+		filter_memo_reset(memo);
+
+		for (j=0; j<NFILTERS; j++) {
+			int expected, res;
+
+			/* tenant is set per object in daemon */
+			if (j % 7 == 0) {
+				uint32_t tenant = htobe32(j % 6);
+
+				memcpy(flow.tenant, &tenant, sizeof(uint32_t));
+			}
+
+			expected = filter_match(exprs[j], &flow);
+			res = filter_match_memo(exprs[j], &flow, memo);
+			if (res != expected) {
+				printf("Filter %lu: different result\n",
+					(unsigned long)j);
+				filter_dump(exprs[j], stdout);
+				goto fail_add;
+			}
+			nmatched += res;
+		}
+
+		/* not shared leaves are evaluated each time */
+		flow_nevals = memo->nevals;
+		for (j=0; j<NFILTERS; j++) {
+			size_t k;
+
+			for (k=0; k<exprs[j]->n; k++) {
+				struct filter_op *op = &exprs[j]->filter[k];
+
+				if ((op->op == FILTER_OP_BASIC) && !op->pred) {
+					flow_nevals--;
+				}
+			}
+		}
+		if (flow_nevals > preds->n) {
+			printf("%lu shared predicates are evaluated, only %lu "
+				"exist\n", (unsigned long)flow_nevals,
+				(unsigned long)preds->n);
+			goto fail_add;
+		}
+
+		nleaves += memo->nleaves;
+		nevals += memo->nevals;
+	}
+
+	if (nleaves != preds->nleaves * NFLOWS) {
+		printf("%lu basic filters checked, expected %lu\n",
+			(unsigned long)nleaves,
+			(unsigned long)(preds->nleaves * NFLOWS));
+		goto fail_add;
+	}
+
+	if (!check_batch(exprs, preds, memo)) {
+		goto fail_add;
+	}
+
+	printf("%d filters, %lu basic filters, %lu shared, %d flows, "
+		"%lu matched, %.2f of %.2f basic filters evaluated per flow\n",
+		NFILTERS, (unsigned long)preds->nleaves,
+		(unsigned long)preds->n, NFLOWS, (unsigned long)nmatched,
+		(double)nevals / NFLOWS, (double)nleaves / NFLOWS);
+
+	ret = EXIT_SUCCESS;
+
+fail_add:
+	filter_preds_free(preds);
+fail_preds:
+	for (i=0; i<NFILTERS; i++) {
+		filter_free(exprs[i]);
+	}
+
+	return ret;
+}
+
@@ -0,0 +1,367 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "../filter.h"
+#include "../flow-info.h"
+
+/*
+ * Compiled sets of literals (bitmaps, sorted ranges, prefix trie) give the
+ * same results as linear scan over literals
+ *
+ * Random filters with up to MAX_LITERALS values, ranges or networks are
+ * matched against random flows. Expected result is computed here from
+ * literals (fb->data), in the same way as filter_basic_match() did before
+ * compilation
+ */
+
+#define NFILTERS 300
+#define NFLOWS 2000
+#define MAX_LITERALS 300
+
+enum KIND
+{
+	KIND_PORT,
+	KIND_AS,
+	KIND_NET,
+	KIND_NET6
+};
+
+struct test_filter
+{
+	const char *text;
+	enum KIND kind;
+	int dir;
+};
+
+static const struct test_filter tests[] = {
+	{"dst port",   KIND_PORT, FILTER_BASIC_DIR_DST},
+	{"port",       KIND_PORT, FILTER_BASIC_DIR_BOTH},
+	{"src as",     KIND_AS,   FILTER_BASIC_DIR_SRC},
+	{"as",         KIND_AS,   FILTER_BASIC_DIR_BOTH},
+	{"dst net",    KIND_NET,  FILTER_BASIC_DIR_DST},
+	{"net",        KIND_NET,  FILTER_BASIC_DIR_BOTH},
+	{"src net6",   KIND_NET6, FILTER_BASIC_DIR_SRC},
+	{"net6",       KIND_NET6, FILTER_BASIC_DIR_BOTH},
+};
+
+static uint64_t rnd_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state;
+}
+
+/* values from small pool, so flows hit literals and their borders */
+static uint32_t
+rnd_int(enum KIND kind)
+{
+	if (kind == KIND_PORT) {
+		return rnd() % 2 ? rnd() % 1024 : rnd() % 65536;
+	}
+	return rnd() % 2 ? rnd() % 4096 : (uint32_t)rnd();
+}
+
+static uint32_t
+rnd_addr4(void)
+{
+	/* 10.0.0.0/12 */
+	return htobe32(0x0a000000 | (rnd() & 0x000fffff));
+}
+
+static void
+rnd_addr6(uint8_t *a)
+{
+	/* 2001:db8::/32, first bytes after prefix are random in small pool */
+	memset(a, 0, 16);
+	a[0] = 0x20;
+	a[1] = 0x01;
+	a[2] = 0x0d;
+	a[3] = 0xb8;
+	a[4] = rnd() % 4;
+	a[5] = rnd() % 256;
+	a[15] = rnd() % 4;
+}
+
+static void
+add_literal(char *s, enum KIND kind)
+{
+	char buf[128];
+
+	if (kind == KIND_PORT || kind == KIND_AS) {
+		uint32_t v = rnd_int(kind);
+
+		if (rnd() % 3 == 0) {
+			sprintf(buf, "%u-%u", v, v + (uint32_t)(rnd() % 200));
+		} else {
+			sprintf(buf, "%u", v);
+		}
+	} else if (kind == KIND_NET) {
+		uint32_t a = rnd_addr4();
+		char astr[INET_ADDRSTRLEN];
+
+		inet_ntop(AF_INET, &a, astr, sizeof(astr));
+		sprintf(buf, "%s/%d", astr, 8 + (int)(rnd() % 25));
+	} else {
+		uint8_t a[16];
+		char astr[INET6_ADDRSTRLEN];
+
+		rnd_addr6(a);
+		inet_ntop(AF_INET6, a, astr, sizeof(astr));
+		sprintf(buf, "%s/%d", astr, 16 + (int)(rnd() % 113));
+	}
+
+	strcat(s, buf);
+}
+
+/* value near border of random literal */
+static int
+near_literal_int(struct filter_basic *fb, int v)
+{
+	struct int_range *r;
+
+	if (rnd() % 2) {
+		return v;
+	}
+
+	r = &fb->data[rnd() % fb->n].data.range;
+	switch (rnd() % 4) {
+		case 0:
+			return r->low;
+		case 1:
+			return r->high;
+		case 2:
+			return r->low - 1;
+		default:
+			return r->high + 1;
+	}
+}
+
+/* random address from random network of filter */
+static void
+near_literal_addr(struct filter_basic *fb, uint8_t *a, size_t size)
+{
+	struct filter_basic_data *d;
+	size_t i;
+
+	if (rnd() % 2) {
+		return;
+	}
+
+	d = &fb->data[rnd() % fb->n];
+	for (i=0; i<size; i++) {
+		uint8_t *addr, *mask;
+
+		if (size == sizeof(uint32_t)) {
+			addr = (uint8_t *)&d->data.ip.ip.v4.addr;
+			mask = (uint8_t *)&d->data.ip.ip.v4.mask;
+		} else {
+			addr = (uint8_t *)&d->data.ip.ip.v6.addr;
+			mask = (uint8_t *)&d->data.ip.ip.v6.mask;
+		}
+		a[i] = addr[i] | (rnd() & ~mask[i]);
+	}
+}
+
+static int
+expected_int(struct filter_basic *fb, int r1, int r2)
+{
+	size_t i;
+
+	for (i=0; i<fb->n; i++) {
+		struct int_range *r = &fb->data[i].data.range;
+
+		if ((r1 >= r->low) && (r1 <= r->high)) {
+			return 1;
+		}
+		if ((fb->direction == FILTER_BASIC_DIR_BOTH)
+			&& (r2 >= r->low) && (r2 <= r->high)) {
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+expected_addr4(struct filter_basic *fb, uint32_t a1, uint32_t a2)
+{
+	size_t i;
+
+	for (i=0; i<fb->n; i++) {
+		struct ip_addr_and_mask_4 *ip = &fb->data[i].data.ip.ip.v4;
+
+		if ((a1 & ip->mask) == ip->addr) {
+			return 1;
+		}
+		if ((fb->direction == FILTER_BASIC_DIR_BOTH)
+			&& ((a2 & ip->mask) == ip->addr)) {
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+expected_addr6(struct filter_basic *fb, xe_ip a1, xe_ip a2)
+{
+	size_t i;
+
+	for (i=0; i<fb->n; i++) {
+		struct ip_addr_and_mask_6 *ip = &fb->data[i].data.ip.ip.v6;
+
+		if ((a1 & ip->mask) == ip->addr) {
+			return 1;
+		}
+		if ((fb->direction == FILTER_BASIC_DIR_BOTH)
+			&& ((a2 & ip->mask) == ip->addr)) {
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+check_filter(const struct test_filter *t, size_t nlit, size_t *nmatched)
+{
+	static char s[MAX_LITERALS * 64];
+	struct filter_input q;
+	struct filter_expr *e;
+	struct filter_basic *fb;
+	size_t i;
+	int ret = 0;
+
+	sprintf(s, "%s ", t->text);
+	for (i=0; i<nlit; i++) {
+		if (i) {
+			strcat(s, " or ");
+		}
+		add_literal(s, t->kind);
+	}
+
+	memset(&q, 0, sizeof(struct filter_input));
+	q.s = s;
+	e = parse_filter(&q);
+	if (!e) {
+		printf("Filter allocation failed\n");
+		return 0;
+	}
+	if (q.error) {
+		printf("Parse error: %s\nFilter: %s\n", q.errmsg, s);
+		goto out;
+	}
+
+	fb = e->filter[0].arg;
+	if ((nlit >= FILTER_SET_MIN_LITERALS)
+		&& (fb->set.type == FILTER_SET_NONE)) {
+
+		printf("Filter is not compiled: %s\n", s);
+		goto out;
+	}
+
+	for (i=0; i<NFLOWS; i++) {
+		struct flow_info flow;
+		int exp, res;
+
+		memset(&flow, 0, sizeof(struct flow_info));
+
+		if (t->kind == KIND_PORT) {
+			uint16_t p1, p2, be1, be2;
+
+			p1 = near_literal_int(fb, rnd_int(t->kind));
+			p2 = near_literal_int(fb, rnd_int(t->kind));
+			be1 = htobe16(p1);
+			be2 = htobe16(p2);
+
+			memcpy(flow.l4_src_port, &be1, sizeof(uint16_t));
+			memcpy(flow.l4_dst_port, &be2, sizeof(uint16_t));
+			exp = (t->dir == FILTER_BASIC_DIR_DST)
+				? expected_int(fb, p2, 0)
+				: expected_int(fb, p1, p2);
+		} else if (t->kind == KIND_AS) {
+			uint32_t a1, a2, be1, be2;
+
+			a1 = near_literal_int(fb, rnd_int(t->kind));
+			a2 = near_literal_int(fb, rnd_int(t->kind));
+			be1 = htobe32(a1);
+			be2 = htobe32(a2);
+
+			memcpy(flow.src_as, &be1, sizeof(uint32_t));
+			memcpy(flow.dst_as, &be2, sizeof(uint32_t));
+			exp = expected_int(fb, (int)a1, (int)a2);
+		} else if (t->kind == KIND_NET) {
+			uint32_t a1 = rnd_addr4(), a2 = rnd_addr4();
+
+			near_literal_addr(fb, (uint8_t *)&a1, sizeof(uint32_t));
+			near_literal_addr(fb, (uint8_t *)&a2, sizeof(uint32_t));
+
+			memcpy(flow.ip4_src_addr, &a1, sizeof(uint32_t));
+			memcpy(flow.ip4_dst_addr, &a2, sizeof(uint32_t));
+			flow.has_ip4_src_addr = 1;
+			flow.has_ip4_dst_addr = 1;
+			exp = (t->dir == FILTER_BASIC_DIR_DST)
+				? expected_addr4(fb, a2, 0)
+				: expected_addr4(fb, a1, a2);
+		} else {
+			xe_ip a1, a2;
+
+			rnd_addr6((uint8_t *)&a1);
+			rnd_addr6((uint8_t *)&a2);
+			near_literal_addr(fb, (uint8_t *)&a1, sizeof(xe_ip));
+			near_literal_addr(fb, (uint8_t *)&a2, sizeof(xe_ip));
+			memcpy(flow.ip6_src_addr, &a1, sizeof(xe_ip));
+			memcpy(flow.ip6_dst_addr, &a2, sizeof(xe_ip));
+			flow.has_ip6_src_addr = 1;
+			flow.has_ip6_dst_addr = 1;
+			exp = expected_addr6(fb, a1, a2);
+		}
+
+		res = filter_match(e, &flow);
+		if (res != exp) {
+			printf("Mismatch: expected %d, got %d\nFilter: %s\n",
+				exp, res, s);
+			goto out;
+		}
+		*nmatched += res;
+	}
+
+	ret = 1;
+
+out:
+	filter_free(e);
+	return ret;
+}
+
+int
+main()
+{
+	size_t i, nmatched = 0;
+
+	for (i=0; i<NFILTERS; i++) {
+		const struct test_filter *t;
+		size_t nlit;
+
+		t = &tests[i % (sizeof(tests) / sizeof(tests[0]))];
+		nlit = 1 + rnd() % MAX_LITERALS;
+
+		if (!check_filter(t, nlit, &nmatched)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%d filters, %d flows, %lu matched\n", NFILTERS,
+		NFILTERS * NFLOWS, (unsigned long)nmatched);
+
+	return EXIT_SUCCESS;
+}
+
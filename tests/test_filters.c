@@ -3,6 +3,52 @@
 #include <stdio.h>
 #include "../filter.h"
 
+/* key fields with net() function */
+static int
+check_net(void)
+{
+	struct field fld;
+	char err[ERR_MSG_LEN];
+
+	if (!parse_field("net(src host, 24, 64)", &fld, err)) {
+		printf("Parse error: %s\n", err);
+		return 0;
+	}
+	if (!fld.is_func || (fld.id != NET) || (fld.size != 4)
+		|| (fld.func_data.net.mask4 != 24)) {
+
+		printf("Incorrect IPv4 net() field\n");
+		return 0;
+	}
+
+	if (!parse_field("net(dst host6, 24, 64) desc", &fld, err)) {
+		printf("Parse error: %s\n", err);
+		return 0;
+	}
+	if ((fld.type != FILTER_BASIC_ADDR6) || (fld.size != 16)
+		|| (fld.func_data.net.mask6 != 64) || !fld.descending) {
+
+		printf("Incorrect IPv6 net() field\n");
+		return 0;
+	}
+
+	/* not a function */
+	if (!parse_field("src net", &fld, err) || fld.is_func) {
+		printf("Incorrect 'src net' field\n");
+		return 0;
+	}
+
+	if (parse_field("net(src host, 33)", &fld, err)
+		|| parse_field("net(src port, 16)", &fld, err)
+		|| parse_field("net(src host6)", &fld, err)) {
+
+		printf("Incorrect net() field accepted\n");
+		return 0;
+	}
+
+	return 1;
+}
+
 int
 main()
 {
@@ -28,6 +74,10 @@ main()
 
 	filter_free(e);
 
+	if (!check_net()) {
+		return EXIT_FAILURE;
+	}
+
 	return EXIT_SUCCESS;
 }
 
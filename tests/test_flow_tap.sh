@@ -0,0 +1,74 @@
+#!/usr/bin/env bash
+
+# Flow tap: every flow seen by collector can be read with xetap
+#
+# Start xenoeye with flow tap in shared memory, send NetFlow v5 and IPFIX
+# with xegen, then read tap with xetap and compare number of records and
+# drops with totals from the sidecar file
+
+. "$(dirname "$0")/lib.sh"
+
+PORT=${XE_TEST_PORT:-32061}
+SHM="/xenoeye-tap-test-$$"
+
+require "$XENOEYE" "$XEGEN" "$XETAP"
+setup_tmp
+
+test_cleanup()
+{
+	rm -f "/dev/shm$SHM"
+}
+
+write_conf "$TMP/xenoeye.conf" "$TMP/exp" "$(capture_conf)
+	\"flow-tap\": {
+		\"shm\": \"$SHM\",
+		\"size-m\": 16,
+		\"filter\": \"src host 10.0.0.0/8 or src host 198.51.100.0/24\",
+		\"fields\": [\"src host\", \"dst host\", \"proto\", \"octets\"]
+	},"
+
+start_daemon
+
+# less flows than slots in rings, reader is started after generator
+if ! "$XEGEN" -p $PORT -m nf5:1,ipfix:1 -n 1000 -r 2000 -s 2 \
+	-o "$TMP/totals.txt"; then
+
+	echo "xegen failed"
+	exit 1
+fi
+sleep 1
+
+if ! "$XETAP" -s "$SHM" -d > "$TMP/tap.txt" 2> "$TMP/drops.txt"; then
+	echo "xetap failed"
+	cat "$TMP/drops.txt"
+	exit 1
+fi
+
+head -n 5 "$TMP/tap.txt"
+
+if [ "$(head -n 1 "$TMP/tap.txt")" != \
+	"$(printf '#time\tsrc host\tdst host\tproto\toctets')" ]; then
+
+	echo "unexpected header"
+	exit 1
+fi
+
+nrecs=$(grep -vc '^#' "$TMP/tap.txt")
+flows=$(awk '$1 == "flows" {print $2}' "$TMP/totals.txt")
+drops=$(awk '{s += $3} END {print s + 0}' "$TMP/drops.txt")
+
+echo "records: $nrecs (expected $flows), dropped: $drops"
+
+if [ "$nrecs" != "$flows" ] || [ "$drops" != 0 ]; then
+	cat "$TMP/totals.txt"
+	exit 1
+fi
+
+# records are consumed, second read returns only header
+nrecs=$("$XETAP" -s "$SHM" | grep -vc '^#')
+if [ "$nrecs" != 0 ]; then
+	echo "expected empty tap after read, got $nrecs records"
+	exit 1
+fi
+
+exit 0
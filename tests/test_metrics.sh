@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+
+# Metrics endpoint: counters of capture, decoder and monitoring objects
+#
+# Start xenoeye with metrics on loopback HTTP port and UNIX socket, send
+# NetFlow v5 packets and check counters and profiler histograms (each
+# packet is sampled)
+
+. "$(dirname "$0")/lib.sh"
+
+PORT=${XE_TEST_PORT:-32056}
+HTTP_PORT=${XE_TEST_HTTP_PORT:-32057}
+SRC_IP="10.1.2.3"
+NPACKETS=10
+
+require "$XENOEYE" curl
+setup_tmp
+
+mkdir -p "$TMP/mo/test"
+
+write_conf "$TMP/xenoeye.conf" "$TMP/exp" "$(capture_conf)
+	\"metrics\": {
+		\"unix-socket\": \"$TMP/metrics.sock\",
+		\"http-port\": $HTTP_PORT,
+		\"profile-sample\": 1,
+		\"mo-report\": \"$TMP/mo-report.txt\",
+		\"mo-report-interval\": 1
+	},"
+
+cat > "$TMP/mo/test/mo.conf" << EOF
+{
+	"filter": "src host $SRC_IP",
+	"mavg": [
+		{
+			"name": "bytes",
+			"time": 600,
+			"mem-m": 16,
+			"fields": ["src host", "octets"]
+		}
+	]
+}
+EOF
+
+start_daemon
+send_v5 $NPACKETS
+sleep 1
+
+fetch_metrics
+
+check 'capture_packets_total{' $NPACKETS
+check 'decode_packets_total{.*proto="netflow_v5"' $NPACKETS
+check 'decode_records_total{.*proto="netflow_v5"' $NPACKETS
+check 'mo_flows_total{mo="test"}' $NPACKETS
+check 'mavg_keys{mo="test",mavg="bytes"}' 1
+check 'stage_duration_seconds_count{stage="packet"}' $NPACKETS
+check 'stage_duration_seconds_count{stage="filter"}' $NPACKETS
+check 'stage_duration_seconds_count{stage="mavg"}' $NPACKETS
+check 'stage_duration_seconds_bucket{stage="packet",le="+Inf"}' $NPACKETS
+
+# cost report with monitoring object
+sleep 1
+if ! grep -q ' test$' "$TMP/mo-report.txt"; then
+	echo "no monitoring object in cost report"
+	cat "$TMP/mo-report.txt"
+	fail=1
+fi
+
+if [ $fail -ne 0 ]; then
+	cat "$TMP/metrics.txt"
+	exit 1
+fi
+
+# UNIX socket returns the same text
+if command -v socat > /dev/null; then
+	if ! socat - "UNIX-CONNECT:$TMP/metrics.sock" < /dev/null \
+		| grep -q '^xenoeye_mo_flows_total{mo="test"}'; then
+
+		echo "no metrics on UNIX socket"
+		exit 1
+	fi
+fi
+
+exit 0
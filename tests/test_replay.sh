@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+
+# Offline replay: results don't depend on wall clock
+#
+# Write pcap file with NetFlow v5 packets spread over two fixed windows,
+# replay it twice and compare results and exported windows
+
+. "$(dirname "$0")/lib.sh"
+
+SRC_IP="10.1.2.3"
+NPACKETS=20
+
+require "$XENOEYE"
+setup_tmp
+
+mkdir -p "$TMP/mo/test"
+
+cat > "$TMP/mo/test/mo.conf" << EOF
+{
+	"filter": "src host $SRC_IP",
+	"fwm": [
+		{
+			"name": "bytes",
+			"time": 10,
+			"fields": ["src host", "octets"]
+		}
+	],
+	"mavg": [
+		{
+			"name": "bytes",
+			"time": 600,
+			"mem-m": 16,
+			"fields": ["src host", "octets"]
+		}
+	]
+}
+EOF
+
+{
+	pcap_header
+	for i in $(seq 0 $((NPACKETS - 1))); do
+		pcap_v5 $((TS + i)) $i 1
+		v5_record '\x0a\x01\x02\x03' 1000000 1000
+	done
+} > "$TMP/flows.pcap"
+
+replay 1
+sleep 1
+replay 2
+
+cat "$TMP/out1.txt"
+
+if ! grep -q "^flows: $NPACKETS$" "$TMP/out1.txt"; then
+	echo "expected $NPACKETS flows"
+	cat "$TMP/err1.txt"
+	exit 1
+fi
+
+if ! diff "$TMP/out1.txt" "$TMP/out2.txt"; then
+	echo "results of two replays differ"
+	exit 1
+fi
+
+# windows are named by capture time
+nfiles=$(ls "$TMP/exp1" | wc -l)
+if [ "$nfiles" -lt 2 ]; then
+	echo "expected at least two exported windows, got $nfiles"
+	exit 1
+fi
+
+if ! diff -r "$TMP/exp1" "$TMP/exp2"; then
+	echo "exported windows differ"
+	exit 1
+fi
+
+exit 0
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "../filter.h"
+#include "../rib.h"
+#include "../flow-info.h"
+
+/*
+ * Routing table: longest prefix match, reload, pfx() in filters and fields
+ */
+
+static const char *table1 =
+	"# prefix origin-as\n"
+	"10.0.0.0/8 65000\n"
+	"10.1.0.0/16 65001\n"
+	"10.1.2.0/24 65002 extra columns\n"
+	"10.1.2.128/25 65003\n"
+	"10.2.3.4/16 65004\n"
+	"192.0.2.1 65005\n"
+	"\n"
+	"2001:db8::/32 65006\n"
+	"2001:db8:1::/48\t65007\n"
+	"bad line\n"
+	"10.3.0.0/33 65008\n"
+	"10.4.0.0/16\n"
+	"10.5.0.0/16 65009";
+
+static const char *table2 =
+	"0.0.0.0/0 1\n"
+	"10.1.0.0/16 65001\n";
+
+/* address, expected prefix, NULL if not found */
+static const char *lookups1[][2] = {
+	{"10.9.9.9", "10.0.0.0/8"},
+	{"10.1.9.9", "10.1.0.0/16"},
+	{"10.1.2.3", "10.1.2.0/24"},
+	{"10.1.2.200", "10.1.2.128/25"},
+	{"10.2.200.1", "10.2.0.0/16"},
+	{"192.0.2.1", "192.0.2.1/32"},
+	{"192.0.2.2", NULL},
+	{"10.3.0.1", "10.0.0.0/8"},
+	{"10.5.1.1", "10.5.0.0/16"},
+	{"11.0.0.1", NULL},
+	{"2001:db8:1::1", "2001:db8:1::/48"},
+	{"2001:db8:2::1", "2001:db8::/32"},
+	{"2001:db9::1", NULL}
+};
+
+static const char *lookups2[][2] = {
+	{"10.9.9.9", "0.0.0.0/0"},
+	{"10.1.2.3", "10.1.0.0/16"},
+	{"2001:db8::1", NULL}
+};
+
+#define NLOOKUPS(L) (sizeof(L) / sizeof(L[0]))
+
+static int
+write_table(const char *path, const char *table)
+{
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (!f) {
+		printf("Can't create '%s'\n", path);
+		return 0;
+	}
+	fputs(table, f);
+	fclose(f);
+
+	return 1;
+}
+
+static int
+check_lookups(const char *l[][2], size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		uint32_t addr;
+		xe_ip addr6;
+		char *pfx;
+		int found;
+
+		if (inet_pton(AF_INET, l[i][0], &addr) == 1) {
+			found = rib_lookup4(addr, &pfx);
+		} else {
+			inet_pton(AF_INET6, l[i][0], &addr6);
+			found = rib_lookup6(&addr6, &pfx);
+		}
+
+		if (!l[i][1] && found) {
+			printf("%s: found '%s', expected nothing\n", l[i][0],
+				pfx);
+			return 0;
+		}
+		if (l[i][1] && (!found || (strcmp(pfx, l[i][1]) != 0))) {
+			printf("%s: found '%s', expected '%s'\n", l[i][0],
+				found ? pfx : "nothing", l[i][1]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+check_filter(void)
+{
+	struct filter_input q;
+	struct filter_expr *e;
+	struct flow_info flow;
+	struct field fld;
+	char err[ERR_MSG_LEN];
+	uint32_t addr;
+	int ret = 0;
+
+	memset(&q, 0, sizeof(struct filter_input));
+	q.s = "pfx(dst host) '10.1.2.0/24' or '10.5.0.0/16'";
+	e = parse_filter(&q);
+	if (!e) {
+		printf("Filter allocation failed\n");
+		return 0;
+	}
+	if (q.error) {
+		printf("Parse error: %s\n", q.errmsg);
+		goto fail;
+	}
+
+	memset(&flow, 0, sizeof(struct flow_info));
+	inet_pton(AF_INET, "10.1.2.3", &addr);
+	memcpy(flow.ip4_dst_addr, &addr, sizeof(uint32_t));
+	if (!filter_match(e, &flow)) {
+		printf("Flow to 10.1.2.3 doesn't match\n");
+		goto fail;
+	}
+	inet_pton(AF_INET, "10.1.2.200", &addr);
+	memcpy(flow.ip4_dst_addr, &addr, sizeof(uint32_t));
+	if (filter_match(e, &flow)) {
+		printf("Flow to 10.1.2.200 matches\n");
+		goto fail;
+	}
+
+	if (!parse_field("pfx(dst host)", &fld, err)) {
+		printf("Parse error: %s\n", err);
+		goto fail;
+	}
+	if (!fld.is_func || (fld.id != PFX) || (fld.size != RIB_PFX_SIZE)
+		|| (fld.type != FILTER_BASIC_STRING)) {
+
+		printf("Incorrect pfx() field\n");
+		goto fail;
+	}
+	if (parse_field("pfx(dst port)", &fld, err)) {
+		printf("pfx() of port accepted\n");
+		goto fail;
+	}
+
+	ret = 1;
+
+fail:
+	filter_free(e);
+	return ret;
+}
+
+int
+main()
+{
+	char path[] = "/tmp/test_rib_XXXXXX";
+	int fd, ret = EXIT_FAILURE;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		printf("Can't create temporary file\n");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	if (!write_table(path, table1) || !rib_load(path)) {
+		printf("Can't load table\n");
+		goto fail;
+	}
+	if (!check_lookups(lookups1, NLOOKUPS(lookups1))) {
+		goto fail;
+	}
+	if (!check_filter()) {
+		goto fail;
+	}
+
+	/* replace */
+	if (!write_table(path, table2) || !rib_load(path)) {
+		printf("Can't reload table\n");
+		goto fail;
+	}
+	if (!check_lookups(lookups2, NLOOKUPS(lookups2))) {
+		goto fail;
+	}
+
+	/* old table stays */
+	unlink(path);
+	if (rib_load(path)) {
+		printf("Missing table loaded\n");
+		goto fail;
+	}
+	if (!check_lookups(lookups2, NLOOKUPS(lookups2))) {
+		goto fail;
+	}
+
+	printf("Routing table OK\n");
+	ret = EXIT_SUCCESS;
+
+fail:
+	unlink(path);
+	return ret;
+}
+
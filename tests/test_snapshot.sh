@@ -0,0 +1,92 @@
+#!/usr/bin/env bash
+
+# Periodic snapshots don't stop processing
+#
+# Snapshot is written every second while NetFlow v5 packets with many
+# sources are sent for several seconds, all flows must reach the monitoring
+# object and the snapshot must be written while collector is running
+
+. "$(dirname "$0")/lib.sh"
+
+PORT=${XE_TEST_PORT:-32066}
+HTTP_PORT=${XE_TEST_HTTP_PORT:-32067}
+NPACKETS=50
+NRECORDS=30
+
+require "$XENOEYE" curl
+setup_tmp
+
+mkdir -p "$TMP/mo/test"
+
+write_conf "$TMP/xenoeye.conf" "$TMP/exp" "$(capture_conf)
+	\"metrics\": {
+		\"http-port\": $HTTP_PORT
+	},
+	\"snapshot\": {
+		\"enabled\": true,
+		\"path\": \"$TMP/snapshot.bin\",
+		\"interval\": 1
+	},"
+
+cat > "$TMP/mo/test/mo.conf" << EOF
+{
+	"filter": "src net 10.1.0.0/16",
+	"mavg": [
+		{
+			"name": "bytes",
+			"time": 600,
+			"mem-m": 16,
+			"fields": ["src host", "octets"]
+		}
+	],
+	"fwm": [
+		{
+			"name": "bytes",
+			"time": 600,
+			"fields": ["src host", "octets"]
+		}
+	]
+}
+EOF
+
+start_daemon
+
+# about 5 seconds, snapshots are written in between
+for i in $(seq $NPACKETS); do
+	{
+		v5_header $(date +%s) $i $NRECORDS
+		for j in $(seq $NRECORDS); do
+			v5_record "\\x0a\\x01$(printf '\\x%02x\\x%02x' $i $j)" \
+				1000 1
+		done
+	} > "$TMP/packet.bin"
+	cat "$TMP/packet.bin" > /dev/udp/127.0.0.1/$PORT
+	sleep 0.1
+done
+sleep 2
+
+if [ ! -s "$TMP/snapshot.bin" ]; then
+	echo "snapshot is not written"
+	cat "$TMP/xenoeye.log"
+	exit 1
+fi
+
+fetch_metrics
+check 'capture_packets_total{' $NPACKETS
+check 'mo_flows_total{mo="test"}' $((NPACKETS * NRECORDS))
+check 'mavg_keys{mo="test",mavg="bytes"}' $((NPACKETS * NRECORDS))
+
+stop_daemon
+
+if grep -q "Can't write snapshot" "$TMP/xenoeye.log"; then
+	echo "snapshot failed"
+	fail=1
+fi
+
+if [ $fail -ne 0 ]; then
+	cat "$TMP/metrics.txt"
+	cat "$TMP/xenoeye.log"
+	exit 1
+fi
+
+exit 0
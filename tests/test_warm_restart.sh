@@ -0,0 +1,80 @@
+#!/usr/bin/env bash
+
+# Warm restart: moving averages are saved on SIGINT and restored at start
+#
+# Start xenoeye, send NetFlow v5 packets, stop it, start again and check
+# that moving average for the source address survived restart
+
+. "$(dirname "$0")/lib.sh"
+
+PORT=${XE_TEST_PORT:-32055}
+SRC_IP="10.1.2.3"
+
+require "$XENOEYE"
+setup_tmp
+
+mkdir -p "$TMP/mo/test"
+
+write_conf "$TMP/xenoeye.conf" "$TMP/exp" "$(capture_conf)
+	\"snapshot\": {
+		\"enabled\": true,
+		\"path\": \"$TMP/snapshot.bin\",
+		\"interval\": 0
+	},"
+
+cat > "$TMP/mo/test/mo.conf" << EOF
+{
+	"filter": "src host $SRC_IP",
+	"mavg": [
+		{
+			"name": "bytes",
+			"time": 600,
+			"dump": 1,
+			"mem-m": 16,
+			"fields": ["src host", "octets"]
+		}
+	]
+}
+EOF
+
+dump_val()
+{
+	rm -f "$TMP/mo/test/bytes.dump"
+	touch "$TMP/mo/test/bytes.d"
+	sleep 3
+	rm -f "$TMP/mo/test/bytes.d"
+	grep "$SRC_IP" "$TMP/mo/test/bytes.dump" | awk '{print $NF}'
+}
+
+start_daemon
+send_v5 10
+sleep 1
+
+before=$(dump_val)
+stop_daemon
+
+if [ ! -s "$TMP/snapshot.bin" ]; then
+	echo "snapshot is not written"
+	cat "$TMP/xenoeye.log"
+	exit 1
+fi
+
+start_daemon
+after=$(dump_val)
+stop_daemon
+
+echo "before restart: '$before', after restart: '$after'"
+
+if [ -z "$before" ] || [ -z "$after" ]; then
+	echo "no moving average for $SRC_IP"
+	cat "$TMP/xenoeye.log"
+	exit 1
+fi
+
+# value decays, but should be close to value before restart
+if awk -v b="$before" -v a="$after" 'BEGIN { exit !(a > 0 && a <= b && a > b * 0.9) }'; then
+	exit 0
+fi
+
+echo "restored value differs from saved"
+exit 1
@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "../workers.h"
+
+/*
+ * Stress test for pool of workers
+ *
+ * Receivers push packets with random sizes from IPv4 and IPv6 exporters
+ * (IPv6 addresses differ only in last bytes), drops are disabled. Workers
+ * check payload and sum values per exporter. Sum of each exporter must be
+ * equal to sum of sent values for any combination of receivers and workers.
+ * Packets of one exporter are never processed by two workers at once and
+ * packets of one receiver and exporter are processed in order, with and
+ * without stealing. Without stealing, packets of one exporter must be
+ * processed by one worker and IPv6 exporters must be spread over workers.
+ */
+
+#define NPACKETS 50000
+#define NEXPORTERS 24
+#define MAX_RECEIVERS 4
+#define MAX_WORKERS 8
+
+/* packet: value, exporter, then bytes (value + offset) */
+#define HDR_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+
+struct totals
+{
+	_Alignas(64) uint64_t packets[NEXPORTERS];
+	uint64_t sum[NEXPORTERS];
+};
+
+static struct totals totals[MAX_WORKERS];
+static struct sockaddr_storage exporters[NEXPORTERS];
+static atomic_int exp_worker[NEXPORTERS];
+static atomic_int exp_inflight[NEXPORTERS];
+/* last packet number of receiver and exporter + 1 */
+static uint64_t exp_last[MAX_RECEIVERS][NEXPORTERS];
+static atomic_int errors;
+static size_t nworkers_cur;
+static int steal_cur;
+
+struct sender
+{
+	struct xe_data *data;
+	size_t idx;
+	uint64_t packets[NEXPORTERS];
+	uint64_t sum[NEXPORTERS];
+};
+
+static void
+exporters_init(void)
+{
+	size_t i;
+
+	for (i=0; i<NEXPORTERS; i++) {
+		memset(&exporters[i], 0, sizeof(struct sockaddr_storage));
+
+		if (i % 2) {
+			struct sockaddr_in6 *sin6;
+
+			sin6 = (struct sockaddr_in6 *)&exporters[i];
+			sin6->sin6_family = AF_INET6;
+			inet_pton(AF_INET6, "2001:db8::", &sin6->sin6_addr);
+			sin6->sin6_addr.s6_addr[15] = i;
+			sin6->sin6_port = htons(2055);
+		} else {
+			struct sockaddr_in *sin;
+
+			sin = (struct sockaddr_in *)&exporters[i];
+			sin->sin_family = AF_INET;
+			sin->sin_addr.s_addr = htonl(0x0a000000 + i / 4);
+			/* two exporters on one address */
+			sin->sin_port = htons(2055 + i % 4);
+		}
+	}
+}
+
+static void
+test_process(struct xe_data *data, size_t thread_id, enum FLOW_TYPE type,
+	struct flow_packet_info *pkt, int len)
+{
+	uint64_t val;
+	uint32_t exporter;
+	int i, expected = -1;
+
+	(void)data;
+	(void)type;
+
+	if (thread_id >= nworkers_cur) {
+		atomic_fetch_add(&errors, 1);
+		return;
+	}
+
+	memcpy(&val, pkt->rawpacket, sizeof(uint64_t));
+	memcpy(&exporter, pkt->rawpacket + sizeof(uint64_t), sizeof(uint32_t));
+	for (i=HDR_SIZE; i<len; i++) {
+		if (pkt->rawpacket[i] != (uint8_t)(val + i)) {
+			atomic_fetch_add(&errors, 1);
+			return;
+		}
+	}
+
+	/* full exporter address is passed through ring */
+	if ((exporter >= NEXPORTERS)
+		|| (memcmp(&pkt->src_addr, &exporters[exporter],
+			sizeof(struct sockaddr_in6)) != 0)) {
+
+		atomic_fetch_add(&errors, 1);
+		return;
+	}
+
+	if (atomic_fetch_add(&exp_inflight[exporter], 1) != 0) {
+		/* another worker processes the same exporter */
+		atomic_fetch_add(&errors, 1);
+	}
+
+	/* exporter isn't processed by others, exp_last is ours */
+	if (exp_last[val >> 32][exporter] > (val & 0xffffffff)) {
+		atomic_fetch_add(&errors, 1);
+	}
+	exp_last[val >> 32][exporter] = (val & 0xffffffff) + 1;
+
+	if (!steal_cur
+		&& !atomic_compare_exchange_strong(&exp_worker[exporter],
+			&expected, (int)thread_id)
+		&& (expected != (int)thread_id)) {
+
+		/* exporter moved to another worker */
+		atomic_fetch_add(&errors, 1);
+	}
+
+	/* only one worker uses thread_id */
+	totals[thread_id].packets[exporter]++;
+	totals[thread_id].sum[exporter] += val;
+
+	atomic_fetch_sub(&exp_inflight[exporter], 1);
+}
+
+static void *
+sender_thread(void *arg)
+{
+	struct sender *s = arg;
+	struct flow_packet_info *pkt;
+	unsigned int seed = s->idx + 1;
+	size_t i;
+
+	pkt = malloc(sizeof(struct flow_packet_info));
+
+	for (i=0; i<NPACKETS; i++) {
+		uint64_t val = ((uint64_t)s->idx << 32) | i;
+		uint32_t exporter = rand_r(&seed) % NEXPORTERS;
+		int len = HDR_SIZE + rand_r(&seed) % 1500;
+		int j;
+
+		if ((i % 1000) == 999) {
+			/* jumbo packet */
+			len = MAX_NF_PACKET_SIZE - 1;
+		}
+
+		memcpy(pkt->rawpacket, &val, sizeof(uint64_t));
+		memcpy(pkt->rawpacket + sizeof(uint64_t), &exporter,
+			sizeof(uint32_t));
+		for (j=HDR_SIZE; j<len; j++) {
+			pkt->rawpacket[j] = (uint8_t)(val + j);
+		}
+		pkt->src_addr = exporters[exporter];
+		pkt->src_addr_ipv4 = 0;
+
+		if (!workers_packet(s->data, s->idx, FLOW_TYPE_NETFLOW, pkt,
+			len)) {
+
+			atomic_fetch_add(&errors, 1);
+			continue;
+		}
+
+		s->packets[exporter]++;
+		s->sum[exporter] += val;
+	}
+
+	free(pkt);
+	return NULL;
+}
+
+static int
+check_spread(size_t nworkers)
+{
+	size_t i;
+	int first = -1;
+
+	if (steal_cur || (nworkers < 2)) {
+		return 1;
+	}
+
+	for (i=1; i<NEXPORTERS; i+=2) {
+		int w = atomic_load(&exp_worker[i]);
+
+		if (first < 0) {
+			first = w;
+		} else if (w != first) {
+			return 1;
+		}
+	}
+
+	printf("All IPv6 exporters are processed by worker %d\n", first);
+	return 0;
+}
+
+static int
+run(size_t nreceivers, size_t nworkers, int steal)
+{
+	struct xe_data data;
+	struct sender senders[MAX_RECEIVERS];
+	pthread_t tids[MAX_RECEIVERS];
+	uint64_t packets = 0;
+	size_t i, e, w;
+
+	memset(&data, 0, sizeof(struct xe_data));
+	memset(totals, 0, sizeof(totals));
+	memset(exp_last, 0, sizeof(exp_last));
+	for (i=0; i<NEXPORTERS; i++) {
+		atomic_store(&exp_worker[i], -1);
+		atomic_store(&exp_inflight[i], 0);
+	}
+	nworkers_cur = nworkers;
+	steal_cur = steal;
+
+	data.nnfcap = nreceivers;
+	data.workers.n = nworkers;
+	data.workers.ring_size_m = 1;
+	data.workers.steal = steal;
+	data.workers.no_drop = 1;
+
+	if (!workers_init(&data, &test_process)) {
+		printf("Can't start workers\n");
+		return 0;
+	}
+
+	for (i=0; i<nreceivers; i++) {
+		memset(&senders[i], 0, sizeof(struct sender));
+		senders[i].data = &data;
+		senders[i].idx = i;
+		pthread_create(&tids[i], NULL, &sender_thread, &senders[i]);
+	}
+
+	for (i=0; i<nreceivers; i++) {
+		pthread_join(tids[i], NULL);
+	}
+
+	workers_stop(&data);
+
+	for (e=0; e<NEXPORTERS; e++) {
+		uint64_t sent_packets = 0, sent_sum = 0;
+		uint64_t exp_packets = 0, exp_sum = 0;
+
+		for (i=0; i<nreceivers; i++) {
+			sent_packets += senders[i].packets[e];
+			sent_sum += senders[i].sum[e];
+		}
+		for (w=0; w<nworkers; w++) {
+			exp_packets += totals[w].packets[e];
+			exp_sum += totals[w].sum[e];
+		}
+
+		if ((exp_packets != sent_packets) || (exp_sum != sent_sum)) {
+			printf("receivers: %lu, workers: %lu, steal: %d, "
+				"exporter %lu: sent %lu packets, processed "
+				"%lu\n", nreceivers, nworkers, steal, e,
+				sent_packets, exp_packets);
+			return 0;
+		}
+		packets += exp_packets;
+	}
+
+	printf("receivers: %lu, workers: %lu, steal: %d, processed: %lu\n",
+		nreceivers, nworkers, steal, packets);
+
+	if (packets != (NPACKETS * nreceivers)) {
+		printf("Packets were dropped\n");
+		return 0;
+	}
+
+	if (atomic_load(&errors)) {
+		printf("%d errors\n", atomic_load(&errors));
+		return 0;
+	}
+
+	return check_spread(nworkers);
+}
+
+int
+main()
+{
+	size_t receivers[] = {1, 2, 4};
+	size_t workers[] = {1, 2, 3, 8};
+	size_t r, w;
+	int steal;
+
+	exporters_init();
+
+	for (r=0; r<sizeof(receivers) / sizeof(receivers[0]); r++) {
+		for (w=0; w<sizeof(workers) / sizeof(workers[0]); w++) {
+			for (steal=0; steal<2; steal++) {
+				if (!run(receivers[r], workers[w], steal)) {
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env bash
+
+# Load generator: collector decodes exactly what generator has sent
+#
+# Start xenoeye with metrics on loopback HTTP port, send mix of NetFlow v5,
+# v9, IPFIX and sFlow with template churn, several exporters and attack
+# bursts, then compare decoder counters with totals from the sidecar file
+
+. "$(dirname "$0")/lib.sh"
+
+PORT=${XE_TEST_PORT:-32058}
+SFLOW_PORT=${XE_TEST_SFLOW_PORT:-32059}
+HTTP_PORT=${XE_TEST_HTTP_PORT:-32060}
+
+require "$XENOEYE" "$XEGEN" curl
+setup_tmp
+
+mkdir -p "$TMP/mo/all"
+
+write_conf "$TMP/xenoeye.conf" "$TMP/exp" "$(capture_conf)
+	\"sflow-capture\": [
+		{\"socket\": {\"listen-on\": \"127.0.0.1\", \"port\": \"$SFLOW_PORT\"}}
+	],
+	\"metrics\": {
+		\"http-port\": $HTTP_PORT
+	},"
+
+# all generated flows
+cat > "$TMP/mo/all/mo.conf" << EOF
+{
+	"filter": "src host 10.0.0.0/8 or src host 198.51.100.0/24"
+}
+EOF
+
+start_daemon
+
+# moderate rate, so kernel doesn't drop datagrams
+if ! "$XEGEN" -p $PORT -P $SFLOW_PORT -m nf5:1,nf9:2,ipfix:2,sflow:1 \
+	-n 2000 -r 2000 -s 4 -c 50 -b 200,20 -R 16 \
+	-o "$TMP/totals.txt"; then
+
+	echo "xegen failed"
+	exit 1
+fi
+sleep 1
+
+fetch_metrics
+
+expected()
+{
+	awk -v k="$1" '$1 == k {print $2}' "$TMP/totals.txt"
+}
+
+for p in netflow_v5 netflow_v9 ipfix sflow; do
+	check "decode_records_total{.*proto=\"$p\"" $(expected "${p}_flows")
+done
+check 'decode_template_misses_total{' 0
+check 'mo_flows_total{mo="all"}' $(expected flows)
+
+if [ $fail -ne 0 ]; then
+	cat "$TMP/totals.txt"
+	exit 1
+fi
+
+exit 0
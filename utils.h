@@ -2,6 +2,7 @@
 #define utils_h_included
 
 #include <syslog.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
@@ -28,6 +29,11 @@ do {                                                           \
 		_buf, __FILE__, __LINE__, __func__);           \
 } while (0)
 
+/* per-thread data written by different threads starts on own cache line */
+#define CACHE_LINE_SIZE 64
+#define CACHE_LINE_ROUND(S) \
+	(((S) + CACHE_LINE_SIZE - 1) & ~((size_t)CACHE_LINE_SIZE - 1))
+
 #define MAC_ADDR_SIZE 6
 
 struct mac_addr
@@ -35,6 +41,26 @@ struct mac_addr
 	uint8_t e[MAC_ADDR_SIZE];
 } __attribute__((packed));
 
+/* cache line aligned malloc(), size is rounded up to cache line */
+static inline void *
+malloc_cl(size_t size)
+{
+	return aligned_alloc(CACHE_LINE_SIZE, CACHE_LINE_ROUND(size));
+}
+
+static inline void *
+calloc_cl(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	ptr = malloc_cl(nmemb * size);
+	if (ptr) {
+		memset(ptr, 0, CACHE_LINE_ROUND(nmemb * size));
+	}
+
+	return ptr;
+}
+
 static inline char *
 string_trim(char *str)
 {
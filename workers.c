@@ -0,0 +1,695 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "utils.h"
+#include "workers.h"
+
+#define RING_WRAP 0xffffffffU
+#define RING_ALIGN(S) (((S) + 7) & ~((size_t)7))
+
+/* record header, followed by datagram */
+struct ring_rec
+{
+	uint32_t len;
+	uint32_t type;
+	uint32_t src_addr_ipv4;
+	/* hash of exporter, never 0 */
+	uint32_t exporter;
+	/* large enough for IPv4 and IPv6 exporters */
+	struct sockaddr_in6 src_addr;
+};
+
+struct worker_ring
+{
+	/* written by receiver */
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail;
+
+	/* written by consumers */
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head;
+	atomic_flag lock;
+
+	uint8_t *buf;
+	size_t size;
+};
+
+struct worker
+{
+	_Alignas(CACHE_LINE_SIZE) atomic_int sleeping;
+	/* exporter of packet being processed with stealing, 0 - none */
+	_Atomic uint32_t inflight;
+	int evfd;
+	size_t idx;
+	pthread_t tid;
+};
+
+struct receiver
+{
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t drops;
+	uint64_t drops_logged;
+	time_t last_log;
+};
+
+static struct xe_data *globl = NULL;
+static workers_process_func process = NULL;
+
+static size_t nworkers = 0, nreceivers = 0;
+static struct worker *workers = NULL;
+static struct receiver *receivers = NULL;
+
+/* nreceivers * nworkers rings, rings of receiver are contiguous */
+static struct worker_ring *rings = NULL;
+
+static atomic_int stop;
+
+#define RING(R, W) (&rings[(R) * nworkers + (W)])
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+workers_config(struct aajson *a, aajson_val *value, struct workers_conf *c)
+{
+	if (STRCMP(a, 2, "threads") == 0) {
+		if (atoi(value->str) < 0) {
+			LOG("workers: incorrect number of threads '%s'",
+				value->str);
+			return 0;
+		}
+		c->n = atoi(value->str);
+	} else if (STRCMP(a, 2, "ring-size-m") == 0) {
+		if (atoi(value->str) <= 0) {
+			LOG("workers: incorrect ring size '%s'", value->str);
+			return 0;
+		}
+		c->ring_size_m = atoi(value->str);
+	} else if (STRCMP(a, 2, "steal") == 0) {
+		c->steal = (value->type == AAJSON_VALUE_TRUE);
+	} else if (STRCMP(a, 2, "drop") == 0) {
+		c->no_drop = (value->type == AAJSON_VALUE_FALSE);
+	}
+
+	return 1;
+}
+#undef STRCMP
+
+size_t
+workers_nthreads(struct xe_data *data)
+{
+	if (data->workers.n) {
+		return data->workers.n;
+	}
+
+	/* each capture thread processes its own packets */
+	return data->nnfcap + data->nsfcap;
+}
+
+static int
+ring_push(struct worker_ring *r, enum FLOW_TYPE type, uint32_t exporter,
+	struct flow_packet_info *pkt, int len)
+{
+	uint64_t head, tail;
+	size_t pos, contig, recsize, need;
+	struct ring_rec *rec;
+
+	recsize = RING_ALIGN(sizeof(struct ring_rec) + len);
+
+	tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+	pos = tail % r->size;
+	contig = r->size - pos;
+
+	/* record doesn't fit at the end, skip rest of buffer */
+	need = (contig < recsize) ? (contig + recsize) : recsize;
+
+	if ((r->size - (tail - head)) < need) {
+		/* ring is full */
+		return 0;
+	}
+
+	if (contig < recsize) {
+		rec = (struct ring_rec *)&r->buf[pos];
+		rec->len = RING_WRAP;
+		tail += contig;
+		pos = 0;
+	}
+
+	rec = (struct ring_rec *)&r->buf[pos];
+	rec->len = len;
+	rec->type = type;
+	rec->src_addr_ipv4 = pkt->src_addr_ipv4;
+	rec->exporter = exporter;
+	memcpy(&rec->src_addr, &pkt->src_addr, sizeof(struct sockaddr_in6));
+	memcpy(&r->buf[pos + sizeof(struct ring_rec)], pkt->rawpacket, len);
+
+	atomic_store_explicit(&r->tail, tail + recsize, memory_order_release);
+
+	return 1;
+}
+
+/*
+ * consumer lock must be held, record is removed from ring by
+ * ring_commit(r, *next)
+ */
+static int
+ring_peek(struct worker_ring *r, enum FLOW_TYPE *type, uint32_t *exporter,
+	struct flow_packet_info *pkt, int *len, uint64_t *next)
+{
+	uint64_t head, tail;
+	size_t pos;
+	struct ring_rec *rec;
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if (head == tail) {
+		return 0;
+	}
+
+	pos = head % r->size;
+	rec = (struct ring_rec *)&r->buf[pos];
+	if (rec->len == RING_WRAP) {
+		/* wrap marker is always followed by record */
+		head += r->size - pos;
+		pos = 0;
+		rec = (struct ring_rec *)&r->buf[pos];
+	}
+
+	*len = rec->len;
+	*type = rec->type;
+	*exporter = rec->exporter;
+	pkt->src_addr_ipv4 = rec->src_addr_ipv4;
+	memcpy(&pkt->src_addr, &rec->src_addr, sizeof(struct sockaddr_in6));
+	memcpy(pkt->rawpacket, &r->buf[pos + sizeof(struct ring_rec)],
+		rec->len);
+
+	*next = head + RING_ALIGN(sizeof(struct ring_rec) + rec->len);
+
+	return 1;
+}
+
+static void
+ring_commit(struct worker_ring *r, uint64_t next)
+{
+	atomic_store_explicit(&r->head, next, memory_order_release);
+}
+
+static int
+ring_is_empty(struct worker_ring *r)
+{
+	return atomic_load_explicit(&r->head, memory_order_relaxed)
+		== atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+/* packet of exporter is processed by another worker */
+static int
+exporter_busy(struct worker *wrk, uint32_t exporter)
+{
+	size_t w;
+
+	for (w=0; w<nworkers; w++) {
+		if ((&workers[w] != wrk)
+			&& (atomic_load_explicit(&workers[w].inflight,
+				memory_order_seq_cst) == exporter)) {
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * process up to WORKERS_BATCH packets from ring, returns number of packets
+ *
+ * Packets of ring are processed in order under ring lock. With stealing
+ * packets of one exporter may be in rings of several receivers, so worker
+ * announces exporter before processing: thief leaves ring if another worker
+ * processes the same exporter, owner of ring waits for it
+ */
+static size_t
+ring_drain(struct worker_ring *r, struct worker *wrk, int own, int steal,
+	struct flow_packet_info *pkt)
+{
+	size_t n;
+
+	if (ring_is_empty(r)) {
+		return 0;
+	}
+
+	if (atomic_flag_test_and_set_explicit(&r->lock,
+		memory_order_acquire)) {
+
+		/* another worker is draining this ring */
+		return 0;
+	}
+
+	for (n=0; n<WORKERS_BATCH; n++) {
+		enum FLOW_TYPE type;
+		uint32_t exporter;
+		uint64_t next;
+		int len;
+
+		if (!ring_peek(r, &type, &exporter, pkt, &len, &next)) {
+			break;
+		}
+
+		if (steal) {
+			atomic_store_explicit(&wrk->inflight, exporter,
+				memory_order_seq_cst);
+			while (exporter_busy(wrk, exporter)) {
+				if (!own) {
+					atomic_store_explicit(&wrk->inflight,
+						0, memory_order_release);
+					goto busy;
+				}
+				sched_yield();
+			}
+		}
+
+		process(globl, wrk->idx, type, pkt, len);
+		ring_commit(r, next);
+
+		if (steal) {
+			atomic_store_explicit(&wrk->inflight, 0,
+				memory_order_release);
+		}
+	}
+
+busy:
+	atomic_flag_clear_explicit(&r->lock, memory_order_release);
+
+	return n;
+}
+
+static int
+worker_has_data(size_t w)
+{
+	size_t r;
+
+	for (r=0; r<nreceivers; r++) {
+		if (!ring_is_empty(RING(r, w))) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void *
+worker_thread(void *arg)
+{
+	struct worker *wrk = (struct worker *)arg;
+	struct flow_packet_info *pkt;
+	int steal = globl->workers.steal && (nworkers > 1);
+
+	pkt = malloc(sizeof(struct flow_packet_info));
+	if (!pkt) {
+		LOG("malloc() failed");
+		return NULL;
+	}
+
+	affinity_thread(&globl->affinity, AFFINITY_WORKER, wrk->idx);
+
+	LOG("Starting worker thread %lu", wrk->idx);
+
+	for (;;) {
+		size_t r, n = 0;
+		struct pollfd pfd;
+		uint64_t cnt;
+
+		for (r=0; r<nreceivers; r++) {
+			n += ring_drain(RING(r, wrk->idx), wrk, 1, steal,
+				pkt);
+		}
+
+		if (n) {
+			continue;
+		}
+
+		if (steal) {
+			size_t w;
+
+			/* take packets from other workers */
+			for (w=1; (w<nworkers) && (n == 0); w++) {
+				size_t victim = (wrk->idx + w) % nworkers;
+
+				for (r=0; r<nreceivers; r++) {
+					n += ring_drain(RING(r, victim),
+						wrk, 0, steal, pkt);
+				}
+			}
+
+			if (n) {
+				continue;
+			}
+		}
+
+		if (atomic_load_explicit(&stop, memory_order_relaxed)
+			&& !worker_has_data(wrk->idx)) {
+
+			/* rings are empty, stop */
+			break;
+		}
+
+		/* nothing to do, receivers wake us up */
+		atomic_store_explicit(&wrk->sleeping, 1, memory_order_seq_cst);
+		if (worker_has_data(wrk->idx)) {
+			atomic_store_explicit(&wrk->sleeping, 0,
+				memory_order_relaxed);
+			continue;
+		}
+
+		pfd.fd = wrk->evfd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, steal ? WORKERS_STEAL_TIMEOUT_MS
+			: WORKERS_IDLE_TIMEOUT_MS) > 0) {
+
+			if ((read(wrk->evfd, &cnt, sizeof(cnt)) < 0)
+				&& (errno != EAGAIN)) {
+
+				LOG("read() failed: %s", strerror(errno));
+			}
+		}
+		atomic_store_explicit(&wrk->sleeping, 0, memory_order_relaxed);
+	}
+
+	free(pkt);
+
+	return NULL;
+}
+
+static void
+receiver_log_drops(size_t receiver_idx)
+{
+	struct receiver *rcv = &receivers[receiver_idx];
+	time_t t = time(NULL);
+	uint64_t drops;
+
+	if ((rcv->last_log + WORKERS_DROPS_LOG_SECS) > t) {
+		return;
+	}
+	rcv->last_log = t;
+
+	drops = atomic_load_explicit(&rcv->drops, memory_order_relaxed);
+	if (drops != rcv->drops_logged) {
+		LOG("Receiver %lu: workers are too slow, %lu packets dropped",
+			receiver_idx, drops - rcv->drops_logged);
+		rcv->drops_logged = drops;
+	}
+}
+
+/* hash of exporter address and port, selects worker */
+static uint32_t
+exporter_hash(struct flow_packet_info *pkt)
+{
+	uint8_t *key;
+	size_t i, size;
+	uint16_t port;
+	uint32_t h = 2166136261U;
+
+	if (pkt->src_addr.ss_family == AF_INET6) {
+		struct sockaddr_in6 *sin6;
+
+		sin6 = (struct sockaddr_in6 *)&pkt->src_addr;
+		key = (uint8_t *)&sin6->sin6_addr;
+		size = sizeof(sin6->sin6_addr);
+		port = sin6->sin6_port;
+	} else if (pkt->src_addr.ss_family == AF_INET) {
+		struct sockaddr_in *sin;
+
+		sin = (struct sockaddr_in *)&pkt->src_addr;
+		key = (uint8_t *)&sin->sin_addr;
+		size = sizeof(sin->sin_addr);
+		port = sin->sin_port;
+	} else {
+		key = (uint8_t *)&pkt->src_addr_ipv4;
+		size = sizeof(pkt->src_addr_ipv4);
+		port = 0;
+	}
+
+	/* FNV-1a */
+	for (i=0; i<size; i++) {
+		h ^= key[i];
+		h *= 16777619U;
+	}
+	h ^= port & 0xff;
+	h *= 16777619U;
+	h ^= port >> 8;
+	h *= 16777619U;
+
+	h ^= h >> 16;
+
+	return h ? h : 1;
+}
+
+/* wake up worker if it's sleeping */
+static void
+worker_wakeup(struct worker *wrk)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&wrk->sleeping, memory_order_relaxed)) {
+		uint64_t ev = 1;
+
+		if (write(wrk->evfd, &ev, sizeof(ev)) < 0) {
+			LOG("write() failed: %s", strerror(errno));
+		}
+	}
+}
+
+int
+workers_packet(struct xe_data *data, size_t receiver_idx,
+	enum FLOW_TYPE type, struct flow_packet_info *pkt, int len)
+{
+	size_t w;
+	uint32_t exporter;
+	struct worker *wrk;
+
+	if (!nworkers) {
+		/* no pool, process in receiver thread */
+		process(data, receiver_idx, type, pkt, len);
+		return 1;
+	}
+
+	exporter = exporter_hash(pkt);
+	w = exporter % nworkers;
+	wrk = &workers[w];
+
+	while (!ring_push(RING(receiver_idx, w), type, exporter, pkt, len)) {
+		if (!data->workers.no_drop) {
+			atomic_fetch_add_explicit(&receivers[receiver_idx].drops,
+				1, memory_order_relaxed);
+			receiver_log_drops(receiver_idx);
+			return 0;
+		}
+
+		/* ring is full, wait for worker */
+		worker_wakeup(wrk);
+		usleep(WORKERS_FULL_WAIT_US);
+	}
+
+	worker_wakeup(wrk);
+
+	return 1;
+}
+
+uint64_t
+workers_drops(void)
+{
+	size_t r;
+	uint64_t drops = 0;
+
+	for (r=0; r<nreceivers; r++) {
+		drops += atomic_load_explicit(&receivers[r].drops,
+			memory_order_relaxed);
+	}
+
+	return drops;
+}
+
+int
+workers_init(struct xe_data *data, workers_process_func process_func)
+{
+	size_t i, ring_size;
+	int thread_err;
+
+	globl = data;
+	process = process_func;
+	atomic_init(&stop, 0);
+
+	if (!data->workers.n) {
+		return 1;
+	}
+
+	nreceivers = data->nnfcap + data->nsfcap;
+
+	if (data->workers.ring_size_m == 0) {
+		data->workers.ring_size_m = WORKERS_DEFAULT_RING_SIZE_M;
+	}
+	ring_size = data->workers.ring_size_m * 1024 * 1024;
+	if (ring_size < WORKERS_RING_MIN_SIZE) {
+		ring_size = WORKERS_RING_MIN_SIZE;
+	}
+
+	workers = aligned_alloc(CACHE_LINE_SIZE,
+		sizeof(struct worker) * data->workers.n);
+	if (!workers) {
+		LOG("aligned_alloc() failed");
+		goto fail_workers;
+	}
+	memset(workers, 0, sizeof(struct worker) * data->workers.n);
+
+	receivers = aligned_alloc(CACHE_LINE_SIZE,
+		sizeof(struct receiver) * nreceivers);
+	if (!receivers) {
+		LOG("aligned_alloc() failed");
+		goto fail_receivers;
+	}
+	memset(receivers, 0, sizeof(struct receiver) * nreceivers);
+
+	rings = aligned_alloc(CACHE_LINE_SIZE,
+		sizeof(struct worker_ring) * nreceivers * data->workers.n);
+	if (!rings) {
+		LOG("aligned_alloc() failed");
+		goto fail_rings;
+	}
+	memset(rings, 0, sizeof(struct worker_ring) * nreceivers
+		* data->workers.n);
+
+	for (i=0; i<nreceivers * data->workers.n; i++) {
+		struct worker_ring *r = &rings[i];
+
+		r->buf = aligned_alloc(sysconf(_SC_PAGESIZE), ring_size);
+		if (!r->buf) {
+			LOG("Can't allocate %lu bytes for ring", ring_size);
+			goto fail_ringbuf;
+		}
+		/* ring is read by worker, keep it on worker's node */
+		affinity_mbind(&data->affinity, AFFINITY_WORKER,
+			i % data->workers.n, r->buf, ring_size);
+		r->size = ring_size;
+		atomic_init(&r->head, 0);
+		atomic_init(&r->tail, 0);
+		atomic_flag_clear(&r->lock);
+	}
+
+	for (i=0; i<data->workers.n; i++) {
+		struct worker *wrk = &workers[i];
+
+		wrk->idx = i;
+		atomic_init(&wrk->sleeping, 0);
+		atomic_init(&wrk->inflight, 0);
+		wrk->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (wrk->evfd < 0) {
+			LOG("eventfd() failed: %s", strerror(errno));
+			goto fail_ringbuf;
+		}
+	}
+
+	/* receivers may push packets now */
+	nworkers = data->workers.n;
+
+	for (i=0; i<nworkers; i++) {
+		thread_err = pthread_create(&workers[i].tid, NULL,
+			&worker_thread, &workers[i]);
+		if (thread_err) {
+			LOG("Can't start thread: %s", strerror(thread_err));
+			goto fail_threads;
+		}
+	}
+
+	LOG("%lu worker threads started, %lu receivers, rings %luM%s",
+		nworkers, nreceivers, ring_size / (1024 * 1024),
+		data->workers.steal ? ", stealing enabled" : "");
+
+	return 1;
+
+fail_threads:
+	/* started workers drain rings and exit */
+	atomic_store_explicit(&stop, 1, memory_order_relaxed);
+	while (i > 0) {
+		uint64_t ev = 1;
+
+		i--;
+		if (write(workers[i].evfd, &ev, sizeof(ev)) < 0) {
+			LOG("write() failed: %s", strerror(errno));
+		}
+		pthread_join(workers[i].tid, NULL);
+	}
+	nworkers = 0;
+fail_ringbuf:
+	for (i=0; i<data->workers.n; i++) {
+		if (workers[i].evfd > 0) {
+			close(workers[i].evfd);
+		}
+	}
+	for (i=0; i<nreceivers * data->workers.n; i++) {
+		free(rings[i].buf);
+	}
+	free(rings);
+	rings = NULL;
+fail_rings:
+	free(receivers);
+	receivers = NULL;
+fail_receivers:
+	free(workers);
+	workers = NULL;
+fail_workers:
+	return 0;
+}
+
+/* wait until workers process all queued packets */
+void
+workers_stop(struct xe_data *data)
+{
+	size_t i;
+
+	(void)data;
+
+	atomic_store_explicit(&stop, 1, memory_order_relaxed);
+
+	for (i=0; i<nworkers; i++) {
+		uint64_t ev = 1;
+
+		if (write(workers[i].evfd, &ev, sizeof(ev)) < 0) {
+			LOG("write() failed: %s", strerror(errno));
+		}
+		pthread_join(workers[i].tid, NULL);
+		close(workers[i].evfd);
+	}
+
+	for (i=0; i<nreceivers * nworkers; i++) {
+		free(rings[i].buf);
+	}
+	free(rings);
+	free(receivers);
+	free(workers);
+
+	rings = NULL;
+	receivers = NULL;
+	workers = NULL;
+	nworkers = nreceivers = 0;
+}
+
@@ -0,0 +1,59 @@
+#ifndef workers_h_included
+#define workers_h_included
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#include "xenoeye.h"
+#include "flow-info.h"
+
+/*
+ * Pool of processing threads
+ *
+ * Each capture thread (receiver) has one ring per worker. Receiver selects
+ * worker by hash of exporter address (IPv4 or IPv6) and port and pushes raw
+ * datagram to the ring, so packets of one exporter are processed by one
+ * worker in order. If the ring is full, packet is dropped, or receiver waits
+ * for worker when drops are disabled. Worker drains all its rings. If
+ * stealing is enabled, idle worker takes whole packets from rings of other
+ * workers, but not packets of exporter processed by another worker.
+ *
+ * Ring is a single-producer byte ring with variable-sized records.
+ * Consumers (owner and thieves) take a per-ring spinlock.
+ */
+
+#define WORKERS_DEFAULT_RING_SIZE_M 2
+#define WORKERS_RING_MIN_SIZE (1024*1024)
+#define WORKERS_BATCH 64
+
+/* idle worker sleeps on eventfd (ms) */
+#define WORKERS_IDLE_TIMEOUT_MS 100
+#define WORKERS_STEAL_TIMEOUT_MS 1
+
+/* receiver polls full ring when drops are disabled (us) */
+#define WORKERS_FULL_WAIT_US 50
+
+#define WORKERS_DROPS_LOG_SECS 10
+
+/* process one packet, called from receiver (no pool) or from worker */
+typedef void (*workers_process_func)(struct xe_data *data, size_t thread_id,
+	enum FLOW_TYPE type, struct flow_packet_info *pkt, int len);
+
+int workers_config(struct aajson *a, aajson_val *value,
+	struct workers_conf *c);
+
+/* nthreads is number of workers when pool is enabled */
+size_t workers_nthreads(struct xe_data *data);
+
+int workers_init(struct xe_data *data, workers_process_func process);
+void workers_stop(struct xe_data *data);
+
+/* called from receiver thread */
+int workers_packet(struct xe_data *data, size_t receiver_idx,
+	enum FLOW_TYPE type, struct flow_packet_info *pkt, int len);
+
+uint64_t workers_drops(void);
+
+#endif
+
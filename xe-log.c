@@ -0,0 +1,419 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "xe-log.h"
+
+struct log_record
+{
+	_Atomic size_t seq;
+
+	struct log_site *site;
+	uint64_t suppressed;
+	time_t time;
+	char msg[LOG_RECORD_MSG_SIZE];
+};
+
+static struct log_conf conf = {
+	.rate = LOG_RL_DEFAULT_RATE,
+	.burst = LOG_RL_DEFAULT_BURST,
+	.queue = LOG_RL_DEFAULT_QUEUE
+};
+
+/* nanoseconds between messages and max advance of site time */
+static uint64_t interval_ns = 1000000000ULL / LOG_RL_DEFAULT_RATE;
+static uint64_t burst_ns = 1000000000ULL / LOG_RL_DEFAULT_RATE
+	* LOG_RL_DEFAULT_BURST;
+
+static struct log_record *queue = NULL;
+static size_t queue_mask;
+static _Alignas(CACHE_LINE_SIZE) _Atomic size_t enqueue_pos;
+static _Alignas(CACHE_LINE_SIZE) size_t dequeue_pos;
+
+/* sites with suppressed messages */
+static struct log_site *_Atomic sites = NULL;
+
+static _Atomic uint64_t total_suppressed;
+static _Atomic uint64_t total_dropped;
+
+static FILE *logfile = NULL;
+static pthread_t log_tid;
+static atomic_int running;
+static atomic_int stop;
+
+#define STRCMP(A, I, S) strcmp(A->path_stack[I].data.path_item, S)
+
+int
+log_config(struct aajson *a, aajson_val *value, struct log_conf *c)
+{
+	if (STRCMP(a, 2, "file") == 0) {
+		if (strlen(value->str) >= sizeof(c->file)) {
+			LOG("log: path to file is too long");
+			return 0;
+		}
+		strcpy(c->file, value->str);
+	} else if (STRCMP(a, 2, "rate") == 0) {
+		c->rate = atoi(value->str);
+		if (c->rate == 0) {
+			LOG("log: incorrect rate '%s'", value->str);
+			return 0;
+		}
+	} else if (STRCMP(a, 2, "burst") == 0) {
+		c->burst = atoi(value->str);
+		if (c->burst == 0) {
+			LOG("log: incorrect burst '%s'", value->str);
+			return 0;
+		}
+	} else if (STRCMP(a, 2, "queue") == 0) {
+		c->queue = strtoull(value->str, NULL, 10);
+		if (c->queue == 0) {
+			LOG("log: incorrect queue size '%s'", value->str);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+#undef STRCMP
+
+static uint64_t
+log_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int
+log_rl_allow(struct log_site *s)
+{
+	uint64_t now = log_now();
+	uint64_t tat, newtat;
+
+	tat = atomic_load_explicit(&s->tat, memory_order_relaxed);
+	do {
+		newtat = (tat > now ? tat : now) + interval_ns;
+		if ((newtat - now) > burst_ns) {
+			break;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&s->tat, &tat,
+		newtat, memory_order_relaxed, memory_order_relaxed));
+
+	if ((newtat - now) <= burst_ns) {
+		return 1;
+	}
+
+	atomic_fetch_add_explicit(&s->suppressed, 1, memory_order_relaxed);
+
+	if (!atomic_flag_test_and_set(&s->registered)) {
+		/* push site to list */
+		s->next = atomic_load(&sites);
+		while (!atomic_compare_exchange_weak(&sites, &s->next, s))
+			;
+	}
+
+	return 0;
+}
+
+static void
+record_print(struct log_site *s, uint64_t suppressed, time_t t,
+	const char *msg)
+{
+	char sup[64];
+
+	*sup = '\0';
+	if (suppressed) {
+		sprintf(sup, " (%lu similar messages suppressed)",
+			(unsigned long)suppressed);
+	}
+
+	if (logfile) {
+		struct tm tm;
+		char tmstr[32];
+
+		localtime_r(&t, &tm);
+		strftime(tmstr, sizeof(tmstr), "%Y-%m-%d %H:%M:%S", &tm);
+		fprintf(logfile, "%s %s%s [%s, line %d, function %s()]\n",
+			tmstr, msg, sup, s->file, s->line, s->func);
+	} else {
+		syslog(LOG_DEBUG | LOG_USER,
+			"%s%s [%s, line %d, function %s()]",
+			msg, sup, s->file, s->line, s->func);
+	}
+}
+
+void
+log_rl_write(struct log_site *s, const char *fmt, ...)
+{
+	va_list ap;
+	struct log_record *r;
+	size_t pos, seq;
+	uint64_t suppressed;
+
+	suppressed = atomic_exchange_explicit(&s->suppressed, 0,
+		memory_order_relaxed);
+	if (suppressed) {
+		atomic_fetch_add_explicit(&total_suppressed, suppressed,
+			memory_order_relaxed);
+	}
+
+	if (!atomic_load_explicit(&running, memory_order_acquire)) {
+		char msg[LOG_RECORD_MSG_SIZE];
+
+		va_start(ap, fmt);
+		vsnprintf(msg, sizeof(msg), fmt, ap);
+		va_end(ap);
+
+		record_print(s, suppressed, time(NULL), msg);
+		return;
+	}
+
+	/* reserve slot */
+	pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+	for (;;) {
+		r = &queue[pos & queue_mask];
+		seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&enqueue_pos,
+				&pos, pos + 1, memory_order_relaxed,
+				memory_order_relaxed)) {
+
+				break;
+			}
+		} else if ((intptr_t)(seq - pos) < 0) {
+			/* full */
+			atomic_fetch_add_explicit(&total_dropped, 1,
+				memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&enqueue_pos,
+				memory_order_relaxed);
+		}
+	}
+
+	r->site = s;
+	r->suppressed = suppressed;
+	r->time = time(NULL);
+
+	va_start(ap, fmt);
+	vsnprintf(r->msg, sizeof(r->msg), fmt, ap);
+	va_end(ap);
+
+	atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+}
+
+/* returns number of written records */
+static size_t
+queue_drain(void)
+{
+	size_t n = 0;
+
+	for (;;) {
+		struct log_record *r = &queue[dequeue_pos & queue_mask];
+		size_t seq = atomic_load_explicit(&r->seq,
+			memory_order_acquire);
+
+		if (seq != (dequeue_pos + 1)) {
+			break;
+		}
+
+		record_print(r->site, r->suppressed, r->time, r->msg);
+
+		atomic_store_explicit(&r->seq, dequeue_pos + queue_mask + 1,
+			memory_order_release);
+		dequeue_pos++;
+		n++;
+	}
+
+	return n;
+}
+
+static void
+report_suppressed(void)
+{
+	struct log_site *s;
+
+	for (s=atomic_load(&sites); s; s=s->next) {
+		uint64_t n = atomic_exchange_explicit(&s->suppressed, 0,
+			memory_order_relaxed);
+
+		if (n == 0) {
+			continue;
+		}
+		atomic_fetch_add_explicit(&total_suppressed, n,
+			memory_order_relaxed);
+
+		if (logfile) {
+			fprintf(logfile, "%lu messages suppressed "
+				"[%s, line %d, function %s()]\n",
+				(unsigned long)n, s->file, s->line, s->func);
+		} else {
+			syslog(LOG_DEBUG | LOG_USER, "%lu messages suppressed "
+				"[%s, line %d, function %s()]",
+				(unsigned long)n, s->file, s->line, s->func);
+		}
+	}
+}
+
+static void *
+log_thread(void *arg)
+{
+	uint64_t last_report = log_now();
+
+	(void)arg;
+
+	for (;;) {
+		size_t n = queue_drain();
+		uint64_t now = log_now();
+
+		if ((now - last_report) >= LOG_REPORT_NS) {
+			report_suppressed();
+			last_report = now;
+			n++;
+		}
+
+		if (n && logfile) {
+			fflush(logfile);
+		}
+
+		if (atomic_load_explicit(&stop, memory_order_relaxed)) {
+			break;
+		}
+
+		if (n == 0) {
+			usleep(LOG_POLL_US);
+		}
+	}
+
+	/* producers may still write synchronously */
+	atomic_store_explicit(&running, 0, memory_order_release);
+	queue_drain();
+	report_suppressed();
+	if (logfile) {
+		fflush(logfile);
+	}
+
+	return NULL;
+}
+
+int
+log_init(struct log_conf *c)
+{
+	size_t i, size = 1;
+	int thread_err;
+
+	if (c->rate) {
+		conf.rate = c->rate;
+	}
+	if (c->burst) {
+		conf.burst = c->burst;
+	}
+	if (c->queue) {
+		conf.queue = c->queue;
+	}
+	strcpy(conf.file, c->file);
+
+	interval_ns = 1000000000ULL / conf.rate;
+	burst_ns = interval_ns * conf.burst;
+
+	while (size < conf.queue) {
+		size <<= 1;
+	}
+	queue_mask = size - 1;
+
+	queue = calloc(size, sizeof(struct log_record));
+	if (!queue) {
+		LOG("log: calloc() failed");
+		goto fail_alloc;
+	}
+	for (i=0; i<size; i++) {
+		atomic_init(&queue[i].seq, i);
+	}
+	atomic_init(&enqueue_pos, 0);
+	dequeue_pos = 0;
+
+	if (*conf.file) {
+		logfile = fopen(conf.file, "a");
+		if (!logfile) {
+			LOG("log: can't open file '%s': %s", conf.file,
+				strerror(errno));
+			goto fail_open;
+		}
+	}
+
+	atomic_store(&stop, 0);
+	atomic_store_explicit(&running, 1, memory_order_release);
+
+	thread_err = pthread_create(&log_tid, NULL, &log_thread, NULL);
+	if (thread_err) {
+		LOG("log: can't start thread: %s", strerror(thread_err));
+		goto fail_thread;
+	}
+
+	LOG("log: rate %u messages/s, burst %u, queue %lu records, %s",
+		conf.rate, conf.burst, (unsigned long)size,
+		logfile ? conf.file : "syslog");
+
+	return 1;
+
+fail_thread:
+	atomic_store(&running, 0);
+	if (logfile) {
+		fclose(logfile);
+		logfile = NULL;
+	}
+fail_open:
+	free(queue);
+	queue = NULL;
+fail_alloc:
+	return 0;
+}
+
+void
+log_stop(void)
+{
+	if (!queue) {
+		return;
+	}
+
+	atomic_store_explicit(&stop, 1, memory_order_relaxed);
+	pthread_join(log_tid, NULL);
+}
+
+uint64_t
+log_suppressed(void)
+{
+	return atomic_load_explicit(&total_suppressed, memory_order_relaxed);
+}
+
+uint64_t
+log_dropped(void)
+{
+	return atomic_load_explicit(&total_dropped, memory_order_relaxed);
+}
+
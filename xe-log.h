@@ -0,0 +1,100 @@
+#ifndef xe_log_h_included
+#define xe_log_h_included
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "aajson/aajson.h"
+
+/*
+ * Rate-limited asynchronous logging for per-packet paths
+ *
+ * LOG() formats message and calls syslog() in the calling thread, this is
+ * fine for configuration and helper threads. Messages which can be repeated
+ * for each packet or flow (unknown templates, malformed packets, full
+ * databases) are written with LOG_RL().
+ *
+ * Each LOG_RL() call site has own token bucket (in GCRA form: one atomic
+ * "theoretical arrival time" per site): 'burst' messages at once and 'rate'
+ * messages per second after that. Other messages are only counted. Number
+ * of suppressed messages is reported with the next message from the same
+ * site, or by logger thread once per second.
+ *
+ * Allowed message is formatted into fixed-size record and pushed to bounded
+ * lock-free queue (multiple producers, one consumer). Logger thread writes
+ * records to syslog or to file. If queue is full record is dropped and
+ * counted. Until logger thread is started (and in utilities) messages are
+ * written synchronously, still rate limited.
+ */
+
+#define LOG_RL_DEFAULT_RATE 10
+#define LOG_RL_DEFAULT_BURST 20
+#define LOG_RL_DEFAULT_QUEUE 4096
+
+#define LOG_RECORD_MSG_SIZE 256
+
+/* how often suppressed counters are reported, and queue polling interval */
+#define LOG_REPORT_NS 1000000000ULL
+#define LOG_POLL_US 20000
+
+struct log_conf
+{
+	/* log file, empty - syslog */
+	char file[PATH_MAX];
+
+	/* messages per second and burst for each call site */
+	unsigned int rate;
+	unsigned int burst;
+
+	/* number of records in queue, rounded to power of two */
+	size_t queue;
+};
+
+/* static data of LOG_RL() call site */
+struct log_site
+{
+	const char *file;
+	int line;
+	const char *func;
+
+	_Atomic uint64_t tat;
+	_Atomic uint64_t suppressed;
+
+	/* site is added to list for periodic reports after first suppressed
+	   message */
+	atomic_flag registered;
+	struct log_site *next;
+};
+
+#define LOG_RL(...)                                                    \
+do {                                                                   \
+	static struct log_site _site = {                               \
+		.file = __FILE__, .line = __LINE__, .func = __func__,  \
+		.registered = ATOMIC_FLAG_INIT                         \
+	};                                                             \
+	if (log_rl_allow(&_site)) {                                    \
+		log_rl_write(&_site, __VA_ARGS__);                     \
+	}                                                              \
+} while (0)
+
+int log_config(struct aajson *a, aajson_val *value, struct log_conf *c);
+
+/* open log file and start logger thread */
+int log_init(struct log_conf *c);
+
+/* write queued records and stop logger thread */
+void log_stop(void);
+
+int log_rl_allow(struct log_site *s);
+
+void log_rl_write(struct log_site *s, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+
+/* counters for metrics */
+uint64_t log_suppressed(void);
+uint64_t log_dropped(void);
+
+#endif
+
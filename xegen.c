@@ -0,0 +1,1456 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Synthetic NetFlow v5/v9, IPFIX and sFlow v5 traffic generator
+ *
+ * Datagrams are sent over UDP with sendmmsg() in batches, optionally at
+ * fixed rate. Sources of traffic are hosts from 10.0.0.0/8, popularity of
+ * host follows Zipf distribution. Attack bursts are flows from DNS
+ * reflectors (198.51.100.0/24, source port 53) to one victim.
+ *
+ * NetFlow v9 templates are sent in separate datagrams, IPFIX templates in
+ * the same datagram before data set. With template churn the layout of
+ * template is changed under the same template id. IPFIX layouts have
+ * variable-length interface name.
+ *
+ * Totals of all sent flows (and top hosts by octets) are written to the
+ * sidecar file. sFlow packets and octets are multiplied by sampling rate,
+ * as the collector does.
+ *
+ * With -C the generator counts records which the combiner of collector
+ * could sum with previous records: records whose key (dst host, pair of
+ * src and dst hosts) was seen before in the same datagram, and in the same
+ * window of N datagrams (as if combiner was flushed every N datagrams).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "netflow.h"
+
+/* only layer types are used, parser is not */
+#define ON_ETH(D, E) (void)D
+#include "rawparse.h"
+
+#define GEN_MTU 1400
+#define GEN_BATCH 64
+
+/* resend template after each N datagrams of source */
+#define GEN_TEMPLATE_REFRESH 64
+#define GEN_TEMPLATE_ID 256
+
+#define GEN_HOSTS_NET 0x0a000000        /* 10.0.0.0/8 */
+#define GEN_DST_NET 0xc0a80000          /* 192.168.0.0/16 */
+#define GEN_REFLECTORS_NET 0xc6336400   /* 198.51.100.0/24 */
+#define GEN_VICTIM 0xcb00710a           /* 203.0.113.10 */
+#define GEN_AGENT 0x7f000001            /* 127.0.0.1 */
+
+#define GEN_TOP_HOSTS 10
+#define GEN_IFNAME_MAX 15
+
+enum GEN_PROTO
+{
+	GEN_NF5,
+	GEN_NF9,
+	GEN_IPFIX,
+	GEN_SFLOW,
+
+	GEN_PROTO_MAX
+};
+
+/* same names as in collector metrics */
+static const char *proto_names[GEN_PROTO_MAX] = {
+	"netflow_v5", "netflow_v9", "ipfix", "sflow"
+};
+
+static const char *proto_opts[GEN_PROTO_MAX] = {
+	"nf5", "nf9", "ipfix", "sflow"
+};
+
+/* template layouts, field id and length */
+struct gen_field
+{
+	uint16_t id;
+	uint16_t len;
+};
+
+#define LAYOUT_A_N 10
+static const struct gen_field layout_a[LAYOUT_A_N] = {
+	{8, 4}, {12, 4}, {7, 2}, {11, 2}, {4, 1}, {6, 1},
+	{2, 4}, {1, 4}, {10, 2}, {14, 2}
+};
+
+#define LAYOUT_B_N 10
+static const struct gen_field layout_b[LAYOUT_B_N] = {
+	{1, 8}, {2, 8}, {8, 4}, {12, 4}, {4, 1}, {7, 2},
+	{11, 2}, {6, 1}, {10, 4}, {14, 4}
+};
+
+/* worst case size of record */
+#define NF9_REC_MAX 38
+#define IPFIX_REC_MAX (38 + 1 + GEN_IFNAME_MAX)
+#define SFLOW_SAMPLE_MAX 120
+
+struct gen_flow
+{
+	uint32_t src, dst;
+	uint16_t sport, dport;
+	uint8_t proto, tcp_flags;
+	uint32_t packets, octets;
+	uint32_t in_if, out_if;
+	size_t host;
+	int attack;
+};
+
+struct gen_totals
+{
+	uint64_t flows, packets, octets;
+};
+
+/* keys of windows for combiner statistics */
+enum GEN_COMB
+{
+	GEN_COMB_DST_DGRAM,
+	GEN_COMB_PAIR_DGRAM,
+	GEN_COMB_DST_WINDOW,
+	GEN_COMB_PAIR_WINDOW,
+	GEN_COMB_MAX
+};
+
+/* set of keys, slot is used if its generation is current */
+struct gen_comb
+{
+	size_t nslots;
+	uint64_t *keys;
+	uint64_t *gens;
+	uint64_t gen;
+	uint64_t hits;
+};
+
+struct gen_source
+{
+	uint32_t id;
+	uint32_t seq[GEN_PROTO_MAX];
+
+	/* NetFlow v9 and IPFIX */
+	int layout[GEN_PROTO_MAX];
+	uint64_t since_tmpl[GEN_PROTO_MAX];
+	uint64_t ndgrams[GEN_PROTO_MAX];
+};
+
+struct gen_batch
+{
+	int fd;
+	size_t n;
+	struct mmsghdr msgs[GEN_BATCH];
+	struct iovec iovs[GEN_BATCH];
+	uint8_t bufs[GEN_BATCH][GEN_MTU];
+};
+
+struct gen
+{
+	/* options */
+	unsigned int weights[GEN_PROTO_MAX];
+	unsigned int weights_sum;
+	uint64_t ndgrams;
+	int duration;
+	uint64_t rate;
+	unsigned int flows;
+	size_t nhosts;
+	double zipf;
+	size_t nsources;
+	uint64_t churn;
+	uint64_t burst_every, burst_len;
+	uint32_t sampling;
+	uint64_t seed;
+	uint64_t comb_window;
+
+	uint64_t rnd;
+	double *cdf;
+	struct gen_source *sources;
+
+	struct gen_batch nf, sf;
+	size_t batch_max;
+
+	struct timespec start;
+
+	/* what was sent */
+	uint64_t sent, templates;
+	uint64_t dgrams[GEN_PROTO_MAX];
+	struct gen_totals proto[GEN_PROTO_MAX];
+	struct gen_totals attack;
+	struct gen_totals *hosts;
+
+	uint64_t comb_records;
+	struct gen_comb comb[GEN_COMB_MAX];
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void
+on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static void
+print_usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-a addr] [-p port] [-P sflow-port] "
+		"[-m mix] [-n datagrams]\n"
+		"\t[-t seconds] [-r rate] [-f flows] [-H hosts] [-z zipf] "
+		"[-s sources]\n"
+		"\t[-c churn] [-b every,len] [-R sampling] [-S seed] "
+		"[-o totals.txt]\n\t[-C datagrams]\n\n", progname);
+	fprintf(stderr,
+		"    -a collector address (default 127.0.0.1)\n"
+		"    -p NetFlow/IPFIX port (default 2055)\n"
+		"    -P sFlow port (default 6343)\n"
+		"    -m mix of protocols with weights, "
+		"e.g. 'nf5:1,nf9:2,ipfix:2,sflow:1' (default nf9)\n"
+		"    -n number of data datagrams (default 10000, "
+		"0 - unlimited)\n"
+		"    -t stop after N seconds\n"
+		"    -r datagrams per second (default 0 - as fast as possible)\n"
+		"    -f flows per datagram (default 10)\n"
+		"    -H number of source hosts (default 10000)\n"
+		"    -z Zipf exponent of host popularity (default 1.0, "
+		"0 - uniform)\n"
+		"    -s number of exporters (source ids, default 1)\n"
+		"    -c change template layout each N datagrams of exporter\n"
+		"    -b attack burst: N datagrams of each EVERY\n"
+		"    -R sFlow sampling rate (default 1)\n"
+		"    -S random seed (default 1)\n"
+		"    -o file with expected totals\n"
+		"    -C print share of records with repeated keys in datagram "
+		"and in N datagrams\n");
+}
+
+/* xorshift64* */
+static uint64_t
+rnd(struct gen *g)
+{
+	g->rnd ^= g->rnd >> 12;
+	g->rnd ^= g->rnd << 25;
+	g->rnd ^= g->rnd >> 27;
+	return g->rnd * 2685821657736338717ULL;
+}
+
+static double
+rnd_double(struct gen *g)
+{
+	return (rnd(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t
+rnd_range(struct gen *g, uint32_t from, uint32_t to)
+{
+	return from + rnd(g) % (to - from + 1);
+}
+
+static int
+zipf_init(struct gen *g)
+{
+	size_t i;
+	double sum = 0.0;
+
+	g->cdf = malloc(g->nhosts * sizeof(double));
+	if (!g->cdf) {
+		fprintf(stderr, "Can't allocate memory for %lu hosts\n",
+			g->nhosts);
+		return 0;
+	}
+
+	for (i=0; i<g->nhosts; i++) {
+		sum += 1.0 / pow((double)(i + 1), g->zipf);
+		g->cdf[i] = sum;
+	}
+	for (i=0; i<g->nhosts; i++) {
+		g->cdf[i] /= sum;
+	}
+
+	return 1;
+}
+
+/* rank of host, 0 is the most popular */
+static size_t
+zipf_host(struct gen *g)
+{
+	double u = rnd_double(g);
+	size_t lo = 0, hi = g->nhosts - 1;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (g->cdf[mid] > u) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return lo;
+}
+
+static void
+flow_gen(struct gen *g, struct gen_flow *f, int attack, int sflow)
+{
+	uint32_t pkt_size;
+
+	memset(f, 0, sizeof(struct gen_flow));
+
+	f->attack = attack;
+	if (attack) {
+		f->src = GEN_REFLECTORS_NET + rnd_range(g, 1, 254);
+		f->dst = GEN_VICTIM;
+		f->sport = 53;
+		f->dport = rnd_range(g, 1024, 65535);
+		f->proto = 17;
+		pkt_size = rnd_range(g, 1200, 1500);
+	} else {
+		f->host = zipf_host(g);
+		f->src = GEN_HOSTS_NET + f->host + 1;
+		f->dst = GEN_DST_NET + rnd_range(g, 1, 65534);
+		f->sport = rnd_range(g, 1024, 65535);
+		if ((rnd(g) % 10) < 8) {
+			f->proto = 6;
+			f->dport = (rnd(g) & 1) ? 443 : 80;
+			f->tcp_flags = 0x18;
+		} else {
+			f->proto = 17;
+			f->dport = 53;
+		}
+		pkt_size = rnd_range(g, 64, 1500);
+	}
+
+	f->packets = sflow ? 1 : rnd_range(g, 1, 100);
+	f->octets = f->packets * pkt_size;
+
+	f->in_if = 1 + (f->src & 3);
+	f->out_if = 5 + (f->dst & 3);
+}
+
+static int
+comb_init(struct gen_comb *c, size_t nkeys)
+{
+	c->nslots = 2;
+	while (c->nslots < nkeys * 2) {
+		c->nslots *= 2;
+	}
+
+	c->keys = calloc(c->nslots, sizeof(uint64_t));
+	c->gens = calloc(c->nslots, sizeof(uint64_t));
+	if (!c->keys || !c->gens) {
+		fprintf(stderr, "Can't allocate memory for %lu keys\n",
+			nkeys);
+		return 0;
+	}
+	c->gen = 1;
+
+	return 1;
+}
+
+static void
+comb_free(struct gen_comb *c)
+{
+	free(c->keys);
+	free(c->gens);
+}
+
+/* key is counted as hit if it's already in set */
+static void
+comb_add(struct gen_comb *c, uint64_t key)
+{
+	size_t i;
+
+	i = ((key * 0x9e3779b97f4a7c15ULL) >> 32) & (c->nslots - 1);
+	while (c->gens[i] == c->gen) {
+		if (c->keys[i] == key) {
+			c->hits++;
+			return;
+		}
+		i = (i + 1) & (c->nslots - 1);
+	}
+
+	c->gens[i] = c->gen;
+	c->keys[i] = key;
+}
+
+static void
+comb_account(struct gen *g, struct gen_flow *f)
+{
+	uint64_t pair = ((uint64_t)f->src << 32) | f->dst;
+
+	g->comb_records++;
+	comb_add(&g->comb[GEN_COMB_DST_DGRAM], f->dst);
+	comb_add(&g->comb[GEN_COMB_PAIR_DGRAM], pair);
+	comb_add(&g->comb[GEN_COMB_DST_WINDOW], f->dst);
+	comb_add(&g->comb[GEN_COMB_PAIR_WINDOW], pair);
+}
+
+/* new datagram, window of datagrams starts at idx */
+static void
+comb_next(struct gen *g, uint64_t idx)
+{
+	g->comb[GEN_COMB_DST_DGRAM].gen++;
+	g->comb[GEN_COMB_PAIR_DGRAM].gen++;
+
+	if ((idx % g->comb_window) == 0) {
+		g->comb[GEN_COMB_DST_WINDOW].gen++;
+		g->comb[GEN_COMB_PAIR_WINDOW].gen++;
+	}
+}
+
+static void
+comb_print(struct gen *g)
+{
+	double n = g->comb_records ? g->comb_records : 1;
+
+	fprintf(stderr, "records with repeated keys: dst host %.1f%% in "
+		"datagram, %.1f%% in %lu datagrams; src and dst host %.1f%% "
+		"in datagram, %.1f%% in %lu datagrams\n",
+		g->comb[GEN_COMB_DST_DGRAM].hits * 100.0 / n,
+		g->comb[GEN_COMB_DST_WINDOW].hits * 100.0 / n,
+		(unsigned long)g->comb_window,
+		g->comb[GEN_COMB_PAIR_DGRAM].hits * 100.0 / n,
+		g->comb[GEN_COMB_PAIR_WINDOW].hits * 100.0 / n,
+		(unsigned long)g->comb_window);
+}
+
+static void
+flow_account(struct gen *g, enum GEN_PROTO p, struct gen_flow *f)
+{
+	uint64_t packets = f->packets, octets = f->octets;
+
+	if (p == GEN_SFLOW) {
+		packets *= g->sampling;
+		octets *= g->sampling;
+	}
+
+	g->proto[p].flows++;
+	g->proto[p].packets += packets;
+	g->proto[p].octets += octets;
+
+	if (f->attack) {
+		g->attack.flows++;
+		g->attack.packets += packets;
+		g->attack.octets += octets;
+	} else {
+		g->hosts[f->host].flows++;
+		g->hosts[f->host].packets += packets;
+		g->hosts[f->host].octets += octets;
+	}
+
+	if (g->comb_window) {
+		comb_account(g, f);
+	}
+}
+
+static uint8_t *
+put8(uint8_t *p, uint8_t v)
+{
+	*p = v;
+	return p + 1;
+}
+
+static uint8_t *
+put16(uint8_t *p, uint16_t v)
+{
+	v = htons(v);
+	memcpy(p, &v, sizeof(uint16_t));
+	return p + sizeof(uint16_t);
+}
+
+static uint8_t *
+put32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof(uint32_t));
+	return p + sizeof(uint32_t);
+}
+
+static uint8_t *
+put64(uint8_t *p, uint64_t v)
+{
+	p = put32(p, v >> 32);
+	return put32(p, v & 0xffffffff);
+}
+
+static uint8_t *
+put_uint(uint8_t *p, uint64_t v, uint16_t len)
+{
+	switch (len) {
+		case 1:
+			return put8(p, v);
+		case 2:
+			return put16(p, v);
+		case 4:
+			return put32(p, v);
+		default:
+			return put64(p, v);
+	}
+}
+
+static uint32_t
+uptime_ms(struct gen *g)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - g->start.tv_sec) * 1000
+		+ (ts.tv_nsec - g->start.tv_nsec) / 1000000;
+}
+
+static size_t
+max_flows(struct gen *g, enum GEN_PROTO p)
+{
+	size_t max;
+
+	switch (p) {
+		case GEN_NF5:
+			max = 30;
+			break;
+		case GEN_NF9:
+			max = (GEN_MTU - sizeof(struct nf9_header) - 4)
+				/ NF9_REC_MAX;
+			break;
+		case GEN_IPFIX:
+			max = (GEN_MTU - sizeof(struct ipfix_header)
+				- 4 * 2 - 4 - 4 * LAYOUT_B_N - 4)
+				/ IPFIX_REC_MAX;
+			break;
+		default:
+			max = (GEN_MTU - 28) / SFLOW_SAMPLE_MAX;
+			break;
+	}
+
+	return g->flows < max ? g->flows : max;
+}
+
+static size_t
+dgram_nf5(struct gen *g, struct gen_source *s, int attack, uint8_t *buf)
+{
+	uint8_t *p = buf;
+	size_t i, n = max_flows(g, GEN_NF5);
+	uint32_t uptime = uptime_ms(g);
+
+	p = put16(p, 5);
+	p = put16(p, n);
+	p = put32(p, uptime);
+	p = put32(p, time(NULL));
+	p = put32(p, 0);
+	p = put32(p, s->seq[GEN_NF5]);
+	p = put8(p, 0);
+	p = put8(p, s->id & 0xff);
+	p = put16(p, 0);
+
+	for (i=0; i<n; i++) {
+		struct gen_flow f;
+
+		flow_gen(g, &f, attack, 0);
+		flow_account(g, GEN_NF5, &f);
+
+		p = put32(p, f.src);
+		p = put32(p, f.dst);
+		p = put32(p, 0);
+		p = put16(p, f.in_if);
+		p = put16(p, f.out_if);
+		p = put32(p, f.packets);
+		p = put32(p, f.octets);
+		p = put32(p, uptime);
+		p = put32(p, uptime);
+		p = put16(p, f.sport);
+		p = put16(p, f.dport);
+		p = put8(p, 0);
+		p = put8(p, f.tcp_flags);
+		p = put8(p, f.proto);
+		p = put8(p, 0);
+		p = put16(p, 0);
+		p = put16(p, 0);
+		p = put8(p, 24);
+		p = put8(p, 24);
+		p = put16(p, 0);
+	}
+	s->seq[GEN_NF5] += n;
+
+	return p - buf;
+}
+
+static void
+layout_get(struct gen_source *s, enum GEN_PROTO p,
+	const struct gen_field **fields, size_t *n)
+{
+	if (s->layout[p]) {
+		*fields = layout_b;
+		*n = LAYOUT_B_N;
+	} else {
+		*fields = layout_a;
+		*n = LAYOUT_A_N;
+	}
+}
+
+/* returns pointer after template record */
+static uint8_t *
+template_put(struct gen_source *s, enum GEN_PROTO p, uint8_t *ptr)
+{
+	const struct gen_field *fields;
+	size_t i, n;
+
+	layout_get(s, p, &fields, &n);
+
+	ptr = put16(ptr, GEN_TEMPLATE_ID);
+	ptr = put16(ptr, n + (p == GEN_IPFIX ? 1 : 0));
+	for (i=0; i<n; i++) {
+		ptr = put16(ptr, fields[i].id);
+		ptr = put16(ptr, fields[i].len);
+	}
+	if (p == GEN_IPFIX) {
+		/* interface name, variable length */
+		ptr = put16(ptr, 82);
+		ptr = put16(ptr, VAR_LEN_FIELD_LEN);
+	}
+
+	return ptr;
+}
+
+static uint8_t *
+record_put(struct gen_source *s, enum GEN_PROTO p, struct gen_flow *f,
+	uint8_t *ptr)
+{
+	const struct gen_field *fields;
+	size_t i, n;
+
+	layout_get(s, p, &fields, &n);
+
+	for (i=0; i<n; i++) {
+		uint64_t v;
+
+		switch (fields[i].id) {
+			case 1: v = f->octets; break;
+			case 2: v = f->packets; break;
+			case 4: v = f->proto; break;
+			case 6: v = f->tcp_flags; break;
+			case 7: v = f->sport; break;
+			case 8: v = f->src; break;
+			case 10: v = f->in_if; break;
+			case 11: v = f->dport; break;
+			case 12: v = f->dst; break;
+			case 14: v = f->out_if; break;
+			default: v = 0; break;
+		}
+		ptr = put_uint(ptr, v, fields[i].len);
+	}
+
+	if (p == GEN_IPFIX) {
+		char ifname[GEN_IFNAME_MAX + 1];
+		int len;
+
+		len = snprintf(ifname, sizeof(ifname), "ge-0/0/%u",
+			f->in_if);
+		ptr = put8(ptr, len);
+		memcpy(ptr, ifname, len);
+		ptr += len;
+	}
+
+	return ptr;
+}
+
+/* template churn and periodic refresh, returns 1 if template is needed */
+static int
+template_needed(struct gen *g, struct gen_source *s, enum GEN_PROTO p)
+{
+	int need = 0;
+
+	if (g->churn && s->ndgrams[p] && ((s->ndgrams[p] % g->churn) == 0)) {
+		s->layout[p] = !s->layout[p];
+		need = 1;
+	}
+
+	if ((s->ndgrams[p] == 0)
+		|| (s->since_tmpl[p] >= GEN_TEMPLATE_REFRESH)) {
+
+		need = 1;
+	}
+
+	if (need) {
+		s->since_tmpl[p] = 0;
+	}
+	s->since_tmpl[p]++;
+	s->ndgrams[p]++;
+
+	return need;
+}
+
+static uint8_t *
+nf9_header_put(struct gen *g, struct gen_source *s, uint16_t count,
+	uint8_t *p)
+{
+	p = put16(p, 9);
+	p = put16(p, count);
+	p = put32(p, uptime_ms(g));
+	p = put32(p, time(NULL));
+	p = put32(p, s->seq[GEN_NF9]++);
+	return put32(p, s->id);
+}
+
+/*
+ * collector walks data flowset "count" (from header) times, so template and
+ * data go in separate datagrams
+ */
+static size_t
+dgram_nf9_template(struct gen *g, struct gen_source *s, uint8_t *buf)
+{
+	uint8_t *p = buf, *fs;
+
+	p = nf9_header_put(g, s, 1, p);
+
+	fs = p;
+	p = put16(p, 0);
+	p = put16(p, 0);
+	p = template_put(s, GEN_NF9, p);
+	put16(fs + 2, p - fs);
+
+	return p - buf;
+}
+
+static size_t
+dgram_nf9(struct gen *g, struct gen_source *s, int attack, uint8_t *buf)
+{
+	uint8_t *p = buf, *fs;
+	size_t i, n = max_flows(g, GEN_NF9);
+
+	p = nf9_header_put(g, s, n, p);
+
+	fs = p;
+	p = put16(p, GEN_TEMPLATE_ID);
+	p = put16(p, 0);
+	for (i=0; i<n; i++) {
+		struct gen_flow f;
+
+		flow_gen(g, &f, attack, 0);
+		flow_account(g, GEN_NF9, &f);
+		p = record_put(s, GEN_NF9, &f, p);
+	}
+	put16(fs + 2, p - fs);
+
+	return p - buf;
+}
+
+static size_t
+dgram_ipfix(struct gen *g, struct gen_source *s, int attack, int tmpl,
+	uint8_t *buf)
+{
+	uint8_t *p = buf, *fs;
+	size_t i, n = max_flows(g, GEN_IPFIX);
+
+	p = put16(p, 10);
+	p = put16(p, 0);
+	p = put32(p, time(NULL));
+	p = put32(p, s->seq[GEN_IPFIX]);
+	p = put32(p, s->id);
+
+	if (tmpl) {
+		fs = p;
+		p = put16(p, 2);
+		p = put16(p, 0);
+		p = template_put(s, GEN_IPFIX, p);
+		put16(fs + 2, p - fs);
+	}
+
+	fs = p;
+	p = put16(p, GEN_TEMPLATE_ID);
+	p = put16(p, 0);
+	for (i=0; i<n; i++) {
+		struct gen_flow f;
+
+		flow_gen(g, &f, attack, 0);
+		flow_account(g, GEN_IPFIX, &f);
+		p = record_put(s, GEN_IPFIX, &f, p);
+	}
+	put16(fs + 2, p - fs);
+
+	/* IPFIX sequence counts data records */
+	s->seq[GEN_IPFIX] += n;
+	put16(buf + 2, p - buf);
+
+	return p - buf;
+}
+
+/* sampled packet headers, Ethernet + IPv4 + TCP/UDP */
+static size_t
+sflow_header_put(struct gen_flow *f, uint8_t *buf)
+{
+	struct ethhdr eth;
+	struct iphdr ip;
+	size_t l4len;
+	uint8_t *p = buf;
+
+	memset(&eth, 0, sizeof(struct ethhdr));
+	eth.h_source[5] = 1;
+	eth.h_dest[5] = 2;
+	eth.h_proto = htons(ETH_P_IP);
+	memcpy(p, &eth, sizeof(struct ethhdr));
+	p += sizeof(struct ethhdr);
+
+	l4len = (f->proto == 6) ? sizeof(struct tcphdr)
+		: sizeof(struct udphdr);
+
+	memset(&ip, 0, sizeof(struct iphdr));
+	ip.version = 4;
+	ip.ihl = 5;
+	ip.ttl = 64;
+	ip.protocol = f->proto;
+	ip.tot_len = htons(f->octets - sizeof(struct ethhdr));
+	ip.saddr = htonl(f->src);
+	ip.daddr = htonl(f->dst);
+	memcpy(p, &ip, sizeof(struct iphdr));
+	p += sizeof(struct iphdr);
+
+	if (f->proto == 6) {
+		struct tcphdr tcp;
+
+		memset(&tcp, 0, sizeof(struct tcphdr));
+		tcp.th_sport = htons(f->sport);
+		tcp.th_dport = htons(f->dport);
+		tcp.th_off = 5;
+		tcp.th_flags = f->tcp_flags;
+		memcpy(p, &tcp, l4len);
+	} else {
+		struct udphdr udp;
+
+		memset(&udp, 0, sizeof(struct udphdr));
+		udp.uh_sport = htons(f->sport);
+		udp.uh_dport = htons(f->dport);
+		udp.uh_ulen = htons(f->octets - sizeof(struct ethhdr)
+			- sizeof(struct iphdr));
+		memcpy(p, &udp, l4len);
+	}
+	p += l4len;
+
+	return p - buf;
+}
+
+static size_t
+dgram_sflow(struct gen *g, struct gen_source *s, int attack, uint8_t *buf)
+{
+	uint8_t *p = buf;
+	size_t i, n = max_flows(g, GEN_SFLOW);
+
+	p = put32(p, 5);
+	p = put32(p, 1);
+	p = put32(p, GEN_AGENT);
+	p = put32(p, s->id);
+	p = put32(p, s->seq[GEN_SFLOW]++);
+	p = put32(p, uptime_ms(g));
+	p = put32(p, n);
+
+	for (i=0; i<n; i++) {
+		struct gen_flow f;
+		uint8_t hdr[64], *sample_len;
+		size_t hlen, hlen_pad;
+
+		flow_gen(g, &f, attack, 1);
+		flow_account(g, GEN_SFLOW, &f);
+
+		hlen = sflow_header_put(&f, hdr);
+		hlen_pad = (hlen + 3) & ~3UL;
+		memset(hdr + hlen, 0, hlen_pad - hlen);
+
+		/* flow sample */
+		p = put32(p, 1);
+		sample_len = p;
+		p = put32(p, 0);
+		p = put32(p, i);
+		p = put32(p, f.in_if);
+		p = put32(p, g->sampling);
+		p = put32(p, 0);
+		p = put32(p, 0);
+		p = put32(p, f.in_if);
+		p = put32(p, f.out_if);
+		p = put32(p, 1);
+
+		/* raw packet header record */
+		p = put32(p, 1);
+		p = put32(p, 16 + hlen_pad);
+		p = put32(p, 1);
+		p = put32(p, f.octets);
+		p = put32(p, 4);
+		p = put32(p, hlen);
+		memcpy(p, hdr, hlen_pad);
+		p += hlen_pad;
+
+		put32(sample_len, p - sample_len - 4);
+	}
+
+	return p - buf;
+}
+
+static int
+socket_open(const char *addr, const char *port)
+{
+	struct addrinfo hints, *res;
+	int rc, fd;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	rc = getaddrinfo(addr, port, &hints, &res);
+	if (rc != 0) {
+		fprintf(stderr, "Can't resolve '%s:%s': %s\n", addr, port,
+			gai_strerror(rc));
+		return -1;
+	}
+
+	fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0) {
+		fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+		goto fail_socket;
+	}
+
+	if (connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+		fprintf(stderr, "connect() failed: %s\n", strerror(errno));
+		close(fd);
+		fd = -1;
+	}
+
+fail_socket:
+	freeaddrinfo(res);
+	return fd;
+}
+
+static void
+batch_init(struct gen_batch *b, int fd)
+{
+	size_t i;
+
+	b->fd = fd;
+	b->n = 0;
+	memset(b->msgs, 0, sizeof(b->msgs));
+	for (i=0; i<GEN_BATCH; i++) {
+		b->iovs[i].iov_base = b->bufs[i];
+		b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+static int
+batch_flush(struct gen *g, struct gen_batch *b)
+{
+	size_t off = 0;
+
+	while (off < b->n) {
+		int rc;
+
+		rc = sendmmsg(b->fd, &b->msgs[off], b->n - off, 0);
+		if (rc < 0) {
+			/* ECONNREFUSED is pending ICMP error for one of
+			   previous datagrams, this one is not sent yet */
+			if ((errno == EINTR) || (errno == ENOBUFS)
+				|| (errno == EAGAIN) || (errno == ECONNREFUSED)) {
+
+				continue;
+			}
+			fprintf(stderr, "sendmmsg() failed: %s\n",
+				strerror(errno));
+			return 0;
+		}
+		off += rc;
+	}
+
+	g->sent += b->n;
+	b->n = 0;
+
+	return 1;
+}
+
+/* returns buffer for next datagram */
+static uint8_t *
+batch_next(struct gen *g, struct gen_batch *b)
+{
+	if (b->n == g->batch_max) {
+		if (!batch_flush(g, b)) {
+			return NULL;
+		}
+	}
+	return b->bufs[b->n];
+}
+
+static void
+batch_commit(struct gen_batch *b, size_t len)
+{
+	b->iovs[b->n].iov_len = len;
+	b->n++;
+}
+
+static void
+rate_wait(struct gen *g, uint64_t n)
+{
+	struct timespec ts;
+	uint64_t ns;
+
+	if (!g->rate) {
+		return;
+	}
+
+	ns = n * 1000000000ULL / g->rate;
+	ts.tv_sec = g->start.tv_sec + ns / 1000000000ULL;
+	ts.tv_nsec = g->start.tv_nsec + ns % 1000000000ULL;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+		== EINTR) {
+
+		if (stop) {
+			break;
+		}
+	}
+}
+
+static enum GEN_PROTO
+proto_pick(struct gen *g)
+{
+	unsigned int r;
+	int p;
+
+	r = rnd(g) % g->weights_sum;
+	for (p=0; p<GEN_PROTO_MAX - 1; p++) {
+		if (r < g->weights[p]) {
+			break;
+		}
+		r -= g->weights[p];
+	}
+
+	return p;
+}
+
+static int
+dgram_send(struct gen *g, uint64_t idx)
+{
+	enum GEN_PROTO p = proto_pick(g);
+	struct gen_source *s = &g->sources[idx % g->nsources];
+	int attack, tmpl;
+	uint8_t *buf;
+	size_t len;
+
+	attack = g->burst_every
+		&& ((idx % g->burst_every) < g->burst_len);
+
+	if (g->comb_window) {
+		comb_next(g, idx);
+	}
+
+	if (p == GEN_SFLOW) {
+		buf = batch_next(g, &g->sf);
+		if (!buf) {
+			return 0;
+		}
+		len = dgram_sflow(g, s, attack, buf);
+		batch_commit(&g->sf, len);
+		g->dgrams[p]++;
+		return 1;
+	}
+
+	if (p == GEN_NF5) {
+		buf = batch_next(g, &g->nf);
+		if (!buf) {
+			return 0;
+		}
+		len = dgram_nf5(g, s, attack, buf);
+		batch_commit(&g->nf, len);
+		g->dgrams[p]++;
+		return 1;
+	}
+
+	tmpl = template_needed(g, s, p);
+
+	if ((p == GEN_NF9) && tmpl) {
+		buf = batch_next(g, &g->nf);
+		if (!buf) {
+			return 0;
+		}
+		len = dgram_nf9_template(g, s, buf);
+		batch_commit(&g->nf, len);
+	}
+	g->templates += tmpl;
+
+	buf = batch_next(g, &g->nf);
+	if (!buf) {
+		return 0;
+	}
+	if (p == GEN_NF9) {
+		len = dgram_nf9(g, s, attack, buf);
+	} else {
+		len = dgram_ipfix(g, s, attack, tmpl, buf);
+	}
+	batch_commit(&g->nf, len);
+	g->dgrams[p]++;
+
+	return 1;
+}
+
+static int
+mix_parse(struct gen *g, char *mix)
+{
+	char *tok, *saveptr = NULL;
+
+	memset(g->weights, 0, sizeof(g->weights));
+	g->weights_sum = 0;
+
+	for (tok = strtok_r(mix, ",", &saveptr); tok;
+		tok = strtok_r(NULL, ",", &saveptr)) {
+
+		char *colon = strchr(tok, ':');
+		unsigned int w = 1;
+		int p;
+
+		if (colon) {
+			*colon = '\0';
+			w = atoi(colon + 1);
+		}
+
+		for (p=0; p<GEN_PROTO_MAX; p++) {
+			if (strcmp(tok, proto_opts[p]) == 0) {
+				break;
+			}
+		}
+		if (p == GEN_PROTO_MAX) {
+			fprintf(stderr, "Unknown protocol '%s'\n", tok);
+			return 0;
+		}
+
+		g->weights[p] += w;
+		g->weights_sum += w;
+	}
+
+	if (!g->weights_sum) {
+		fprintf(stderr, "Empty mix of protocols\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+static void
+totals_print(FILE *f, const char *prefix, struct gen_totals *t)
+{
+	fprintf(f, "%sflows %lu\n", prefix, (unsigned long)t->flows);
+	fprintf(f, "%spackets %lu\n", prefix, (unsigned long)t->packets);
+	fprintf(f, "%soctets %lu\n", prefix, (unsigned long)t->octets);
+}
+
+static int
+totals_write(struct gen *g, const char *path)
+{
+	FILE *f;
+	struct gen_totals all;
+	size_t top[GEN_TOP_HOSTS];
+	size_t ntop = 0, i, j;
+	int p;
+	char prefix[64];
+
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Can't open '%s': %s\n", path,
+			strerror(errno));
+		return 0;
+	}
+
+	memset(&all, 0, sizeof(struct gen_totals));
+	for (p=0; p<GEN_PROTO_MAX; p++) {
+		all.flows += g->proto[p].flows;
+		all.packets += g->proto[p].packets;
+		all.octets += g->proto[p].octets;
+	}
+
+	fprintf(f, "# xegen expected totals, seed %lu\n",
+		(unsigned long)g->seed);
+	fprintf(f, "datagrams %lu\n", (unsigned long)g->sent);
+	fprintf(f, "templates %lu\n", (unsigned long)g->templates);
+	totals_print(f, "", &all);
+
+	for (p=0; p<GEN_PROTO_MAX; p++) {
+		sprintf(prefix, "%s_", proto_names[p]);
+		fprintf(f, "%sdatagrams %lu\n", prefix,
+			(unsigned long)g->dgrams[p]);
+		totals_print(f, prefix, &g->proto[p]);
+	}
+
+	totals_print(f, "attack_", &g->attack);
+
+	/* top hosts by octets, ties by rank */
+	for (i=0; i<g->nhosts; i++) {
+		if (!g->hosts[i].flows) {
+			continue;
+		}
+		for (j=ntop; j>0; j--) {
+			if (g->hosts[top[j - 1]].octets >= g->hosts[i].octets) {
+				break;
+			}
+			if (j < GEN_TOP_HOSTS) {
+				top[j] = top[j - 1];
+			}
+		}
+		if (j < GEN_TOP_HOSTS) {
+			top[j] = i;
+			if (ntop < GEN_TOP_HOSTS) {
+				ntop++;
+			}
+		}
+	}
+
+	fprintf(f, "# host flows packets octets\n");
+	for (i=0; i<ntop; i++) {
+		struct gen_totals *t = &g->hosts[top[i]];
+		uint32_t addr = htonl(GEN_HOSTS_NET + top[i] + 1);
+		char s[INET_ADDRSTRLEN];
+
+		inet_ntop(AF_INET, &addr, s, sizeof(s));
+		fprintf(f, "host %s %lu %lu %lu\n", s, (unsigned long)t->flows,
+			(unsigned long)t->packets, (unsigned long)t->octets);
+	}
+
+	fclose(f);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct gen *g;
+	int opt;
+	char *addr = "127.0.0.1", *port = "2055", *sf_port = "6343";
+	char *totals = NULL;
+	char mix[] = "nf9";
+	char *mix_str = mix;
+	uint64_t i;
+	time_t deadline = 0;
+	size_t s, c;
+	int ret = EXIT_FAILURE;
+
+	g = calloc(1, sizeof(struct gen));
+	if (!g) {
+		fprintf(stderr, "calloc() failed\n");
+		return EXIT_FAILURE;
+	}
+
+	g->ndgrams = 10000;
+	g->flows = 10;
+	g->nhosts = 10000;
+	g->zipf = 1.0;
+	g->nsources = 1;
+	g->sampling = 1;
+	g->seed = 1;
+
+	while ((opt = getopt(argc, argv, "a:p:P:m:n:t:r:f:H:z:s:c:b:R:S:o:C:h"))
+		!= -1) {
+
+		switch (opt) {
+			case 'a':
+				addr = optarg;
+				break;
+			case 'p':
+				port = optarg;
+				break;
+			case 'P':
+				sf_port = optarg;
+				break;
+			case 'm':
+				mix_str = optarg;
+				break;
+			case 'n':
+				g->ndgrams = strtoull(optarg, NULL, 10);
+				break;
+			case 't':
+				g->duration = atoi(optarg);
+				break;
+			case 'r':
+				g->rate = strtoull(optarg, NULL, 10);
+				break;
+			case 'f':
+				g->flows = atoi(optarg);
+				break;
+			case 'H':
+				g->nhosts = strtoull(optarg, NULL, 10);
+				break;
+			case 'z':
+				g->zipf = atof(optarg);
+				break;
+			case 's':
+				g->nsources = strtoull(optarg, NULL, 10);
+				break;
+			case 'c':
+				g->churn = strtoull(optarg, NULL, 10);
+				break;
+			case 'b':
+				if (sscanf(optarg, "%lu,%lu",
+					&g->burst_every, &g->burst_len) != 2) {
+
+					fprintf(stderr, "Incorrect burst '%s'\n",
+						optarg);
+					goto fail_opts;
+				}
+				break;
+			case 'R':
+				g->sampling = atoi(optarg);
+				break;
+			case 'S':
+				g->seed = strtoull(optarg, NULL, 10);
+				break;
+			case 'o':
+				totals = optarg;
+				break;
+			case 'C':
+				g->comb_window = strtoull(optarg, NULL, 10);
+				break;
+			case 'h':
+			default:
+				print_usage(argv[0]);
+				goto fail_opts;
+		}
+	}
+
+	if (!mix_parse(g, mix_str)) {
+		goto fail_opts;
+	}
+
+	if ((g->flows == 0) || (g->nhosts == 0) || (g->nhosts > 0xfffffe)
+		|| (g->nsources == 0) || (g->sampling == 0)) {
+
+		fprintf(stderr, "Incorrect number of flows, hosts, sources "
+			"or sampling rate\n");
+		goto fail_opts;
+	}
+
+	if (!zipf_init(g)) {
+		goto fail_opts;
+	}
+
+	g->hosts = calloc(g->nhosts, sizeof(struct gen_totals));
+	g->sources = calloc(g->nsources, sizeof(struct gen_source));
+	if (!g->hosts || !g->sources) {
+		fprintf(stderr, "calloc() failed\n");
+		goto fail_alloc;
+	}
+	for (s=0; s<g->nsources; s++) {
+		g->sources[s].id = s + 1;
+	}
+
+	for (c=0; g->comb_window && (c<GEN_COMB_MAX); c++) {
+		/* flows of datagram are limited by MTU */
+		size_t nkeys = (g->flows < GEN_MTU) ? g->flows : GEN_MTU;
+
+		if ((c == GEN_COMB_DST_WINDOW) || (c == GEN_COMB_PAIR_WINDOW)) {
+			nkeys *= g->comb_window;
+		}
+		if (!comb_init(&g->comb[c], nkeys)) {
+			goto fail_alloc;
+		}
+	}
+
+	batch_init(&g->nf, socket_open(addr, port));
+	batch_init(&g->sf, socket_open(addr, sf_port));
+	if ((g->nf.fd < 0) || (g->sf.fd < 0)) {
+		goto fail_socket;
+	}
+
+	/* about 1 ms of traffic in one batch at low rates */
+	g->batch_max = GEN_BATCH;
+	if (g->rate && (g->rate / 1000 < GEN_BATCH)) {
+		g->batch_max = g->rate / 1000 ? g->rate / 1000 : 1;
+	}
+
+	g->rnd = g->seed * 0x9e3779b97f4a7c15ULL + 1;
+
+	signal(SIGINT, &on_signal);
+	signal(SIGTERM, &on_signal);
+
+	clock_gettime(CLOCK_MONOTONIC, &g->start);
+	if (g->duration) {
+		deadline = time(NULL) + g->duration;
+	}
+
+	for (i=0; !stop && (!g->ndgrams || (i < g->ndgrams)); i++) {
+		if (!dgram_send(g, i)) {
+			goto fail_send;
+		}
+
+		if (((i + 1) % g->batch_max) == 0) {
+			if (!batch_flush(g, &g->nf) || !batch_flush(g, &g->sf)) {
+				goto fail_send;
+			}
+			if (deadline && (time(NULL) >= deadline)) {
+				break;
+			}
+			rate_wait(g, i + 1);
+		}
+	}
+
+	if (!batch_flush(g, &g->nf) || !batch_flush(g, &g->sf)) {
+		goto fail_send;
+	}
+
+	fprintf(stderr, "sent %lu datagrams (%lu templates)\n",
+		(unsigned long)g->sent, (unsigned long)g->templates);
+
+	if (totals && !totals_write(g, totals)) {
+		goto fail_send;
+	}
+
+	if (g->comb_window) {
+		comb_print(g);
+	}
+
+	ret = EXIT_SUCCESS;
+
+fail_send:
+fail_socket:
+	if (g->nf.fd >= 0) {
+		close(g->nf.fd);
+	}
+	if (g->sf.fd >= 0) {
+		close(g->sf.fd);
+	}
+fail_alloc:
+	for (c=0; c<GEN_COMB_MAX; c++) {
+		comb_free(&g->comb[c]);
+	}
+	free(g->sources);
+	free(g->hosts);
+	free(g->cdf);
+fail_opts:
+	free(g);
+
+	return ret;
+}
+
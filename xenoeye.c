@@ -37,6 +37,10 @@
 #include "xenoeye.h"
 #include "devices.h"
 #include "geoip.h"
+#include "rib.h"
+#include "sflow.h"
+#include "workers.h"
+#include "replay.h"
 
 #define DEFAULT_CONFIG_FILE "/etc/xenoeye/xenoeye.conf"
 #define DEFAULT_TEMPLATES_FILE "/var/lib/xenoeye/templates.tkv"
@@ -50,7 +54,14 @@ static struct xe_data *globl;
 static void
 on_ctrl_c(int s)
 {
-	if (s != SIGINT) {
+	if ((s != SIGINT) && (s != SIGTERM)) {
+		return;
+	}
+
+	if (globl && globl->snapshot.enabled) {
+		/* snapshot thread saves data, main thread exits */
+		atomic_store_explicit(&globl->shutdown, 1,
+			memory_order_relaxed);
 		return;
 	}
 
@@ -58,6 +69,33 @@ on_ctrl_c(int s)
 	exit(0);
 }
 
+static void
+flow_packet_process(struct xe_data *data, size_t thread_id,
+	enum FLOW_TYPE type, struct flow_packet_info *pkt, int len)
+{
+	struct metrics_prof *prof = &data->m_prof[thread_id];
+
+	prof_packet_begin(prof, &data->metrics);
+	monit_objects_packet_begin(data, thread_id);
+
+	if (type == FLOW_TYPE_NETFLOW) {
+		netflow_process(data, thread_id, pkt, len);
+	} else {
+		struct metrics_proc *m = &data->m_proc[thread_id];
+
+		METRICS_ADD(m->packets[METRICS_SFLOW], 1);
+		if (!sflow_process(data, thread_id, pkt, len)) {
+			METRICS_ADD(m->decode_errors, 1);
+		}
+	}
+
+	/* windows with records summed in combiners */
+	monit_objects_combine_flush(data, thread_id);
+
+	monit_objects_packet_end(data, thread_id);
+	prof_packet_end(prof);
+}
+
 static void
 on_hup(int s)
 {
@@ -75,10 +113,12 @@ on_hup(int s)
 static void
 print_usage(const char *progname)
 {
-	fprintf(stderr, "Usage:\n %s [-c config.json]\n", progname);
+	fprintf(stderr, "Usage:\n %s [-c config.json] [-r file.pcap]\n",
+		progname);
 	fprintf(stderr, " %s -h\n", progname);
 	fprintf(stderr, "    -c config file (default '%s')\n",
 		DEFAULT_CONFIG_FILE);
+	fprintf(stderr, "    -r replay flows from pcap file and exit\n");
 	fprintf(stderr, "    -h print this message\n");
 }
 
@@ -306,6 +346,10 @@ config_callback(struct aajson *a, aajson_val *value, void *user)
 		strcpy(data->geodb_dir, value->str);
 	}
 
+	if (STRCMP(a, 1, "rib-file") == 0) {
+		strcpy(data->rib_file, value->str);
+	}
+
 	if (STRCMP(a, 1, "db-export") == 0) {
 		strcpy(data->db_exporter_path, value->str);
 	}
@@ -344,6 +388,40 @@ config_callback(struct aajson *a, aajson_val *value, void *user)
 		}
 	}
 
+	/* records of packet in one block */
+	if (STRCMP(a, 1, "flow-batch") == 0) {
+		if (value->type == AAJSON_VALUE_NUM) {
+			data->flow_batch = atoi(value->str);
+			if ((data->flow_batch < 0)
+				|| (data->flow_batch > FILTER_BATCH_MAX)) {
+
+				LOG("flow-batch: expected value from 0 to %d",
+					FILTER_BATCH_MAX);
+				return 0;
+			}
+		} else {
+			LOG("flow-batch: expected integer value");
+			return 0;
+		}
+	}
+
+	/* records of packet with equal keys of window */
+	if (STRCMP(a, 1, "combine") == 0) {
+		if (value->type == AAJSON_VALUE_NUM) {
+			data->combine = atoi(value->str);
+			if ((data->combine < 0)
+				|| (data->combine > MO_COMBINE_MAX)) {
+
+				LOG("combine: expected value from 0 to %d",
+					MO_COMBINE_MAX);
+				return 0;
+			}
+		} else {
+			LOG("combine: expected integer value");
+			return 0;
+		}
+	}
+
 	if (a->path_stack_pos < 2) {
 		return 1;
 	}
@@ -356,6 +434,38 @@ config_callback(struct aajson *a, aajson_val *value, void *user)
 		return flow_debug_config(a, value, &data->debug);
 	}
 
+	if (STRCMP(a, 1, "flow-tap") == 0) {
+		return flow_tap_config(a, value, &data->tap);
+	}
+
+	if (STRCMP(a, 1, "notify-dispatcher") == 0) {
+		return mavg_notify_config(a, value, &data->notify);
+	}
+
+	if (STRCMP(a, 1, "status-table") == 0) {
+		return status_table_config(a, value, &data->status_table);
+	}
+
+	if (STRCMP(a, 1, "snapshot") == 0) {
+		return snapshot_config(a, value, &data->snapshot);
+	}
+
+	if (STRCMP(a, 1, "workers") == 0) {
+		return workers_config(a, value, &data->workers);
+	}
+
+	if (STRCMP(a, 1, "cpu-affinity") == 0) {
+		return affinity_config(a, value, &data->affinity);
+	}
+
+	if (STRCMP(a, 1, "metrics") == 0) {
+		return metrics_config(a, value, &data->metrics);
+	}
+
+	if (STRCMP(a, 1, "log") == 0) {
+		return log_config(a, value, &data->log);
+	}
+
 	/* capture section */
 	if (STRCMP(a, 1, "capture") == 0) {
 		return config_capture(a, value, data, FLOW_TYPE_NETFLOW);
@@ -409,7 +519,7 @@ config_parse(struct xe_data *data, const char *conffile)
 		goto fail_parse;
 	}
 
-	data->nthreads = data->nnfcap + data->nsfcap;
+	data->nthreads = workers_nthreads(data);
 
 	ret = 1;
 
@@ -426,6 +536,7 @@ int
 main(int argc, char *argv[])
 {
 	char *conffile = NULL;
+	char *replay_file = NULL;
 	struct xe_data data;
 	int opt;
 	size_t i;
@@ -434,12 +545,16 @@ main(int argc, char *argv[])
 	size_t thread_idx;
 
 
-	while ((opt = getopt(argc, argv, "c:h")) != -1) {
+	while ((opt = getopt(argc, argv, "c:r:h")) != -1) {
 		switch (opt) {
 			case 'c':
 				conffile = optarg;
 				break;
 
+			case 'r':
+				replay_file = optarg;
+				break;
+
 			case 'h':
 			default:
 				print_usage(argv[0]);
@@ -451,6 +566,8 @@ main(int argc, char *argv[])
 
 	memset(&data, 0, sizeof(struct xe_data));
 	atomic_init(&data.stop, 0);
+	atomic_init(&data.shutdown, 0);
+	atomic_init(&data.mo_hold, 0);
 	atomic_init(&data.mavg_db_bank_idx, 0);
 
 	/* reload geoip/as db at start */
@@ -459,10 +576,27 @@ main(int argc, char *argv[])
 	/* default db type */
 	data.db_type = DB_PG;
 
+	data.snapshot.interval = SNAPSHOT_DEFAULT_INTERVAL;
+
 	if (!config_parse(&data, conffile ? conffile : DEFAULT_CONFIG_FILE)) {
 		return EXIT_FAILURE;
 	}
 
+	if (replay_file) {
+		/* one processing thread, each packet is profiled, nothing
+		   is shared with running collector except files from
+		   config */
+		data.replay = 1;
+		data.nthreads = 1;
+		data.workers.n = 0;
+		data.snapshot.enabled = 0;
+		*data.metrics.unix_socket = '\0';
+		data.metrics.http_port = 0;
+		*data.metrics.mo_report = '\0';
+		data.metrics.profile_sample = 1;
+		data.metrics.profile_mask = 0;
+	}
+
 	/* load devices with sampling rates */
 	if (*data.devices) {
 		if (!devices_load(data.devices)) {
@@ -523,6 +657,14 @@ main(int argc, char *argv[])
 
 	globl = &data;
 
+	/* helper threads inherit affinity of main thread */
+	affinity_thread(&data.affinity, AFFINITY_HELPER, 0);
+
+	if (!log_init(&data.log)) {
+		LOG("Can't start logger thread, messages from processing "
+			"threads will be written synchronously");
+	}
+
 #ifdef FLOWS_CNT
 	{
 		thread_err = pthread_create(&data.fc_tid, NULL,
@@ -536,11 +678,28 @@ main(int argc, char *argv[])
 #endif
 
 	/* geoip/as */
-	thread_err = pthread_create(&data.geoip_tid, NULL,
-		&geoip_thread, &data);
-	if (thread_err) {
-		LOG("Can't start thread: %s", strerror(thread_err));
-		return EXIT_FAILURE;
+	if (data.replay) {
+		geoip_reload(&data);
+		if (*data.rib_file) {
+			rib_load(data.rib_file);
+		}
+	} else {
+		thread_err = pthread_create(&data.geoip_tid, NULL,
+			&geoip_thread, &data);
+		if (thread_err) {
+			LOG("Can't start thread: %s", strerror(thread_err));
+			return EXIT_FAILURE;
+		}
+
+		if (!status_table_init(&data)) {
+			LOG("Can't create status table, using notification "
+				"files only");
+		}
+
+		if (!mavg_notify_init(&data)) {
+			LOG("Can't start notification dispatcher, "
+				"scripts will be started for each event");
+		}
 	}
 
 	if (!monit_objects_init(&data)) {
@@ -553,11 +712,13 @@ main(int argc, char *argv[])
 	}
 
 	/* config reload thread */
-	thread_err = pthread_create(&data.config_tid, NULL,
-		&config_reload_thread, &data);
-	if (thread_err) {
-		LOG("Can't start thread: %s", strerror(thread_err));
-		return EXIT_FAILURE;
+	if (!data.replay) {
+		thread_err = pthread_create(&data.config_tid, NULL,
+			&config_reload_thread, &data);
+		if (thread_err) {
+			LOG("Can't start thread: %s", strerror(thread_err));
+			return EXIT_FAILURE;
+		}
 	}
 
 	netflow_process_init();
@@ -568,6 +729,9 @@ main(int argc, char *argv[])
 	sigemptyset(&sig_int.sa_mask);
 	sig_int.sa_flags = 0;
 	sigaction(SIGINT, &sig_int, NULL);
+	if (data.snapshot.enabled) {
+		sigaction(SIGTERM, &sig_int, NULL);
+	}
 
 	/* HUP */
 	sig_hup.sa_handler = &on_hup;
@@ -581,6 +745,30 @@ main(int argc, char *argv[])
 	sig_chld.sa_flags = SA_NOCLDWAIT;
 	sigaction(SIGCHLD, &sig_chld, NULL);
 
+	/* counters must be allocated before capture and processing threads
+	   are started */
+	if (!metrics_init(&data)) {
+		LOG("Can't init metrics, exiting");
+		return EXIT_FAILURE;
+	}
+
+	if (!flow_tap_init(&data)) {
+		LOG("Can't create flow tap, continuing without it");
+	}
+
+	if (data.replay) {
+		int ret = replay_run(&data, replay_file, &flow_packet_process);
+
+		log_stop();
+		return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	/* processing threads */
+	if (!workers_init(&data, &flow_packet_process)) {
+		LOG("Can't start worker threads, exiting");
+		return EXIT_FAILURE;
+	}
+
 	/* netflow threads */
 	thread_idx = 0;
 	for (i=0; i<data.nnfcap; i++) {
@@ -624,6 +812,13 @@ main(int argc, char *argv[])
 		thread_idx++;
 	}
 
+	if (data.snapshot.enabled) {
+		/* snapshot thread saves data on SIGINT/SIGTERM and exits */
+		pthread_join(data.snapshot_tid, NULL);
+		netflow_templates_shutdown();
+		return EXIT_SUCCESS;
+	}
+
 	/* FIXME: correct shutdown */
 	for (i=0; i<data.nnfcap; i++) {
 		pthread_join(data.nfcap[i].tid, NULL);
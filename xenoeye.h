@@ -8,6 +8,12 @@
 
 #include "utils.h"
 #include "xe-debug.h"
+#include "flow-tap.h"
+#include "status-table.h"
+#include "affinity.h"
+#include "metrics.h"
+#include "xe-log.h"
+#include "monit-objects-conf.h"
 #include "monit-objects.h"
 
 /*#define FLOWS_CNT*/
@@ -51,10 +57,25 @@ struct capture
 	unsigned int port;
 };
 
+/* pool of processing threads */
+struct workers_conf
+{
+	/* number of worker threads, 0 - process in capture threads */
+	size_t n;
+	size_t ring_size_m;
+	int steal;
+	/* receiver waits for worker instead of dropping packet */
+	int no_drop;
+};
+
 struct xe_data
 {
 	size_t nmonit_objects;
 	struct monit_object *monit_objects;
+	/* index of top-level objects by addresses, may be NULL */
+	struct filter_index *mo_index;
+	/* basic filters shared by all objects, may be NULL */
+	struct filter_preds *mo_preds;
 
 	struct capture *nfcap;
 	size_t nnfcap;
@@ -62,8 +83,23 @@ struct xe_data
 	struct capture *sfcap;
 	size_t nsfcap;
 
-	/* numer of threads, nthreads == ncap */
+	/* numer of processing threads, nthreads == ncap or number of
+	   workers */
 	size_t nthreads;
+	struct workers_conf workers;
+
+	/* CPU affinity of threads */
+	struct affinity_conf affinity;
+
+	/* runtime counters, ncap and nthreads slots */
+	struct metrics_conf metrics;
+	struct metrics_capture *m_capture;
+	struct metrics_proc *m_proc;
+	struct metrics_prof *m_prof;
+	pthread_t metrics_tid;
+
+	/* rate-limited logging from processing threads */
+	struct log_conf log;
 
 	/* backgriund thread for fixed windows in memory */
 	pthread_t fwm_tid;
@@ -71,6 +107,25 @@ struct xe_data
 	/* moving averages */
 	pthread_t mavg_dump_tid, mavg_act_tid, mavg_under_tid;
 	_Atomic size_t mavg_db_bank_idx;
+	/* workers notify act thread about new overlimited items */
+	int mavg_act_evfd;
+	/* per processing thread, packet handoff to background threads */
+	struct mo_thread_ack *mo_thread_ack;
+	/* snapshot is written, processing threads wait between packets */
+	atomic_int mo_hold;
+
+	/* notification dispatcher */
+	struct mavg_notify_conf notify;
+	pthread_t mavg_notify_tid;
+
+	/* memory-mapped table with overlimited items */
+	struct status_table_conf status_table;
+
+	/* warm restart */
+	struct snapshot_conf snapshot;
+	pthread_t snapshot_tid;
+	/* fwm and act threads hold it while changing banks */
+	pthread_mutex_t snapshot_mtx;
 
 	/* classification thread */
 	pthread_t clsf_tid;
@@ -80,12 +135,17 @@ struct xe_data
 	/* config reload thread */
 	pthread_t config_tid;
 
+	/* offline replay of pcap file, virtual clock from capture time */
+	int replay;
+	uint64_t replay_time_ns;
+
 	/* templates */
 	int allow_templates_in_future;
 	char templates_db[PATH_MAX];
 
 	/* debug settings */
 	struct xe_debug debug;
+	struct flow_tap_conf tap;
 
 	/* path to devices list */
 	char devices[PATH_MAX];
@@ -108,6 +168,9 @@ struct xe_data
 	/* path to dir with GeoIP/AS DBs */
 	char geodb_dir[PATH_MAX];
 
+	/* routing table for pfx(), "prefix origin-as" lines */
+	char rib_file[PATH_MAX];
+
 	/* path to DB export script */
 	char db_exporter_path[PATH_MAX];
 
@@ -118,6 +181,12 @@ struct xe_data
 	/* receive buffer size in Mbytes */
 	int rcvbufsize_m;
 
+	/* number of flow records of packet processed together, 0 - off */
+	int flow_batch;
+
+	/* max keys of window summed in one packet, 0 - off */
+	int combine;
+
 	/* notify geoip thread about reload */
 	atomic_int reload_geoip;
 
@@ -127,6 +196,9 @@ struct xe_data
 	/* notify threads about stop */
 	atomic_int stop;
 
+	/* SIGINT/SIGTERM with snapshots enabled, save data and exit */
+	atomic_int shutdown;
+
 #ifdef FLOWS_CNT
 	/* flows counter */
 	_Atomic uint64_t nflows;
@@ -0,0 +1,185 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* dump status table with overlimited/underlimited items */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "status-table.h"
+
+#define READ_RETRIES 1000
+
+static void
+print_usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-f status_table] [-w]\n", progname);
+	fprintf(stderr, "\t-f /path/to/table: status table (default '%s')\n",
+		STATUS_TABLE_DEFAULT_PATH);
+	fprintf(stderr, "\t-w: write notification files instead of printing\n");
+	fprintf(stderr, "\n %s -h\n", progname);
+	fprintf(stderr, "\t-h: print this message\n");
+}
+
+/* copy slot using seqlock */
+static int
+slot_read(struct status_table_slot *s, struct status_table_slot *res)
+{
+	int i;
+
+	for (i=0; i<READ_RETRIES; i++) {
+		uint32_t seq1, seq2;
+
+		seq1 = atomic_load_explicit(&s->seq, memory_order_acquire);
+		if (seq1 & 1) {
+			/* writer is updating slot */
+			continue;
+		}
+
+		memcpy(res, s, sizeof(struct status_table_slot));
+
+		atomic_thread_fence(memory_order_acquire);
+		seq2 = atomic_load_explicit(&s->seq, memory_order_relaxed);
+		if (seq1 == seq2) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+slot_write_file(struct status_table_slot *s)
+{
+	FILE *f;
+
+	f = fopen(s->name, "w");
+	if (!f) {
+		fprintf(stderr, "Can't create file '%s': %s\n", s->name,
+			strerror(errno));
+		return 0;
+	}
+	fputs(s->text, f);
+	fclose(f);
+
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt, fd;
+	int write_files = 0;
+	char path[PATH_MAX] = STATUS_TABLE_DEFAULT_PATH;
+	struct stat st;
+	struct status_table_header *tbl;
+	uint64_t i, nslots;
+	int ret = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "hf:w")) != -1) {
+		switch (opt) {
+			case 'f':
+				strcpy(path, optarg);
+				break;
+
+			case 'w':
+				write_files = 1;
+				break;
+
+			case 'h':
+			default:
+				print_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open '%s': %s\n", path,
+			strerror(errno));
+		goto fail_open;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "Can't stat '%s': %s\n", path,
+			strerror(errno));
+		goto fail_stat;
+	}
+
+	if ((size_t)st.st_size < sizeof(struct status_table_header)) {
+		fprintf(stderr, "File '%s' is too small\n", path);
+		goto fail_stat;
+	}
+
+	tbl = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (tbl == MAP_FAILED) {
+		fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+		goto fail_stat;
+	}
+
+	if ((tbl->magic != STATUS_TABLE_MAGIC)
+		|| (tbl->version != STATUS_TABLE_VERSION)
+		|| (tbl->slot_size != sizeof(struct status_table_slot))) {
+
+		fprintf(stderr, "'%s' is not a status table or has "
+			"unsupported version\n", path);
+		goto fail_fmt;
+	}
+
+	nslots = tbl->nslots;
+	if ((size_t)st.st_size < STATUS_TABLE_SIZE(nslots)) {
+		fprintf(stderr, "File '%s' is truncated\n", path);
+		goto fail_fmt;
+	}
+
+	for (i=0; i<nslots; i++) {
+		struct status_table_slot s;
+
+		if (!slot_read(STATUS_TABLE_SLOT(tbl, i), &s)) {
+			fprintf(stderr, "Can't read slot %lu\n", i);
+			continue;
+		}
+
+		if (s.state == STATUS_SLOT_FREE) {
+			continue;
+		}
+
+		if (write_files) {
+			slot_write_file(&s);
+		} else {
+			printf("%s: %s\n", s.name, s.text);
+		}
+	}
+
+	ret = EXIT_SUCCESS;
+
+fail_fmt:
+	munmap(tbl, st.st_size);
+fail_stat:
+	close(fd);
+fail_open:
+	return ret;
+}
+
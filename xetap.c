@@ -0,0 +1,292 @@
+/*
+ * xenoeye
+ *
+ * Copyright (c) 2026, Vladimir Misyurov, Michael Kogan
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "flow-tap.h"
+
+/* polling interval in follow mode */
+#define POLL_US 10000
+
+static volatile sig_atomic_t stop = 0;
+
+static void
+on_signal(int s)
+{
+	(void)s;
+	stop = 1;
+}
+
+static void
+print_usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-s shm_name] [-f] [-n] [-c count] [-d]\n",
+		progname);
+	fprintf(stderr, "\t-s name: shared memory object (default '%s')\n",
+		FLOW_TAP_DEFAULT_SHM);
+	fprintf(stderr, "\t-f: follow, wait for new records\n");
+	fprintf(stderr, "\t-n: skip records written before start\n");
+	fprintf(stderr, "\t-c count: exit after count records\n");
+	fprintf(stderr, "\t-d: print number of dropped records at exit\n");
+	fprintf(stderr, "\n %s -h\n", progname);
+	fprintf(stderr, "\t-h: print this message\n");
+}
+
+static void
+print_field(struct flow_tap_field *f, const uint8_t *data)
+{
+	char s[INET6_ADDRSTRLEN + 1];
+	uint64_t v = 0;
+	uint32_t i;
+
+	switch (f->type) {
+		case FLOW_TAP_ADDR4:
+			inet_ntop(AF_INET, data, s, sizeof(s));
+			fputs(s, stdout);
+			break;
+
+		case FLOW_TAP_ADDR6:
+			inet_ntop(AF_INET6, data, s, sizeof(s));
+			fputs(s, stdout);
+			break;
+
+		case FLOW_TAP_MAC:
+			for (i=0; i<f->size; i++) {
+				printf(i ? ":%02x" : "%02x", data[i]);
+			}
+			break;
+
+		case FLOW_TAP_STRING:
+			for (i=0; (i<f->size) && data[i]; i++) {
+				if (isprint(data[i]) && (data[i] != '\\')) {
+					putchar(data[i]);
+				} else {
+					printf("\\x%02x", data[i]);
+				}
+			}
+			break;
+
+		default:
+			/* big endian integer */
+			if (f->size <= sizeof(uint64_t)) {
+				memcpy((uint8_t *)&v + sizeof(uint64_t) - f->size,
+					data, f->size);
+			}
+			printf("%lu", (unsigned long)be64toh(v));
+			break;
+	}
+}
+
+static void
+print_record(struct flow_tap_header *h, const uint8_t *rec)
+{
+	uint64_t time_ns;
+	uint32_t i;
+
+	memcpy(&time_ns, rec, sizeof(uint64_t));
+	printf("%lu.%09lu", (unsigned long)(time_ns / 1000000000ULL),
+		(unsigned long)(time_ns % 1000000000ULL));
+	rec += sizeof(uint64_t);
+
+	for (i=0; i<h->nfields; i++) {
+		putchar('\t');
+		print_field(&h->fields[i], rec);
+		rec += h->fields[i].size;
+	}
+	putchar('\n');
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt, fd;
+	int follow = 0, skip = 0, print_drops = 0;
+	uint64_t count = 0, nrecs = 0;
+	char name[NAME_MAX] = FLOW_TAP_DEFAULT_SHM;
+	struct stat st;
+	struct flow_tap_header *h;
+	struct sigaction sa;
+	uint32_t i;
+	int ret = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "hs:fnc:d")) != -1) {
+		switch (opt) {
+			case 's':
+				if (strlen(optarg) >= sizeof(name)) {
+					fprintf(stderr, "Name is too long\n");
+					return EXIT_FAILURE;
+				}
+				strcpy(name, optarg);
+				break;
+
+			case 'f':
+				follow = 1;
+				break;
+
+			case 'n':
+				skip = 1;
+				break;
+
+			case 'c':
+				count = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'd':
+				print_drops = 1;
+				break;
+
+			case 'h':
+			default:
+				print_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open '%s': %s\n", name,
+			strerror(errno));
+		goto fail_open;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "Can't stat '%s': %s\n", name,
+			strerror(errno));
+		goto fail_stat;
+	}
+
+	if ((size_t)st.st_size < FLOW_TAP_HEADER_SIZE) {
+		fprintf(stderr, "'%s' is too small\n", name);
+		goto fail_stat;
+	}
+
+	h = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+		goto fail_stat;
+	}
+
+	if ((h->magic != FLOW_TAP_MAGIC) || (h->version != FLOW_TAP_VERSION)
+		|| (h->nfields > FLOW_TAP_MAX_FIELDS)
+		|| (h->nslots == 0) || (h->nslots & (h->nslots - 1))) {
+
+		fprintf(stderr, "'%s' is not a flow tap or has unsupported "
+			"version\n", name);
+		goto fail_fmt;
+	}
+
+	if ((size_t)st.st_size
+		< (FLOW_TAP_HEADER_SIZE + h->nrings * h->ring_size)) {
+
+		fprintf(stderr, "'%s' is truncated\n", name);
+		goto fail_fmt;
+	}
+
+	if (skip) {
+		for (i=0; i<h->nrings; i++) {
+			struct flow_tap_ring *r = FLOW_TAP_RING(h, i);
+
+			atomic_store_explicit(&r->tail,
+				atomic_load_explicit(&r->head,
+					memory_order_acquire),
+				memory_order_release);
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* header */
+	printf("#time");
+	for (i=0; i<h->nfields; i++) {
+		printf("\t%s", h->fields[i].name);
+	}
+	putchar('\n');
+
+	while (!stop) {
+		uint64_t n = 0;
+
+		for (i=0; (i<h->nrings) && !stop; i++) {
+			struct flow_tap_ring *r = FLOW_TAP_RING(h, i);
+			uint64_t head, tail;
+
+			head = atomic_load_explicit(&r->head,
+				memory_order_acquire);
+			tail = atomic_load_explicit(&r->tail,
+				memory_order_relaxed);
+
+			for (; tail != head; tail++) {
+				print_record(h, r->data
+					+ (tail & (h->nslots - 1)) * h->rec_size);
+				n++;
+				nrecs++;
+				if (count && (nrecs >= count)) {
+					stop = 1;
+					tail++;
+					break;
+				}
+			}
+
+			atomic_store_explicit(&r->tail, tail,
+				memory_order_release);
+		}
+
+		if (!follow) {
+			break;
+		}
+		if (n == 0) {
+			fflush(stdout);
+			usleep(POLL_US);
+		}
+	}
+	fflush(stdout);
+
+	if (print_drops) {
+		for (i=0; i<h->nrings; i++) {
+			struct flow_tap_ring *r = FLOW_TAP_RING(h, i);
+
+			fprintf(stderr, "ring %u: %lu records dropped\n", i,
+				(unsigned long)atomic_load(&r->drops));
+		}
+	}
+
+	ret = EXIT_SUCCESS;
+
+fail_fmt:
+	munmap(h, st.st_size);
+fail_stat:
+	close(fd);
+fail_open:
+	return ret;
+}
+